@@ -1,9 +1,54 @@
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
+
 #include <iostream>
 #include <vector>
 #include <limits>
 #include <iomanip>
 #include <utility>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <set>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <filesystem>
+#include <functional>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <list>
+#include <future>
+#include <charconv>
+#include <cerrno>
 
 using namespace std;
 
@@ -15,9 +60,41 @@ struct Movie {
     int duration;  // Duration in minutes
 };
 
-// Global movie list
-vector<Movie> movies;
-int nextMovieId = 1; // Auto-increment ID
+// ===== Movie title search index =====
+// Trigram postings for fuzzy matching plus a sorted title set for prefix
+// matching. Kept up to date by addMovie / editMovie / deleteMovie.
+// Postings hold dense slots rather than movie IDs so a search can count
+// overlaps in a flat array.
+struct TitleIndex {
+    unordered_map<unsigned int, vector<int>> postings; // Trigram -> slots
+    vector<int> slotMovieId;                           // Slot -> movie ID (-1 = free)
+    vector<int> slotTrigramCount;                      // Slot -> trigrams in its title
+    unordered_map<int, int> slotByMovieId;
+    vector<int> freeSlots;
+    set<pair<string, int>> sortedTitles;               // (normalized title, movie ID)
+};
+
+struct TitleMatch {
+    int movieId;
+    double score; // Higher is better; prefix matches score above 1
+};
+
+// ===== Hall seat layout =====
+enum SeatType {
+    SEAT_NORMAL = 0,
+    SEAT_BLOCKED,    // Aisle or missing seat, never sold
+    SEAT_ACCESSIBLE  // Wheelchair space
+};
+
+// Seat types of a hall. Immutable once built and shared by the hall and
+// all of its showtimes.
+struct HallLayout {
+    int rows;
+    int cols;
+    vector<unsigned char> seatType;    // seatType[r * cols + c]
+    vector<unsigned long long> sellable; // Bit r * cols + c set if the seat can be sold
+    int sellableCount;
+};
 
 // ===== Hall data structure =====
 struct Hall {
@@ -26,13 +103,10 @@ struct Hall {
     int floor;   // Floor number, e.g. 1, 2, 3
     int rows;    // Number of seat rows
     int cols;    // Number of seat columns
-    // Total seats = rows * cols
+    // Total seats = rows * cols, minus blocked seats of the layout
+    shared_ptr<const HallLayout> layout;
 };
 
-// Global hall list
-vector<Hall> halls;
-int nextHallId = 1; // Auto-increment ID for halls
-
 // ===== Showtime data structure =====
 struct Showtime {
     int id;        // Unique ID
@@ -43,46 +117,984 @@ struct Showtime {
 
     int rows;      // Number of seat rows (copied from hall)
     int cols;      // Number of seat columns (copied from hall)
-    // seats[r][c] = 0 => available, 1 => sold
-    vector<vector<int>> seats;
+    shared_ptr<const HallLayout> layout; // Shared with the hall
+    // Bit r * cols + c set => seat sold / temporarily held.
+    // Empty until the seat map is loaded, see ensureSeatMap().
+    vector<unsigned long long> soldBits;
+    vector<unsigned long long> heldBits;
+
+    bool seatsLoaded = false;  // soldBits / heldBits are resident
+    bool seatsDirty = false;   // Seats changed since the last save (dirty maps stay resident)
+    long long savedSeq = 0;    // Write that last carried this seat map, see Cinema::writesDone
+    int storedSold = 0;        // Sold seats while the seat map is not resident
+};
+
+// ===== Showtime column store =====
+// Structure-of-arrays mirror of `showtimes` used by the report scans.
+// Entry i of every column describes showtimes[i], so the two must be
+// changed together (see appendShowtimeColumns / eraseShowtimeColumns).
+struct ShowtimeColumns {
+    vector<int> id;
+    vector<int> movieId;
+    vector<int> hallId;
+    vector<long long> startMinute; // Minutes since 1970-01-01, -1 if unparsable
+    vector<long long> priceCents;  // Ticket price in cents
+    vector<int> capacity;          // rows * cols
+    vector<int> sold;              // Number of sold seats
+    vector<long long> revenueCents; // Amount paid for the sold seats
+
+    unordered_map<int, int> indexById; // Showtime ID -> entry index
+    // (startMinute, ID) ordered for paging; [0] has seats left, [1] sold out
+    set<pair<long long, int>> byStart[2];
+};
+
+// Aggregate result of a column scan
+struct SalesTotals {
+    long long ticketsSold = 0;
+    long long revenueCents = 0;
+    long long capacity = 0;
+};
+
+// ===== Paginated listings =====
+// Pages are keyset based: the cursor is the last key returned, so
+// fetching any page costs O(log N + page size).
+const size_t LIST_PAGE_SIZE = 20;
+const int ANY_FLOOR = numeric_limits<int>::min();
+
+struct IdPage {
+    vector<int> ids;
+    int nextAfterId = 0; // Pass back as afterId for the following page
+    bool hasMore = false;
+};
+
+struct ShowtimeFilter {
+    long long fromMinute = numeric_limits<long long>::min(); // Inclusive
+    long long toMinute = numeric_limits<long long>::max();   // Inclusive
+    int soldOut = -1; // -1 = any, 0 = seats left, 1 = sold out
+};
+
+// Showtimes are listed by start time, then ID
+struct ShowtimeCursor {
+    long long startMinute = numeric_limits<long long>::min();
+    int id = numeric_limits<int>::min();
+};
+
+struct ShowtimePage {
+    vector<int> ids;
+    ShowtimeCursor next; // Pass back as `after` for the following page
+    bool hasMore = false;
+};
+
+// ===== Order data structure =====
+struct Order {
+    long long id;                 // Unique ID (shared with the ticket log)
+    string idempotencyKey;        // Client reference for safe retries, may be empty
+    int showtimeId;               // ID of the showtime
+    vector<pair<int, int>> seats; // (row, col), 1-based
+    vector<long long> seatPriceCents; // Quoted price of each seat
+    long long totalCents;         // Amount charged
+    long long createdAt;          // Seconds since 1970-01-01 (UTC)
+    bool refunded;
+    long long flagOffset = -1;    // Offset of the refunded flag in ORDER_FILE, -1 if unknown
+};
+
+// Result of bookSeats()
+enum BookingStatus {
+    BOOKING_OK,         // New order created
+    BOOKING_REPLAYED,   // Key already used, original order returned
+    BOOKING_SEAT_TAKEN, // At least one seat is no longer available
+    BOOKING_INVALID     // Unknown showtime or seat out of range
+};
+
+// Result of refundOrder()
+enum RefundStatus {
+    REFUND_OK,
+    REFUND_NOT_FOUND,        // No order with this ID
+    REFUND_ALREADY_REFUNDED,
+    REFUND_SHOWTIME_CLOSED   // The showtime was archived or removed
+};
+
+// One showtime of a batch booking: explicit seats, or a seat count that
+// is assigned automatically
+struct BatchItem {
+    int showtimeId;
+    int count;                    // Used when `seats` is empty
+    vector<pair<int, int>> seats; // (row, col), 1-based
+};
+
+// ===== Waitlist =====
+// Customers turned away by a sold-out showtime queue for it. Seats that
+// come back (refunds, expired offers) are offered to the queue in order
+// and held for the customer until the offer expires.
+const size_t MAX_WAITLIST_PER_SHOWTIME = 100;
+const size_t MAX_WAITLIST_ENTRIES = 10000; // Per site, queued and offered
+const int WAITLIST_OFFER_MINUTES = 15;
+
+struct WaitlistEntry {
+    long long id;      // Waitlist ticket number, unique per site
+    int showtimeId;
+    string contact;    // Name or phone number to notify
+    int tickets;       // Seats wanted, all offered at once
+};
+
+// Seats held for a waitlist entry until `expiresAt`
+struct WaitlistOffer {
+    WaitlistEntry entry;
+    vector<pair<int, int>> seats; // (row, col), 1-based
+    long long expiresAt;          // Seconds since 1970-01-01 (UTC)
+};
+
+// Seats that became available again, waiting to be offered
+struct SeatRelease {
+    int showtimeId;
+    vector<pair<int, int>> seats; // (row, col), 1-based
+};
+
+// ===== Pricing rules =====
+// Seat zones of a hall. Front rows take precedence over the premium block.
+enum SeatTier {
+    TIER_STANDARD = 0,
+    TIER_PREMIUM,   // Center block of the hall
+    TIER_FRONT,     // First rows
+    TIER_COUNT
+};
+
+// Per-hall pricing rules; halls without an entry use the defaults, which
+// charge the showtime price for every seat until an admin sets rules.
+struct PricingRules {
+    int frontRows = 2;              // Number of front rows
+    double frontMultiplier = 1.0;
+    double premiumShare = 0.5;      // Share of rows and columns in the center block
+    double premiumMultiplier = 1.0;
+    int matineeEndHour = 12;        // Shows starting before this hour
+    double matineeMultiplier = 1.0;
+    int eveningStartHour = 18;      // Shows starting at or after this hour
+    double eveningMultiplier = 1.0;
+    double surgeOccupancy = 0.7;    // Occupancy from which surge applies
+    double surgeMultiplier = 1.0;
+    double peakOccupancy = 0.9;     // Occupancy from which peak applies
+    double peakMultiplier = 1.0;
+};
+
+// Rules of one hall compiled into a flat seat -> tier table
+struct CompiledPricing {
+    int rows = 0;
+    int cols = 0;
+    vector<unsigned char> tier; // tier[r * cols + c]
+};
+
+// Per-tier prices of a showtime, valid for one occupancy bucket
+const int OCCUPANCY_BUCKETS = 20; // 5% steps
+struct QuoteCacheEntry {
+    int bucket = -1;
+    long long tierPriceCents[TIER_COUNT];
+};
+
+// ===== Archived (cold) showtime segments =====
+// Past days are rolled out of `showtimes` into immutable segment files.
+// The archive index keeps per-segment totals so day-level reports do
+// not need to open the segments.
+struct ArchiveSegment {
+    long long day;          // Days since 1970-01-01
+    string fileName;        // Segment file inside ARCHIVE_DIR
+    int showtimeCount;      // Number of showtimes in the segment
+    long long ticketsSold;  // Sum of sold seats
+    long long revenueCents; // Sum of sold seats * price
+    int maxShowtimeId;      // Highest showtime ID in the segment
+};
+
+// ===== Ticket sales fact log =====
+// Append-only record of every ticket sold (and later refunded). Rows are
+// buffered in `pending` and written to the log file as compressed column
+// blocks; queries memory-map the file and decode only the columns they use.
+enum FactColumn {
+    FACT_ORDER_ID = 0,
+    FACT_SHOWTIME_ID,
+    FACT_MOVIE_ID,  // Copied from the showtime so archived/deleted
+    FACT_HALL_ID,   // showtimes can still be grouped
+    FACT_SEAT,      // (row << 16) | col, both 1-based
+    FACT_PRICE,     // Cents; negative for refunds
+    FACT_QUANTITY,  // +1 for a sale, -1 for a refund
+    FACT_SALE_TIME, // Seconds since 1970-01-01 (UTC)
+    FACT_COLUMN_COUNT
+};
+
+const int FACT_BLOCK_ROWS = 4096; // Maximum rows per compressed block
+
+struct TicketFactLog {
+    string path;
+    vector<long long> pending[FACT_COLUMN_COUNT]; // Rows not yet written
+    long long maxOrderId = 0;                      // Highest order ID logged
+    long long blockCount = 0;
+    long long rowCount = 0;                        // Rows on disk and no longer pending
+    size_t queuedRows = 0;                         // Pending rows already handed to the writer
+    atomic<long long> durableRows{ 0 };            // Rows on disk, published by the writer
+    atomic<bool> writeFailed{ false };             // Writer dropped queued rows; queue them again
+};
+
+// A decoded run of fact rows. Only the requested columns are filled.
+struct FactBatch {
+    int rows = 0;
+    const long long* col[FACT_COLUMN_COUNT] = {};
+};
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    bool open(const string& path);
+    void close();
+    ~MappedFile() { close(); }
+};
+
+// ===== Text input =====
+// Whitespace-separated values and whole lines read through one large
+// buffer, with numbers parsed by from_chars. Used for the console and
+// for the data files. Extraction follows the istream rules the menus and
+// loaders were written against: leading whitespace is skipped, a number
+// ends at the first character that cannot continue it, and a failed read
+// sets the fail state, after which every read fails until clear(). Files
+// are read as binary, so lines of CRLF files keep their '\r'.
+const size_t TEXT_READER_BUFFER_BYTES = 1 << 20;
+
+struct TextReader {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+    bool ownsSource = false;
+    bool interactive = false;   // Flush cout before waiting for input
+    vector<char> buffer;
+    size_t pos = 0;             // Next unread byte of `buffer`
+    size_t end = 0;             // End of the valid bytes of `buffer`
+    long long bufferOffset = 0; // Source offset of buffer[0]
+    bool atEof = false;
+    bool failed = false;
+
+    TextReader() = default;
+    explicit TextReader(const string& path, size_t bufferBytes = TEXT_READER_BUFFER_BYTES) {
+        open(path, bufferBytes);
+    }
+    TextReader(const TextReader&) = delete;
+    TextReader& operator=(const TextReader&) = delete;
+    ~TextReader() { close(); }
+
+    bool open(const string& path, size_t bufferBytes = TEXT_READER_BUFFER_BYTES);
+    void attachStdin();
+    void close();
+
+    explicit operator bool() const { return !failed; }
+    bool operator!() const { return failed; }
+    void clear() { failed = false; atEof = false; }
+    TextReader& ignore(streamsize count, int delim);
+    long long tellg() const { return failed ? -1 : bufferOffset + static_cast<long long>(pos); }
+    TextReader& seekg(long long offset);
+
+    TextReader& operator>>(int& value) { return readNumber(value); }
+    TextReader& operator>>(long long& value) { return readNumber(value); }
+    TextReader& operator>>(double& value) { return readNumber(value); }
+    TextReader& operator>>(char& value);
+    TextReader& operator>>(string& value);
+
+    bool fill();           // Read more input; false at the end of it
+    bool skipWhitespace(); // False at the end of input
+    size_t tokenEnd();     // Buffer the whole token at `pos`; returns its end
+    template <class T> TextReader& readNumber(T& value);
+};
+
+TextReader console; // Standard input of the interactive menus
+
+// Revenue grouping keys for the fact log queries
+enum FactGroup {
+    GROUP_BY_MOVIE,
+    GROUP_BY_HALL,
+    GROUP_BY_HOUR, // Hour of day, local time
+    GROUP_BY_DAY   // Day number, local time
+};
+
+struct FactGroupRow {
+    long long key;
+    long long tickets;
+    long long revenueCents;
+};
+
+// ===== Seat analytics =====
+// Per-seat sale counts of every hall and fill curves per movie and time
+// slot, folded in from the ticket log. The analytics remember how many
+// log rows they have consumed and read only newer rows on refresh.
+
+// One counter per seat of a hall, stored as bit planes: bit i of plane k
+// is bit k of seat i's count. Adding a bitmap of seats is a ripple carry
+// over whole words, 64 seats per operation.
+struct BitSlicedCounter {
+    vector<vector<unsigned long long>> planes;
+
+    void add(const vector<unsigned long long>& bits);
+    long long count(int seat) const;
+};
+
+struct HallHeat {
+    int rows = 0;
+    int cols = 0;
+    BitSlicedCounter sold;     // Sales of each seat
+    BitSlicedCounter refunded; // Sales refunded later
+    BitSlicedCounter early;    // Sales while the showtime was less than a quarter full
+};
+
+// Part of the day a show starts in, for the fill curves
+enum TimeSlot {
+    SLOT_MORNING = 0, // Before 12:00
+    SLOT_AFTERNOON,   // 12:00 - 16:59
+    SLOT_EVENING,     // 17:00 - 20:59
+    SLOT_LATE,        // 21:00 and later
+    SLOT_COUNT
+};
+
+// Fill curve buckets: a sale falls into the first bucket whose lead time
+// (minutes before the show) it reaches; the last bucket takes the rest.
+const int FILL_LEAD_BUCKETS = 7;
+const long long FILL_LEAD_MINUTES[FILL_LEAD_BUCKETS] = { 14 * 1440, 7 * 1440, 3 * 1440, 1440, 360, 60, 0 };
+
+struct FillCurve {
+    long long tickets[FILL_LEAD_BUCKETS] = {}; // Net tickets per lead-time bucket
+    int showtimes = 0;
+    long long capacity = 0;                    // Sum over those showtimes
+};
+
+// A showtime as the analytics saw it when its first sale was read
+struct ShowtimeFill {
+    long long startMinute;       // -1 if the showtime was already gone
+    int capacity;
+    int sold = 0;                // Net seats sold so far
+    FillCurve* curve = nullptr;  // Null if the start is unknown
+};
+
+struct SeatAnalytics {
+    long long rowsConsumed = 0; // Ticket log rows folded in
+    unordered_map<int, HallHeat> halls;
+    unordered_map<int, ShowtimeFill> showtimes;
+    map<pair<int, int>, FillCurve> curves; // (movie ID, TimeSlot) -> curve
+};
+
+// ===== Consistency checker =====
+// Verifies a site's data files without loading them: each file is scanned
+// by its own thread, then references between the files are checked.
+// Repairs are made on the loaded site, which is then saved in full.
+const size_t MAX_LISTED_PROBLEMS = 20; // Per file; all problems are counted
+
+struct FileCheck {
+    string fileName;
+    long long bytes = 0;
+    long long records = 0;
+    long long problemCount = 0;
+    double ms = 0;           // Time spent scanning this file
+    vector<string> problems; // The first MAX_LISTED_PROBLEMS
+
+    void problem(const string& message) {
+        if (problems.size() < MAX_LISTED_PROBLEMS) problems.push_back(message);
+        ++problemCount;
+    }
+};
+
+struct ConsistencyReport {
+    vector<FileCheck> files;
+    vector<int> regridShowtimeIds; // Seat grids with values other than 0/1, a bad layout or a wrong sold count
+    double ms = 0;
+
+    long long problemCount() const {
+        long long n = 0;
+        for (const FileCheck& f : files) n += f.problemCount;
+        return n;
+    }
+};
+
+// ===== Metrics =====
+// Latency histograms and counters are recorded into a per-thread block
+// without locks and merged across threads when read.
+enum MetricOp {
+    OP_TICKET_PURCHASE = 0,
+    OP_SAVE_DATA,
+    OP_LOAD_DATA,
+    OP_REPORT_SHOWTIME_STATUS,
+    OP_REPORT_MOVIE_TOTALS,
+    OP_REPORT_SALES_OVERVIEW,
+    OP_REPORT_ARCHIVED_SALES,
+    OP_REPORT_REVENUE_ANALYTICS,
+    OP_REPORT_SEAT_ANALYTICS,
+    OP_REPLICATION_LAG, // File change on the primary until the standby has applied it
+    OP_ADMISSION_WAIT,  // Flash-sale customer queued until admitted
+    OP_COUNT
+};
+
+enum MetricCounter {
+    COUNTER_BOOKINGS = 0,
+    COUNTER_SEATS_SOLD,
+    COUNTER_REFUNDS,
+    COUNTER_SAVE_BYTES,
+    COUNTER_FSYNCS,
+    COUNTER_SEAT_MAP_LOADS,
+    COUNTER_WRITE_BATCHES,
+    COUNTER_WRITES_COALESCED,
+    COUNTER_WAITLIST_OFFERS,
+    COUNTER_WAITLIST_EXPIRED,
+    COUNTER_REPLICATION_FRAMES, // Shipped on a primary, applied on a standby
+    COUNTER_REPLICATION_BYTES,
+    COUNTER_REPLICATION_RESYNCS,
+    COUNTER_SESSIONS_SERVED,    // Purchase sessions served over the session socket
+    COUNTER_SESSIONS_TIMED_OUT,
+    COUNTER_ADMISSIONS_QUEUED,  // Flash-sale customers who had to wait in line
+    COUNTER_ADMISSION_TURNS_EXPIRED,
+    COUNTER_COUNT
+};
+
+// Log-linear buckets: 16 sub-buckets per power of two of nanoseconds,
+// i.e. at most ~6% relative error per recorded value.
+const int HIST_SUB_BUCKETS = 16;
+const int HIST_BUCKETS = 61 * HIST_SUB_BUCKETS;
+
+struct ThreadMetrics {
+    atomic<unsigned long long> latency[OP_COUNT][HIST_BUCKETS];
+    atomic<unsigned long long> latencySumNs[OP_COUNT];
+    atomic<unsigned long long> latencyMaxNs[OP_COUNT];
+    atomic<long long> counters[COUNTER_COUNT];
+};
+
+// Records the time from construction to destruction under `op`
+struct ScopedLatency {
+    MetricOp op;
+    chrono::steady_clock::time_point start;
+
+    explicit ScopedLatency(MetricOp o) : op(o), start(chrono::steady_clock::now()) {}
+    ~ScopedLatency();
+};
+
+// ===== Tracing =====
+// RAII spans recorded into a per-thread ring buffer while tracing is
+// enabled and exported in the Chrome trace-event format (chrome://tracing,
+// Perfetto). A disabled span costs one relaxed atomic load.
+const int TRACE_RING_SIZE = 8192; // Events kept per thread
+
+struct TraceEvent {
+    atomic<unsigned long long> seq;     // 0 while being written, else write index + 1
+    atomic<const char*> name;
+    atomic<long long> startNs;          // Relative to traceEpoch
+    atomic<long long> durationNs;
+};
+
+struct ThreadTrace {
+    int tid;                            // Small sequential thread number
+    atomic<unsigned long long> written; // Total events ever written
+    TraceEvent events[TRACE_RING_SIZE];
+};
+
+atomic<bool> tracingEnabled{ false };
+
+struct TraceSpan {
+    const char* name; // Must be a string literal
+    long long startNs = -1;
+
+    explicit TraceSpan(const char* spanName);
+    ~TraceSpan() { end(); }
+    void end(); // Close the span early; later calls do nothing
+};
+
+// ===== Background writer =====
+// saveDataToFiles() serializes on the site's worker and hands the bytes to
+// a single writer thread through a lock-free queue; the writer does all
+// file I/O and fsyncs. Jobs that pile up while a batch is being written
+// are coalesced: only the newest contents of each file are written, and
+// appends to the same file share one fsync.
+struct Cinema;
+
+enum WriteKind {
+    WRITE_REPLACE = 0, // Replace the file with `data`
+    WRITE_SNAPSHOT,    // Replace the showtime file with `data`, then `pieces`
+    WRITE_APPEND,      // Append `data`
+    WRITE_PATCH        // Overwrite `patches` in place
+};
+
+// Files of a site, as bits of Cinema::dirtyFiles
+enum DirtyFile {
+    DIRTY_MOVIES = 1 << 0,
+    DIRTY_HALLS = 1 << 1,
+    DIRTY_LAYOUTS = 1 << 2,
+    DIRTY_SHOWTIMES = 1 << 3, // Showtimes added, deleted or archived
+    DIRTY_PRICING = 1 << 4,
+    DIRTY_ORDERS = 1 << 5,    // Order file must be rewritten in full
+    DIRTY_ALL = (1 << 6) - 1
+};
+
+enum DurabilityMode {
+    DURABILITY_ENQUEUE = 0, // A save returns once its writes are queued
+    DURABILITY_FSYNC        // A save returns once its writes are on stable storage
+};
+
+atomic<int> durabilityMode{ DURABILITY_ENQUEUE };
+
+// One showtime of the snapshot file: its header, then its seat grid,
+// either inline or copied from the snapshot currently on disk.
+struct SnapshotPiece {
+    int showtimeId;
+    string text;
+    size_t gridStart; // Where the grid starts in `text`
+    bool copyGrid;    // Grid is not resident; copy it from the current snapshot
+};
+
+// Bytes to overwrite in place. With a showtime ID the offset is relative
+// to the start of that showtime's seat grid in the snapshot on disk.
+struct FilePatch {
+    int showtimeId = -1;
+    long long offset;
+    string bytes;
+};
+
+struct TicketFactLog;
+
+struct WriteJob {
+    WriteJob* next = nullptr; // Queue link
+    Cinema* site = nullptr;
+    long long seq = 0;        // Increases per site, see Cinema::writesDone
+    WriteKind kind = WRITE_REPLACE;
+    string path;
+    string data;
+    vector<SnapshotPiece> pieces;
+    vector<FilePatch> patches;
+    unsigned dirtyOnFailure = 0;   // DirtyFile bits to rewrite in full if this job fails
+    bool repair = false;           // Appends that restart a path after a failure
+    TicketFactLog* log = nullptr;  // Sales log appends: rows up to endRow are durable once synced
+    long long endRow = 0;
+};
+
+// ===== Replication =====
+// A primary ships every change the background writer makes to the data
+// files to a hot standby over a Unix domain socket: whole-file
+// replacements, in-place writes and removals, in the order they hit the
+// disk. A standby that connects first receives a base copy of every file.
+// The standby applies the frames to its own copy and acknowledges them;
+// when the primary goes away it loads that copy and serves the console.
+enum ReplicaFrameKind {
+    REPLICA_REPLACE = 1, // Replace the file with the payload
+    REPLICA_WRITE,       // Write the payload at `offset`, extending the file if needed
+    REPLICA_REMOVE,      // Remove the file
+    REPLICA_SYNCED,      // Base copy complete; the standby may take over from here on
+    REPLICA_BYE          // Clean shutdown of the primary; the standby keeps waiting
+};
+
+// kind (1), seq (8), offset (8), path bytes (4), payload bytes (8)
+const size_t REPLICA_FRAME_HEADER = 29;
+const size_t MAX_REPLICA_BACKLOG_BYTES = size_t(256) << 20; // Unsent bytes before the standby is dropped
+
+struct ReplicaFrame {
+    long long seq;
+    chrono::steady_clock::time_point queuedAt;
+    string bytes; // Encoded frame
+};
+
+struct ReplicationState {
+    string socketPath;
+    atomic<bool> enabled{ false };
+    atomic<bool> connected{ false };
+    atomic<bool> streaming{ false };       // The standby has the base copy; ship every change
+    atomic<bool> resyncRequested{ false }; // The writer owes the standby a base copy
+    atomic<bool> dropRequested{ false };   // Backlog too large; reconnect and resync
+    atomic<bool> stopping{ false };
+    atomic<long long> ackedSeq{ 0 };
+
+    mutex outboxMutex; // Guards the fields below
+    deque<ReplicaFrame> outbox;
+    size_t outboxBytes = 0;
+    long long lastSeq = 0;
+
+    int wakePipe[2] = { -1, -1 }; // Wakes the sender when frames are queued
+    thread sender;
 };
 
-// Global showtime list
-vector<Showtime> showtimes;
-int nextShowtimeId = 1; // Auto-increment ID for showtimes
+ReplicationState replication;
+
+// ===== Admission control =====
+// When a flash sale opens, every customer wants the same showtime at once;
+// left alone they pick the same seats, and most bookings fail and start
+// over. A showtime with an admission gate lets customers choose seats a
+// few at a time: a token bucket limits how fast they are let in, at most
+// maxActive choose at once, and the rest wait in arrival order and are
+// told their place in line. The ticket count a customer enters keeps that
+// many free seats for them, so the line hears the showtime is sold out as
+// soon as every seat is sold, held or kept. Gates are not saved; a restart
+// opens the showtime to everyone.
+struct AdmissionPolicy {
+    double ratePerSecond = 2; // Customers let in per second...
+    int burst = 10;           // ...and at most this many at once
+    int maxActive = 20;       // Customers choosing seats at the same time
+    int turnMinutes = 5;      // Time an admitted customer has to book
+};
+
+struct AdmissionGate {
+    AdmissionPolicy policy;
+    double tokens = 0;
+    long long refilledAtMs = -1;
+    int active = 0;                   // Admitted and not finished, box office included
+    int deciding = 0;                 // Admitted, ticket count not entered yet
+    int promised = 0;                 // Free seats kept for ticket counts entered and not yet held
+    deque<long long> waiting;         // Queue tickets in arrival order
+    unordered_set<long long> called;  // Admitted; their session has not been told yet
+    long long queuedTotal = 0;
+    long long admittedTotal = 0;
+    long long turnsExpired = 0;
+    size_t longestQueue = 0;
+};
+
+// ===== Purchase sessions =====
+// The customer purchase dialogue as a state machine. A session suspends
+// between inputs instead of holding a thread while the customer thinks,
+// so one thread can serve thousands of them: the console drives one
+// session, the session server multiplexes many over a Unix domain socket.
+// Steps run on the site's worker. The site may change while a session
+// waits, so every step looks its showtime up again.
+enum PurchaseStep {
+    STEP_REFERENCE = 0, // Optional purchase reference (a whole line)
+    STEP_MOVIE_PAGE,    // Show the next page of movies? (Y/N)
+    STEP_MOVIE,         // Movie ID or part of a title (a whole line)
+    STEP_SHOWTIME,
+    STEP_TICKET_COUNT,
+    STEP_AUTO_SEATS,    // Choose the best seats automatically? (Y/N)
+    STEP_SEAT_ROW,
+    STEP_SEAT_COL,
+    STEP_QUEUED,        // Waiting to be admitted to a flash-sale showtime
+    STEP_DONE
+};
+
+enum PurchaseOutcome {
+    PURCHASE_OPEN = 0,
+    PURCHASE_BOOKED,
+    PURCHASE_REPLAYED,   // The purchase reference was used before
+    PURCHASE_SOLD_OUT,
+    PURCHASE_NOT_BOOKED, // The seats were taken before the booking
+    PURCHASE_CLOSED      // Nothing to sell, the showtime went away or the customer left
+};
+
+struct PurchaseSession {
+    PurchaseStep step = STEP_REFERENCE;
+    PurchaseOutcome outcome = PURCHASE_OPEN;
+    string requestKey;
+    int moviePageAfterId = 0;     // Cursor of the movie listing
+    int movieId = 0;
+    int showtimeId = 0;
+    int ticketCount = 0;
+    int row = 0;                  // Row entered for the seat being selected, 1-based
+    vector<pair<int, int>> seats; // Selected seats, 1-based
+    long long orderId = -1;
+
+    // Admission through the showtime's gate, if it has one
+    bool boxOffice = false;       // Sold at the counter: never queued
+    long long queueTicket = 0;    // Set while queued or admitted
+    bool admitted = false;
+    int promisedSeats = 0;        // Seats the gate keeps for the ticket count until they are held
+    long long queuedAtMs = 0;
+    long long admittedAtMs = 0;
+    int reportedPosition = 0;     // Place in line last told to the customer
+    long long reportedAtMs = 0;
+};
+
+const int SESSION_IDLE_TIMEOUT_SECONDS = 300;
+const size_t MAX_SESSION_LINE_BYTES = 4096; // A longer input line closes the connection
+
+struct SessionServerState {
+    string socketPath;
+    Cinema* site = nullptr;          // The site customers buy from
+    atomic<bool> enabled{ false };
+    atomic<bool> stopping{ false };
+    atomic<long long> openSessions{ 0 };
+    int listenFd = -1;
+    int wakePipe[2] = { -1, -1 };    // Wakes the server to stop
+    thread loop;
+};
+
+SessionServerState sessionServer;
+
+// ===== Schedule optimizer =====
+// Plans a week of showtimes from demand estimates. A movie's weekly
+// demand is spread over the days by weekday and over start-time bands;
+// the shows of one movie in one band share that band's customers, so
+// the band sells min(demand, seats offered) tickets. Each hall-day is
+// filled from a greedy start and improved by local search, with the
+// days searched in parallel. Shows already in the week stay where they
+// are and count toward the seats offered.
+const int SCHEDULE_BANDS = 4; // Start before 14:00, before 17:00, before 20:00, later
+const int SCHEDULE_SLOT_MINUTES = 5; // Shows start on multiples of this
+
+struct ScheduleDemand {
+    int movieId;
+    double weeklyTickets; // Expected tickets over the whole week
+};
+
+struct ScheduleOptions {
+    long long firstDay = 0;     // Day number of the first planned day
+    int days = 7;
+    int openMinute = 10 * 60;   // Earliest start of a day
+    int closeMinute = 24 * 60;  // Every show ends by then
+    int cleaningMinutes = 20;   // Between two shows in a hall
+    double matineePrice = 9.5;  // Shows starting before 17:00
+    double eveningPrice = 12.5;
+    int threads = 0;            // 0 = one per core
+    int restarts = 0;           // Searches per day, best kept; 0 = enough to use every thread
+    int iterations = 200000;    // Moves per search
+};
+
+struct PlannedShow {
+    int movieId;
+    int hallId;
+    long long startMinute; // Minutes since 1970-01-01
+    double price;
+};
+
+struct SchedulePlan {
+    vector<PlannedShow> shows;    // In hall, then start order
+    double greedyRevenue = 0;     // Expected revenue of the greedy start
+    double expectedRevenue = 0;   // Expected revenue of the whole week, kept shows included
+    double expectedTickets = 0;
+    double demandTickets = 0;
+    vector<double> dayRevenue;
+    double ms = 0;
+    int threads = 0;
+    int searches = 0;
+};
+
+// ===== Cinema site context =====
+// Everything one site owns: its catalog, orders, indexes and the directory
+// its files live in. One process can host many sites. Each site has a
+// worker thread that runs every operation on the site, so sites never
+// share a lock; code reaches the site it is running for through cinema().
+struct Cinema {
+    int id = 0;
+    string name;
+    string dataDir = "."; // Directory holding this site's data files
+
+    // Movies, kept in ascending ID order
+    vector<Movie> movies;
+    int nextMovieId = 1; // Auto-increment ID
+    unordered_map<string, set<int>> movieIdsByRating; // Rating -> movie IDs, for filtered listings
+    TitleIndex movieTitleIndex;
+
+    // Halls, kept in ascending ID order
+    vector<Hall> halls;
+    int nextHallId = 1; // Auto-increment ID for halls
+    map<int, set<int>> hallIdsByFloor; // Floor -> hall IDs, for filtered listings
+
+    // Showtimes and their column store mirror
+    vector<Showtime> showtimes;
+    int nextShowtimeId = 1; // Auto-increment ID for showtimes
+    ShowtimeColumns showtimeCols;
+
+    // Orders and their hash indexes
+    vector<Order> orders;
+    unordered_map<long long, size_t> orderIndexById; // Order ID -> index in orders
+    unordered_map<string, long long> orderIdByKey;   // Idempotency key -> order ID
+    long long nextOrderId = 1;                       // Auto-increment ID for orders
+
+    // Pricing
+    map<int, PricingRules> hallPricingRules;               // Hall ID -> rules
+    unordered_map<int, CompiledPricing> compiledPricingByHall;
+    unordered_map<int, QuoteCacheEntry> quoteCache;        // Showtime ID -> prices
+
+    // Showtime IDs grouped by the day they start on (days since 1970-01-01).
+    // Showtimes whose datetime cannot be parsed are kept under day -1 and
+    // are never archived.
+    map<long long, vector<int>> showtimesByDay;
+    vector<ArchiveSegment> archiveSegments;
+
+    TicketFactLog ticketLog;
+    SeatAnalytics seatAnalytics;
+
+    // Background writes. Seat grids of the snapshot on disk are located
+    // through seatGridIndex, which the writer swaps when it replaces the
+    // file; readers of either hold snapshotMutex.
+    long long lastWriteSeq = 0;               // Last write queued by this site
+    atomic<long long> writesDone{ 0 };        // Writes finished by the writer
+    atomic<long long> failedWriteSeq{ 0 };    // Latest write the writer could not do
+    atomic<long long> committedSnapshotSeq{ 0 }; // Write that produced the snapshot on disk
+    mutex snapshotMutex;
+    unordered_map<int, pair<long long, long long>> seatGridIndex; // Showtime ID -> (offset, bytes)
+
+    // Latest consistency report, still valid while lastWriteSeq equals
+    // dataReportSeq (-1: none yet)
+    ConsistencyReport dataReport;
+    long long dataReportSeq = -1;
+
+    // Incremental saves: only dirty files are rewritten. Changed seat
+    // grids and refund flags are patched in place and new orders are
+    // appended, as long as the files on disk have the fixed layout.
+    unsigned dirtyFiles = DIRTY_ALL;    // DirtyFile bits
+    atomic<unsigned> failedWrites{ 0 }; // DirtyFile bits of writes the writer could not do
+    bool snapshotPatchable = false;     // Seat grids on disk have the fixed layout
+    bool ordersPatchable = false;       // ORDER_FILE was written in full by this process
+    size_t savedOrderCount = 0;         // Orders already in ORDER_FILE
+    long long orderFileBytes = 0;       // Size of ORDER_FILE once queued writes are done
+    vector<size_t> refundedOrders;      // Indexes of orders refunded since the last save
+
+    // Waitlists. Offers all last WAITLIST_OFFER_MINUTES, so offerExpiry
+    // is in expiry order; offers leave it when they are claimed, declined
+    // or dropped. Held seats are not saved: a restart returns them to sale.
+    unordered_map<int, deque<WaitlistEntry>> waitlists; // Showtime ID -> queue
+    unordered_map<long long, WaitlistOffer> waitlistOffers; // Entry ID -> open offer
+    deque<pair<long long, long long>> offerExpiry;      // (expiresAt, entry ID)
+    deque<SeatRelease> seatReleases;                    // Released seats not yet offered
+    unordered_map<long long, int> waitlistShowtimeById; // Queued entry ID -> showtime ID
+    size_t waitlistEntryCount = 0;                      // Queued plus offered
+    long long nextWaitlistId = 1;
+
+    // Resident seat maps by showtime ID, most recently used first
+    list<int> seatMapLru;
+    unordered_map<int, list<int>::iterator> seatMapLruPos;
+    // Eviction target, not a hard bound: maps with unsaved changes, held
+    // seats or writes still in flight stay resident past it
+    size_t maxResidentSeatMaps = 4096;
+
+    // Flash-sale admission gates by showtime ID
+    unordered_map<int, AdmissionGate> admissionGates;
+    long long nextAdmissionTicket = 1;
+
+    // Worker thread and its task queue
+    thread worker;
+    mutex taskMutex;
+    condition_variable taskReady;
+    deque<packaged_task<void()>> tasks;
+    bool stopping = false;
+};
+
+vector<unique_ptr<Cinema>> cinemas;       // All sites hosted by this process
+thread_local Cinema* currentCinema = nullptr; // Site the running thread works for
 
 // ===== File names for saving/loading data =====
 const string MOVIE_FILE = "movies.txt";
 const string HALL_FILE = "halls.txt";
 const string SHOWTIME_FILE = "showtimes.txt";
+const string ARCHIVE_DIR = "archive";
+const string ARCHIVE_INDEX_FILE = "archive/index.txt";
+const string SALES_LOG_FILE = "sales.log";
+const string ORDER_FILE = "orders.txt";
+const string PRICING_FILE = "pricing.txt";
+const string LAYOUT_FILE = "layouts.txt";
+const string METRICS_FILE = "metrics.txt";
+const string TRACE_FILE = "trace.json";
+const string SITES_FILE = "sites.txt"; // Site list, kept in the working directory
+const string BOOKING_TRACE_FILE = "bookings.trace"; // Written by --generate, read by --replay
+const string SCHEDULE_DEMAND_FILE = "demand.txt"; // Default input of the schedule optimizer
+const string WAITLIST_NOTIFY_FILE = "notifications.log"; // Waitlist offers to send to customers
 
 // ===== Function declarations =====
+void openTicketOffice();
+int runTicketOffice();
 void mainChoice1();
 void mainChoice2();
 
 // Movie management functions
 void addMovie();
-void listAllMovies();
+void listAllMovies(bool paged = true);
 void deleteMovie();
 void editMovie();
 int findMovieIndexById(int id);
 
+// Movie title search functions
+string normalizeTitle(const string& title);
+void indexMovieTitle(const Movie& m);
+void unindexMovieTitle(const Movie& m);
+void rebuildMovieTitleIndex();
+vector<TitleMatch> searchMovieTitles(const string& query, size_t limit);
+void searchMoviesMenu();
+
 // Hall management functions
 void addHall();
-void listAllHalls();
+void listAllHalls(bool paged = true);
 void deleteHall();
 int findHallIndexById(int id);
 
 // Showtime management functions
 void addShowtime();
-void listAllShowtimes();
+void listAllShowtimes(bool paged = true);
 void listShowtimesForMovie();
 void deleteShowtime();
 int findShowtimeIndexById(int id);
 
 // Customer purchase functions
 void startTicketPurchase();
-void displaySeatMap(const Showtime& s);
+void displaySeatMap(const Showtime& s, ostream& out = cout);
+
+// Seat layout functions
+shared_ptr<const HallLayout> makeHallLayout(int rows, int cols, const vector<unsigned char>& seatType);
+shared_ptr<const HallLayout> defaultHallLayout(int rows, int cols);
+void initShowtimeSeats(Showtime& s, const shared_ptr<const HallLayout>& layout);
+bool isSeatSellable(const Showtime& s, int r, int c);
+bool isSeatSold(const Showtime& s, int r, int c);
+bool isSeatHeld(const Showtime& s, int r, int c);
+bool isSeatAvailable(const Showtime& s, int r, int c);
+void setSeatSold(Showtime& s, int r, int c, bool sold);
+void setSeatHeld(Showtime& s, int r, int c, bool held);
+int countHeldSeats(const Showtime& s);
+void ensureSeatMap(Showtime& s);
+void evictSeatMaps();
+void forgetSeatMap(int showtimeId);
+bool findBestSeats(const Showtime& s, int count, vector<pair<int, int>>& seats);
+void editHallLayout();
+
+// Pricing functions
+const PricingRules& pricingRulesForHall(int hallId);
+SeatTier seatTierFromRules(const PricingRules& rules, int rows, int cols, int r, int c);
+const CompiledPricing& compiledPricingForHall(int hallId, int rows, int cols);
+const long long* tierPricesForShowtime(int sIdx);
+long long quoteSeats(int sIdx, const vector<pair<int, int>>& seats, vector<long long>* seatPrices);
+void invalidatePricing(int hallId);
+void printZonePrices(int sIdx, ostream& out = cout);
+string quotedPriceRange(int sIdx);
+void editHallPricingRules();
+
+// Order functions
+BookingStatus placeOrder(int showtimeId, const vector<pair<int, int>>& seats,
+                         const string& idempotencyKey, long long createdAt, long long& orderId);
+BookingStatus bookSeats(int showtimeId, const vector<pair<int, int>>& seats,
+                        const string& idempotencyKey, long long& orderId);
+BookingStatus bookBatch(const vector<BatchItem>& items, const string& idempotencyKey,
+                        vector<long long>& orderIds, size_t& failedItem);
+bool isValidBookingReference(const string& reference);
+RefundStatus refundOrder(long long orderId);
+Order* findOrderById(long long id);
+void addOrder(const Order& o);
+bool seatListWithoutPrices(const char* p, const char* end, int seatCount);
+void splitOrderTotal(Order& o);
+void printOrderSummary(const Order& o, ostream& out = cout);
+void lookUpOrder();
+void refundOrderMenu();
+void groupBookingMenu();
+
+// Waitlist functions
+long long joinWaitlist(int showtimeId, const string& contact, int tickets);
+int waitlistPosition(long long entryId);
+void releaseSeats(int showtimeId, const vector<pair<int, int>>& seats);
+void dispatchSeatReleases();
+void expireWaitlistOffers();
+long long nextWaitlistExpiry(const Cinema& site);
+BookingStatus claimWaitlistOffer(long long entryId, long long& orderId);
+void declineWaitlistOffer(long long entryId);
+void dropWaitlist(int showtimeId);
+void offerWaitlistMenu(int showtimeId);
+void waitlistStatusMenu();
+
+// Admission control functions
+long long admissionClockMs();
+void setAdmissionGate(int showtimeId, const AdmissionPolicy& policy);
+void removeAdmissionGate(int showtimeId);
+void flashSaleAdmissionMenu();
+
+// Schedule optimizer functions
+bool readScheduleDemand(const string& path, vector<ScheduleDemand>& demand);
+SchedulePlan planSchedule(const vector<ScheduleDemand>& demand, const ScheduleOptions& options);
+int addPlannedShowtimes(const SchedulePlan& plan);
+void planScheduleMenu();
 
 // Statistics / query functions
 int countSoldSeats(const Showtime& s);
@@ -90,6 +1102,145 @@ void viewTicketStatusOfShowtime();
 void viewTotalTicketsForMovie();
 void viewOverallSalesOverview();
 
+// Paginated listing functions
+IdPage pageMovies(const string& rating, int afterId, size_t limit);
+IdPage pageHalls(int floor, int afterId, size_t limit);
+ShowtimePage pageShowtimes(const ShowtimeFilter& filter, const ShowtimeCursor& after, size_t limit);
+void rebuildListingIndexes();
+bool askNextPage();
+void printMoviePages(const string& rating, bool paged = true);
+void printHallPages(int floor, bool paged = true);
+void printShowtimePages(const ShowtimeFilter& filter, bool withSales, bool paged = true);
+void browseMoviesByRating();
+void browseHallsByFloor();
+void browseShowtimes();
+
+// Showtime column store functions
+long long parseDatetimeMinutes(const string& datetime);
+void appendShowtimeColumns(ShowtimeColumns& cols, const Showtime& s);
+void eraseShowtimeColumns(ShowtimeColumns& cols, int idx);
+void rebuildShowtimeColumns();
+void addShowtimeSold(ShowtimeColumns& cols, int idx, int delta);
+SalesTotals sumSales(const ShowtimeColumns& cols);
+SalesTotals sumSalesForMovie(const ShowtimeColumns& cols, int movieId);
+
+// Day partition / archive functions
+long long todayDayNumber();
+string formatDayNumber(long long day);
+long long parseDayNumber(const string& date);
+void addToDayPartition(int showtimeId, long long startMinute);
+void removeFromDayPartition(int showtimeId, long long startMinute);
+int archivePastShowtimes();
+int dropArchivedShowtimeCopies();
+void archivePastShowtimesMenu();
+void viewArchivedSales();
+void loadArchiveIndex();
+void saveArchiveIndex();
+
+// Text input functions
+TextReader& getline(TextReader& in, string& line);
+template <class T>
+const char* parseNextNumber(const char* p, const char* end, T& value);
+const char* parseNextWord(const char* p, const char* end, string& word);
+
+// Ticket fact log functions
+void openTicketFactLog(TicketFactLog& log, const string& path);
+void appendTicketFact(TicketFactLog& log, long long orderId, const Showtime& s,
+                      int row, int col, long long priceCents, int quantity, long long saleTime);
+bool flushTicketFacts(TicketFactLog& log);
+void scanTicketFacts(const TicketFactLog& log, unsigned columnMask,
+                     const function<void(const FactBatch&)>& fn, long long fromRow = 0);
+vector<FactGroupRow> groupTicketRevenue(const TicketFactLog& log, FactGroup group);
+void viewRevenueAnalytics();
+
+// Seat analytics functions
+long long refreshSeatAnalytics();
+void viewHallHeatMap();
+void viewFillCurves();
+void seatAnalyticsMenu();
+
+// Metrics functions
+void recordLatency(MetricOp op, unsigned long long ns);
+void countMetric(MetricCounter counter, long long delta = 1);
+bool syncFileToDisk(const string& path);
+string formatMetricsText();
+void viewSystemMetrics();
+
+// Tracing functions
+bool exportTraceJson(const string& path);
+void clearTraceBuffers();
+void tracingMenu();
+
+// Consistency checker functions
+ConsistencyReport checkDataFiles();
+void printConsistencyReport(const ConsistencyReport& report);
+int repairSiteData(const ConsistencyReport& report);
+int checkDataFilesMenu(bool repair);
+void warnAboutDataProblems();
+
+// Replication functions
+bool startReplicationPrimary(const string& socketPath);
+void stopReplication();
+void shipFileReplacement(const string& path, const string& data);
+void shipFileFromDisk(const string& path);
+void shipFileWrites(const string& path, const vector<pair<long long, const string*>>& writes);
+void sendReplicaBaseCopy();
+long long replicationFramesBehind();
+void printReplicationStatus();
+int runStandby(const string& socketPath);
+
+// Purchase session functions
+void startPurchaseSession(PurchaseSession& ps, ostream& out);
+bool purchaseStepTakesLine(const PurchaseSession& ps);
+bool feedPurchaseSession(PurchaseSession& ps, const string& input, long long nowMs, ostream& out);
+void pumpPurchaseSession(PurchaseSession& ps, long long nowMs, ostream& out);
+bool purchaseSessionWaiting(const PurchaseSession& ps);
+void abandonPurchaseSession(PurchaseSession& ps);
+bool startSessionServer(const string& socketPath, Cinema& site);
+void stopSessionServer();
+
+// Command line modes
+int runCommandLineMode(int argc, char* argv[]);
+void benchmarkShowtimeScans(int rowCount);
+void benchmarkTicketFacts(long long rowCount);
+void benchmarkPricing(int quoteCount);
+void benchmarkTitleSearch(int titleCount);
+void benchmarkColdStart(int showtimeCount);
+void benchmarkBatchBooking(int groups);
+void benchmarkSeatKernels(int iterations);
+void benchmarkTextInput(int recordCount);
+void benchmarkPurchaseSessions(int sessionCount);
+void benchmarkFlashSale(int customerCount);
+void benchmarkScheduleOptimizer(int hallCount);
+bool generateSyntheticSite(const string& dir, int movieCount, int hallCount, int weeks,
+                           int traceLength, unsigned long long seed);
+bool replayBookingTrace(const string& dir, const string& tracePath);
+int runSelfTests();
+
+// Background writer functions
+void startBackgroundWriter();
+void stopBackgroundWriter();
+void submitWrites(vector<WriteJob*>& jobs);
+bool waitForWrites(Cinema& site, long long seq, long long afterSeq = 0);
+bool flushPendingWrites();
+void printWriterErrors();
+void persistenceMenu();
+
+// Cinema site functions
+Cinema& cinema();
+string sitePath(const string& fileName);
+Cinema& addCinema(const string& name, const string& dataDir);
+void pinWorkerThread(thread& worker, int siteId);
+future<void> postToCinema(Cinema& site, function<void()> task);
+void runOnCinema(Cinema& site, function<void()> task);
+void runConsoleMenu(Cinema& site, void (*menu)());
+void resumeConsoleStep();
+void pauseConsoleStep();
+void stopCinemaWorkers();
+void loadCinemaSites();
+void saveCinemaSites();
+Cinema* selectCinemaMenu(Cinema* selected);
+
 // Persistence functions
 void saveDataToFiles();
 void loadDataFromFiles();
@@ -99,44 +1250,85 @@ bool hasShowtimeForMovie(int movieId);
 bool hasShowtimeForHall(int hallId);
 
 // ===== Main function =====
-int main() {
+int main(int argc, char* argv[]) {
+    console.attachStdin();
+    if (argc > 1) {
+        return runCommandLineMode(argc, argv);
+    }
+
+    openTicketOffice();
+    return runTicketOffice();
+}
+
+// Start the writer and load every site.
+void openTicketOffice() {
+    startBackgroundWriter();
+    loadCinemaSites();
+}
+
+// Serve the console until the operator exits.
+int runTicketOffice() {
     int mainChoice = -1;
-    loadDataFromFiles();
+    Cinema* selected = cinemas.front().get();
 
     while (true) {
+        printWriterErrors(); // Background write errors since the last menu
         cout << "\n=========== Movie Ticket System ===========" << endl;
+        if (cinemas.size() > 1) {
+            cout << "Site: " << selected->name << endl;
+        }
         cout << "1. Ticket Office (Admin Mode)" << endl;
         cout << "2. Purchase Tickets (Customer Mode)" << endl;
+        cout << "3. Select Cinema Site" << endl;
         cout << "0. Exit System" << endl;
         cout << "==========================================" << endl;
         cout << "Please enter your choice: ";
-        cin >> mainChoice;
+        console >> mainChoice;
 
-        if (!cin) {
-            cin.clear();
-            cin.ignore(10000, '\n');
+        if (!console) {
+            console.clear();
+            console.ignore(10000, '\n');
             cout << "Invalid input. Please enter a number option." << endl;
             continue;
         }
 
         if (mainChoice == 0) {
-            char ans;
+            stopSessionServer(); // No customer may book after the final save
+            char ans = 'N';
             cout << "Do you want to save the current data? (Y/N): ";
-            cin >> ans;
+            console >> ans;
 
             if (ans == 'Y' || ans == 'y') {
-                saveDataToFiles();
+                // Every site saves on its own worker, in parallel
+                vector<future<void>> saves;
+                for (auto& site : cinemas) {
+                    saves.push_back(postToCinema(*site, saveDataToFiles));
+                }
+                for (auto& done : saves) {
+                    done.get();
+                }
                 cout << "Data saved." << endl;
             } else {
                 cout << "Data not saved." << endl;
             }
 
+            // Saves acknowledged before they reached the disk must get there now
+            bool flushed = flushPendingWrites();
+            printWriterErrors();
+            if (!flushed) {
+                cout << "[Error] Some data could not be written to disk; see the errors above." << endl;
+            }
+            stopCinemaWorkers();
+            stopBackgroundWriter();
+            stopReplication(); // Everything written above reaches the standby first
             cout << "Program terminated. Goodbye!" << endl;
             break;
         } else if (mainChoice == 1) {
-            mainChoice1();
+            runConsoleMenu(*selected, mainChoice1);
         } else if (mainChoice == 2) {
-            mainChoice2();
+            runConsoleMenu(*selected, mainChoice2);
+        } else if (mainChoice == 3) {
+            selected = selectCinemaMenu(selected);
         } else {
             cout << "Invalid option. Please try again." << endl;
         }
@@ -150,19 +1342,24 @@ void mainChoice1() {
     int adminChoice = -1;
 
     while (true) {
+        expireWaitlistOffers();
+        printWriterErrors();
         cout << "\n========== Ticket Office (Admin) ==========" << endl;
         cout << "1. Movie Management" << endl;
         cout << "2. Hall / Floor Management" << endl;
         cout << "3. Showtime Management" << endl;
         cout << "4. Query & Statistics" << endl;
+        cout << "5. System Metrics" << endl;
+        cout << "6. Tracing" << endl;
+        cout << "7. Persistence Settings" << endl;
         cout << "0. Return to Main Menu" << endl;
         cout << "==========================================" << endl;
         cout << "Please enter your choice: ";
-        cin >> adminChoice;
+        console >> adminChoice;
 
-        if (!cin) {
-            cin.clear();
-            cin.ignore(10000, '\n');
+        if (!console) {
+            console.clear();
+            console.ignore(10000, '\n');
             cout << "Invalid input. Please enter a number option." << endl;
             continue;
         }
@@ -181,14 +1378,16 @@ void mainChoice1() {
                 cout << "2. Delete Movie" << endl;
                 cout << "3. Edit Movie Information" << endl;
                 cout << "4. List All Movies" << endl;
+                cout << "5. Search Movies" << endl;
+                cout << "6. Browse Movies by Rating" << endl;
                 cout << "0. Back" << endl;
                 cout << "--------------------------------------" << endl;
                 cout << "Please enter your choice: ";
-                cin >> movieChoice;
+                console >> movieChoice;
 
-                if (!cin) {
-                    cin.clear();
-                    cin.ignore(10000, '\n');
+                if (!console) {
+                    console.clear();
+                    console.ignore(10000, '\n');
                     cout << "Invalid input. Please enter a number option." << endl;
                     continue;
                 }
@@ -211,6 +1410,12 @@ void mainChoice1() {
                 case 4:
                     listAllMovies();
                     break;
+                case 5:
+                    searchMoviesMenu();
+                    break;
+                case 6:
+                    browseMoviesByRating();
+                    break;
                 default:
                     cout << "Invalid option. Please try again." << endl;
                 }
@@ -224,14 +1429,17 @@ void mainChoice1() {
                 cout << "1. Add Hall" << endl;
                 cout << "2. Delete Hall" << endl;
                 cout << "3. View All Halls" << endl;
+                cout << "4. Edit Hall Pricing Rules" << endl;
+                cout << "5. Edit Hall Seat Layout" << endl;
+                cout << "6. Browse Halls by Floor" << endl;
                 cout << "0. Back" << endl;
                 cout << "-------------------------------------" << endl;
                 cout << "Please enter your choice: ";
-                cin >> hallChoice;
+                console >> hallChoice;
 
-                if (!cin) {
-                    cin.clear();
-                    cin.ignore(10000, '\n');
+                if (!console) {
+                    console.clear();
+                    console.ignore(10000, '\n');
                     cout << "Invalid input. Please enter a number option." << endl;
                     continue;
                 }
@@ -251,6 +1459,15 @@ void mainChoice1() {
                 case 3:
                     listAllHalls();
                     break;
+                case 4:
+                    editHallPricingRules();
+                    break;
+                case 5:
+                    editHallLayout();
+                    break;
+                case 6:
+                    browseHallsByFloor();
+                    break;
                 default:
                     cout << "Invalid option. Please try again." << endl;
                 }
@@ -265,14 +1482,18 @@ void mainChoice1() {
                 cout << "2. Delete Showtime" << endl;
                 cout << "3. View Showtimes for a Movie" << endl;
                 cout << "4. View All Showtimes" << endl;
+                cout << "5. Archive Past Showtimes" << endl;
+                cout << "6. Browse Showtimes by Date / Sold-Out Status" << endl;
+                cout << "7. Flash Sale Admission" << endl;
+                cout << "8. Plan Week Schedule" << endl;
                 cout << "0. Back" << endl;
                 cout << "-----------------------------------------" << endl;
                 cout << "Please enter your choice: ";
-                cin >> showtimeChoice;
+                console >> showtimeChoice;
 
-                if (!cin) {
-                    cin.clear();
-                    cin.ignore(10000, '\n');
+                if (!console) {
+                    console.clear();
+                    console.ignore(10000, '\n');
                     cout << "Invalid input. Please enter a number option." << endl;
                     continue;
                 }
@@ -295,6 +1516,18 @@ void mainChoice1() {
                 case 4:
                     listAllShowtimes();
                     break;
+                case 5:
+                    archivePastShowtimesMenu();
+                    break;
+                case 6:
+                    browseShowtimes();
+                    break;
+                case 7:
+                    flashSaleAdmissionMenu();
+                    break;
+                case 8:
+                    planScheduleMenu();
+                    break;
                 default:
                     cout << "Invalid option. Please try again." << endl;
                 }
@@ -308,14 +1541,17 @@ void mainChoice1() {
                 cout << "1. View ticket status of a showtime" << endl;
                 cout << "2. View today's total tickets of a movie" << endl;
                 cout << "3. View ticket sales overview" << endl;
+                cout << "4. View archived sales by date range" << endl;
+                cout << "5. View revenue analytics (ticket log)" << endl;
+                cout << "6. View seat heat maps and fill curves" << endl;
                 cout << "0. Back" << endl;
                 cout << "----------------------------------------" << endl;
                 cout << "Please enter your choice: ";
-                cin >> statsChoice;
+                console >> statsChoice;
 
-                if (!cin) {
-                    cin.clear();
-                    cin.ignore(10000, '\n');
+                if (!console) {
+                    console.clear();
+                    console.ignore(10000, '\n');
                     cout << "Invalid input. Please enter a number option." << endl;
                     continue;
                 }
@@ -335,10 +1571,31 @@ void mainChoice1() {
                 case 3:
                     viewOverallSalesOverview();
                     break;
+                case 4:
+                    viewArchivedSales();
+                    break;
+                case 5:
+                    viewRevenueAnalytics();
+                    break;
+                case 6:
+                    seatAnalyticsMenu();
+                    break;
                 default:
                     cout << "Invalid option. Please try again." << endl;
                 }
             }
+        }
+        // System Metrics
+        else if (adminChoice == 5) {
+            viewSystemMetrics();
+        }
+        // Tracing
+        else if (adminChoice == 6) {
+            tracingMenu();
+        }
+        // Persistence Settings
+        else if (adminChoice == 7) {
+            persistenceMenu();
         } else {
             cout << "Invalid option. Please try again." << endl;
         }
@@ -350,16 +1607,21 @@ void mainChoice2() {
     int userChoice = -1;
 
     while (true) {
+        expireWaitlistOffers();
         cout << "\n========== Purchase (Customer) ==========" << endl;
         cout << "1. Start Ticket Purchase" << endl;
+        cout << "2. Look Up Order" << endl;
+        cout << "3. Refund Order" << endl;
+        cout << "4. Waitlist Status" << endl;
+        cout << "5. Group Booking" << endl;
         cout << "0. Return to Main Menu" << endl;
         cout << "=========================================" << endl;
         cout << "Please enter your choice: ";
-        cin >> userChoice;
+        console >> userChoice;
 
-        if (!cin) {
-            cin.clear();
-            cin.ignore(10000, '\n');
+        if (!console) {
+            console.clear();
+            console.ignore(10000, '\n');
             cout << "Invalid input. Please enter a number option." << endl;
             continue;
         }
@@ -371,6 +1633,14 @@ void mainChoice2() {
 
         if (userChoice == 1) {
             startTicketPurchase();
+        } else if (userChoice == 2) {
+            lookUpOrder();
+        } else if (userChoice == 3) {
+            refundOrderMenu();
+        } else if (userChoice == 4) {
+            waitlistStatusMenu();
+        } else if (userChoice == 5) {
+            groupBookingMenu();
         } else {
             cout << "Invalid option. Please try again." << endl;
         }
@@ -382,72 +1652,69 @@ void mainChoice2() {
 // Find movie index in the vector by its ID.
 // Return index if found, -1 if not found.
 int findMovieIndexById(int id) {
-    for (size_t i = 0; i < movies.size(); ++i) {
-        if (movies[i].id == id) {
-            return static_cast<int>(i);
-        }
-    }
-    return -1;
+    Cinema& site = cinema();
+    auto it = lower_bound(site.movies.begin(), site.movies.end(), id,
+                          [](const Movie& m, int key) { return m.id < key; });
+    return (it != site.movies.end() && it->id == id) ? static_cast<int>(it - site.movies.begin()) : -1;
 }
 
 // Add a new movie.
 void addMovie() {
     Movie m;
-    m.id = nextMovieId++;
+    m.id = cinema().nextMovieId++;
 
     cout << "\n--- Add New Movie ---" << endl;
 
     // Clear leftover '\n' from previous cin >>
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    console.ignore(numeric_limits<streamsize>::max(), '\n');
 
     cout << "Enter movie title: ";
-    getline(cin, m.title);
+    getline(console, m.title);
 
     cout << "Enter rating (e.g. G, PG, PG-13, R): ";
-    getline(cin, m.rating);
+    getline(console, m.rating);
 
     cout << "Enter duration (minutes): ";
-    while (!(cin >> m.duration) || m.duration <= 0) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> m.duration) || m.duration <= 0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid duration. Please enter a positive integer: ";
     }
 
-    movies.push_back(m);
+    cinema().movies.push_back(m);
+    indexMovieTitle(m);
+    cinema().movieIdsByRating[m.rating].insert(m.id);
     cout << "Movie added successfully! [ID = " << m.id << "]" << endl;
+    cinema().dirtyFiles |= DIRTY_MOVIES;
     saveDataToFiles();
 }
 
 // List all movies.
-void listAllMovies() {
+void listAllMovies(bool paged) {
     cout << "\n--- All Movies ---" << endl;
-    if (movies.empty()) {
+    if (cinema().movies.empty()) {
         cout << "No movies found." << endl;
         return;
     }
 
-    for (const auto& m : movies) {
-        cout << "ID: " << m.id
-             << " | Title: " << m.title
-             << " | Rating: " << m.rating
-             << " | Duration: " << m.duration << " minutes" << endl;
-    }
+    printMoviePages("", paged);
 }
 
 // Delete a movie by ID.
 void deleteMovie() {
+    Cinema& site = cinema();
     cout << "\n--- Delete Movie ---" << endl;
 
-    if (movies.empty()) {
+    if (site.movies.empty()) {
         cout << "No movies to delete." << endl;
         return;
     }
 
     int id;
     cout << "Enter movie ID to delete: ";
-    while (!(cin >> id)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a valid movie ID: ";
     }
 
@@ -461,25 +1728,29 @@ void deleteMovie() {
         cout << "Please delete those showtimes first." << endl;
         return;
     }
-    cout << "Movie \"" << movies[idx].title << "\" deleted." << endl;
-    movies.erase(movies.begin() + idx);
+    cout << "Movie \"" << site.movies[idx].title << "\" deleted." << endl;
+    unindexMovieTitle(site.movies[idx]);
+    site.movieIdsByRating[site.movies[idx].rating].erase(id);
+    site.movies.erase(site.movies.begin() + idx);
+    site.dirtyFiles |= DIRTY_MOVIES;
     saveDataToFiles();
 }
 
 // Edit a movie by ID.
 void editMovie() {
+    Cinema& site = cinema();
     cout << "\n--- Edit Movie ---" << endl;
 
-    if (movies.empty()) {
+    if (site.movies.empty()) {
         cout << "No movies to edit." << endl;
         return;
     }
 
     int id;
     cout << "Enter movie ID to edit: ";
-    while (!(cin >> id)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a valid movie ID: ";
     }
 
@@ -489,30 +1760,34 @@ void editMovie() {
         return;
     }
 
-    Movie& m = movies[idx];
+    Movie& m = site.movies[idx];
     cout << "Editing movie: " << m.title << endl;
 
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
 
     cout << "Enter new title (leave empty to keep \"" << m.title << "\"): ";
     string newTitle;
-    getline(cin, newTitle);
+    getline(console, newTitle);
     if (!newTitle.empty()) {
+        unindexMovieTitle(m);
         m.title = newTitle;
+        indexMovieTitle(m);
     }
 
     cout << "Enter new rating (leave empty to keep \"" << m.rating << "\"): ";
     string newRating;
-    getline(cin, newRating);
+    getline(console, newRating);
     if (!newRating.empty()) {
+        site.movieIdsByRating[m.rating].erase(m.id);
         m.rating = newRating;
+        site.movieIdsByRating[m.rating].insert(m.id);
     }
 
     cout << "Enter new duration in minutes (0 to keep " << m.duration << "): ";
     int newDuration;
-    while (!(cin >> newDuration)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> newDuration)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a non-negative integer: ";
     }
     if (newDuration > 0) {
@@ -520,91 +1795,259 @@ void editMovie() {
     }
 
     cout << "Movie updated successfully." << endl;
+    cinema().dirtyFiles |= DIRTY_MOVIES;
     saveDataToFiles();
 }
 
-// ===== Hall management function implementations =====
+// ===== Movie title search implementations =====
+
+// Lowercase, map everything but letters and digits to a single space and
+// trim, e.g. "The Dark  Knight!" -> "the dark knight".
+string normalizeTitle(const string& title) {
+    string out;
+    out.reserve(title.size());
+    for (unsigned char ch : title) {
+        if (isalnum(ch)) {
+            out += static_cast<char>(tolower(ch));
+        } else if (!out.empty() && out.back() != ' ') {
+            out += ' ';
+        }
+    }
+    if (!out.empty() && out.back() == ' ') out.pop_back();
+    return out;
+}
 
-int findHallIndexById(int id) {
-    for (size_t i = 0; i < halls.size(); ++i) {
-        if (halls[i].id == id) {
-            return static_cast<int>(i);
+// Distinct trigrams of a normalized title padded with spaces, so word
+// starts and ends form their own trigrams.
+static vector<unsigned int> titleTrigrams(const string& normalized) {
+    string padded = "  " + normalized + " ";
+    vector<unsigned int> grams;
+    for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+        grams.push_back((static_cast<unsigned char>(padded[i]) << 16)
+                        | (static_cast<unsigned char>(padded[i + 1]) << 8)
+                        | static_cast<unsigned char>(padded[i + 2]));
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+void indexMovieTitle(const Movie& m) {
+    TitleIndex& index = cinema().movieTitleIndex;
+    int slot;
+    if (!index.freeSlots.empty()) {
+        slot = index.freeSlots.back();
+        index.freeSlots.pop_back();
+    } else {
+        slot = static_cast<int>(index.slotMovieId.size());
+        index.slotMovieId.push_back(-1);
+        index.slotTrigramCount.push_back(0);
+    }
+
+    string normalized = normalizeTitle(m.title);
+    vector<unsigned int> grams = titleTrigrams(normalized);
+    for (unsigned int g : grams) {
+        index.postings[g].push_back(slot);
+    }
+    index.slotMovieId[slot] = m.id;
+    index.slotTrigramCount[slot] = static_cast<int>(grams.size());
+    index.slotByMovieId[m.id] = slot;
+    index.sortedTitles.insert({ normalized, m.id });
+}
+
+void unindexMovieTitle(const Movie& m) {
+    TitleIndex& index = cinema().movieTitleIndex;
+    auto slotIt = index.slotByMovieId.find(m.id);
+    if (slotIt == index.slotByMovieId.end()) return;
+    int slot = slotIt->second;
+
+    string normalized = normalizeTitle(m.title);
+    for (unsigned int g : titleTrigrams(normalized)) {
+        auto it = index.postings.find(g);
+        if (it == index.postings.end()) continue;
+        vector<int>& slots = it->second;
+        slots.erase(remove(slots.begin(), slots.end(), slot), slots.end());
+        if (slots.empty()) index.postings.erase(it);
+    }
+    index.slotMovieId[slot] = -1;
+    index.slotTrigramCount[slot] = 0;
+    index.freeSlots.push_back(slot);
+    index.slotByMovieId.erase(slotIt);
+    index.sortedTitles.erase({ normalized, m.id });
+}
+
+void rebuildMovieTitleIndex() {
+    cinema().movieTitleIndex = TitleIndex();
+    for (const auto& m : cinema().movies) {
+        indexMovieTitle(m);
+    }
+}
+
+// Rank titles against `query`: titles starting with the query come first
+// (shorter titles before longer ones), then trigram similarity
+// (Dice coefficient), which tolerates typos such as "Intersteller".
+vector<TitleMatch> searchMovieTitles(const string& query, size_t limit) {
+    Cinema& site = cinema();
+    vector<TitleMatch> result;
+    string normalized = normalizeTitle(query);
+    if (normalized.empty() || limit == 0) return result;
+
+    unordered_map<int, double> scores;
+
+    // Prefix matches from the sorted title set
+    for (auto it = site.movieTitleIndex.sortedTitles.lower_bound(make_pair(normalized, numeric_limits<int>::min()));
+         it != site.movieTitleIndex.sortedTitles.end() && it->first.compare(0, normalized.size(), normalized) == 0;
+         ++it) {
+        scores[it->second] = 2.0 - static_cast<double>(it->first.size()) / 1e4;
+        if (scores.size() >= limit) break;
+    }
+
+    // Trigram overlap. Skip the most common trigrams (e.g. " th") when the
+    // query has enough rarer ones; they say little and cost the most.
+    vector<unsigned int> grams = titleTrigrams(normalized);
+    vector<pair<size_t, const vector<int>*>> lists;
+    for (unsigned int g : grams) {
+        auto it = site.movieTitleIndex.postings.find(g);
+        if (it != site.movieTitleIndex.postings.end()) lists.push_back({ it->second.size(), &it->second });
+    }
+    sort(lists.begin(), lists.end());
+    size_t useLists = lists.size();
+    size_t commonLimit = max<size_t>(1000, site.movieTitleIndex.slotByMovieId.size() / 20);
+    while (useLists > 3 && lists[useLists - 1].first > commonLimit) --useLists;
+
+    // Per-thread scratch counters indexed by slot; only touched slots are reset
+    thread_local vector<unsigned short> shared;
+    thread_local vector<int> touched;
+    if (shared.size() < site.movieTitleIndex.slotMovieId.size()) shared.resize(site.movieTitleIndex.slotMovieId.size(), 0);
+    touched.clear();
+    for (size_t i = 0; i < useLists; ++i) {
+        for (int slot : *lists[i].second) {
+            if (shared[slot]++ == 0) touched.push_back(slot);
         }
     }
-    return -1;
+    const double minScore = 0.3;
+    for (int slot : touched) {
+        double dice = 2.0 * shared[slot] / (grams.size() + site.movieTitleIndex.slotTrigramCount[slot]);
+        shared[slot] = 0;
+        if (dice < minScore) continue;
+        double& score = scores[site.movieTitleIndex.slotMovieId[slot]];
+        score = max(score, dice);
+    }
+
+    for (const auto& entry : scores) {
+        result.push_back({ entry.first, entry.second });
+    }
+    size_t n = min(limit, result.size());
+    partial_sort(result.begin(), result.begin() + n, result.end(), [](const TitleMatch& a, const TitleMatch& b) {
+        return a.score != b.score ? a.score > b.score : a.movieId < b.movieId;
+    });
+    result.resize(n);
+    return result;
+}
+
+void searchMoviesMenu() {
+    cout << "\n--- Search Movies ---" << endl;
+
+    if (cinema().movies.empty()) {
+        cout << "No movies found." << endl;
+        return;
+    }
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    string query;
+    cout << "Enter part of a title: ";
+    getline(console, query);
+
+    vector<TitleMatch> matches = searchMovieTitles(query, 20);
+    if (matches.empty()) {
+        cout << "No matching movies found." << endl;
+        return;
+    }
+    for (const auto& match : matches) {
+        const Movie& m = cinema().movies[findMovieIndexById(match.movieId)];
+        cout << "ID: " << m.id
+             << " | Title: " << m.title
+             << " | Rating: " << m.rating
+             << " | Duration: " << m.duration << " minutes" << endl;
+    }
+}
+
+// ===== Hall management function implementations =====
+
+int findHallIndexById(int id) {
+    Cinema& site = cinema();
+    auto it = lower_bound(site.halls.begin(), site.halls.end(), id,
+                          [](const Hall& h, int key) { return h.id < key; });
+    return (it != site.halls.end() && it->id == id) ? static_cast<int>(it - site.halls.begin()) : -1;
 }
 
 void addHall() {
     Hall h;
-    h.id = nextHallId++;
+    h.id = cinema().nextHallId++;
 
     cout << "\n--- Add New Hall ---" << endl;
 
     // Clear leftover '\n' from previous cin >>
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    console.ignore(numeric_limits<streamsize>::max(), '\n');
 
     cout << "Enter hall name (e.g. Hall 1, IMAX): ";
-    getline(cin, h.name);
+    getline(console, h.name);
 
     cout << "Enter floor number: ";
-    while (!(cin >> h.floor)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> h.floor)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter an integer for floor: ";
     }
 
     cout << "Enter number of seat rows: ";
-    while (!(cin >> h.rows) || h.rows <= 0) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> h.rows) || h.rows <= 0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a positive integer for rows: ";
     }
 
     cout << "Enter number of seat columns: ";
-    while (!(cin >> h.cols) || h.cols <= 0) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> h.cols) || h.cols <= 0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a positive integer for columns: ";
     }
 
-    halls.push_back(h);
+    h.layout = defaultHallLayout(h.rows, h.cols);
+    cinema().halls.push_back(h);
+    cinema().hallIdsByFloor[h.floor].insert(h.id);
     cout << "Hall added successfully! [ID = " << h.id
          << ", total seats = " << h.rows * h.cols << "]" << endl;
+    cinema().dirtyFiles |= DIRTY_HALLS;
     saveDataToFiles();
 }
 
-void listAllHalls() {
+void listAllHalls(bool paged) {
     cout << "\n--- All Halls ---" << endl;
 
-    if (halls.empty()) {
+    if (cinema().halls.empty()) {
         cout << "No halls found." << endl;
         return;
     }
 
-    for (const auto& h : halls) {
-        cout << "ID: " << h.id
-             << " | Name: " << h.name
-             << " | Floor: " << h.floor
-             << " | Rows: " << h.rows
-             << " | Cols: " << h.cols
-             << " | Total seats: " << h.rows * h.cols
-             << endl;
-    }
+    printHallPages(ANY_FLOOR, paged);
 }
 
 void deleteHall() {
+    Cinema& site = cinema();
     cout << "\n--- Delete Hall ---" << endl;
 
-    if (halls.empty()) {
+    if (site.halls.empty()) {
         cout << "No halls to delete." << endl;
         return;
     }
 
     int id;
     cout << "Enter hall ID to delete: ";
-    while (!(cin >> id)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a valid hall ID: ";
     }
 
@@ -618,143 +2061,134 @@ void deleteHall() {
         cout << "Please delete those showtimes first." << endl;
         return;
     }
-    cout << "Hall \"" << halls[idx].name << "\" deleted." << endl;
-    halls.erase(halls.begin() + idx);
+    cout << "Hall \"" << site.halls[idx].name << "\" deleted." << endl;
+    site.hallPricingRules.erase(id);
+    invalidatePricing(id);
+    site.hallIdsByFloor[site.halls[idx].floor].erase(id);
+    site.halls.erase(site.halls.begin() + idx);
+    site.dirtyFiles |= DIRTY_HALLS | DIRTY_LAYOUTS | DIRTY_PRICING;
     saveDataToFiles();
 }
 
 // ===== Showtime management function implementations =====
 
 int findShowtimeIndexById(int id) {
-    for (size_t i = 0; i < showtimes.size(); ++i) {
-        if (showtimes[i].id == id) {
-            return static_cast<int>(i);
-        }
-    }
-    return -1;
+    auto it = cinema().showtimeCols.indexById.find(id);
+    return (it != cinema().showtimeCols.indexById.end()) ? it->second : -1;
 }
 
 void addShowtime() {
+    Cinema& site = cinema();
     cout << "\n--- Add New Showtime ---" << endl;
 
-    if (movies.empty()) {
+    if (site.movies.empty()) {
         cout << "No movies available. Please add movies first." << endl;
         return;
     }
-    if (halls.empty()) {
+    if (site.halls.empty()) {
         cout << "No halls available. Please add halls first." << endl;
         return;
     }
 
     // List movies and halls for the admin to choose from
     cout << "\nAvailable Movies:" << endl;
-    listAllMovies();
+    listAllMovies(false);
 
     int movieId;
     cout << "\nEnter movie ID for this showtime: ";
-    while (!(cin >> movieId) || findMovieIndexById(movieId) == -1) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> movieId) || findMovieIndexById(movieId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid movie ID. Please enter a valid movie ID: ";
     }
 
     cout << "\nAvailable Halls:" << endl;
-    listAllHalls();
+    listAllHalls(false);
 
     int hallId;
     cout << "\nEnter hall ID for this showtime: ";
-    while (!(cin >> hallId) || findHallIndexById(hallId) == -1) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> hallId) || findHallIndexById(hallId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid hall ID. Please enter a valid hall ID: ";
     }
 
     Showtime s;
-    s.id = nextShowtimeId++;
+    s.id = site.nextShowtimeId++;
     s.movieId = movieId;
     s.hallId = hallId;
 
     // Initialize seat map based on the hall's rows and cols
     int hIdx = findHallIndexById(hallId);
-    Hall& hall = halls[hIdx]; // hIdx is valid because hallId has been validated
-    s.rows = hall.rows;
-    s.cols = hall.cols;
-    s.seats.assign(s.rows, vector<int>(s.cols, 0)); // Set all seats to 0 (available)
+    Hall& hall = site.halls[hIdx]; // hIdx is valid because hallId has been validated
+    initShowtimeSeats(s, hall.layout); // All seats available
 
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
 
     cout << "Enter date and time (e.g. 2025-01-01 19:30): ";
-    getline(cin, s.datetime);
+    getline(console, s.datetime);
 
     cout << "Enter ticket price: ";
-    while (!(cin >> s.price) || s.price <= 0.0) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> s.price) || s.price <= 0.0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid price. Please enter a positive number: ";
     }
 
-    showtimes.push_back(s);
+    site.showtimes.push_back(s);
+    appendShowtimeColumns(site.showtimeCols, s);
+    addToDayPartition(s.id, site.showtimeCols.startMinute.back());
     cout << "Showtime added successfully! [ID = " << s.id << "]" << endl;
+    site.dirtyFiles |= DIRTY_SHOWTIMES;
     saveDataToFiles();
 }
 
-void listAllShowtimes() {
+void listAllShowtimes(bool paged) {
     cout << "\n--- All Showtimes ---" << endl;
 
-    if (showtimes.empty()) {
+    if (cinema().showtimes.empty()) {
         cout << "No showtimes found." << endl;
         return;
     }
 
-    for (const auto& s : showtimes) {
-        int mIdx = findMovieIndexById(s.movieId);
-        int hIdx = findHallIndexById(s.hallId);
-
-        string movieTitle = (mIdx != -1) ? movies[mIdx].title : "(unknown movie)";
-        string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
-
-        cout << "ID: " << s.id
-             << " | Movie: " << movieTitle << " (ID " << s.movieId << ")"
-             << " | Hall: " << hallName << " (ID " << s.hallId << ")"
-             << " | Time: " << s.datetime
-             << " | Price: " << s.price
-             << endl;
-    }
+    printShowtimePages(ShowtimeFilter(), false, paged);
 }
 
 void listShowtimesForMovie() {
+    Cinema& site = cinema();
     cout << "\n--- Showtimes for a Movie ---" << endl;
 
-    if (movies.empty()) {
+    if (site.movies.empty()) {
         cout << "No movies available." << endl;
         return;
     }
-    if (showtimes.empty()) {
+    if (site.showtimes.empty()) {
         cout << "No showtimes available." << endl;
         return;
     }
 
     cout << "Available Movies:" << endl;
-    listAllMovies();
+    listAllMovies(false);
 
     int movieId;
     cout << "\nEnter movie ID to view its showtimes: ";
-    while (!(cin >> movieId) || findMovieIndexById(movieId) == -1) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> movieId) || findMovieIndexById(movieId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid movie ID. Please enter a valid movie ID: ";
     }
 
     bool found = false;
-    for (const auto& s : showtimes) {
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        const Showtime& s = site.showtimes[i];
         if (s.movieId == movieId) {
             int hIdx = findHallIndexById(s.hallId);
-            string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
+            string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
 
             cout << "Showtime ID: " << s.id
                  << " | Hall: " << hallName << " (ID " << s.hallId << ")"
                  << " | Time: " << s.datetime
-                 << " | Price: " << s.price
+                 << " | Price: " << quotedPriceRange(static_cast<int>(i))
                  << endl;
             found = true;
         }
@@ -766,21 +2200,22 @@ void listShowtimesForMovie() {
 }
 
 void deleteShowtime() {
+    Cinema& site = cinema();
     cout << "\n--- Delete Showtime ---" << endl;
 
-    if (showtimes.empty()) {
+    if (site.showtimes.empty()) {
         cout << "No showtimes to delete." << endl;
         return;
     }
 
     // List all showtimes to help selection
-    listAllShowtimes();
+    listAllShowtimes(false);
 
     int id;
     cout << "\nEnter showtime ID to delete: ";
-    while (!(cin >> id)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
         cout << "Invalid input. Please enter a valid showtime ID: ";
     }
 
@@ -790,572 +2225,9556 @@ void deleteShowtime() {
         return;
     }
 
-    cout << "Showtime ID " << showtimes[idx].id << " deleted." << endl;
-    showtimes.erase(showtimes.begin() + idx);
+    cout << "Showtime ID " << site.showtimes[idx].id << " deleted." << endl;
+    removeFromDayPartition(site.showtimes[idx].id, site.showtimeCols.startMinute[idx]);
+    site.quoteCache.erase(site.showtimes[idx].id);
+    forgetSeatMap(site.showtimes[idx].id);
+    dropWaitlist(site.showtimes[idx].id);
+    removeAdmissionGate(site.showtimes[idx].id);
+    site.showtimes.erase(site.showtimes.begin() + idx);
+    eraseShowtimeColumns(site.showtimeCols, idx);
+    site.dirtyFiles |= DIRTY_SHOWTIMES;
     saveDataToFiles();
 }
 
-void displaySeatMap(const Showtime& s) {
-    cout << "\n--- Seat Map ---" << endl;
-    cout << "O = available, X = sold" << endl;
+void displaySeatMap(const Showtime& s, ostream& out) {
+    out << "\n--- Seat Map ---" << endl;
+    out << "O = available, A = accessible, X = sold, H = held, blank = no seat" << endl;
 
     // Column header
-    cout << "     ";
+    out << "     ";
     for (int c = 0; c < s.cols; ++c) {
-        cout << (c + 1) << " ";
+        out << (c + 1) << " ";
     }
-    cout << endl;
+    out << endl;
 
     for (int r = 0; r < s.rows; ++r) {
-        cout << "Row " << (r + 1);
+        out << "Row " << (r + 1);
         if (s.rows >= 10 && r + 1 < 10) {
-            cout << " "; // Minor alignment for single-digit rows
+            out << " "; // Minor alignment for single-digit rows
         }
-        cout << "  ";
+        out << "  ";
 
         for (int c = 0; c < s.cols; ++c) {
-            char ch = (s.seats[r][c] == 0) ? 'O' : 'X';
-            cout << ch << " ";
+            char ch;
+            if (!isSeatSellable(s, r, c)) {
+                ch = ' ';
+            } else if (isSeatSold(s, r, c)) {
+                ch = 'X';
+            } else if (isSeatHeld(s, r, c)) {
+                ch = 'H';
+            } else {
+                ch = (s.layout->seatType[r * s.cols + c] == SEAT_ACCESSIBLE) ? 'A' : 'O';
+            }
+            out << ch << " ";
         }
-        cout << endl;
+        out << endl;
     }
 }
 
-void startTicketPurchase() {
-    cout << "\n=== Ticket Purchase ===" << endl;
+// ===== Seat kernel implementations =====
 
-    if (movies.empty()) {
-        cout << "No movies available. Please ask staff to add movies first." << endl;
-        return;
-    }
-    if (halls.empty()) {
-        cout << "No halls available. Please ask staff to add halls first." << endl;
-        return;
-    }
-    if (showtimes.empty()) {
-        cout << "No showtimes available at the moment." << endl;
-        return;
+// Branch-free popcount. Unlike __builtin_popcountll it does not turn
+// into a library call without -mpopcnt, and the compiler can vectorize
+// it over the words of a seat map.
+static inline unsigned long long popcountWord(unsigned long long x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+// Set bits of a seat bitmap
+static int countSeatBits(const unsigned long long* bits, size_t words) {
+    unsigned long long count = 0;
+    for (size_t w = 0; w < words; ++w) {
+        count += popcountWord(bits[w]);
     }
+    return static_cast<int>(count);
+}
 
-    // 1) Select a movie
-    cout << "\nAvailable Movies:" << endl;
-    listAllMovies();
+// Bits of row r (at most 64 columns) as the low bits of one word
+static inline unsigned long long seatRowBits(const unsigned long long* bits, int r, int c) {
+    int offset = r * c;
+    int shift = offset % 64;
+    unsigned long long v = bits[offset / 64] >> shift;
+    if (shift + c > 64) v |= bits[offset / 64 + 1] << (64 - shift);
+    return (c == 64) ? v : v & ((1ULL << c) - 1);
+}
 
-    int movieId;
-    cout << "\nEnter movie ID to purchase: ";
-    while (!(cin >> movieId) || findMovieIndexById(movieId) == -1) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cout << "Invalid movie ID. Please enter a valid movie ID: ";
+// Seat-by-seat search for halls wider than one word
+static bool findSeatRunScalar(const Showtime& s, int count, int& bestRow, int& bestStart) {
+    double targetRow = (s.rows - 1) * 0.6;
+    double targetCol = (s.cols - 1) / 2.0;
+    double bestScore = 1e18;
+    bestRow = -1;
+    for (int r = 0; r < s.rows; ++r) {
+        int run = 0;
+        for (int c = 0; c < s.cols; ++c) {
+            run = isSeatAvailable(s, r, c) ? run + 1 : 0;
+            if (run >= count) {
+                int start = c - count + 1;
+                double score = 2.0 * fabs(r - targetRow) + fabs(start + (count - 1) / 2.0 - targetCol);
+                if (score < bestScore) {
+                    bestScore = score;
+                    bestRow = r;
+                    bestStart = start;
+                }
+            }
+        }
     }
+    return bestRow != -1;
+}
 
-    // 2) Show showtimes for the selected movie
-    cout << "\nAvailable showtimes for this movie:" << endl;
-    bool hasShowtime = false;
-    for (const auto& s : showtimes) {
-        if (s.movieId == movieId) {
-            int hIdx = findHallIndexById(s.hallId);
-            string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
-
-            cout << "Showtime ID: " << s.id
-                 << " | Hall: " << hallName
-                 << " | Time: " << s.datetime
-                 << " | Price: " << s.price
-                 << endl;
-            hasShowtime = true;
+// Free run of `count` seats in one row closest to the sweet spot, 0-based.
+// A row's free seats as one word; bit c of `starts` is set when seats
+// c .. c + count - 1 are all free. The score of a start grows with its
+// distance from the centre, so only the nearest start on each side of
+// it can win, and rows whose distance alone is no better are skipped.
+// Ties resolve like the seat-by-seat search: lowest row, then column.
+static bool findSeatRun(const Showtime& s, int count, int& bestRow, int& bestStart) {
+    const int rows = s.rows;
+    const int cols = s.cols;
+    bestRow = -1;
+    if (cols > 64) return findSeatRunScalar(s, count, bestRow, bestStart);
+    if (count <= 0 || count > cols) return false;
+
+    const unsigned long long* sellable = s.layout->sellable.data();
+    const unsigned long long* sold = s.soldBits.data();
+    const unsigned long long* held = s.heldBits.data();
+    double targetRow = (rows - 1) * 0.6;
+    double targetCol = (cols - 1) / 2.0;
+    double centre = targetCol - (count - 1) / 2.0; // Ideal start column
+    int split = static_cast<int>(floor(centre));   // Last column on the left side
+    unsigned long long leftMask = (split < 0) ? 0 : (split >= 63) ? ~0ULL : (2ULL << split) - 1;
+    double bestScore = 1e18;
+    for (int r = 0; r < rows; ++r) {
+        double rowScore = 2.0 * fabs(r - targetRow);
+        if (rowScore >= bestScore) continue;
+        unsigned long long starts = seatRowBits(sellable, r, cols) & ~seatRowBits(sold, r, cols)
+                                    & ~seatRowBits(held, r, cols);
+        int len = 1;
+        while (starts && len * 2 <= count) {
+            starts &= starts >> len;
+            len *= 2;
+        }
+        if (len < count) starts &= starts >> (count - len);
+        if (!starts) continue;
+
+        unsigned long long left = starts & leftMask;
+        unsigned long long right = starts & ~leftMask;
+        int candidates[2];
+        int n = 0;
+        if (left) candidates[n++] = 63 - __builtin_clzll(left);
+        if (right) candidates[n++] = __builtin_ctzll(right);
+        for (int i = 0; i < n; ++i) {
+            int start = candidates[i];
+            double score = rowScore + fabs(start + (count - 1) / 2.0 - targetCol);
+            if (score < bestScore) {
+                bestScore = score;
+                bestRow = r;
+                bestStart = start;
+            }
         }
     }
+    return bestRow != -1;
+}
 
-    if (!hasShowtime) {
-        cout << "No showtimes for this movie. Please choose another movie." << endl;
-        return;
+// ===== Seat layout implementations =====
+
+shared_ptr<const HallLayout> makeHallLayout(int rows, int cols, const vector<unsigned char>& seatType) {
+    auto layout = make_shared<HallLayout>();
+    layout->rows = rows;
+    layout->cols = cols;
+    layout->seatType = seatType;
+    layout->sellable.assign((static_cast<size_t>(rows) * cols + 63) / 64, 0);
+    layout->sellableCount = 0;
+    for (int i = 0; i < rows * cols; ++i) {
+        if (seatType[i] != SEAT_BLOCKED) {
+            layout->sellable[i / 64] |= 1ULL << (i % 64);
+            ++layout->sellableCount;
+        }
     }
+    return layout;
+}
 
-    int showtimeId;
-    cout << "\nEnter showtime ID to purchase: ";
-    while (true) {
-        if (!(cin >> showtimeId)) {
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            cout << "Invalid input. Please enter a valid showtime ID: ";
-            continue;
-        }
-        int idx = findShowtimeIndexById(showtimeId);
-        if (idx == -1 || showtimes[idx].movieId != movieId) {
-            cout << "Showtime ID not valid for the selected movie. Please try again: ";
-            continue;
-        }
-        break;
+// Layout without blocked or accessible seats; one instance per size.
+// Shared by all sites, hence the lock.
+shared_ptr<const HallLayout> defaultHallLayout(int rows, int cols) {
+    static map<pair<int, int>, shared_ptr<const HallLayout>> cache;
+    static mutex cacheMutex;
+    lock_guard<mutex> lock(cacheMutex);
+    auto& layout = cache[{ rows, cols }];
+    if (!layout) {
+        layout = makeHallLayout(rows, cols, vector<unsigned char>(static_cast<size_t>(rows) * cols, SEAT_NORMAL));
     }
+    return layout;
+}
 
-    int sIdx = findShowtimeIndexById(showtimeId);
-    Showtime& s = showtimes[sIdx];
+void initShowtimeSeats(Showtime& s, const shared_ptr<const HallLayout>& layout) {
+    s.layout = layout;
+    s.rows = layout->rows;
+    s.cols = layout->cols;
+    s.soldBits.assign(layout->sellable.size(), 0);
+    s.heldBits.assign(layout->sellable.size(), 0);
+    s.seatsLoaded = true;
+    s.seatsDirty = true;
+}
 
-    int mIdx = findMovieIndexById(s.movieId);
-    int hIdx = findHallIndexById(s.hallId);
+// Seat coordinates below are 0-based.
+bool isSeatSellable(const Showtime& s, int r, int c) {
+    int i = r * s.cols + c;
+    return (s.layout->sellable[i / 64] >> (i % 64)) & 1;
+}
 
-    string movieTitle = (mIdx != -1) ? movies[mIdx].title : "(unknown movie)";
-    string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
+bool isSeatSold(const Showtime& s, int r, int c) {
+    int i = r * s.cols + c;
+    return (s.soldBits[i / 64] >> (i % 64)) & 1;
+}
 
-    cout << "\nYou selected:" << endl;
-    cout << "Movie: " << movieTitle << endl;
-    cout << "Hall: " << hallName << endl;
-    cout << "Time: " << s.datetime << endl;
-    cout << "Price (per ticket): " << s.price << endl;
+bool isSeatHeld(const Showtime& s, int r, int c) {
+    int i = r * s.cols + c;
+    return (s.heldBits[i / 64] >> (i % 64)) & 1;
+}
 
-    // 3) Check seat availability
-    int totalSeats = s.rows * s.cols;
-    int soldSeats = countSoldSeats(s);
-    int availableSeats = totalSeats - soldSeats;
+bool isSeatAvailable(const Showtime& s, int r, int c) {
+    int i = r * s.cols + c;
+    unsigned long long free = s.layout->sellable[i / 64] & ~s.soldBits[i / 64] & ~s.heldBits[i / 64];
+    return (free >> (i % 64)) & 1;
+}
 
-    if (availableSeats <= 0) {
-        cout << "Sorry, this showtime is sold out." << endl;
-        return;
+void setSeatSold(Showtime& s, int r, int c, bool sold) {
+    int i = r * s.cols + c;
+    if (sold) {
+        s.soldBits[i / 64] |= 1ULL << (i % 64);
+    } else {
+        s.soldBits[i / 64] &= ~(1ULL << (i % 64));
     }
+    s.seatsDirty = true;
+}
 
-    cout << "\nTotal seats: " << totalSeats
-         << " | Sold: " << soldSeats
-         << " | Available: " << availableSeats << endl;
-
-    // 4) Display seat map
-    displaySeatMap(s);
-
-    // 5) Ask how many tickets
-    int ticketCount;
-    cout << "\nHow many tickets do you want to buy? ";
-    while (!(cin >> ticketCount) || ticketCount <= 0 || ticketCount > availableSeats) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cout << "Invalid number. Please enter a number between 1 and "
-             << availableSeats << ": ";
+// Holds are not saved, so they do not make the seat map dirty
+void setSeatHeld(Showtime& s, int r, int c, bool held) {
+    int i = r * s.cols + c;
+    if (held) {
+        s.heldBits[i / 64] |= 1ULL << (i % 64);
+    } else {
+        s.heldBits[i / 64] &= ~(1ULL << (i % 64));
     }
+}
 
-    vector<pair<int, int>> selectedSeats;
-    selectedSeats.reserve(ticketCount);
-
-    // 6) Seat selection for each ticket
-    for (int t = 1; t <= ticketCount; ++t) {
-        cout << "\nSelect seat for ticket #" << t << endl;
-
-        int row, col;
-        while (true) {
-            cout << "Enter row number (1-" << s.rows << "): ";
-            if (!(cin >> row) || row < 1 || row > s.rows) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Invalid row. Please enter a number between 1 and "
-                     << s.rows << "." << endl;
-                continue;
-            }
-
-            cout << "Enter column number (1-" << s.cols << "): ";
-            if (!(cin >> col) || col < 1 || col > s.cols) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "Invalid column. Please enter a number between 1 and "
-                     << s.cols << "." << endl;
-                continue;
-            }
-
-            int rIdx = row - 1;
-            int cIdx = col - 1;
-
-            if (s.seats[rIdx][cIdx] == 1) {
-                cout << "This seat is already taken. Please choose another seat." << endl;
-                continue;
-            }
+int countHeldSeats(const Showtime& s) {
+    return countSeatBits(s.heldBits.data(), s.heldBits.size());
+}
 
-            // Check if this seat is duplicated in the current order
-            bool duplicate = false;
-            for (const auto& p : selectedSeats) {
-                if (p.first == row && p.second == col) {
-                    duplicate = true;
-                    break;
+// Load the seat grid of `s` from the snapshot on first use and mark it
+// as most recently used. Every path that reads or changes seats of an
+// existing showtime calls this first.
+void ensureSeatMap(Showtime& s) {
+    Cinema& site = cinema();
+    if (!s.seatsLoaded) {
+        s.soldBits.assign(s.layout->sellable.size(), 0);
+        s.heldBits.assign(s.layout->sellable.size(), 0);
+        // The writer may be replacing the snapshot; hold it in place
+        lock_guard<mutex> lock(site.snapshotMutex);
+        auto grid = site.seatGridIndex.find(s.id);
+        if (grid != site.seatGridIndex.end()) {
+            // Buffer just the grid, plus room for the newline ending it
+            TextReader fin(sitePath(SHOWTIME_FILE), static_cast<size_t>(grid->second.second) + 64);
+            fin.seekg(grid->second.first);
+            int blockedSold = 0; // Sold in the file where the hall has no seat
+            for (int r = 0; r < s.rows; ++r) {
+                for (int c = 0; c < s.cols; ++c) {
+                    int v;
+                    fin >> v;
+                    if (!fin || v == 0) continue;
+                    if (isSeatSellable(s, r, c)) {
+                        setSeatSold(s, r, c, true);
+                    } else {
+                        ++blockedSold;
+                    }
                 }
             }
-            if (duplicate) {
-                cout << "You already selected this seat in this order. Please choose another seat." << endl;
-                continue;
+            if (!fin) {
+                cout << "[Error] Failed to read the seat map of showtime " << s.id << "." << endl;
+            } else if (blockedSold > 0) {
+                cout << "[Warning] Showtime " << s.id << " has " << blockedSold
+                     << " sold seat(s) where its hall has no seat; they were ignored." << endl;
             }
-
-            // Seat is available: record it and mark as sold
-            s.seats[rIdx][cIdx] = 1;
-            selectedSeats.push_back({ row, col });
-            break;
         }
+        s.seatsLoaded = true;
+        s.seatsDirty = false;
+        countMetric(COUNTER_SEAT_MAP_LOADS);
+    }
 
-        // If you want to refresh the seat map after each selection,
-        // you can call displaySeatMap(s) here.
+    auto pos = site.seatMapLruPos.find(s.id);
+    if (pos != site.seatMapLruPos.end()) {
+        site.seatMapLru.splice(site.seatMapLru.begin(), site.seatMapLru, pos->second);
+    } else {
+        site.seatMapLru.push_front(s.id);
+        site.seatMapLruPos[s.id] = site.seatMapLru.begin();
     }
+    evictSeatMaps();
+}
 
-    // 7) Print ticket summary
-    saveDataToFiles();
-    cout << "\nTicket(s) booked successfully!" << endl;
-    cout << "----- Ticket Summary -----" << endl;
-    cout << "Movie : " << movieTitle << endl;
-    cout << "Hall  : " << hallName << endl;
-    cout << "Time  : " << s.datetime << endl;
-    cout << "Seats : ";
-
-    for (size_t i = 0; i < selectedSeats.size(); ++i) {
-        cout << "(Row " << selectedSeats[i].first
-             << ", Col " << selectedSeats[i].second << ")";
-        if (i + 1 < selectedSeats.size()) cout << ", ";
+// Drop least recently used seat maps beyond the site's limit. Maps with
+// unsaved changes or held seats stay until they are saved or released, and
+// saved maps stay until the writer has put them on disk.
+void evictSeatMaps() {
+    Cinema& site = cinema();
+    long long committed = site.committedSnapshotSeq.load(memory_order_acquire);
+    auto it = site.seatMapLru.end();
+    // The front map was just touched by the caller and always stays
+    while (site.seatMapLru.size() > site.maxResidentSeatMaps && prev(it) != site.seatMapLru.begin()) {
+        --it;
+        int idx = findShowtimeIndexById(*it);
+        if (idx != -1) {
+            Showtime& victim = site.showtimes[idx];
+            if (victim.seatsDirty || victim.savedSeq > committed || countHeldSeats(victim) > 0) continue;
+            victim.storedSold = countSoldSeats(victim);
+            vector<unsigned long long>().swap(victim.soldBits);
+            vector<unsigned long long>().swap(victim.heldBits);
+            victim.seatsLoaded = false;
+        }
+        site.seatMapLruPos.erase(*it);
+        it = site.seatMapLru.erase(it);
     }
-    cout << endl;
+}
 
-    double totalPrice = s.price * ticketCount;
-    cout << "Price per ticket : " << fixed << setprecision(2) << s.price << endl;
-    cout << "Total price      : " << fixed << setprecision(2) << totalPrice << endl;
-    cout << "-------------------------" << endl;
+void forgetSeatMap(int showtimeId) {
+    Cinema& site = cinema();
+    auto pos = site.seatMapLruPos.find(showtimeId);
+    if (pos == site.seatMapLruPos.end()) return;
+    site.seatMapLru.erase(pos->second);
+    site.seatMapLruPos.erase(pos);
 }
 
-int countSoldSeats(const Showtime& s) {
-    int count = 0;
+// Pick `count` available seats, preferring seats next to each other in
+// one row as close as possible to the sweet spot (center column, a bit
+// behind the middle row). Falls back to the best single seats when no
+// row has a long enough free run. Seats are returned 1-based.
+bool findBestSeats(const Showtime& s, int count, vector<pair<int, int>>& seats) {
+    double targetRow = (s.rows - 1) * 0.6;
+    double targetCol = (s.cols - 1) / 2.0;
+
+    int bestRow, bestStart;
+    seats.clear();
+    if (findSeatRun(s, count, bestRow, bestStart)) {
+        for (int k = 0; k < count; ++k) {
+            seats.push_back({ bestRow + 1, bestStart + k + 1 });
+        }
+        return true;
+    }
+
+    vector<pair<double, int>> candidates;
     for (int r = 0; r < s.rows; ++r) {
         for (int c = 0; c < s.cols; ++c) {
-            if (s.seats[r][c] == 1) {
-                ++count;
+            if (isSeatAvailable(s, r, c)) {
+                candidates.push_back({ 2.0 * fabs(r - targetRow) + fabs(c - targetCol), r * s.cols + c });
             }
         }
     }
-    return count;
+    if (static_cast<int>(candidates.size()) < count) return false;
+
+    partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+    for (int k = 0; k < count; ++k) {
+        seats.push_back({ candidates[k].second / s.cols + 1, candidates[k].second % s.cols + 1 });
+    }
+    return true;
 }
 
-void viewTicketStatusOfShowtime() {
-    cout << "\n--- Ticket Status of a Showtime ---" << endl;
+// Mark seats of a hall as blocked or accessible. Showtimes share the
+// layout immutably, so only halls without showtimes can be changed.
+void editHallLayout() {
+    cout << "\n--- Edit Hall Seat Layout ---" << endl;
 
-    if (showtimes.empty()) {
-        cout << "No showtimes available." << endl;
+    if (cinema().halls.empty()) {
+        cout << "No halls available." << endl;
         return;
     }
 
-    // List all showtimes for easier selection
-    listAllShowtimes();
+    listAllHalls(false);
 
-    int id;
-    cout << "\nEnter showtime ID to view its status: ";
-    while (!(cin >> id)) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cout << "Invalid input. Please enter a valid showtime ID: ";
+    int hallId;
+    cout << "\nEnter hall ID: ";
+    while (!(console >> hallId) || findHallIndexById(hallId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid hall ID. Please enter a valid hall ID: ";
     }
-
-    int idx = findShowtimeIndexById(id);
-    if (idx == -1) {
-        cout << "Showtime ID not found." << endl;
+    if (hasShowtimeForHall(hallId)) {
+        cout << "Cannot change the layout of this hall because it has existing showtimes." << endl;
+        cout << "Please delete those showtimes first." << endl;
         return;
     }
 
-    Showtime& s = showtimes[idx];
+    Hall& h = cinema().halls[findHallIndexById(hallId)];
+    vector<unsigned char> types = h.layout->seatType;
 
-    int mIdx = findMovieIndexById(s.movieId);
-    int hIdx = findHallIndexById(s.hallId);
+    cout << "Seat types: 0 = normal, 1 = blocked (aisle / no seat), 2 = accessible" << endl;
+    while (true) {
+        int row, col, type;
+        cout << "Enter row number (1-" << h.rows << ", 0 to finish): ";
+        if (!(console >> row) || row < 0 || row > h.rows) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid row." << endl;
+            continue;
+        }
+        if (row == 0) break;
 
-    string movieTitle = (mIdx != -1) ? movies[mIdx].title : "(unknown movie)";
-    string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
+        cout << "Enter column number (1-" << h.cols << "): ";
+        if (!(console >> col) || col < 1 || col > h.cols) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid column." << endl;
+            continue;
+        }
 
-    int sold = countSoldSeats(s);
-    int total = s.rows * s.cols;
-    int available = total - sold;
+        cout << "Enter seat type (0-2): ";
+        if (!(console >> type) || type < SEAT_NORMAL || type > SEAT_ACCESSIBLE) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid seat type." << endl;
+            continue;
+        }
+        types[(row - 1) * h.cols + (col - 1)] = static_cast<unsigned char>(type);
+    }
 
-    cout << "\nShowtime Info:" << endl;
-    cout << "Showtime ID: " << s.id << endl;
-    cout << "Movie      : " << movieTitle << endl;
-    cout << "Hall       : " << hallName << endl;
-    cout << "Time       : " << s.datetime << endl;
-    cout << "Price      : " << s.price << endl;
-    cout << "Sold       : " << sold << " / " << total << endl;
-    cout << "Available  : " << available << endl;
+    h.layout = makeHallLayout(h.rows, h.cols, types);
+    cout << "Layout updated. Sellable seats: " << h.layout->sellableCount << endl;
+    cinema().dirtyFiles |= DIRTY_LAYOUTS;
+    saveDataToFiles();
+}
 
-    // Display seat map
-    displaySeatMap(s);
+// ===== Admission control implementations =====
+
+long long admissionClockMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void viewTotalTicketsForMovie() {
-    cout << "\n--- Total Tickets for a Movie (All Showtimes) ---" << endl;
+// Refill the token bucket and let in customers from the front of the
+// line while there are tokens and free turns. Every customer let in is
+// sure of at least one of the `seatsFree` seats: seats promised to
+// ticket counts already entered are not offered again. Customers who
+// hold part of an order and wait for seats held by others would never
+// finish.
+static void callAdmittedCustomers(AdmissionGate& g, long long nowMs, int seatsFree) {
+    if (g.refilledAtMs >= 0 && nowMs > g.refilledAtMs) {
+        g.tokens = min<double>(g.policy.burst, g.tokens + (nowMs - g.refilledAtMs) * g.policy.ratePerSecond / 1000.0);
+    }
+    g.refilledAtMs = max(g.refilledAtMs, nowMs);
+    while (!g.waiting.empty() && g.tokens >= 1 && g.active < g.policy.maxActive
+           && g.deciding < seatsFree - g.promised) {
+        g.called.insert(g.waiting.front());
+        g.waiting.pop_front();
+        g.tokens -= 1;
+        ++g.active;
+        ++g.deciding;
+        ++g.admittedTotal;
+    }
+}
 
-    if (movies.empty()) {
-        cout << "No movies available." << endl;
-        return;
+// 1-based place in line, or 0 if the ticket is not waiting.
+static int queuePosition(const AdmissionGate& g, long long ticket) {
+    auto it = lower_bound(g.waiting.begin(), g.waiting.end(), ticket); // Tickets only grow
+    if (it == g.waiting.end() || *it != ticket) return 0;
+    return static_cast<int>(it - g.waiting.begin()) + 1;
+}
+
+// Queue the session at its showtime's gate. True if it was let in at once.
+static bool enterAdmission(PurchaseSession& ps, AdmissionGate& g, long long nowMs, int seatsFree) {
+    ps.queueTicket = cinema().nextAdmissionTicket++;
+    ps.queuedAtMs = nowMs;
+    if (ps.boxOffice) {
+        ++g.active; // The customer at the counter takes a turn but does not wait for one
+        ++g.deciding;
+    } else {
+        g.waiting.push_back(ps.queueTicket);
+        ++g.queuedTotal;
+        callAdmittedCustomers(g, nowMs, seatsFree);
+        if (!g.called.erase(ps.queueTicket)) {
+            g.longestQueue = max(g.longestQueue, g.waiting.size());
+            countMetric(COUNTER_ADMISSIONS_QUEUED);
+            return false;
+        }
     }
-    if (showtimes.empty()) {
-        cout << "No showtimes available." << endl;
-        return;
+    ps.admitted = true;
+    ps.admittedAtMs = nowMs;
+    return true;
+}
+
+// Seats an admitted session has entered are held for its turn, so no
+// other customer can take them before it books. Return them to sale.
+static void releaseSeatHolds(PurchaseSession& ps) {
+    if (!ps.admitted || ps.seats.empty()) return;
+    int idx = findShowtimeIndexById(ps.showtimeId);
+    if (idx == -1) return;
+    Showtime& s = cinema().showtimes[idx];
+    ensureSeatMap(s);
+    for (const auto& p : ps.seats) {
+        if (p.first <= s.rows && p.second <= s.cols) setSeatHeld(s, p.first - 1, p.second - 1, false);
     }
+}
 
-    cout << "Available Movies:" << endl;
-    listAllMovies();
+// Give up the session's place in line or its turn.
+static void leaveAdmission(PurchaseSession& ps) {
+    if (ps.queueTicket == 0) return;
+    releaseSeatHolds(ps);
+    auto gate = cinema().admissionGates.find(ps.showtimeId);
+    if (gate != cinema().admissionGates.end()) {
+        AdmissionGate& g = gate->second;
+        if (ps.admitted || g.called.erase(ps.queueTicket)) {
+            // A gate set up again meanwhile starts from zero
+            g.active = max(0, g.active - 1);
+            if (ps.ticketCount == 0) g.deciding = max(0, g.deciding - 1);
+            g.promised = max(0, g.promised - ps.promisedSeats);
+        } else {
+            auto it = lower_bound(g.waiting.begin(), g.waiting.end(), ps.queueTicket);
+            if (it != g.waiting.end() && *it == ps.queueTicket) g.waiting.erase(it);
+        }
+    }
+    ps.queueTicket = 0;
+    ps.admitted = false;
+    ps.promisedSeats = 0;
+}
 
-    int movieId;
-    cout << "\nEnter movie ID: ";
-    while (!(cin >> movieId) || findMovieIndexById(movieId) == -1) {
-        cin.clear();
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        cout << "Invalid movie ID. Please enter a valid movie ID: ";
+// Put a showtime behind a gate, or change the policy of its gate. The
+// line and the customers choosing seats stay as they are.
+void setAdmissionGate(int showtimeId, const AdmissionPolicy& policy) {
+    auto inserted = cinema().admissionGates.emplace(showtimeId, AdmissionGate());
+    AdmissionGate& g = inserted.first->second;
+    g.policy = policy;
+    if (inserted.second) g.tokens = policy.burst;
+    g.tokens = min<double>(g.tokens, policy.burst);
+}
+
+// Open the showtime to everyone. Customers in line are let in as their
+// sessions next run.
+void removeAdmissionGate(int showtimeId) {
+    cinema().admissionGates.erase(showtimeId);
+}
+
+void flashSaleAdmissionMenu() {
+    Cinema& site = cinema();
+    while (true) {
+        cout << "\n--- Flash Sale Admission ---" << endl;
+        if (site.admissionGates.empty()) {
+            cout << "No showtime has admission control. Every customer may choose seats at once." << endl;
+        }
+        vector<int> gated;
+        for (const auto& entry : site.admissionGates) gated.push_back(entry.first);
+        sort(gated.begin(), gated.end());
+        for (int id : gated) {
+            const AdmissionGate& g = site.admissionGates[id];
+            cout << "Showtime " << id
+                 << " | Rate: " << g.policy.ratePerSecond << "/s (burst " << g.policy.burst << ")"
+                 << " | Max choosing: " << g.policy.maxActive
+                 << " | Turn: " << g.policy.turnMinutes << " min" << endl;
+            cout << "    Choosing now: " << g.active
+                 << " | In line: " << g.waiting.size()
+                 << " | Longest line: " << g.longestQueue
+                 << " | Queued: " << g.queuedTotal
+                 << " | Turns expired: " << g.turnsExpired << endl;
+        }
+
+        int choice;
+        cout << "1. Set up admission for a showtime" << endl;
+        cout << "2. Remove admission from a showtime" << endl;
+        cout << "0. Back" << endl;
+        cout << "Please enter your choice: ";
+        if (!(console >> choice)) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input. Please enter a number option." << endl;
+            continue;
+        }
+        if (choice == 0) return;
+        if (choice != 1 && choice != 2) {
+            cout << "Invalid option. Please try again." << endl;
+            continue;
+        }
+
+        int showtimeId;
+        cout << "Enter showtime ID: ";
+        while (!(console >> showtimeId) || findShowtimeIndexById(showtimeId) == -1) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid showtime ID. Please enter a valid showtime ID: ";
+        }
+        if (choice == 2) {
+            if (site.admissionGates.count(showtimeId)) {
+                removeAdmissionGate(showtimeId);
+                cout << "Showtime " << showtimeId << " is open to every customer again." << endl;
+            } else {
+                cout << "Showtime " << showtimeId << " has no admission control." << endl;
+            }
+            continue;
+        }
+
+        AdmissionPolicy policy;
+        cout << "Customers let in per second: ";
+        while (!(console >> policy.ratePerSecond) || policy.ratePerSecond <= 0.0) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid rate. Please enter a positive number: ";
+        }
+        cout << "Customers let in at once (burst): ";
+        while (!(console >> policy.burst) || policy.burst <= 0) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid number. Please enter a positive number: ";
+        }
+        cout << "Customers choosing seats at the same time: ";
+        while (!(console >> policy.maxActive) || policy.maxActive <= 0) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid number. Please enter a positive number: ";
+        }
+        cout << "Minutes each customer has to book: ";
+        while (!(console >> policy.turnMinutes) || policy.turnMinutes <= 0) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid number. Please enter a positive number: ";
+        }
+        setAdmissionGate(showtimeId, policy);
+        cout << "Admission control set for showtime " << showtimeId << "." << endl;
     }
+}
 
-    int mIdx = findMovieIndexById(movieId);
-    string movieTitle = (mIdx != -1) ? movies[mIdx].title : "(unknown movie)";
+// ===== Purchase session implementations =====
 
-    int totalSold = 0;
-    double totalRevenue = 0.0;
-    bool hasShowtime = false;
+// The whole input as a number; unlike console >> nothing may follow it.
+static bool parseSessionNumber(const string& input, int& value) {
+    char* end = nullptr;
+    long v = strtol(input.c_str(), &end, 10);
+    if (end == input.c_str() || *end != '\0' || v < numeric_limits<int>::min() || v > numeric_limits<int>::max()) {
+        return false;
+    }
+    value = static_cast<int>(v);
+    return true;
+}
 
-    cout << "\nShowtimes for \"" << movieTitle << "\":" << endl;
+static bool isYesAnswer(const string& input) {
+    return !input.empty() && (input[0] == 'Y' || input[0] == 'y');
+}
 
-    for (const auto& s : showtimes) {
-        if (s.movieId == movieId) {
-            hasShowtime = true;
-            int sold = countSoldSeats(s);
-            int totalSeats = s.rows * s.cols;
-            double revenue = sold * s.price;
+static void finishPurchaseSession(PurchaseSession& ps, PurchaseOutcome outcome) {
+    leaveAdmission(ps);
+    ps.step = STEP_DONE;
+    ps.outcome = outcome;
+}
 
-            int hIdx = findHallIndexById(s.hallId);
-            string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
+static void showMoviePage(PurchaseSession& ps, ostream& out) {
+    Cinema& site = cinema();
+    IdPage page = pageMovies("", ps.moviePageAfterId, LIST_PAGE_SIZE);
+    if (page.ids.empty() && ps.moviePageAfterId == 0) out << "No movies found." << endl;
+    for (int id : page.ids) {
+        const Movie& m = site.movies[findMovieIndexById(id)];
+        out << "ID: " << m.id
+            << " | Title: " << m.title
+            << " | Rating: " << m.rating
+            << " | Duration: " << m.duration << " minutes" << endl;
+    }
+    ps.moviePageAfterId = page.nextAfterId;
+    if (page.hasMore) {
+        out << "More results. Show the next page? (Y/N): ";
+        ps.step = STEP_MOVIE_PAGE;
+    } else {
+        // Anything that is not a number is treated as a title search
+        out << "\nEnter movie ID to purchase (or part of a title to search): ";
+        ps.step = STEP_MOVIE;
+    }
+}
 
-            cout << "Showtime ID: " << s.id
-                 << " | Hall: " << hallName
-                 << " | Time: " << s.datetime
-                 << " | Sold: " << sold << " / " << totalSeats
-                 << " | Revenue: " << fixed << setprecision(2) << revenue
-                 << endl;
+static void showShowtimesOfMovie(PurchaseSession& ps, ostream& out) {
+    Cinema& site = cinema();
+    out << "\nAvailable showtimes for this movie:" << endl;
+    bool hasShowtime = false;
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        const Showtime& s = site.showtimes[i];
+        if (s.movieId == ps.movieId) {
+            int hIdx = findHallIndexById(s.hallId);
+            string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
 
-            totalSold += sold;
-            totalRevenue += revenue;
+            out << "Showtime ID: " << s.id
+                << " | Hall: " << hallName
+                << " | Time: " << s.datetime
+                << " | Price: " << quotedPriceRange(static_cast<int>(i))
+                << endl;
+            hasShowtime = true;
         }
     }
 
     if (!hasShowtime) {
-        cout << "No showtimes for this movie." << endl;
+        out << "No showtimes for this movie. Please choose another movie." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
         return;
     }
+    out << "\nEnter showtime ID to purchase: ";
+    ps.step = STEP_SHOWTIME;
+}
 
-    cout << "\nTotal tickets sold for \"" << movieTitle << "\": " << totalSold << endl;
-    cout << "Total revenue: " << fixed << setprecision(2) << totalRevenue << endl;
+// The session's showtime with its seat map loaded, or null (and the
+// session closed) if it was deleted or archived while the session waited.
+static Showtime* sessionShowtime(PurchaseSession& ps, ostream& out) {
+    int idx = findShowtimeIndexById(ps.showtimeId);
+    if (idx == -1) {
+        out << "Sorry, this showtime is no longer available." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
+        return nullptr;
+    }
+    Showtime& s = cinema().showtimes[idx];
+    ensureSeatMap(s);
+    return &s;
 }
 
-void viewOverallSalesOverview() {
-    cout << "\n--- Overall Ticket Sales Overview ---" << endl;
+static void promptSeatRow(const Showtime& s, ostream& out) {
+    out << "Enter row number (1-" << s.rows << "): ";
+}
 
-    if (showtimes.empty()) {
-        cout << "No showtimes available." << endl;
+// Ask for the next seat, or book once every ticket has one.
+static void nextSeatOrBook(PurchaseSession& ps, const Showtime& s, ostream& out) {
+    if (static_cast<int>(ps.seats.size()) < ps.ticketCount) {
+        out << "\nSelect seat for ticket #" << ps.seats.size() + 1 << endl;
+        promptSeatRow(s, out);
+        ps.step = STEP_SEAT_ROW;
         return;
     }
 
-    int grandTotalSold = 0;
-    double grandTotalRevenue = 0.0;
+    long long orderId;
+    releaseSeatHolds(ps);
+    BookingStatus status = bookSeats(ps.showtimeId, ps.seats, ps.requestKey, orderId);
+    if (status != BOOKING_OK && status != BOOKING_REPLAYED) {
+        out << "Sorry, the booking could not be completed. Please try again." << endl;
+        finishPurchaseSession(ps, PURCHASE_NOT_BOOKED);
+        return;
+    }
+    out << "\nTicket(s) booked successfully!" << endl;
+    printOrderSummary(*findOrderById(orderId), out);
+    ps.orderId = orderId;
+    finishPurchaseSession(ps, PURCHASE_BOOKED);
+}
 
-    for (const auto& s : showtimes) {
-        int sold = countSoldSeats(s);
-        int totalSeats = s.rows * s.cols;
-        double revenue = sold * s.price;
+// Seats of the showtime at `idx` still for sale. Its seat map must be loaded.
+static int availableSeatsOf(int idx) {
+    Cinema& site = cinema();
+    return site.showtimeCols.capacity[idx] - site.showtimeCols.sold[idx] - countHeldSeats(site.showtimes[idx]);
+}
 
-        int mIdx = findMovieIndexById(s.movieId);
-        int hIdx = findHallIndexById(s.hallId);
+// Seats the session may ask for at the showtime at `idx`. Behind a gate,
+// seats promised to other customers' ticket counts are not offered, and
+// each other customer let in who has not chosen yet keeps one. Sales
+// outside the gate may have taken those; then one seat is still offered.
+static int seatsOnOffer(const PurchaseSession& ps, int idx) {
+    Cinema& site = cinema();
+    int available = availableSeatsOf(idx);
+    auto gate = ps.admitted ? site.admissionGates.find(ps.showtimeId) : site.admissionGates.end();
+    if (gate == site.admissionGates.end() || available <= 0) return available;
+    const AdmissionGate& g = gate->second;
+    return max(1, available - g.promised - max(0, g.deciding - 1));
+}
 
-        string movieTitle = (mIdx != -1) ? movies[mIdx].title : "(unknown movie)";
-        string hallName = (hIdx != -1) ? halls[hIdx].name : "(unknown hall)";
+// Show the chosen showtime and its seat map and ask for the ticket count.
+static void showSelectedShowtime(PurchaseSession& ps, ostream& out) {
+    Cinema& site = cinema();
+    Showtime* found = sessionShowtime(ps, out);
+    if (!found) return;
+    const Showtime& s = *found;
+    int idx = findShowtimeIndexById(ps.showtimeId);
 
-        cout << "Showtime ID: " << s.id
-             << " | Movie: " << movieTitle
-             << " | Hall: " << hallName
-             << " | Time: " << s.datetime
-             << " | Sold: " << sold << " / " << totalSeats
-             << " | Revenue: " << fixed << setprecision(2) << revenue
-             << endl;
+    int mIdx = findMovieIndexById(s.movieId);
+    int hIdx = findHallIndexById(s.hallId);
+    string movieTitle = (mIdx != -1) ? site.movies[mIdx].title : "(unknown movie)";
+    string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
+
+    out << "\nYou selected:" << endl;
+    out << "Movie: " << movieTitle << endl;
+    out << "Hall: " << hallName << endl;
+    out << "Time: " << s.datetime << endl;
+    out << "Price (per ticket): " << quotedPriceRange(idx) << endl;
 
-        grandTotalSold += sold;
-        grandTotalRevenue += revenue;
+    TraceSpan availabilityStep("compute_availability");
+    int totalSeats = site.showtimeCols.capacity[idx];
+    int soldSeats = site.showtimeCols.sold[idx];
+    int availableSeats = availableSeatsOf(idx);
+    availabilityStep.end();
+
+    if (availableSeats <= 0) {
+        out << "Sorry, this showtime is sold out." << endl;
+        finishPurchaseSession(ps, PURCHASE_SOLD_OUT);
+        return;
     }
 
-    cout << "\nGrand total tickets sold (all showtimes): " << grandTotalSold << endl;
-    cout << "Grand total revenue: " << fixed << setprecision(2) << grandTotalRevenue << endl;
+    out << "\nTotal seats: " << totalSeats
+        << " | Sold: " << soldSeats
+        << " | Available: " << availableSeats << endl;
+
+    displaySeatMap(s, out);
+    printZonePrices(idx, out);
+    out << "\nHow many tickets do you want to buy? ";
+    ps.step = STEP_TICKET_COUNT;
 }
 
-void loadDataFromFiles() {
-    // ----- Load movies -----
-    {
-        ifstream fin(MOVIE_FILE);
-        if (!fin) {
-            // No file yet -> start empty
-            // cout << "[Info] No movie file found. Starting with empty movies.\n";
-        } else {
-            int count;
-            if (!(fin >> count)) {
-                // cout << "[Warning] Failed to read movie count.\n";
-            } else {
-                fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip rest of line
-                movies.clear();
-                int maxId = 0;
+// Print the header and the first prompt. A site with nothing to sell
+// closes the session right away.
+void startPurchaseSession(PurchaseSession& ps, ostream& out) {
+    Cinema& site = cinema();
+    ps = PurchaseSession();
+    out << "\n=== Ticket Purchase ===" << endl;
+
+    if (site.movies.empty()) {
+        out << "No movies available. Please ask staff to add movies first." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
+    } else if (site.halls.empty()) {
+        out << "No halls available. Please ask staff to add halls first." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
+    } else if (site.showtimes.empty()) {
+        out << "No showtimes available at the moment." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
+    } else {
+        // An optional reference makes a retried purchase safe
+        out << "Enter a purchase reference to allow safe retries (leave empty to skip): ";
+    }
+}
 
-                for (int i = 0; i < count; ++i) {
-                    Movie m;
-                    fin >> m.id;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip end of line
+// True if the current step reads a whole line rather than one word.
+bool purchaseStepTakesLine(const PurchaseSession& ps) {
+    return ps.step == STEP_REFERENCE || ps.step == STEP_MOVIE;
+}
 
-                    getline(fin, m.title);
-                    getline(fin, m.rating);
+// Run one step of the session on `input`, given at `nowMs` on the
+// admission clock, and print what follows, ending with the next prompt.
+// Returns false if the input was not readable at all, where the console
+// drops the rest of the line.
+bool feedPurchaseSession(PurchaseSession& ps, const string& input, long long nowMs, ostream& out) {
+    Cinema& site = cinema();
+    switch (ps.step) {
+    case STEP_REFERENCE: {
+        if (!isValidBookingReference(input)) {
+            out << "Invalid reference. Please use printable characters only (leave empty to skip): ";
+            return true;
+        }
+        ps.requestKey = input;
+        if (!ps.requestKey.empty() && site.orderIdByKey.count(ps.requestKey)) {
+            out << "\nThis purchase was already completed. Original order:" << endl;
+            printOrderSummary(*findOrderById(site.orderIdByKey[ps.requestKey]), out);
+            finishPurchaseSession(ps, PURCHASE_REPLAYED);
+            return true;
+        }
+        TraceSpan step("validate_movie");
+        out << "\nAvailable Movies:" << endl;
+        out << "\n--- All Movies ---" << endl;
+        showMoviePage(ps, out);
+        return true;
+    }
 
-                    fin >> m.duration;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip end of line
+    case STEP_MOVIE_PAGE: {
+        TraceSpan step("validate_movie");
+        if (isYesAnswer(input)) {
+            showMoviePage(ps, out);
+        } else {
+            out << "\nEnter movie ID to purchase (or part of a title to search): ";
+            ps.step = STEP_MOVIE;
+        }
+        return true;
+    }
 
-                    movies.push_back(m);
-                    if (m.id > maxId) maxId = m.id;
-                }
-                nextMovieId = maxId + 1;
+    case STEP_MOVIE: {
+        TraceSpan step("validate_movie");
+        size_t first = input.find_first_not_of(" \t\r");
+        if (first == string::npos) {
+            out << "Enter movie ID to purchase (or part of a title to search): ";
+            return true;
+        }
+        string text = input.substr(first, input.find_last_not_of(" \t\r") - first + 1);
+
+        char* end = nullptr;
+        long id = strtol(text.c_str(), &end, 10);
+        if (*end == '\0') {
+            ps.movieId = static_cast<int>(id);
+            if (findMovieIndexById(ps.movieId) == -1) {
+                out << "Invalid movie ID. Please enter a valid movie ID: ";
+                return true;
             }
+            showShowtimesOfMovie(ps, out);
+            return true;
+        }
+
+        vector<TitleMatch> matches = searchMovieTitles(text, 10);
+        if (matches.empty()) {
+            out << "No matching titles. Please try again: ";
+            return true;
+        }
+        out << "Matching movies:" << endl;
+        for (const auto& match : matches) {
+            const Movie& m = site.movies[findMovieIndexById(match.movieId)];
+            out << "ID: " << m.id << " | Title: " << m.title
+                << " | Rating: " << m.rating << endl;
         }
+        out << "Enter movie ID to purchase (or part of a title to search): ";
+        return true;
     }
 
-    // ----- Load halls -----
-    {
-        ifstream fin(HALL_FILE);
-        if (!fin) {
-            // cout << "[Info] No hall file found. Starting with empty halls.\n";
-        } else {
-            int count;
+    case STEP_SHOWTIME: {
+        TraceSpan step("validate_showtime");
+        if (!parseSessionNumber(input, ps.showtimeId)) {
+            out << "Invalid input. Please enter a valid showtime ID: ";
+            return false;
+        }
+        int idx = findShowtimeIndexById(ps.showtimeId);
+        if (idx == -1 || site.showtimes[idx].movieId != ps.movieId) {
+            out << "Showtime ID not valid for the selected movie. Please try again: ";
+            return true;
+        }
+        ensureSeatMap(site.showtimes[idx]);
+        step.end();
+
+        auto gate = site.admissionGates.find(ps.showtimeId);
+        int seatsFree = availableSeatsOf(idx);
+        if (gate != site.admissionGates.end() && seatsFree > 0 && seatsFree <= gate->second.promised) {
+            out << "Sorry, this showtime is sold out." << endl;
+            finishPurchaseSession(ps, PURCHASE_SOLD_OUT);
+            return true;
+        }
+        if (gate != site.admissionGates.end() && seatsFree > 0 && !enterAdmission(ps, gate->second, nowMs, seatsFree)) {
+            ps.reportedPosition = queuePosition(gate->second, ps.queueTicket);
+            ps.reportedAtMs = nowMs;
+            out << "\nThis showtime is in high demand. You are number " << ps.reportedPosition
+                << " in line; " << seatsFree - gate->second.promised << " seats are still free." << endl;
+            out << "Please keep this session open; it continues when it is your turn." << endl;
+            ps.step = STEP_QUEUED;
+            return true;
+        }
+        showSelectedShowtime(ps, out);
+        return true;
+    }
+
+    case STEP_QUEUED: {
+        pumpPurchaseSession(ps, nowMs, out);
+        if (ps.step == STEP_QUEUED) {
+            out << "You are number " << ps.reportedPosition << " in line. Please wait." << endl;
+        }
+        return true;
+    }
+
+    case STEP_TICKET_COUNT: {
+        TraceSpan step("select_seats");
+        Showtime* s = sessionShowtime(ps, out);
+        if (!s) return true;
+        int availableSeats = seatsOnOffer(ps, findShowtimeIndexById(ps.showtimeId));
+        auto gate = ps.admitted ? site.admissionGates.find(ps.showtimeId) : site.admissionGates.end();
+        int count;
+        if (!parseSessionNumber(input, count) || count <= 0 || count > availableSeats) {
+            if (availableSeats <= 0) {
+                out << "Sorry, this showtime is sold out." << endl;
+                finishPurchaseSession(ps, PURCHASE_SOLD_OUT);
+                return true;
+            }
+            out << "Invalid number. Please enter a number between 1 and " << availableSeats << ": ";
+            return false;
+        }
+        ps.ticketCount = count;
+        if (gate != site.admissionGates.end()) {
+            gate->second.deciding = max(0, gate->second.deciding - 1);
+            gate->second.promised += count;
+            ps.promisedSeats = count;
+        }
+        ps.seats.clear();
+        ps.seats.reserve(ps.ticketCount);
+        out << "Choose the best available seats automatically? (Y/N): ";
+        ps.step = STEP_AUTO_SEATS;
+        return true;
+    }
+
+    case STEP_AUTO_SEATS: {
+        TraceSpan step("select_seats");
+        Showtime* s = sessionShowtime(ps, out);
+        if (!s) return true;
+        if (isYesAnswer(input) && findBestSeats(*s, ps.ticketCount, ps.seats)) {
+            out << "Selected seats: ";
+            for (size_t i = 0; i < ps.seats.size(); ++i) {
+                out << "(Row " << ps.seats[i].first << ", Col " << ps.seats[i].second << ")";
+                if (i + 1 < ps.seats.size()) out << ", ";
+            }
+            out << endl;
+        }
+        nextSeatOrBook(ps, *s, out);
+        return true;
+    }
+
+    case STEP_SEAT_ROW: {
+        TraceSpan step("select_seats");
+        Showtime* s = sessionShowtime(ps, out);
+        if (!s) return true;
+        if (!parseSessionNumber(input, ps.row) || ps.row < 1 || ps.row > s->rows) {
+            out << "Invalid row. Please enter a number between 1 and " << s->rows << "." << endl;
+            promptSeatRow(*s, out);
+            return false;
+        }
+        out << "Enter column number (1-" << s->cols << "): ";
+        ps.step = STEP_SEAT_COL;
+        return true;
+    }
+
+    case STEP_SEAT_COL: {
+        TraceSpan step("select_seats");
+        Showtime* s = sessionShowtime(ps, out);
+        if (!s) return true;
+        int col;
+        ps.step = STEP_SEAT_ROW; // Any problem asks for the whole seat again
+        if (!parseSessionNumber(input, col) || col < 1 || col > s->cols) {
+            out << "Invalid column. Please enter a number between 1 and " << s->cols << "." << endl;
+            promptSeatRow(*s, out);
+            return false;
+        }
+
+        int rIdx = ps.row - 1;
+        int cIdx = col - 1;
+        if (!isSeatSellable(*s, rIdx, cIdx)) {
+            out << "There is no seat at this position. Please choose another seat." << endl;
+        } else if (find(ps.seats.begin(), ps.seats.end(), make_pair(ps.row, col)) != ps.seats.end()) {
+            // Before the availability check: an admitted session holds its own picks
+            out << "You already selected this seat in this order. Please choose another seat." << endl;
+        } else if (!isSeatAvailable(*s, rIdx, cIdx)) {
+            out << "This seat is already taken. Please choose another seat." << endl;
+        } else {
+            // Seat is available: record it (sold when the order is booked)
+            ps.seats.push_back({ ps.row, col });
+            if (ps.admitted) {
+                setSeatHeld(*s, rIdx, cIdx, true);
+                auto gate = site.admissionGates.find(ps.showtimeId);
+                if (ps.promisedSeats > 0 && gate != site.admissionGates.end()) {
+                    gate->second.promised = max(0, gate->second.promised - 1); // Held now instead
+                    --ps.promisedSeats;
+                }
+            }
+            nextSeatOrBook(ps, *s, out);
+            return true;
+        }
+        promptSeatRow(*s, out);
+        return true;
+    }
+
+    case STEP_DONE:
+        break;
+    }
+    return true;
+}
+
+// Move a session on without input: let it in when its turn comes, tell it
+// its place in line, and end turns that ran out. Drivers call this for
+// every session purchaseSessionWaiting() reports, a few times a second.
+void pumpPurchaseSession(PurchaseSession& ps, long long nowMs, ostream& out) {
+    if (!purchaseSessionWaiting(ps)) return;
+    Cinema& site = cinema();
+    auto gate = site.admissionGates.find(ps.showtimeId);
+    if (ps.step != STEP_QUEUED) {
+        if (gate != site.admissionGates.end() && !ps.boxOffice
+            && nowMs - ps.admittedAtMs > gate->second.policy.turnMinutes * 60000LL) {
+            out << "\nYour turn to choose seats has ended. Please start again to get back in line." << endl;
+            ++gate->second.turnsExpired;
+            countMetric(COUNTER_ADMISSION_TURNS_EXPIRED);
+            finishPurchaseSession(ps, PURCHASE_CLOSED);
+        }
+        return;
+    }
+
+    int idx = findShowtimeIndexById(ps.showtimeId);
+    if (idx == -1) {
+        out << "\nSorry, this showtime is no longer available." << endl;
+        finishPurchaseSession(ps, PURCHASE_CLOSED);
+        return;
+    }
+    bool admitted = gate == site.admissionGates.end(); // The gate was removed
+    if (!admitted) {
+        AdmissionGate& g = gate->second;
+        Showtime& s = site.showtimes[idx];
+        ensureSeatMap(s);
+        int seatsFree = availableSeatsOf(idx);
+        callAdmittedCustomers(g, nowMs, seatsFree);
+        admitted = g.called.erase(ps.queueTicket) > 0;
+        if (!admitted) {
+            // Every seat left is held or promised to a customer choosing.
+            // They come back only if that customer leaves, and the line
+            // would wait until every turn ends to learn whether one did.
+            if (seatsFree <= g.promised) {
+                out << "\nSorry, this showtime sold out while you were waiting." << endl;
+                finishPurchaseSession(ps, PURCHASE_SOLD_OUT);
+                return;
+            }
+            int position = queuePosition(g, ps.queueTicket);
+            admitted = position == 0; // Queued at a gate that was since set up again
+            if (!admitted && position != ps.reportedPosition
+                && (position <= 10 || nowMs - ps.reportedAtMs >= 10000)) {
+                out << "You are now number " << position << " in line; " << seatsFree - g.promised
+                    << " seats are still free." << endl;
+                ps.reportedPosition = position;
+                ps.reportedAtMs = nowMs;
+            }
+        }
+    }
+    if (!admitted) return;
+
+    ps.admitted = true;
+    ps.admittedAtMs = nowMs;
+    recordLatency(OP_ADMISSION_WAIT, (nowMs - ps.queuedAtMs) * 1000000);
+    out << "\nIt is your turn!";
+    if (gate != site.admissionGates.end()) {
+        out << " You have " << gate->second.policy.turnMinutes << " minutes to choose your seats.";
+    }
+    out << endl;
+    showSelectedShowtime(ps, out);
+}
+
+// True while the session is queued or admitted at a gate, i.e. needs
+// pumpPurchaseSession() even when the customer types nothing.
+bool purchaseSessionWaiting(const PurchaseSession& ps) {
+    return ps.queueTicket != 0 && ps.step != STEP_DONE;
+}
+
+// The customer went away: give up the session's place in line or turn.
+void abandonPurchaseSession(PurchaseSession& ps) {
+    if (ps.step != STEP_DONE) finishPurchaseSession(ps, PURCHASE_CLOSED);
+}
+
+// Read the console input for the session's current step the way the
+// dialogue read it before it became a session: a whole line where it
+// takes lines, one character for a Y/N answer, and the leading number of
+// the next word for a number, leaving the rest of the word for the next
+// prompt. False at the end of input.
+static bool readConsoleStepInput(const PurchaseSession& ps, string& input) {
+    input.clear();
+    if (purchaseStepTakesLine(ps)) {
+        if (!getline(console, input)) return false;
+        if (!input.empty() && input.back() == '\r') input.pop_back();
+        return true;
+    }
+    if (ps.step == STEP_MOVIE_PAGE || ps.step == STEP_AUTO_SEATS) {
+        char answer;
+        if (!(console >> answer)) return false;
+        input.assign(1, answer);
+        return true;
+    }
+    if (ps.step == STEP_QUEUED) return static_cast<bool>(console >> input);
+    if (!console.skipWhitespace()) return false;
+    int value;
+    if (console >> value) {
+        input = to_string(value);
+    } else {
+        console.clear(); // Not a number: the step rejects the empty input
+    }
+    return true;
+}
+
+// The console's purchase dialogue: one session fed from the console.
+// OP_TICKET_PURCHASE records the time spent in the steps of the
+// purchase, not the time the customer takes to answer the prompts.
+void startTicketPurchase() {
+    PurchaseSession ps;
+    chrono::steady_clock::duration work{};
+    auto stepStart = chrono::steady_clock::now();
+    {
+        TraceSpan step("purchase_step"); // One span per step; waits for input are not traced
+        startPurchaseSession(ps, cout);
+    }
+    work += chrono::steady_clock::now() - stepStart;
+    ps.boxOffice = true;
+    if (ps.step != STEP_DONE) {
+        console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    }
+
+    while (ps.step != STEP_DONE) {
+        string input;
+        bool takesLine = purchaseStepTakesLine(ps);
+        if (!readConsoleStepInput(ps, input)) {
+            finishPurchaseSession(ps, PURCHASE_CLOSED); // End of input
+            break;
+        }
+        stepStart = chrono::steady_clock::now();
+        bool consumed;
+        {
+            TraceSpan step("purchase_step");
+            consumed = feedPurchaseSession(ps, input, admissionClockMs(), cout);
+        }
+        work += chrono::steady_clock::now() - stepStart;
+        if (!consumed && !takesLine) {
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+    }
+    recordLatency(OP_TICKET_PURCHASE,
+                  static_cast<unsigned long long>(chrono::duration_cast<chrono::nanoseconds>(work).count()));
+
+    if (ps.outcome == PURCHASE_SOLD_OUT) {
+        offerWaitlistMenu(ps.showtimeId);
+    }
+}
+
+// ===== Pricing implementations =====
+
+const PricingRules& pricingRulesForHall(int hallId) {
+    static const PricingRules defaults;
+    auto it = cinema().hallPricingRules.find(hallId);
+    return (it != cinema().hallPricingRules.end()) ? it->second : defaults;
+}
+
+// Zone of seat (r, c), 0-based, under `rules`
+SeatTier seatTierFromRules(const PricingRules& rules, int rows, int cols, int r, int c) {
+    if (r < rules.frontRows) {
+        return TIER_FRONT;
+    }
+    int blockRows = static_cast<int>(rows * rules.premiumShare + 0.5);
+    int blockCols = static_cast<int>(cols * rules.premiumShare + 0.5);
+    int firstRow = (rows - blockRows) / 2;
+    int firstCol = (cols - blockCols) / 2;
+    if (r >= firstRow && r < firstRow + blockRows && c >= firstCol && c < firstCol + blockCols) {
+        return TIER_PREMIUM;
+    }
+    return TIER_STANDARD;
+}
+
+static double tierMultiplier(const PricingRules& rules, int tier) {
+    if (tier == TIER_PREMIUM) return rules.premiumMultiplier;
+    if (tier == TIER_FRONT) return rules.frontMultiplier;
+    return 1.0;
+}
+
+static double timeOfDayMultiplier(const PricingRules& rules, long long startMinute) {
+    if (startMinute < 0) return 1.0;
+    int hour = static_cast<int>(startMinute % (24 * 60) / 60);
+    if (hour < rules.matineeEndHour) return rules.matineeMultiplier;
+    if (hour >= rules.eveningStartHour) return rules.eveningMultiplier;
+    return 1.0;
+}
+
+static double occupancyMultiplier(const PricingRules& rules, double occupancy) {
+    if (occupancy >= rules.peakOccupancy) return rules.peakMultiplier;
+    if (occupancy >= rules.surgeOccupancy) return rules.surgeMultiplier;
+    return 1.0;
+}
+
+// Seat tier table of a hall, compiled on first use.
+const CompiledPricing& compiledPricingForHall(int hallId, int rows, int cols) {
+    CompiledPricing& cp = cinema().compiledPricingByHall[hallId];
+    if (cp.rows != rows || cp.cols != cols) {
+        const PricingRules& rules = pricingRulesForHall(hallId);
+        cp.rows = rows;
+        cp.cols = cols;
+        cp.tier.assign(static_cast<size_t>(rows) * cols, TIER_STANDARD);
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                cp.tier[r * cols + c] = static_cast<unsigned char>(seatTierFromRules(rules, rows, cols, r, c));
+            }
+        }
+    }
+    return cp;
+}
+
+// Price of each tier for the showtime at index `sIdx` at its current
+// occupancy. Recomputed only when the occupancy crosses a 5% bucket.
+const long long* tierPricesForShowtime(int sIdx) {
+    Cinema& site = cinema();
+    int capacity = site.showtimeCols.capacity[sIdx];
+    int bucket = (capacity > 0) ? site.showtimeCols.sold[sIdx] * OCCUPANCY_BUCKETS / capacity : 0;
+
+    QuoteCacheEntry& entry = site.quoteCache[site.showtimeCols.id[sIdx]];
+    if (entry.bucket != bucket) {
+        const PricingRules& rules = pricingRulesForHall(site.showtimeCols.hallId[sIdx]);
+        double occupancy = static_cast<double>(bucket) / OCCUPANCY_BUCKETS;
+        double factor = timeOfDayMultiplier(rules, site.showtimeCols.startMinute[sIdx])
+                        * occupancyMultiplier(rules, occupancy);
+        for (int t = 0; t < TIER_COUNT; ++t) {
+            entry.tierPriceCents[t] = llround(site.showtimeCols.priceCents[sIdx] * tierMultiplier(rules, t) * factor);
+        }
+        entry.bucket = bucket;
+    }
+    return entry.tierPriceCents;
+}
+
+// Total price of `seats` (1-based) of the showtime at index `sIdx`;
+// optionally also each seat's price.
+long long quoteSeats(int sIdx, const vector<pair<int, int>>& seats, vector<long long>* seatPrices) {
+    const Showtime& s = cinema().showtimes[sIdx];
+    const CompiledPricing& cp = compiledPricingForHall(s.hallId, s.rows, s.cols);
+    const long long* prices = tierPricesForShowtime(sIdx);
+
+    long long total = 0;
+    if (seatPrices) seatPrices->resize(seats.size());
+    for (size_t i = 0; i < seats.size(); ++i) {
+        long long price = prices[cp.tier[(seats[i].first - 1) * cp.cols + (seats[i].second - 1)]];
+        total += price;
+        if (seatPrices) (*seatPrices)[i] = price;
+    }
+    return total;
+}
+
+// Drop compiled tables and cached quotes after a hall's rules changed.
+void invalidatePricing(int hallId) {
+    cinema().compiledPricingByHall.erase(hallId);
+    cinema().quoteCache.clear();
+}
+
+// Cheapest and dearest seat of the showtime at index `sIdx` as quoted
+// now, over the zones its hall has: "10.00" or "8.00 - 13.80".
+string quotedPriceRange(int sIdx) {
+    const Showtime& s = cinema().showtimes[sIdx];
+    const CompiledPricing& cp = compiledPricingForHall(s.hallId, s.rows, s.cols);
+    const long long* prices = tierPricesForShowtime(sIdx);
+    bool present[TIER_COUNT] = {};
+    for (unsigned char t : cp.tier) present[t] = true;
+    long long lowest = numeric_limits<long long>::max();
+    long long highest = numeric_limits<long long>::min();
+    for (int t = 0; t < TIER_COUNT; ++t) {
+        if (!present[t]) continue;
+        lowest = min(lowest, prices[t]);
+        highest = max(highest, prices[t]);
+    }
+    if (lowest > highest) lowest = highest = prices[TIER_STANDARD]; // Hall without seats
+
+    ostringstream text;
+    text << fixed << setprecision(2) << lowest / 100.0;
+    if (highest != lowest) text << " - " << highest / 100.0;
+    return text.str();
+}
+
+void printZonePrices(int sIdx, ostream& out) {
+    const Showtime& s = cinema().showtimes[sIdx];
+    const PricingRules& rules = pricingRulesForHall(s.hallId);
+    const long long* prices = tierPricesForShowtime(sIdx);
+
+    out << "\nCurrent ticket prices:" << endl;
+    string frontLabel = "Front (rows 1-" + to_string(min(rules.frontRows, s.rows)) + ")";
+    out << left << setw(19) << frontLabel << ": "
+        << fixed << setprecision(2) << prices[TIER_FRONT] / 100.0 << endl;
+    out << left << setw(19) << "Premium (center)" << ": "
+        << fixed << setprecision(2) << prices[TIER_PREMIUM] / 100.0 << endl;
+    out << left << setw(19) << "Standard" << ": "
+        << fixed << setprecision(2) << prices[TIER_STANDARD] / 100.0 << endl;
+}
+
+void editHallPricingRules() {
+    cout << "\n--- Edit Hall Pricing Rules ---" << endl;
+
+    if (cinema().halls.empty()) {
+        cout << "No halls available." << endl;
+        return;
+    }
+
+    listAllHalls(false);
+
+    int hallId;
+    cout << "\nEnter hall ID: ";
+    while (!(console >> hallId) || findHallIndexById(hallId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid hall ID. Please enter a valid hall ID: ";
+    }
+
+    PricingRules r = pricingRulesForHall(hallId);
+    auto askInt = [](const string& prompt, int& value, int lo, int hi) {
+        cout << prompt << " [" << value << "]: ";
+        int v;
+        while (!(console >> v) || v < lo || v > hi) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input. Please enter a number between " << lo << " and " << hi << ": ";
+        }
+        value = v;
+    };
+    auto askDouble = [](const string& prompt, double& value, double lo, double hi) {
+        cout << prompt << " [" << value << "]: ";
+        double v;
+        while (!(console >> v) || v < lo || v > hi) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid input. Please enter a number between " << lo << " and " << hi << ": ";
+        }
+        value = v;
+    };
+
+    cout << defaultfloat;
+    askInt("Number of front rows", r.frontRows, 0, 1000);
+    askDouble("Front row price multiplier", r.frontMultiplier, 0.1, 10.0);
+    askDouble("Premium center block share (0-1)", r.premiumShare, 0.0, 1.0);
+    askDouble("Premium price multiplier", r.premiumMultiplier, 0.1, 10.0);
+    askInt("Matinee ends at hour (0-24)", r.matineeEndHour, 0, 24);
+    askDouble("Matinee price multiplier", r.matineeMultiplier, 0.1, 10.0);
+    askInt("Evening starts at hour (0-24)", r.eveningStartHour, 0, 24);
+    askDouble("Evening price multiplier", r.eveningMultiplier, 0.1, 10.0);
+    askDouble("Surge occupancy (0-1)", r.surgeOccupancy, 0.0, 1.0);
+    askDouble("Surge price multiplier", r.surgeMultiplier, 0.1, 10.0);
+    // Peak is the higher step: it starts no earlier and costs no less than surge
+    r.peakOccupancy = max(r.peakOccupancy, r.surgeOccupancy);
+    r.peakMultiplier = max(r.peakMultiplier, r.surgeMultiplier);
+    askDouble("Peak occupancy (surge occupancy-1)", r.peakOccupancy, r.surgeOccupancy, 1.0);
+    askDouble("Peak price multiplier (at least the surge multiplier)", r.peakMultiplier, r.surgeMultiplier, 10.0);
+
+    cinema().hallPricingRules[hallId] = r;
+    invalidatePricing(hallId);
+    cout << "Pricing rules updated." << endl;
+    cinema().dirtyFiles |= DIRTY_PRICING;
+    saveDataToFiles();
+}
+
+// ===== Order function implementations =====
+
+// Order files written before per-seat prices list "count r c r c ..."
+// instead of "count r c price ...". True if the seat list after the
+// count (starting at `p`) is in that older form.
+bool seatListWithoutPrices(const char* p, const char* end, int seatCount) {
+    long long value;
+    int values = 0;
+    while (p != nullptr && (p = parseNextNumber(p, end, value)) != nullptr) ++values;
+    return seatCount > 0 && values == 2 * seatCount;
+}
+
+// Spread an order total without per-seat prices evenly over its seats
+void splitOrderTotal(Order& o) {
+    long long n = static_cast<long long>(o.seats.size());
+    for (long long k = 0; k < n; ++k) {
+        o.seatPriceCents[k] = o.totalCents / n + (k < o.totalCents % n ? 1 : 0);
+    }
+}
+
+Order* findOrderById(long long id) {
+    auto it = cinema().orderIndexById.find(id);
+    return (it != cinema().orderIndexById.end()) ? &cinema().orders[it->second] : nullptr;
+}
+
+// Store an order and index it by ID and idempotency key.
+void addOrder(const Order& o) {
+    Cinema& site = cinema();
+    site.orderIndexById[o.id] = site.orders.size();
+    if (!o.idempotencyKey.empty()) {
+        site.orderIdByKey[o.idempotencyKey] = o.id;
+    }
+    site.orders.push_back(o);
+}
+
+// Sell `seats` of a showtime as one order. All seats are sold or none.
+// With a non-empty idempotency key a repeated call returns the original
+// order in `orderId` instead of selling again.
+BookingStatus bookSeats(int showtimeId, const vector<pair<int, int>>& seats,
+                        const string& idempotencyKey, long long& orderId) {
+    TraceSpan span("book_seats");
+    BookingStatus status = placeOrder(showtimeId, seats, idempotencyKey,
+                                      static_cast<long long>(time(nullptr)), orderId);
+    if (status == BOOKING_OK) saveDataToFiles();
+    return status;
+}
+
+// bookSeats() without saving, for callers that save once for many orders.
+BookingStatus placeOrder(int showtimeId, const vector<pair<int, int>>& seats,
+                         const string& idempotencyKey, long long createdAt, long long& orderId) {
+    if (!idempotencyKey.empty()) {
+        auto it = cinema().orderIdByKey.find(idempotencyKey);
+        if (it != cinema().orderIdByKey.end()) {
+            orderId = it->second;
+            return BOOKING_REPLAYED;
+        }
+    }
+
+    int sIdx = findShowtimeIndexById(showtimeId);
+    if (sIdx == -1 || seats.empty()) {
+        return BOOKING_INVALID;
+    }
+    Showtime& s = cinema().showtimes[sIdx];
+    ensureSeatMap(s);
+
+    // Mark seats one by one and roll back on the first conflict; this
+    // also rejects a seat listed twice in the same request.
+    for (size_t i = 0; i < seats.size(); ++i) {
+        int r = seats[i].first - 1;
+        int c = seats[i].second - 1;
+        BookingStatus failure = BOOKING_OK;
+        if (r < 0 || r >= s.rows || c < 0 || c >= s.cols || !isSeatSellable(s, r, c)) {
+            failure = BOOKING_INVALID;
+        } else if (!isSeatAvailable(s, r, c)) {
+            failure = BOOKING_SEAT_TAKEN;
+        }
+        if (failure != BOOKING_OK) {
+            for (size_t j = 0; j < i; ++j) {
+                setSeatSold(s, seats[j].first - 1, seats[j].second - 1, false);
+            }
+            return failure;
+        }
+        setSeatSold(s, r, c, true);
+    }
+
+    // Quote at the occupancy before this order, then count the seats
+    Order o;
+    o.totalCents = quoteSeats(sIdx, seats, &o.seatPriceCents);
+    addShowtimeSold(cinema().showtimeCols, sIdx, static_cast<int>(seats.size()));
+    cinema().showtimeCols.revenueCents[sIdx] += o.totalCents;
+
+    o.id = cinema().nextOrderId++;
+    o.idempotencyKey = idempotencyKey;
+    o.showtimeId = showtimeId;
+    o.seats = seats;
+    o.createdAt = createdAt;
+    o.refunded = false;
+    addOrder(o);
+
+    for (size_t k = 0; k < seats.size(); ++k) {
+        appendTicketFact(cinema().ticketLog, o.id, s, seats[k].first, seats[k].second,
+                         o.seatPriceCents[k], 1, o.createdAt);
+    }
+
+    orderId = o.id;
+    countMetric(COUNTER_BOOKINGS);
+    countMetric(COUNTER_SEATS_SOLD, static_cast<long long>(seats.size()));
+    return BOOKING_OK;
+}
+
+// Undo the unsaved order placed last, for a batch that failed halfway.
+// The ticket log may already hold its rows, so they are cancelled with
+// negative rows the way a refund is; the order ID stays used.
+static void unplaceLastOrder() {
+    Cinema& site = cinema();
+    Order o = move(site.orders.back());
+    site.orders.pop_back();
+    site.orderIndexById.erase(o.id);
+    if (!o.idempotencyKey.empty()) site.orderIdByKey.erase(o.idempotencyKey);
+
+    int sIdx = findShowtimeIndexById(o.showtimeId);
+    Showtime& s = site.showtimes[sIdx];
+    long long now = static_cast<long long>(time(nullptr));
+    for (size_t k = 0; k < o.seats.size(); ++k) {
+        const auto& p = o.seats[k];
+        setSeatSold(s, p.first - 1, p.second - 1, false);
+        appendTicketFact(site.ticketLog, o.id, s, p.first, p.second, -o.seatPriceCents[k], -1, now);
+    }
+    addShowtimeSold(site.showtimeCols, sIdx, -static_cast<int>(o.seats.size()));
+    site.showtimeCols.revenueCents[sIdx] -= o.totalCents;
+    countMetric(COUNTER_BOOKINGS, -1);
+    countMetric(COUNTER_SEATS_SOLD, -static_cast<long long>(o.seats.size()));
+}
+
+// References customers and staff type may not contain control characters;
+// batch items are keyed with one, see batchItemKey().
+bool isValidBookingReference(const string& reference) {
+    for (unsigned char ch : reference) {
+        if (ch < 0x20 || ch == 0x7f) return false;
+    }
+    return true;
+}
+
+// Key of item `item` of the batch booked under `batchKey`. Item keys share
+// the idempotency index with purchase references, so they are joined with
+// a control character no reference can contain.
+static string batchItemKey(const string& batchKey, size_t item) {
+    return batchKey + '\x1f' + to_string(item);
+}
+
+// Book several showtimes as one unit: either every item gets an order or
+// none does, and everything is saved with one flush. Seats are picked in
+// ascending showtime ID order and held until all items have been placed,
+// so items for the same showtime never pick the same seat. With a key,
+// item i is stored under batchItemKey(key, i) and a repeated call returns
+// the original orders; items a earlier call already booked are not booked
+// again. On failure `failedItem` is the item that could not be placed.
+BookingStatus bookBatch(const vector<BatchItem>& items, const string& idempotencyKey,
+                        vector<long long>& orderIds, size_t& failedItem) {
+    TraceSpan span("book_batch");
+    Cinema& site = cinema();
+    orderIds.assign(items.size(), -1);
+    failedItem = items.size();
+    if (items.empty()) return BOOKING_INVALID;
+
+    vector<size_t> order;
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto it = idempotencyKey.empty() ? site.orderIdByKey.end()
+                                         : site.orderIdByKey.find(batchItemKey(idempotencyKey, i));
+        if (it != site.orderIdByKey.end()) {
+            orderIds[i] = it->second;
+        } else {
+            order.push_back(i);
+        }
+    }
+    if (order.empty()) return BOOKING_REPLAYED;
+
+    stable_sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return items[a].showtimeId < items[b].showtimeId; });
+
+    // 1) Pick and hold the seats of every item
+    vector<vector<pair<int, int>>> assigned(items.size());
+    BookingStatus status = BOOKING_OK;
+    for (size_t i : order) {
+        const BatchItem& item = items[i];
+        int sIdx = findShowtimeIndexById(item.showtimeId);
+        if (sIdx == -1 || (item.seats.empty() && item.count <= 0)) {
+            status = BOOKING_INVALID;
+        } else {
+            Showtime& s = site.showtimes[sIdx];
+            ensureSeatMap(s);
+            if (item.seats.empty()) {
+                if (!findBestSeats(s, item.count, assigned[i])) status = BOOKING_SEAT_TAKEN;
+                for (const auto& p : assigned[i]) {
+                    setSeatHeld(s, p.first - 1, p.second - 1, true);
+                }
+            } else {
+                for (const auto& p : item.seats) {
+                    int r = p.first - 1;
+                    int c = p.second - 1;
+                    if (r < 0 || r >= s.rows || c < 0 || c >= s.cols || !isSeatSellable(s, r, c)) {
+                        status = BOOKING_INVALID;
+                        break;
+                    }
+                    if (!isSeatAvailable(s, r, c)) {
+                        status = BOOKING_SEAT_TAKEN;
+                        break;
+                    }
+                    setSeatHeld(s, r, c, true); // Also catches a seat listed twice
+                    assigned[i].push_back(p);
+                }
+            }
+        }
+        if (status != BOOKING_OK) {
+            failedItem = i;
+            break;
+        }
+    }
+
+    // 2) Release the holds, then sell the seats if every item fitted
+    for (size_t i : order) {
+        if (assigned[i].empty()) continue;
+        Showtime& s = site.showtimes[findShowtimeIndexById(items[i].showtimeId)];
+        for (const auto& p : assigned[i]) {
+            setSeatHeld(s, p.first - 1, p.second - 1, false);
+        }
+    }
+    if (status != BOOKING_OK) return status;
+
+    long long now = static_cast<long long>(time(nullptr));
+    size_t placed = 0;
+    for (size_t i : order) {
+        string key = idempotencyKey.empty() ? "" : batchItemKey(idempotencyKey, i);
+        status = placeOrder(items[i].showtimeId, assigned[i], key, now, orderIds[i]);
+        if (status != BOOKING_OK) {
+            failedItem = i;
+            orderIds[i] = -1;
+            for (; placed > 0; --placed) {
+                unplaceLastOrder();
+                orderIds[order[placed - 1]] = -1;
+            }
+            return status;
+        }
+        ++placed;
+    }
+    saveDataToFiles();
+    return BOOKING_OK;
+}
+
+// Release the seats of an order and log the refund.
+// Cost is proportional to the number of seats in the order.
+RefundStatus refundOrder(long long orderId) {
+    Cinema& site = cinema();
+    Order* o = findOrderById(orderId);
+    if (o == nullptr) return REFUND_NOT_FOUND;
+    if (o->refunded) return REFUND_ALREADY_REFUNDED;
+    int sIdx = findShowtimeIndexById(o->showtimeId);
+    if (sIdx == -1) return REFUND_SHOWTIME_CLOSED;
+
+    Showtime& s = site.showtimes[sIdx];
+    ensureSeatMap(s);
+    long long now = static_cast<long long>(time(nullptr));
+    for (size_t k = 0; k < o->seats.size(); ++k) {
+        const auto& p = o->seats[k];
+        setSeatSold(s, p.first - 1, p.second - 1, false);
+        appendTicketFact(site.ticketLog, o->id, s, p.first, p.second, -o->seatPriceCents[k], -1, now);
+    }
+    addShowtimeSold(site.showtimeCols, sIdx, -static_cast<int>(o->seats.size()));
+    site.showtimeCols.revenueCents[sIdx] -= o->totalCents;
+    o->refunded = true;
+    site.refundedOrders.push_back(site.orderIndexById[o->id]);
+    countMetric(COUNTER_REFUNDS);
+    countMetric(COUNTER_SEATS_SOLD, -static_cast<long long>(o->seats.size()));
+    releaseSeats(o->showtimeId, o->seats);
+
+    saveDataToFiles();
+    return REFUND_OK;
+}
+
+void printOrderSummary(const Order& o, ostream& out) {
+    int sIdx = findShowtimeIndexById(o.showtimeId);
+    string movieTitle = "(unknown movie)";
+    string hallName = "(unknown hall)";
+    string datetime = "(archived showtime)";
+    if (sIdx != -1) {
+        const Showtime& s = cinema().showtimes[sIdx];
+        int mIdx = findMovieIndexById(s.movieId);
+        int hIdx = findHallIndexById(s.hallId);
+        if (mIdx != -1) movieTitle = cinema().movies[mIdx].title;
+        if (hIdx != -1) hallName = cinema().halls[hIdx].name;
+        datetime = s.datetime;
+    }
+
+    out << "----- Ticket Summary -----" << endl;
+    out << "Order : " << o.id << (o.refunded ? " (REFUNDED)" : "") << endl;
+    out << "Movie : " << movieTitle << endl;
+    out << "Hall  : " << hallName << endl;
+    out << "Time  : " << datetime << endl;
+    out << "Seats : ";
+
+    for (size_t i = 0; i < o.seats.size(); ++i) {
+        out << "(Row " << o.seats[i].first
+            << ", Col " << o.seats[i].second << ")";
+        if (i + 1 < o.seats.size()) out << ", ";
+    }
+    out << endl;
+
+    out << "Ticket prices    : ";
+    for (size_t i = 0; i < o.seatPriceCents.size(); ++i) {
+        out << fixed << setprecision(2) << o.seatPriceCents[i] / 100.0;
+        if (i + 1 < o.seatPriceCents.size()) out << ", ";
+    }
+    out << endl;
+    out << "Total price      : " << fixed << setprecision(2) << o.totalCents / 100.0 << endl;
+    out << "-------------------------" << endl;
+}
+
+void lookUpOrder() {
+    cout << "\n--- Look Up Order ---" << endl;
+
+    long long id;
+    cout << "Enter order ID: ";
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter a valid order ID: ";
+    }
+
+    Order* o = findOrderById(id);
+    if (o == nullptr) {
+        cout << "Order ID not found." << endl;
+        return;
+    }
+    printOrderSummary(*o);
+}
+
+void refundOrderMenu() {
+    cout << "\n--- Refund Order ---" << endl;
+
+    long long id;
+    cout << "Enter order ID to refund: ";
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter a valid order ID: ";
+    }
+
+    switch (refundOrder(id)) {
+    case REFUND_OK:
+        cout << "Order " << id << " refunded. Its seats were released." << endl;
+        break;
+    case REFUND_NOT_FOUND:
+        cout << "Order ID not found." << endl;
+        break;
+    case REFUND_ALREADY_REFUNDED:
+        cout << "This order has already been refunded." << endl;
+        break;
+    case REFUND_SHOWTIME_CLOSED:
+        cout << "The showtime of this order is no longer open for refunds." << endl;
+        break;
+    }
+}
+
+// Book seats for a group across several showtimes in one step. Seats are
+// assigned automatically.
+void groupBookingMenu() {
+    Cinema& site = cinema();
+    cout << "\n--- Group Booking ---" << endl;
+
+    if (site.showtimes.empty()) {
+        cout << "No showtimes available at the moment." << endl;
+        return;
+    }
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    string requestKey;
+    cout << "Enter a booking reference to allow safe retries (leave empty to skip): ";
+    while (getline(console, requestKey) && !isValidBookingReference(requestKey)) {
+        cout << "Invalid reference. Please use printable characters only (leave empty to skip): ";
+    }
+
+    int itemCount;
+    cout << "How many showtimes does this booking cover? ";
+    while (!(console >> itemCount) || itemCount <= 0 || itemCount > 100) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid number. Please enter a number between 1 and 100: ";
+    }
+
+    vector<BatchItem> items(static_cast<size_t>(itemCount));
+    for (int k = 0; k < itemCount; ++k) {
+        BatchItem& item = items[k];
+        cout << "Showtime ID for item #" << k + 1 << ": ";
+        while (!(console >> item.showtimeId) || findShowtimeIndexById(item.showtimeId) == -1) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid showtime ID. Please enter a valid showtime ID: ";
+        }
+        int capacity = site.showtimeCols.capacity[findShowtimeIndexById(item.showtimeId)];
+        cout << "Number of seats: ";
+        while (!(console >> item.count) || item.count <= 0 || item.count > capacity) {
+            console.clear();
+            console.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << "Invalid number. Please enter a number between 1 and " << capacity << ": ";
+        }
+    }
+
+    vector<long long> orderIds;
+    size_t failedItem;
+    BookingStatus status = bookBatch(items, requestKey, orderIds, failedItem);
+    if (status == BOOKING_INVALID) {
+        cout << "Sorry, showtime " << items[failedItem].showtimeId
+             << " can no longer be booked. Nothing was booked." << endl;
+        return;
+    }
+    if (status == BOOKING_SEAT_TAKEN) {
+        cout << "Sorry, showtime " << items[failedItem].showtimeId << " does not have "
+             << items[failedItem].count << " seats available. Nothing was booked." << endl;
+        return;
+    }
+
+    cout << (status == BOOKING_REPLAYED ? "\nThis group booking was already completed. Orders:"
+                                         : "\nGroup booking completed. Orders:") << endl;
+    long long totalCents = 0;
+    for (size_t k = 0; k < items.size(); ++k) {
+        const Order* o = (orderIds[k] != -1) ? findOrderById(orderIds[k]) : nullptr;
+        if (o == nullptr) continue;
+        cout << "Order " << o->id << " | Showtime " << o->showtimeId << " | Seats: " << o->seats.size()
+             << " | Total: " << fixed << setprecision(2) << o->totalCents / 100.0 << endl;
+        totalCents += o->totalCents;
+    }
+    cout << "Grand total: " << fixed << setprecision(2) << totalCents / 100.0 << endl;
+}
+
+// ===== Waitlist implementations =====
+
+// Queue a customer for a showtime. Returns the waitlist ticket number,
+// or -1 if the showtime's queue or the site's waitlist is full.
+long long joinWaitlist(int showtimeId, const string& contact, int tickets) {
+    Cinema& site = cinema();
+    deque<WaitlistEntry>& queue = site.waitlists[showtimeId];
+    if (queue.size() >= MAX_WAITLIST_PER_SHOWTIME || site.waitlistEntryCount >= MAX_WAITLIST_ENTRIES) {
+        if (queue.empty()) site.waitlists.erase(showtimeId);
+        return -1;
+    }
+    WaitlistEntry e{ site.nextWaitlistId++, showtimeId, contact, tickets };
+    queue.push_back(e);
+    site.waitlistShowtimeById[e.id] = showtimeId;
+    ++site.waitlistEntryCount;
+    return e.id;
+}
+
+// Place in line (1 = next) of a queued entry, 0 if seats are held for it,
+// -1 if it is unknown, claimed or expired.
+int waitlistPosition(long long entryId) {
+    Cinema& site = cinema();
+    if (site.waitlistOffers.count(entryId)) return 0;
+    auto it = site.waitlistShowtimeById.find(entryId);
+    if (it == site.waitlistShowtimeById.end()) return -1;
+    // Entries only leave from the front, so IDs ascend along the queue
+    const deque<WaitlistEntry>& queue = site.waitlists[it->second];
+    auto pos = lower_bound(queue.begin(), queue.end(), entryId,
+                           [](const WaitlistEntry& e, long long id) { return e.id < id; });
+    return static_cast<int>(pos - queue.begin()) + 1;
+}
+
+// Seats of a showtime are available again: offer them to its waitlist.
+void releaseSeats(int showtimeId, const vector<pair<int, int>>& seats) {
+    cinema().seatReleases.push_back({ showtimeId, seats });
+    dispatchSeatReleases();
+}
+
+// Offer released seats to the front of each showtime's queue. An entry
+// gets its seats only if all of them fit in the same release; otherwise
+// it keeps its place and the seats go back on sale. Cost is
+// proportional to the released seats, independent of the queue length.
+void dispatchSeatReleases() {
+    Cinema& site = cinema();
+    while (!site.seatReleases.empty()) {
+        SeatRelease release = move(site.seatReleases.front());
+        site.seatReleases.pop_front();
+        auto queue = site.waitlists.find(release.showtimeId);
+        int sIdx = findShowtimeIndexById(release.showtimeId);
+        if (queue == site.waitlists.end() || sIdx == -1) continue; // Nobody waiting
+
+        Showtime& s = site.showtimes[sIdx];
+        ensureSeatMap(s);
+        vector<pair<int, int>>& seats = release.seats;
+        seats.erase(remove_if(seats.begin(), seats.end(),
+                              [&](const pair<int, int>& p) { return !isSeatAvailable(s, p.first - 1, p.second - 1); }),
+                    seats.end());
+
+        size_t next = 0;
+        while (!queue->second.empty() && seats.size() - next >= static_cast<size_t>(queue->second.front().tickets)) {
+            WaitlistOffer offer;
+            offer.entry = move(queue->second.front());
+            queue->second.pop_front();
+            site.waitlistShowtimeById.erase(offer.entry.id);
+
+            offer.seats.assign(seats.begin() + next, seats.begin() + next + offer.entry.tickets);
+            next += offer.entry.tickets;
+            for (const auto& p : offer.seats) {
+                setSeatHeld(s, p.first - 1, p.second - 1, true);
+            }
+            offer.expiresAt = static_cast<long long>(time(nullptr)) + WAITLIST_OFFER_MINUTES * 60;
+            site.offerExpiry.push_back({ offer.expiresAt, offer.entry.id });
+            countMetric(COUNTER_WAITLIST_OFFERS);
+
+            // The console may be in another customer's dialogue; the
+            // messaging service picks notices up from the log
+            ofstream notify(sitePath(WAITLIST_NOTIFY_FILE), ios::app);
+            notify << static_cast<long long>(time(nullptr)) << " Notify " << offer.entry.contact << ": "
+                   << offer.entry.tickets << " seat(s) for showtime " << s.id << " (" << s.datetime
+                   << ") are held for waitlist ticket #" << offer.entry.id << " for "
+                   << WAITLIST_OFFER_MINUTES << " minutes." << endl;
+            if (!notify) {
+                cout << "[Error] Failed to write " << sitePath(WAITLIST_NOTIFY_FILE) << "." << endl;
+            }
+            site.waitlistOffers.emplace(offer.entry.id, move(offer));
+        }
+        if (queue->second.empty()) site.waitlists.erase(queue);
+    }
+}
+
+// Take a closed offer out of the expiry queue. The queue is sorted by
+// expiry time, so only offers expiring in the same second are scanned.
+static void forgetOfferExpiry(const WaitlistOffer& offer) {
+    deque<pair<long long, long long>>& expiry = cinema().offerExpiry;
+    auto it = lower_bound(expiry.begin(), expiry.end(), offer.expiresAt,
+                          [](const pair<long long, long long>& e, long long t) { return e.first < t; });
+    for (; it != expiry.end() && it->first == offer.expiresAt; ++it) {
+        if (it->second == offer.entry.id) {
+            expiry.erase(it);
+            return;
+        }
+    }
+}
+
+// Cancel an open offer and pass its seats on to the next in line.
+static void withdrawWaitlistOffer(long long entryId) {
+    Cinema& site = cinema();
+    auto it = site.waitlistOffers.find(entryId);
+    if (it == site.waitlistOffers.end()) return;
+    WaitlistOffer offer = move(it->second);
+    site.waitlistOffers.erase(it);
+    forgetOfferExpiry(offer);
+    --site.waitlistEntryCount;
+
+    int sIdx = findShowtimeIndexById(offer.entry.showtimeId);
+    if (sIdx == -1) return;
+    Showtime& s = site.showtimes[sIdx];
+    ensureSeatMap(s);
+    for (const auto& p : offer.seats) {
+        setSeatHeld(s, p.first - 1, p.second - 1, false);
+    }
+    site.seatReleases.push_back({ offer.entry.showtimeId, move(offer.seats) });
+}
+
+// Withdraw offers whose time is up. Each expired offer is looked at once.
+void expireWaitlistOffers() {
+    Cinema& site = cinema();
+    long long now = static_cast<long long>(time(nullptr));
+    while (!site.offerExpiry.empty() && site.offerExpiry.front().first <= now) {
+        long long entryId = site.offerExpiry.front().second;
+        if (!site.waitlistOffers.count(entryId)) {
+            site.offerExpiry.pop_front(); // Not expected; closed offers leave the queue
+            continue;
+        }
+        withdrawWaitlistOffer(entryId); // Removes the front entry
+        countMetric(COUNTER_WAITLIST_EXPIRED);
+    }
+    dispatchSeatReleases();
+}
+
+// When the earliest open offer may expire, -1 if there is none. Only
+// called on the site's own worker thread.
+long long nextWaitlistExpiry(const Cinema& site) {
+    return site.offerExpiry.empty() ? -1 : site.offerExpiry.front().first;
+}
+
+// Book the seats held for a waitlist entry.
+BookingStatus claimWaitlistOffer(long long entryId, long long& orderId) {
+    Cinema& site = cinema();
+    expireWaitlistOffers();
+    auto it = site.waitlistOffers.find(entryId);
+    if (it == site.waitlistOffers.end()) return BOOKING_INVALID;
+    WaitlistOffer offer = move(it->second);
+    site.waitlistOffers.erase(it);
+    forgetOfferExpiry(offer);
+    --site.waitlistEntryCount;
+
+    int sIdx = findShowtimeIndexById(offer.entry.showtimeId);
+    if (sIdx == -1) return BOOKING_INVALID;
+    Showtime& s = site.showtimes[sIdx];
+    ensureSeatMap(s);
+    for (const auto& p : offer.seats) {
+        setSeatHeld(s, p.first - 1, p.second - 1, false);
+    }
+    BookingStatus status = bookSeats(offer.entry.showtimeId, offer.seats, "", orderId);
+    if (status != BOOKING_OK) {
+        releaseSeats(offer.entry.showtimeId, offer.seats);
+    }
+    return status;
+}
+
+void declineWaitlistOffer(long long entryId) {
+    withdrawWaitlistOffer(entryId);
+    dispatchSeatReleases();
+}
+
+// Forget the queue and offers of a showtime that is deleted or archived.
+void dropWaitlist(int showtimeId) {
+    Cinema& site = cinema();
+    auto queue = site.waitlists.find(showtimeId);
+    if (queue != site.waitlists.end()) {
+        for (const WaitlistEntry& e : queue->second) {
+            site.waitlistShowtimeById.erase(e.id);
+        }
+        site.waitlistEntryCount -= queue->second.size();
+        site.waitlists.erase(queue);
+    }
+    for (auto it = site.waitlistOffers.begin(); it != site.waitlistOffers.end();) {
+        if (it->second.entry.showtimeId == showtimeId) {
+            forgetOfferExpiry(it->second);
+            it = site.waitlistOffers.erase(it);
+            --site.waitlistEntryCount;
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Offered to a customer who found the showtime sold out.
+void offerWaitlistMenu(int showtimeId) {
+    Cinema& site = cinema();
+    char ans = 'N';
+    cout << "Join the waitlist for this showtime? (Y/N): ";
+    console >> ans;
+    if (ans != 'Y' && ans != 'y') return;
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n');
+    string contact;
+    cout << "Enter your name or phone number: ";
+    while (getline(console, contact) && contact.empty()) {
+        cout << "Please enter a name or phone number: ";
+    }
+    if (contact.empty()) return;
+
+    int capacity = site.showtimeCols.capacity[findShowtimeIndexById(showtimeId)];
+    int tickets;
+    cout << "How many tickets do you need? ";
+    while (!(console >> tickets) || tickets <= 0 || tickets > capacity) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid number. Please enter a number between 1 and " << capacity << ": ";
+    }
+
+    long long entryId = joinWaitlist(showtimeId, contact, tickets);
+    if (entryId == -1) {
+        cout << "Sorry, the waitlist for this showtime is full." << endl;
+        return;
+    }
+    cout << "You are number " << waitlistPosition(entryId) << " on the waitlist. Your waitlist ticket is #"
+         << entryId << "." << endl;
+    cout << "When seats are released they are held for you for " << WAITLIST_OFFER_MINUTES
+         << " minutes; book them under Waitlist Status." << endl;
+}
+
+void waitlistStatusMenu() {
+    Cinema& site = cinema();
+    cout << "\n--- Waitlist Status ---" << endl;
+
+    long long id;
+    cout << "Enter your waitlist ticket number: ";
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter a valid waitlist ticket number: ";
+    }
+
+    expireWaitlistOffers();
+    int position = waitlistPosition(id);
+    if (position == -1) {
+        cout << "No open waitlist entry with this number. It may have been booked or expired." << endl;
+        return;
+    }
+    if (position > 0) {
+        cout << "You are number " << position << " in line for showtime "
+             << site.waitlistShowtimeById[id] << "." << endl;
+        return;
+    }
+
+    const WaitlistOffer& offer = site.waitlistOffers[id];
+    long long secondsLeft = offer.expiresAt - static_cast<long long>(time(nullptr));
+    cout << "Seats held for you at showtime " << offer.entry.showtimeId << ": ";
+    for (size_t i = 0; i < offer.seats.size(); ++i) {
+        cout << "(Row " << offer.seats[i].first << ", Col " << offer.seats[i].second << ")";
+        if (i + 1 < offer.seats.size()) cout << ", ";
+    }
+    cout << endl;
+    cout << "The hold ends in " << (secondsLeft + 59) / 60 << " minute(s)." << endl;
+
+    char ans = 'N';
+    cout << "Book these seats now? (Y = book, N = give them up, other = decide later): ";
+    console >> ans;
+    if (ans == 'Y' || ans == 'y') {
+        long long orderId;
+        if (claimWaitlistOffer(id, orderId) != BOOKING_OK) {
+            cout << "Sorry, the booking could not be completed." << endl;
+            return;
+        }
+        cout << "\nTicket(s) booked successfully!" << endl;
+        printOrderSummary(*findOrderById(orderId));
+    } else if (ans == 'N' || ans == 'n') {
+        declineWaitlistOffer(id);
+        cout << "The seats were released." << endl;
+    }
+}
+
+int countSoldSeats(const Showtime& s) {
+    return countSeatBits(s.soldBits.data(), s.soldBits.size());
+}
+
+void viewTicketStatusOfShowtime() {
+    Cinema& site = cinema();
+    cout << "\n--- Ticket Status of a Showtime ---" << endl;
+
+    if (site.showtimes.empty()) {
+        cout << "No showtimes available." << endl;
+        return;
+    }
+
+    // List all showtimes for easier selection
+    listAllShowtimes(false);
+
+    int id;
+    cout << "\nEnter showtime ID to view its status: ";
+    while (!(console >> id)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter a valid showtime ID: ";
+    }
+    ScopedLatency timer(OP_REPORT_SHOWTIME_STATUS); // The report, not the prompts
+
+    int idx = findShowtimeIndexById(id);
+    if (idx == -1) {
+        cout << "Showtime ID not found." << endl;
+        return;
+    }
+
+    Showtime& s = site.showtimes[idx];
+    ensureSeatMap(s);
+
+    int mIdx = findMovieIndexById(s.movieId);
+    int hIdx = findHallIndexById(s.hallId);
+
+    string movieTitle = (mIdx != -1) ? site.movies[mIdx].title : "(unknown movie)";
+    string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
+
+    int sold = site.showtimeCols.sold[idx];
+    int total = site.showtimeCols.capacity[idx];
+    int available = total - sold - countHeldSeats(s);
+
+    cout << "\nShowtime Info:" << endl;
+    cout << "Showtime ID: " << s.id << endl;
+    cout << "Movie      : " << movieTitle << endl;
+    cout << "Hall       : " << hallName << endl;
+    cout << "Time       : " << s.datetime << endl;
+    cout << "Price      : " << quotedPriceRange(idx) << endl;
+    cout << "Sold       : " << sold << " / " << total << endl;
+    cout << "Available  : " << available << endl;
+
+    // Display seat map
+    displaySeatMap(s);
+}
+
+void viewTotalTicketsForMovie() {
+    Cinema& site = cinema();
+    cout << "\n--- Total Tickets for a Movie (All Showtimes) ---" << endl;
+
+    if (site.movies.empty()) {
+        cout << "No movies available." << endl;
+        return;
+    }
+    if (site.showtimes.empty()) {
+        cout << "No showtimes available." << endl;
+        return;
+    }
+
+    cout << "Available Movies:" << endl;
+    listAllMovies(false);
+
+    int movieId;
+    cout << "\nEnter movie ID: ";
+    while (!(console >> movieId) || findMovieIndexById(movieId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid movie ID. Please enter a valid movie ID: ";
+    }
+    ScopedLatency timer(OP_REPORT_MOVIE_TOTALS); // The report, not the prompts
+
+    int mIdx = findMovieIndexById(movieId);
+    string movieTitle = (mIdx != -1) ? site.movies[mIdx].title : "(unknown movie)";
+
+    const ShowtimeColumns& cols = site.showtimeCols;
+    bool hasShowtime = false;
+
+    cout << "\nShowtimes for \"" << movieTitle << "\":" << endl;
+
+    for (size_t i = 0; i < cols.id.size(); ++i) {
+        if (cols.movieId[i] == movieId) {
+            hasShowtime = true;
+            int sold = cols.sold[i];
+            double revenue = cols.revenueCents[i] / 100.0;
+
+            int hIdx = findHallIndexById(cols.hallId[i]);
+            string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
+
+            cout << "Showtime ID: " << cols.id[i]
+                 << " | Hall: " << hallName
+                 << " | Time: " << site.showtimes[i].datetime
+                 << " | Sold: " << sold << " / " << cols.capacity[i]
+                 << " | Revenue: " << fixed << setprecision(2) << revenue
+                 << endl;
+        }
+    }
+
+    if (!hasShowtime) {
+        cout << "No showtimes for this movie." << endl;
+        return;
+    }
+
+    SalesTotals totals = sumSalesForMovie(cols, movieId);
+    cout << "\nTotal tickets sold for \"" << movieTitle << "\": " << totals.ticketsSold << endl;
+    cout << "Total revenue: " << fixed << setprecision(2) << totals.revenueCents / 100.0 << endl;
+}
+
+void viewOverallSalesOverview() {
+    ScopedLatency timer(OP_REPORT_SALES_OVERVIEW);
+    cout << "\n--- Overall Ticket Sales Overview ---" << endl;
+
+    if (cinema().showtimes.empty()) {
+        cout << "No showtimes available." << endl;
+        return;
+    }
+
+    // Totals first: they come from a column scan, the rows are paged
+    const ShowtimeColumns& cols = cinema().showtimeCols;
+    SalesTotals totals = sumSales(cols);
+    cout << "Grand total tickets sold (all showtimes): " << totals.ticketsSold << endl;
+    cout << "Grand total revenue: " << fixed << setprecision(2) << totals.revenueCents / 100.0 << endl;
+    cout << endl;
+
+    printShowtimePages(ShowtimeFilter(), true);
+}
+
+// ===== Paginated listing implementations =====
+
+// Movies with the given rating (all movies if empty) whose ID is greater
+// than afterId, in ID order.
+IdPage pageMovies(const string& rating, int afterId, size_t limit) {
+    Cinema& site = cinema();
+    IdPage page;
+    page.nextAfterId = afterId;
+    if (rating.empty()) {
+        auto it = upper_bound(site.movies.begin(), site.movies.end(), afterId,
+                              [](int key, const Movie& m) { return key < m.id; });
+        for (; it != site.movies.end() && page.ids.size() < limit; ++it) {
+            page.ids.push_back(it->id);
+        }
+        page.hasMore = (it != site.movies.end());
+    } else {
+        auto byRating = site.movieIdsByRating.find(rating);
+        if (byRating == site.movieIdsByRating.end()) return page;
+        auto it = byRating->second.upper_bound(afterId);
+        for (; it != byRating->second.end() && page.ids.size() < limit; ++it) {
+            page.ids.push_back(*it);
+        }
+        page.hasMore = (it != byRating->second.end());
+    }
+    if (!page.ids.empty()) page.nextAfterId = page.ids.back();
+    return page;
+}
+
+// Halls on `floor` (all halls for ANY_FLOOR) whose ID is greater than
+// afterId, in ID order.
+IdPage pageHalls(int floor, int afterId, size_t limit) {
+    Cinema& site = cinema();
+    IdPage page;
+    page.nextAfterId = afterId;
+    if (floor == ANY_FLOOR) {
+        auto it = upper_bound(site.halls.begin(), site.halls.end(), afterId,
+                              [](int key, const Hall& h) { return key < h.id; });
+        for (; it != site.halls.end() && page.ids.size() < limit; ++it) {
+            page.ids.push_back(it->id);
+        }
+        page.hasMore = (it != site.halls.end());
+    } else {
+        auto byFloor = site.hallIdsByFloor.find(floor);
+        if (byFloor == site.hallIdsByFloor.end()) return page;
+        auto it = byFloor->second.upper_bound(afterId);
+        for (; it != byFloor->second.end() && page.ids.size() < limit; ++it) {
+            page.ids.push_back(*it);
+        }
+        page.hasMore = (it != byFloor->second.end());
+    }
+    if (!page.ids.empty()) page.nextAfterId = page.ids.back();
+    return page;
+}
+
+// Showtimes matching `filter` that come after `after` in (start time, ID)
+// order. Without a sold-out filter the open and sold-out sets are merged.
+ShowtimePage pageShowtimes(const ShowtimeFilter& filter, const ShowtimeCursor& after, size_t limit) {
+    ShowtimePage page;
+    page.next = after;
+
+    const set<pair<long long, int>>& open = cinema().showtimeCols.byStart[0];
+    const set<pair<long long, int>>& full = cinema().showtimeCols.byStart[1];
+    pair<long long, int> from = max(make_pair(after.startMinute, after.id),
+                                    make_pair(filter.fromMinute, numeric_limits<int>::min()));
+    auto openIt = (filter.soldOut == 1) ? open.end() : open.upper_bound(from);
+    auto fullIt = (filter.soldOut == 0) ? full.end() : full.upper_bound(from);
+
+    auto inRange = [&](set<pair<long long, int>>::const_iterator it, const set<pair<long long, int>>& s) {
+        return it != s.end() && it->first <= filter.toMinute;
+    };
+
+    while (page.ids.size() < limit) {
+        bool haveOpen = inRange(openIt, open);
+        bool haveFull = inRange(fullIt, full);
+        if (!haveOpen && !haveFull) break;
+
+        auto& it = (haveOpen && (!haveFull || *openIt < *fullIt)) ? openIt : fullIt;
+        page.ids.push_back(it->second);
+        page.next.startMinute = it->first;
+        page.next.id = it->second;
+        ++it;
+    }
+    page.hasMore = inRange(openIt, open) || inRange(fullIt, full);
+    return page;
+}
+
+void rebuildListingIndexes() {
+    Cinema& site = cinema();
+    site.movieIdsByRating.clear();
+    for (const auto& m : site.movies) {
+        site.movieIdsByRating[m.rating].insert(m.id);
+    }
+    site.hallIdsByFloor.clear();
+    for (const auto& h : site.halls) {
+        site.hallIdsByFloor[h.floor].insert(h.id);
+    }
+}
+
+bool askNextPage() {
+    char answer;
+    cout << "More results. Show the next page? (Y/N): ";
+    if (!(console >> answer)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        return false;
+    }
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Drop the rest of the answer line
+    return answer == 'Y' || answer == 'y';
+}
+
+void printMoviePages(const string& rating, bool paged) {
+    IdPage page;
+    do {
+        page = pageMovies(rating, page.nextAfterId, LIST_PAGE_SIZE);
+        for (int id : page.ids) {
+            const Movie& m = cinema().movies[findMovieIndexById(id)];
+            cout << "ID: " << m.id
+                 << " | Title: " << m.title
+                 << " | Rating: " << m.rating
+                 << " | Duration: " << m.duration << " minutes" << endl;
+        }
+    } while (page.hasMore && (!paged || askNextPage()));
+}
+
+void printHallPages(int floor, bool paged) {
+    IdPage page;
+    do {
+        page = pageHalls(floor, page.nextAfterId, LIST_PAGE_SIZE);
+        for (int id : page.ids) {
+            const Hall& h = cinema().halls[findHallIndexById(id)];
+            cout << "ID: " << h.id
+                 << " | Name: " << h.name
+                 << " | Floor: " << h.floor
+                 << " | Rows: " << h.rows
+                 << " | Cols: " << h.cols
+                 << " | Total seats: " << h.layout->sellableCount
+                 << endl;
+        }
+    } while (page.hasMore && (!paged || askNextPage()));
+}
+
+// withSales selects the sales overview columns instead of the schedule ones.
+// Unpaged output prints every page without asking, for screens that read
+// an ID right after the list.
+void printShowtimePages(const ShowtimeFilter& filter, bool withSales, bool paged) {
+    Cinema& site = cinema();
+    const ShowtimeColumns& cols = site.showtimeCols;
+    ShowtimePage page;
+    do {
+        page = pageShowtimes(filter, page.next, LIST_PAGE_SIZE);
+        for (int id : page.ids) {
+            int i = findShowtimeIndexById(id);
+            int mIdx = findMovieIndexById(cols.movieId[i]);
+            int hIdx = findHallIndexById(cols.hallId[i]);
+
+            string movieTitle = (mIdx != -1) ? site.movies[mIdx].title : "(unknown movie)";
+            string hallName = (hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)";
+
+            if (withSales) {
+                cout << "Showtime ID: " << cols.id[i]
+                     << " | Movie: " << movieTitle
+                     << " | Hall: " << hallName
+                     << " | Time: " << site.showtimes[i].datetime
+                     << " | Sold: " << cols.sold[i] << " / " << cols.capacity[i]
+                     << " | Revenue: " << fixed << setprecision(2) << cols.revenueCents[i] / 100.0
+                     << endl;
+            } else {
+                cout << "ID: " << cols.id[i]
+                     << " | Movie: " << movieTitle << " (ID " << cols.movieId[i] << ")"
+                     << " | Hall: " << hallName << " (ID " << cols.hallId[i] << ")"
+                     << " | Time: " << site.showtimes[i].datetime
+                     << " | Price: " << site.showtimes[i].price
+                     << endl;
+            }
+        }
+    } while (page.hasMore && (!paged || askNextPage()));
+}
+
+void browseMoviesByRating() {
+    cout << "\n--- Browse Movies by Rating ---" << endl;
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    string rating;
+    cout << "Enter rating (e.g. G, PG, PG-13, R): ";
+    getline(console, rating);
+
+    if (rating.empty() || !cinema().movieIdsByRating.count(rating) || cinema().movieIdsByRating[rating].empty()) {
+        cout << "No movies found." << endl;
+        return;
+    }
+    printMoviePages(rating);
+}
+
+void browseHallsByFloor() {
+    cout << "\n--- Browse Halls by Floor ---" << endl;
+
+    int floor;
+    cout << "Enter floor number: ";
+    while (!(console >> floor)) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter an integer for floor: ";
+    }
+
+    auto byFloor = cinema().hallIdsByFloor.find(floor);
+    if (byFloor == cinema().hallIdsByFloor.end() || byFloor->second.empty()) {
+        cout << "No halls found on this floor." << endl;
+        return;
+    }
+    printHallPages(floor);
+}
+
+void browseShowtimes() {
+    cout << "\n--- Browse Showtimes ---" << endl;
+
+    ShowtimeFilter filter;
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+
+    string date;
+    cout << "Enter start date (e.g. 2025-01-01, leave empty for no limit): ";
+    while (getline(console, date) && !date.empty()) {
+        long long day = parseDayNumber(date);
+        if (day >= 0) {
+            filter.fromMinute = day * 24 * 60;
+            break;
+        }
+        cout << "Invalid date. Please use YYYY-MM-DD or leave empty: ";
+    }
+    cout << "Enter end date (e.g. 2025-01-31, leave empty for no limit): ";
+    while (getline(console, date) && !date.empty()) {
+        long long day = parseDayNumber(date);
+        if (day >= 0) {
+            filter.toMinute = (day + 1) * 24 * 60 - 1;
+            break;
+        }
+        cout << "Invalid date. Please use YYYY-MM-DD or leave empty: ";
+    }
+
+    int status;
+    cout << "Show 0 = all, 1 = with seats left, 2 = sold out only: ";
+    while (!(console >> status) || status < 0 || status > 2) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid input. Please enter 0, 1 or 2: ";
+    }
+    filter.soldOut = status - 1;
+
+    ShowtimePage first = pageShowtimes(filter, ShowtimeCursor(), 1);
+    if (first.ids.empty()) {
+        cout << "No matching showtimes." << endl;
+        return;
+    }
+    printShowtimePages(filter, false);
+}
+
+// ===== Showtime column store implementations =====
+
+// Days since 1970-01-01 for a proleptic Gregorian date.
+static long long daysFromCivil(int y, int m, int d) {
+    y -= (m <= 2) ? 1 : 0;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Parse "YYYY-MM-DD HH:MM" into minutes since 1970-01-01.
+// Return -1 if the string does not follow that format.
+long long parseDatetimeMinutes(const string& datetime) {
+    int y, mo, d, h, mi;
+    char extra;
+    if (sscanf(datetime.c_str(), "%d-%d-%d %d:%d%c", &y, &mo, &d, &h, &mi, &extra) != 5) {
+        return -1;
+    }
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h < 0 || h > 23 || mi < 0 || mi > 59) {
+        return -1;
+    }
+    return daysFromCivil(y, mo, d) * 24 * 60 + h * 60 + mi;
+}
+
+void appendShowtimeColumns(ShowtimeColumns& cols, const Showtime& s) {
+    cols.indexById[s.id] = static_cast<int>(cols.id.size());
+    cols.id.push_back(s.id);
+    cols.movieId.push_back(s.movieId);
+    cols.hallId.push_back(s.hallId);
+    cols.startMinute.push_back(parseDatetimeMinutes(s.datetime));
+    cols.priceCents.push_back(llround(s.price * 100.0));
+    cols.capacity.push_back(s.layout->sellableCount);
+    cols.sold.push_back(s.seatsLoaded ? countSoldSeats(s) : s.storedSold);
+    cols.revenueCents.push_back(cols.sold.back() * cols.priceCents.back());
+    cols.byStart[cols.sold.back() >= cols.capacity.back()].insert({ cols.startMinute.back(), s.id });
+}
+
+void eraseShowtimeColumns(ShowtimeColumns& cols, int idx) {
+    cols.byStart[cols.sold[idx] >= cols.capacity[idx]].erase({ cols.startMinute[idx], cols.id[idx] });
+    cols.indexById.erase(cols.id[idx]);
+    for (size_t i = idx + 1; i < cols.id.size(); ++i) {
+        cols.indexById[cols.id[i]] = static_cast<int>(i - 1);
+    }
+    cols.id.erase(cols.id.begin() + idx);
+    cols.movieId.erase(cols.movieId.begin() + idx);
+    cols.hallId.erase(cols.hallId.begin() + idx);
+    cols.startMinute.erase(cols.startMinute.begin() + idx);
+    cols.priceCents.erase(cols.priceCents.begin() + idx);
+    cols.capacity.erase(cols.capacity.begin() + idx);
+    cols.sold.erase(cols.sold.begin() + idx);
+    cols.revenueCents.erase(cols.revenueCents.begin() + idx);
+}
+
+// Change the sold count of entry idx, moving it between the open and
+// sold-out paging sets when it crosses capacity.
+void addShowtimeSold(ShowtimeColumns& cols, int idx, int delta) {
+    pair<long long, int> key(cols.startMinute[idx], cols.id[idx]);
+    bool wasSoldOut = cols.sold[idx] >= cols.capacity[idx];
+    cols.sold[idx] += delta;
+    bool soldOut = cols.sold[idx] >= cols.capacity[idx];
+    if (soldOut != wasSoldOut) {
+        cols.byStart[wasSoldOut].erase(key);
+        cols.byStart[soldOut].insert(key);
+    }
+}
+
+// Rebuild the column store from scratch, e.g. after loading from files.
+void rebuildShowtimeColumns() {
+    Cinema& site = cinema();
+    site.showtimeCols = ShowtimeColumns();
+    site.showtimesByDay.clear();
+    for (const auto& s : site.showtimes) {
+        appendShowtimeColumns(site.showtimeCols, s);
+        addToDayPartition(s.id, site.showtimeCols.startMinute.back());
+    }
+
+    // Seats sold through orders were charged their quoted price rather
+    // than the base price assumed above.
+    for (const auto& o : site.orders) {
+        int idx = findShowtimeIndexById(o.showtimeId);
+        if (idx == -1 || o.refunded) continue;
+        site.showtimeCols.revenueCents[idx] += o.totalCents
+            - site.showtimeCols.priceCents[idx] * static_cast<long long>(o.seats.size());
+    }
+}
+
+// The scans below only touch plain integer arrays and contain no
+// branches, so the compiler can vectorize them at -O2/-O3.
+SalesTotals sumSales(const ShowtimeColumns& cols) {
+    SalesTotals t;
+    const int* sold = cols.sold.data();
+    const int* capacity = cols.capacity.data();
+    const long long* paid = cols.revenueCents.data();
+    size_t n = cols.sold.size();
+
+    long long tickets = 0, revenue = 0, seats = 0;
+    for (size_t i = 0; i < n; ++i) {
+        tickets += sold[i];
+        revenue += paid[i];
+        seats += capacity[i];
+    }
+    t.ticketsSold = tickets;
+    t.revenueCents = revenue;
+    t.capacity = seats;
+    return t;
+}
+
+SalesTotals sumSalesForMovie(const ShowtimeColumns& cols, int movieId) {
+    SalesTotals t;
+    const int* movie = cols.movieId.data();
+    const int* sold = cols.sold.data();
+    const int* capacity = cols.capacity.data();
+    const long long* paid = cols.revenueCents.data();
+    size_t n = cols.sold.size();
+
+    long long tickets = 0, revenue = 0, seats = 0;
+    for (size_t i = 0; i < n; ++i) {
+        long long match = (movie[i] == movieId) ? 1 : 0;
+        tickets += match * sold[i];
+        revenue += match * paid[i];
+        seats += match * capacity[i];
+    }
+    t.ticketsSold = tickets;
+    t.revenueCents = revenue;
+    t.capacity = seats;
+    return t;
+}
+
+// ===== Day partition / archive implementations =====
+
+long long todayDayNumber() {
+    time_t now = time(nullptr);
+    tm local = *localtime(&now);
+    return daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+}
+
+// Format a day number as "YYYY-MM-DD".
+string formatDayNumber(long long day) {
+    day += 719468;
+    long long era = (day >= 0 ? day : day - 146096) / 146097;
+    long long doe = day - era * 146097;
+    long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long long mp = (5 * doy + 2) / 153;
+    int d = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+    int m = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+    long long y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%04lld-%02d-%02d", y, m, d);
+    return buf;
+}
+
+// Parse "YYYY-MM-DD" into a day number. Return -1 if invalid.
+long long parseDayNumber(const string& date) {
+    long long minutes = parseDatetimeMinutes(date + " 00:00");
+    return (minutes < 0) ? -1 : minutes / (24 * 60);
+}
+
+void addToDayPartition(int showtimeId, long long startMinute) {
+    long long day = (startMinute < 0) ? -1 : startMinute / (24 * 60);
+    cinema().showtimesByDay[day].push_back(showtimeId);
+}
+
+void removeFromDayPartition(int showtimeId, long long startMinute) {
+    long long day = (startMinute < 0) ? -1 : startMinute / (24 * 60);
+    auto it = cinema().showtimesByDay.find(day);
+    if (it == cinema().showtimesByDay.end()) return;
+
+    vector<int>& ids = it->second;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] == showtimeId) {
+            ids.erase(ids.begin() + i);
+            break;
+        }
+    }
+    if (ids.empty()) cinema().showtimesByDay.erase(it);
+}
+
+// Seat grids are stored as alternating run lengths of available / sold
+// seats in row-major order, starting with an available run.
+static string encodeSeatRuns(const Showtime& s) {
+    vector<int> runs;
+    int current = 0;
+    int length = 0;
+    for (int r = 0; r < s.rows; ++r) {
+        for (int c = 0; c < s.cols; ++c) {
+            int v = isSeatSold(s, r, c) ? 1 : 0;
+            if (v != current) {
+                runs.push_back(length);
+                current = v;
+                length = 0;
+            }
+            ++length;
+        }
+    }
+    runs.push_back(length);
+
+    string out = to_string(runs.size());
+    for (int n : runs) {
+        out += ' ';
+        out += to_string(n);
+    }
+    return out;
+}
+
+// Write the given showtimes of one day as a new immutable segment.
+// Existing segments of the same day are never rewritten; a numbered
+// suffix is used instead. The segment is written under a temporary name
+// and renamed, so a replica base copy never sees half of it.
+static bool writeArchiveSegment(long long day, const vector<int>& indices, ArchiveSegment& seg) {
+    Cinema& site = cinema();
+    string base = "showtimes-" + formatDayNumber(day);
+    string fileName = base + ".seg";
+    for (int n = 1; filesystem::exists(sitePath(ARCHIVE_DIR) + "/" + fileName); ++n) {
+        fileName = base + "." + to_string(n) + ".seg";
+    }
+
+    string path = sitePath(ARCHIVE_DIR) + "/" + fileName;
+    ofstream fout(path + ".tmp");
+    if (!fout) {
+        cout << "[Error] Failed to open archive segment for writing." << endl;
+        return false;
+    }
+
+    seg.day = day;
+    seg.fileName = fileName;
+    seg.showtimeCount = static_cast<int>(indices.size());
+    seg.ticketsSold = 0;
+    seg.revenueCents = 0;
+    seg.maxShowtimeId = 0;
+
+    fout << indices.size() << '\n';
+    for (int idx : indices) {
+        Showtime& s = site.showtimes[idx];
+        ensureSeatMap(s);
+        int mIdx = findMovieIndexById(s.movieId);
+        int hIdx = findHallIndexById(s.hallId);
+
+        // Titles and hall names are copied so the archive stays readable
+        // after the movie or hall is deleted.
+        fout << s.id << '\n';
+        fout << s.movieId << '\n';
+        fout << s.hallId << '\n';
+        fout << ((mIdx != -1) ? site.movies[mIdx].title : "(unknown movie)") << '\n';
+        fout << ((hIdx != -1) ? site.halls[hIdx].name : "(unknown hall)") << '\n';
+        fout << s.datetime << '\n';
+        fout << s.price << '\n';
+        fout << s.rows << ' ' << s.cols << ' ' << site.showtimeCols.sold[idx] << '\n';
+        fout << encodeSeatRuns(s) << '\n';
+
+        seg.ticketsSold += site.showtimeCols.sold[idx];
+        seg.revenueCents += site.showtimeCols.revenueCents[idx];
+        if (s.id > seg.maxShowtimeId) seg.maxShowtimeId = s.id;
+    }
+    fout.close();
+    error_code ec;
+    if (fout) filesystem::rename(path + ".tmp", path, ec);
+    return fout && !ec;
+}
+
+// Move every showtime that starts before today into archive segments.
+// Return the number of showtimes archived.
+int archivePastShowtimes() {
+    Cinema& site = cinema();
+    long long today = todayDayNumber();
+    auto end = site.showtimesByDay.lower_bound(today);
+    auto begin = site.showtimesByDay.upper_bound(-1); // Skip unparsable datetimes
+    if (begin == end) return 0;
+
+    error_code ec;
+    filesystem::create_directories(sitePath(ARCHIVE_DIR), ec);
+    if (ec) {
+        cout << "[Error] Failed to create archive directory." << endl;
+        return 0;
+    }
+
+    unordered_map<int, int> indexById;
+    for (size_t i = 0; i < site.showtimeCols.id.size(); ++i) {
+        indexById[site.showtimeCols.id[i]] = static_cast<int>(i);
+    }
+
+    vector<bool> archived(site.showtimes.size(), false);
+    int archivedCount = 0;
+    for (auto it = begin; it != end; ++it) {
+        vector<int> indices;
+        for (int id : it->second) {
+            indices.push_back(indexById[id]);
+        }
+
+        ArchiveSegment seg;
+        if (!writeArchiveSegment(it->first, indices, seg)) {
+            continue; // Keep the day hot and retry next time
+        }
+        shipFileFromDisk(sitePath(ARCHIVE_DIR) + "/" + seg.fileName);
+        site.archiveSegments.push_back(seg);
+        for (int idx : indices) {
+            archived[idx] = true;
+            ++archivedCount;
+        }
+    }
+    if (archivedCount == 0) return 0;
+    saveArchiveIndex();
+
+    vector<Showtime> hot;
+    hot.reserve(site.showtimes.size() - archivedCount);
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        if (!archived[i]) {
+            hot.push_back(move(site.showtimes[i]));
+        } else {
+            forgetSeatMap(site.showtimes[i].id);
+            dropWaitlist(site.showtimes[i].id);
+            removeAdmissionGate(site.showtimes[i].id);
+        }
+    }
+    site.showtimes.swap(hot);
+    rebuildShowtimeColumns();
+    site.dirtyFiles |= DIRTY_SHOWTIMES;
+    return archivedCount;
+}
+
+// Archiving writes the segments and the index before SHOWTIME_FILE is
+// rewritten, so a crash in between leaves archived showtimes in both.
+// Drop the hot copies of showtimes a segment of their day already holds;
+// the segment wins. Return the number of showtimes dropped.
+int dropArchivedShowtimeCopies() {
+    Cinema& site = cinema();
+    unordered_set<long long> hotArchivedDays;
+    for (const auto& seg : site.archiveSegments) {
+        if (site.showtimesByDay.count(seg.day)) hotArchivedDays.insert(seg.day);
+    }
+    if (hotArchivedDays.empty()) return 0;
+
+    unordered_set<int> archivedIds;
+    for (const auto& seg : site.archiveSegments) {
+        if (!hotArchivedDays.count(seg.day)) continue;
+        TextReader fin(sitePath(ARCHIVE_DIR) + "/" + seg.fileName);
+        int count = 0;
+        if (!(fin >> count)) continue;
+        fin.ignore(numeric_limits<streamsize>::max(), '\n');
+        string line;
+        for (int i = 0; i < count && fin; ++i) {
+            getline(fin, line);
+            archivedIds.insert(atoi(line.c_str()));
+            for (int k = 0; k < 8; ++k) getline(fin, line); // Rest of the record
+        }
+    }
+
+    vector<Showtime> hot;
+    hot.reserve(site.showtimes.size());
+    for (Showtime& s : site.showtimes) {
+        if (archivedIds.count(s.id)) {
+            forgetSeatMap(s.id);
+        } else {
+            hot.push_back(move(s));
+        }
+    }
+    int dropped = static_cast<int>(site.showtimes.size() - hot.size());
+    if (dropped == 0) return 0;
+    site.showtimes.swap(hot);
+    rebuildShowtimeColumns();
+    site.dirtyFiles |= DIRTY_SHOWTIMES;
+    return dropped;
+}
+
+void archivePastShowtimesMenu() {
+    cout << "\n--- Archive Past Showtimes ---" << endl;
+    int count = archivePastShowtimes();
+    if (count == 0) {
+        cout << "No past showtimes to archive." << endl;
+        return;
+    }
+    cout << count << " showtime(s) moved to the archive." << endl;
+    saveDataToFiles();
+}
+
+void viewArchivedSales() {
+    cout << "\n--- Archived Sales by Date Range ---" << endl;
+
+    if (cinema().archiveSegments.empty()) {
+        cout << "No archived showtimes." << endl;
+        return;
+    }
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+
+    long long fromDay, toDay;
+    string line;
+    cout << "Enter start date (e.g. 2025-01-01): ";
+    while (!getline(console, line) || (fromDay = parseDayNumber(line)) < 0) {
+        if (!console) return;
+        cout << "Invalid date. Please use the format YYYY-MM-DD: ";
+    }
+    cout << "Enter end date (e.g. 2025-01-31): ";
+    while (!getline(console, line) || (toDay = parseDayNumber(line)) < fromDay) {
+        if (!console) return;
+        cout << "Invalid date. Please enter a date not before the start date: ";
+    }
+    ScopedLatency timer(OP_REPORT_ARCHIVED_SALES); // The report, not the prompts
+
+    long long totalSold = 0;
+    long long totalRevenue = 0;
+    int totalShowtimes = 0;
+    for (const auto& seg : cinema().archiveSegments) {
+        if (seg.day < fromDay || seg.day > toDay) continue;
+
+        cout << "Date: " << formatDayNumber(seg.day)
+             << " | Showtimes: " << seg.showtimeCount
+             << " | Sold: " << seg.ticketsSold
+             << " | Revenue: " << fixed << setprecision(2) << seg.revenueCents / 100.0
+             << endl;
+
+        // Per-showtime detail comes from the segment itself
+        ifstream fin(sitePath(ARCHIVE_DIR) + "/" + seg.fileName);
+        int count = 0;
+        if (fin >> count) {
+            fin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        for (int i = 0; i < count && fin; ++i) {
+            string idLine, movieIdLine, hallIdLine, title, hallName, datetime, priceLine, dims, runs;
+            getline(fin, idLine);
+            getline(fin, movieIdLine);
+            getline(fin, hallIdLine);
+            getline(fin, title);
+            getline(fin, hallName);
+            getline(fin, datetime);
+            getline(fin, priceLine);
+            getline(fin, dims);
+            getline(fin, runs);
+
+            int rows = 0, cols = 0, sold = 0;
+            sscanf(dims.c_str(), "%d %d %d", &rows, &cols, &sold);
+            cout << "    Showtime ID: " << idLine
+                 << " | Movie: " << title
+                 << " | Hall: " << hallName
+                 << " | Time: " << datetime
+                 << " | Sold: " << sold << " / " << rows * cols
+                 << endl;
+        }
+
+        totalSold += seg.ticketsSold;
+        totalRevenue += seg.revenueCents;
+        totalShowtimes += seg.showtimeCount;
+    }
+
+    if (totalShowtimes == 0) {
+        cout << "No archived showtimes in this date range." << endl;
+        return;
+    }
+    cout << "\nArchived showtimes in range: " << totalShowtimes << endl;
+    cout << "Archived tickets sold: " << totalSold << endl;
+    cout << "Archived revenue: " << fixed << setprecision(2) << totalRevenue / 100.0 << endl;
+}
+
+void loadArchiveIndex() {
+    cinema().archiveSegments.clear();
+
+    TextReader fin(sitePath(ARCHIVE_INDEX_FILE));
+    if (!fin) return; // No archive yet
+
+    int count;
+    if (!(fin >> count)) return;
+    for (int i = 0; i < count; ++i) {
+        string date;
+        ArchiveSegment seg;
+        if (!(fin >> date >> seg.fileName >> seg.showtimeCount
+                  >> seg.ticketsSold >> seg.revenueCents >> seg.maxShowtimeId)) {
+            break;
+        }
+        seg.day = parseDayNumber(date);
+        cinema().archiveSegments.push_back(seg);
+    }
+}
+
+void saveArchiveIndex() {
+    string path = sitePath(ARCHIVE_INDEX_FILE);
+    ofstream fout(path + ".tmp"); // Renamed into place, see writeArchiveSegment()
+    if (!fout) {
+        cout << "[Error] Failed to open archive index for writing." << endl;
+        return;
+    }
+    fout << cinema().archiveSegments.size() << '\n';
+    for (const auto& seg : cinema().archiveSegments) {
+        fout << formatDayNumber(seg.day) << ' ' << seg.fileName << ' '
+             << seg.showtimeCount << ' ' << seg.ticketsSold << ' '
+             << seg.revenueCents << ' ' << seg.maxShowtimeId << '\n';
+    }
+    fout.close();
+    error_code ec;
+    if (fout) filesystem::rename(path + ".tmp", path, ec);
+    if (!fout || ec) {
+        cout << "[Error] Failed to write the archive index." << endl;
+        return;
+    }
+    shipFileFromDisk(path);
+}
+
+// ===== Text input implementations =====
+
+static inline bool isSpaceChar(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parse the next whitespace-separated number of [p, end) into `value`.
+// Returns the position after it, or nullptr if no number starts there.
+template <class T>
+const char* parseNextNumber(const char* p, const char* end, T& value) {
+    while (p < end && isSpaceChar(*p)) ++p;
+    // istream accepts a leading '+', from_chars does not
+    if (end - p > 1 && p[0] == '+' && p[1] != '-' && p[1] != '+') ++p;
+    from_chars_result result = from_chars(p, end, value);
+    if (result.ec == errc::invalid_argument) {
+        value = 0;
+        return nullptr;
+    }
+    if (result.ec == errc::result_out_of_range) {
+        value = (*p == '-') ? numeric_limits<T>::lowest() : numeric_limits<T>::max();
+        return nullptr;
+    }
+    if constexpr (is_floating_point<T>::value) {
+        // from_chars reads "inf" and "nan"; istream and the files do not
+        if (!isfinite(value)) {
+            value = 0;
+            return nullptr;
+        }
+    }
+    return result.ptr;
+}
+
+// Copy the next whitespace-separated word of [p, end) into `word`.
+// Returns the position after it, or nullptr if only whitespace is left.
+const char* parseNextWord(const char* p, const char* end, string& word) {
+    while (p < end && isSpaceChar(*p)) ++p;
+    const char* first = p;
+    while (p < end && !isSpaceChar(*p)) ++p;
+    word.assign(first, p);
+    return (p > first) ? p : nullptr;
+}
+
+bool TextReader::open(const string& path, size_t bufferBytes) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    bool ok = file != INVALID_HANDLE_VALUE;
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    bool ok = fd >= 0;
+#endif
+    ownsSource = ok;
+    failed = !ok;
+    buffer.resize(max<size_t>(bufferBytes, 64));
+    return ok;
+}
+
+void TextReader::attachStdin() {
+    close();
+#ifdef _WIN32
+    file = GetStdHandle(STD_INPUT_HANDLE);
+#else
+    fd = 0;
+#endif
+    interactive = true;
+    buffer.resize(TEXT_READER_BUFFER_BYTES);
+}
+
+void TextReader::close() {
+#ifdef _WIN32
+    if (ownsSource && file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (ownsSource && fd >= 0) ::close(fd);
+    fd = -1;
+#endif
+    ownsSource = false;
+    pos = end = 0;
+    bufferOffset = 0;
+    atEof = failed = false;
+}
+
+bool TextReader::fill() {
+    if (atEof) return false;
+    // Keep the unread bytes, grow only for a token longer than the buffer
+    if (pos > 0) {
+        memmove(buffer.data(), buffer.data() + pos, end - pos);
+        bufferOffset += static_cast<long long>(pos);
+        end -= pos;
+        pos = 0;
+    }
+    if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+    if (interactive) {
+        cout.flush();
+        pauseConsoleStep(); // The site's worker is not held while the clerk types
+    }
+
+    long long n = -1;
+#ifdef _WIN32
+    DWORD got = 0;
+    if (file != INVALID_HANDLE_VALUE
+        && ReadFile(file, buffer.data() + end, static_cast<DWORD>(buffer.size() - end), &got, nullptr)) {
+        n = got;
+    }
+#else
+    if (fd >= 0) {
+        do {
+            n = ::read(fd, buffer.data() + end, buffer.size() - end);
+        } while (n < 0 && errno == EINTR);
+    }
+#endif
+    if (interactive) resumeConsoleStep();
+    if (n <= 0) {
+        atEof = true;
+        return false;
+    }
+    end += static_cast<size_t>(n);
+    return true;
+}
+
+bool TextReader::skipWhitespace() {
+    while (true) {
+        while (pos < end && isSpaceChar(buffer[pos])) ++pos;
+        if (pos < end) return true;
+        if (!fill()) return false;
+    }
+}
+
+size_t TextReader::tokenEnd() {
+    size_t scan = pos;
+    while (true) {
+        while (scan < end && !isSpaceChar(buffer[scan])) ++scan;
+        if (scan < end) return scan;
+        size_t scanned = scan - pos;
+        if (!fill()) return end;
+        scan = pos + scanned;
+    }
+}
+
+template <class T>
+TextReader& TextReader::readNumber(T& value) {
+    if (failed) return *this;
+    if (!skipWhitespace()) {
+        failed = true;
+        return *this;
+    }
+    size_t last = tokenEnd(); // May move the buffer, so take pointers after
+    const char* first = buffer.data() + pos;
+    const char* next = parseNextNumber(first, buffer.data() + last, value);
+    if (next == nullptr) {
+        failed = true;
+        return *this;
+    }
+    pos += static_cast<size_t>(next - first);
+    return *this;
+}
+
+TextReader& TextReader::operator>>(char& value) {
+    if (failed) return *this;
+    if (!skipWhitespace()) {
+        failed = true;
+        return *this;
+    }
+    value = buffer[pos++];
+    return *this;
+}
+
+TextReader& TextReader::operator>>(string& value) {
+    if (failed) return *this;
+    if (!skipWhitespace()) {
+        failed = true;
+        return *this;
+    }
+    size_t last = tokenEnd();
+    value.assign(buffer.data() + pos, last - pos);
+    pos = last;
+    return *this;
+}
+
+TextReader& TextReader::ignore(streamsize count, int delim) {
+    if (failed) return *this;
+    bool unlimited = count == numeric_limits<streamsize>::max();
+    while (count > 0) {
+        if (pos == end && !fill()) return *this;
+        size_t avail = end - pos;
+        if (!unlimited) avail = min(avail, static_cast<size_t>(count));
+        const char* start = buffer.data() + pos;
+        const char* hit = static_cast<const char*>(memchr(start, delim, avail));
+        if (hit != nullptr) {
+            pos += static_cast<size_t>(hit - start) + 1;
+            return *this;
+        }
+        pos += avail;
+        if (!unlimited) count -= static_cast<streamsize>(avail);
+    }
+    return *this;
+}
+
+// Reposition a file reader. A target inside the buffer is reached
+// without reading again, so skipping forward through a file is cheap.
+TextReader& TextReader::seekg(long long offset) {
+    if (failed) return *this;
+    atEof = false;
+    if (offset >= bufferOffset && offset <= bufferOffset + static_cast<long long>(end)) {
+        pos = static_cast<size_t>(offset - bufferOffset);
+        return *this;
+    }
+#ifdef _WIN32
+    LARGE_INTEGER target;
+    target.QuadPart = offset;
+    bool ok = file != INVALID_HANDLE_VALUE && SetFilePointerEx(file, target, nullptr, FILE_BEGIN);
+#else
+    bool ok = fd >= 0 && ::lseek(fd, static_cast<off_t>(offset), SEEK_SET) >= 0;
+#endif
+    if (!ok) {
+        failed = true;
+        return *this;
+    }
+    bufferOffset = offset;
+    pos = end = 0;
+    return *this;
+}
+
+// Read up to the next '\n' (removed, not stored), like std::getline.
+TextReader& getline(TextReader& in, string& line) {
+    line.clear();
+    if (in.failed) return in;
+    bool extracted = false;
+    while (true) {
+        if (in.pos == in.end && !in.fill()) {
+            if (!extracted) in.failed = true;
+            return in;
+        }
+        const char* start = in.buffer.data() + in.pos;
+        size_t avail = in.end - in.pos;
+        const char* newline = static_cast<const char*>(memchr(start, '\n', avail));
+        if (newline != nullptr) {
+            line.append(start, newline);
+            in.pos += static_cast<size_t>(newline - start) + 1;
+            return in;
+        }
+        line.append(start, avail);
+        in.pos = in.end;
+        extracted = true;
+    }
+}
+
+// ===== Ticket fact log implementations =====
+
+// Block layout (little-endian):
+//   uint32 magic, uint32 rowCount,
+//   int64 minSaleTime, int64 maxSaleTime, int64 maxOrderId,
+//   uint32 columnBytes[FACT_COLUMN_COUNT],
+//   column data: zigzag varints of the delta to the previous row.
+const uint32_t FACT_BLOCK_MAGIC = 0x31424654; // "TFB1"
+const size_t FACT_BLOCK_HEADER = 4 + 4 + 8 * 3 + 4 * FACT_COLUMN_COUNT;
+
+struct FactBlockHeader {
+    uint32_t rowCount;
+    long long minTime;
+    long long maxTime;
+    long long maxOrderId;
+    uint32_t columnBytes[FACT_COLUMN_COUNT];
+    size_t totalBytes;
+};
+
+bool MappedFile::open(const string& path) {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size = static_cast<size_t>(length.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+    data = static_cast<const unsigned char*>(p);
+    size = static_cast<size_t>(st.st_size);
+#endif
+    if (!data) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap(const_cast<unsigned char*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+static void putVarint(string& out, unsigned long long v) {
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+static void encodeFactColumn(string& out, const long long* values, size_t n) {
+    long long prev = 0;
+    for (size_t i = 0; i < n; ++i) {
+        long long delta = values[i] - prev;
+        prev = values[i];
+        putVarint(out, (static_cast<unsigned long long>(delta) << 1) ^ static_cast<unsigned long long>(delta >> 63));
+    }
+}
+
+// Decode `n` values; return false if the column data is truncated.
+static bool decodeFactColumn(const unsigned char* p, size_t bytes, size_t n, long long* out) {
+    const unsigned char* end = p + bytes;
+    long long prev = 0;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned long long v = 0;
+        int shift = 0;
+        while (true) {
+            if (p == end || shift > 63) return false;
+            unsigned char b = *p++;
+            v |= static_cast<unsigned long long>(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+            shift += 7;
+        }
+        long long delta = static_cast<long long>(v >> 1) ^ -static_cast<long long>(v & 1);
+        prev += delta;
+        out[i] = prev;
+    }
+    return true;
+}
+
+// Parse the block header at `offset`; return false at end of data or on
+// a torn/corrupt block.
+static bool readFactBlockHeader(const unsigned char* data, size_t size, size_t offset, FactBlockHeader& h) {
+    if (offset + FACT_BLOCK_HEADER > size) return false;
+    const unsigned char* p = data + offset;
+    uint32_t magic;
+    memcpy(&magic, p, 4);
+    if (magic != FACT_BLOCK_MAGIC) return false;
+    memcpy(&h.rowCount, p + 4, 4);
+    memcpy(&h.minTime, p + 8, 8);
+    memcpy(&h.maxTime, p + 16, 8);
+    memcpy(&h.maxOrderId, p + 24, 8);
+    memcpy(h.columnBytes, p + 32, 4 * FACT_COLUMN_COUNT);
+
+    h.totalBytes = FACT_BLOCK_HEADER;
+    for (int c = 0; c < FACT_COLUMN_COUNT; ++c) h.totalBytes += h.columnBytes[c];
+    return offset + h.totalBytes <= size;
+}
+
+// Open (or create on first flush) the log at `path` and read the block
+// headers to restore the order ID high-water mark.
+void openTicketFactLog(TicketFactLog& log, const string& path) {
+    log.path = path;
+    for (int c = 0; c < FACT_COLUMN_COUNT; ++c) log.pending[c].clear();
+    log.maxOrderId = 0;
+    log.blockCount = 0;
+    log.rowCount = 0;
+    log.queuedRows = 0;
+    log.durableRows.store(0, memory_order_release);
+    log.writeFailed.store(false);
+
+    MappedFile file;
+    if (!file.open(path)) return; // No sales logged yet
+
+    size_t offset = 0;
+    FactBlockHeader h;
+    while (readFactBlockHeader(file.data, file.size, offset, h)) {
+        if (h.maxOrderId > log.maxOrderId) log.maxOrderId = h.maxOrderId;
+        log.rowCount += h.rowCount;
+        log.blockCount++;
+        offset += h.totalBytes;
+    }
+    if (offset != file.size) {
+        cout << "[Warning] Ignoring " << file.size - offset
+             << " trailing byte(s) of incomplete data in " << path << "." << endl;
+        file.close();
+        filesystem::resize_file(path, offset);
+    }
+    log.durableRows.store(log.rowCount, memory_order_release);
+}
+
+void appendTicketFact(TicketFactLog& log, long long orderId, const Showtime& s,
+                      int row, int col, long long priceCents, int quantity, long long saleTime) {
+    log.pending[FACT_ORDER_ID].push_back(orderId);
+    log.pending[FACT_SHOWTIME_ID].push_back(s.id);
+    log.pending[FACT_MOVIE_ID].push_back(s.movieId);
+    log.pending[FACT_HALL_ID].push_back(s.hallId);
+    log.pending[FACT_SEAT].push_back((static_cast<long long>(row) << 16) | col);
+    log.pending[FACT_PRICE].push_back(priceCents);
+    log.pending[FACT_QUANTITY].push_back(quantity);
+    log.pending[FACT_SALE_TIME].push_back(saleTime);
+    if (orderId > log.maxOrderId) log.maxOrderId = orderId;
+
+    if (log.pending[FACT_ORDER_ID].size() - log.queuedRows >= static_cast<size_t>(FACT_BLOCK_ROWS)) {
+        flushTicketFacts(log);
+    }
+}
+
+// Drop pending rows the writer has put on disk. They stay pending (and
+// visible to scans) until then.
+static void trimDurableFacts(TicketFactLog& log) {
+    long long durable = log.durableRows.load(memory_order_acquire);
+    if (durable <= log.rowCount) return;
+    size_t n = static_cast<size_t>(durable - log.rowCount);
+    for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+        log.pending[c].erase(log.pending[c].begin(), log.pending[c].begin() + n);
+    }
+    log.queuedRows -= n;
+    log.rowCount = durable;
+}
+
+// Encode the pending rows not yet handed to the writer as compressed
+// blocks and queue them for appending to the log file.
+bool flushTicketFacts(TicketFactLog& log) {
+    TraceSpan span("flush_sales_log");
+    trimDurableFacts(log);
+    bool repair = log.writeFailed.exchange(false);
+    if (repair) log.queuedRows = 0; // Everything not yet durable goes again
+    size_t total = log.pending[FACT_ORDER_ID].size();
+    if (total == log.queuedRows) return true;
+
+    WriteJob* job = new WriteJob();
+    job->kind = WRITE_APPEND;
+    job->path = log.path;
+    job->repair = repair;
+    job->log = &log;
+    job->endRow = log.rowCount + static_cast<long long>(total);
+
+    for (size_t start = log.queuedRows; start < total; start += FACT_BLOCK_ROWS) {
+        size_t n = min(total - start, static_cast<size_t>(FACT_BLOCK_ROWS));
+
+        string columns[FACT_COLUMN_COUNT];
+        for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+            encodeFactColumn(columns[c], log.pending[c].data() + start, n);
+        }
+
+        const long long* times = log.pending[FACT_SALE_TIME].data() + start;
+        const long long* orders = log.pending[FACT_ORDER_ID].data() + start;
+        long long minTime = times[0], maxTime = times[0], maxOrder = orders[0];
+        for (size_t i = 1; i < n; ++i) {
+            minTime = min(minTime, times[i]);
+            maxTime = max(maxTime, times[i]);
+            maxOrder = max(maxOrder, orders[i]);
+        }
+
+        string header(FACT_BLOCK_HEADER, '\0');
+        uint32_t rows = static_cast<uint32_t>(n);
+        memcpy(&header[0], &FACT_BLOCK_MAGIC, 4);
+        memcpy(&header[4], &rows, 4);
+        memcpy(&header[8], &minTime, 8);
+        memcpy(&header[16], &maxTime, 8);
+        memcpy(&header[24], &maxOrder, 8);
+        for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+            uint32_t bytes = static_cast<uint32_t>(columns[c].size());
+            memcpy(&header[32 + 4 * c], &bytes, 4);
+        }
+
+        job->data += header;
+        for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+            job->data += columns[c];
+        }
+        log.blockCount++;
+    }
+    log.queuedRows = total;
+
+    // Sales are money: the writer fsyncs the log before the rows count as durable
+    vector<WriteJob*> jobs{ job };
+    submitWrites(jobs);
+    trimDurableFacts(log); // Already done when no writer thread is running
+    return true;
+}
+
+// Call `fn` for every block of the log (and the pending rows), with the
+// columns selected by `columnMask` (bit i = FactColumn i) decoded. Rows
+// before `fromRow` are skipped; whole blocks of them are not decoded.
+void scanTicketFacts(const TicketFactLog& log, unsigned columnMask,
+                     const function<void(const FactBatch&)>& fn, long long fromRow) {
+    // Rows the writer appended after the last trim are both in the file
+    // and still pending; count file rows to skip them in `pending`.
+    long long fileRows = 0;
+    MappedFile file;
+    if (file.open(log.path)) {
+        vector<long long> buffers[FACT_COLUMN_COUNT];
+        size_t offset = 0;
+        FactBlockHeader h;
+        while (readFactBlockHeader(file.data, file.size, offset, h)) {
+            if (fileRows + h.rowCount <= fromRow) {
+                offset += h.totalBytes;
+                fileRows += h.rowCount;
+                continue;
+            }
+            int skip = static_cast<int>(max(fromRow - fileRows, 0LL));
+            FactBatch batch;
+            batch.rows = static_cast<int>(h.rowCount) - skip;
+
+            const unsigned char* colData = file.data + offset + FACT_BLOCK_HEADER;
+            bool ok = true;
+            for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+                if (columnMask & (1u << c)) {
+                    buffers[c].resize(h.rowCount);
+                    ok = ok && decodeFactColumn(colData, h.columnBytes[c], h.rowCount, buffers[c].data());
+                    batch.col[c] = buffers[c].data() + skip;
+                }
+                colData += h.columnBytes[c];
+            }
+            if (ok) fn(batch);
+            offset += h.totalBytes;
+            fileRows += h.rowCount;
+        }
+    }
+
+    size_t pendingRows = log.pending[FACT_ORDER_ID].size();
+    size_t skip = static_cast<size_t>(min<long long>(max({ fileRows - log.rowCount, fromRow - log.rowCount, 0LL }),
+                                                     static_cast<long long>(pendingRows)));
+    if (skip < pendingRows) {
+        FactBatch batch;
+        batch.rows = static_cast<int>(pendingRows - skip);
+        for (int c = 0; c < FACT_COLUMN_COUNT; ++c) {
+            batch.col[c] = log.pending[c].data() + skip;
+        }
+        fn(batch);
+    }
+}
+
+// Offset in seconds of local time from UTC, sampled once per query.
+static long long localUtcOffsetSeconds() {
+    time_t now = time(nullptr);
+    tm local = *localtime(&now);
+    tm utc = *gmtime(&now);
+    long long localMin = daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) * 1440
+                         + local.tm_hour * 60 + local.tm_min;
+    long long utcMin = daysFromCivil(utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday) * 1440
+                       + utc.tm_hour * 60 + utc.tm_min;
+    return (localMin - utcMin) * 60;
+}
+
+// Sum tickets and revenue per group key over the whole log. Keys are
+// first materialized into a dense array per block, then accumulated in
+// a tight loop over plain arrays.
+vector<FactGroupRow> groupTicketRevenue(const TicketFactLog& log, FactGroup group) {
+    unsigned mask = (1u << FACT_PRICE) | (1u << FACT_QUANTITY);
+    FactColumn keyColumn = FACT_SALE_TIME;
+    if (group == GROUP_BY_MOVIE) keyColumn = FACT_MOVIE_ID;
+    if (group == GROUP_BY_HALL) keyColumn = FACT_HALL_ID;
+    mask |= 1u << keyColumn;
+
+    long long utcOffset = localUtcOffsetSeconds();
+    long long minKey = 0;
+    bool haveMinKey = false;
+    vector<long long> tickets, revenue;
+    vector<long long> keys;
+
+    scanTicketFacts(log, mask, [&](const FactBatch& b) {
+        int n = b.rows;
+        const long long* src = b.col[keyColumn];
+        keys.resize(n);
+        long long* k = keys.data();
+
+        if (group == GROUP_BY_HOUR) {
+            for (int i = 0; i < n; ++i) k[i] = ((src[i] + utcOffset) / 3600) % 24;
+        } else if (group == GROUP_BY_DAY) {
+            for (int i = 0; i < n; ++i) k[i] = (src[i] + utcOffset) / 86400;
+        } else {
+            for (int i = 0; i < n; ++i) k[i] = src[i];
+        }
+
+        // Dense accumulators indexed by (key - minKey); day numbers are
+        // rebased so a few years of history stay small.
+        long long lo = k[0], hi = k[0];
+        for (int i = 1; i < n; ++i) {
+            lo = min(lo, k[i]);
+            hi = max(hi, k[i]);
+        }
+        if (!haveMinKey) {
+            minKey = lo;
+            haveMinKey = true;
+        }
+        if (lo < minKey) {
+            size_t shift = static_cast<size_t>(minKey - lo);
+            tickets.insert(tickets.begin(), shift, 0);
+            revenue.insert(revenue.begin(), shift, 0);
+            minKey = lo;
+        }
+        if (static_cast<size_t>(hi - minKey + 1) > tickets.size()) {
+            tickets.resize(hi - minKey + 1, 0);
+            revenue.resize(hi - minKey + 1, 0);
+        }
+
+        const long long* price = b.col[FACT_PRICE];
+        const long long* qty = b.col[FACT_QUANTITY];
+        long long* t = tickets.data() - minKey;
+        long long* r = revenue.data() - minKey;
+        for (int i = 0; i < n; ++i) {
+            t[k[i]] += qty[i];
+            r[k[i]] += price[i];
+        }
+    });
+
+    vector<FactGroupRow> result;
+    for (size_t i = 0; i < tickets.size(); ++i) {
+        if (tickets[i] != 0 || revenue[i] != 0) {
+            result.push_back({ minKey + static_cast<long long>(i), tickets[i], revenue[i] });
+        }
+    }
+    return result;
+}
+
+void viewRevenueAnalytics() {
+    Cinema& site = cinema();
+    cout << "\n--- Revenue Analytics (Ticket Log) ---" << endl;
+
+    if (site.ticketLog.rowCount == 0 && site.ticketLog.pending[FACT_ORDER_ID].empty()) {
+        cout << "No ticket sales have been logged yet." << endl;
+        return;
+    }
+
+    cout << "1. Revenue by movie" << endl;
+    cout << "2. Revenue by hall" << endl;
+    cout << "3. Revenue by hour of day" << endl;
+    cout << "4. Revenue by day" << endl;
+    cout << "Please enter your choice: ";
+    int choice;
+    while (!(console >> choice) || choice < 1 || choice > 4) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid option. Please enter a number between 1 and 4: ";
+    }
+    ScopedLatency timer(OP_REPORT_REVENUE_ANALYTICS); // The report, not the prompts
+
+    FactGroup group = static_cast<FactGroup>(choice - 1);
+    vector<FactGroupRow> rows = groupTicketRevenue(site.ticketLog, group);
+
+    long long totalTickets = 0;
+    long long totalRevenue = 0;
+    for (const auto& row : rows) {
+        string label;
+        if (group == GROUP_BY_MOVIE) {
+            int mIdx = findMovieIndexById(static_cast<int>(row.key));
+            label = "Movie: " + ((mIdx != -1) ? site.movies[mIdx].title : "(movie ID " + to_string(row.key) + ")");
+        } else if (group == GROUP_BY_HALL) {
+            int hIdx = findHallIndexById(static_cast<int>(row.key));
+            label = "Hall: " + ((hIdx != -1) ? site.halls[hIdx].name : "(hall ID " + to_string(row.key) + ")");
+        } else if (group == GROUP_BY_HOUR) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "Hour: %02lld:00", row.key);
+            label = buf;
+        } else {
+            label = "Date: " + formatDayNumber(row.key);
+        }
+
+        cout << label
+             << " | Tickets: " << row.tickets
+             << " | Revenue: " << fixed << setprecision(2) << row.revenueCents / 100.0
+             << endl;
+        totalTickets += row.tickets;
+        totalRevenue += row.revenueCents;
+    }
+
+    cout << "\nTotal tickets (net of refunds): " << totalTickets << endl;
+    cout << "Total revenue: " << fixed << setprecision(2) << totalRevenue / 100.0 << endl;
+}
+
+// ===== Seat analytics implementations =====
+
+void BitSlicedCounter::add(const vector<unsigned long long>& bits) {
+    vector<unsigned long long> carry = bits;
+    for (size_t k = 0; k < planes.size(); ++k) {
+        vector<unsigned long long>& plane = planes[k];
+        unsigned long long any = 0;
+        for (size_t w = 0; w < carry.size(); ++w) {
+            unsigned long long c = plane[w] & carry[w];
+            plane[w] ^= carry[w];
+            carry[w] = c;
+            any |= c;
+        }
+        if (!any) return;
+    }
+    for (unsigned long long word : carry) {
+        if (word) {
+            planes.push_back(move(carry));
+            return;
+        }
+    }
+}
+
+long long BitSlicedCounter::count(int seat) const {
+    long long n = 0;
+    for (size_t k = 0; k < planes.size(); ++k) {
+        n |= static_cast<long long>((planes[k][seat / 64] >> (seat % 64)) & 1) << k;
+    }
+    return n;
+}
+
+static TimeSlot timeSlotOfMinute(long long startMinute) {
+    long long hour = (startMinute % 1440) / 60;
+    if (hour < 12) return SLOT_MORNING;
+    if (hour < 17) return SLOT_AFTERNOON;
+    if (hour < 21) return SLOT_EVENING;
+    return SLOT_LATE;
+}
+
+static const char* const TIME_SLOT_NAMES[SLOT_COUNT] = { "Morning", "Afternoon", "Evening", "Late" };
+
+// Fold ticket log rows written since the last refresh into the seat
+// analytics. Rows of one showtime come in runs (an order's seats are
+// logged together); each run is collected into seat bitmaps that are
+// added to the hall's counters in one step. Returns the rows read.
+long long refreshSeatAnalytics() {
+    Cinema& site = cinema();
+    SeatAnalytics& a = site.seatAnalytics;
+    long long utcOffset = localUtcOffsetSeconds();
+    long long before = a.rowsConsumed;
+
+    HallHeat* heat = nullptr;
+    int runShowtimeId = -1;
+    vector<unsigned long long> soldRun, refundedRun, earlyRun;
+    auto flushRun = [&]() {
+        if (heat == nullptr) return;
+        heat->sold.add(soldRun);
+        heat->refunded.add(refundedRun);
+        heat->early.add(earlyRun);
+        fill(soldRun.begin(), soldRun.end(), 0);
+        fill(refundedRun.begin(), refundedRun.end(), 0);
+        fill(earlyRun.begin(), earlyRun.end(), 0);
+    };
+
+    unsigned mask = (1u << FACT_SHOWTIME_ID) | (1u << FACT_MOVIE_ID) | (1u << FACT_HALL_ID)
+                    | (1u << FACT_SEAT) | (1u << FACT_QUANTITY) | (1u << FACT_SALE_TIME);
+    scanTicketFacts(site.ticketLog, mask, [&](const FactBatch& b) {
+        for (int i = 0; i < b.rows; ++i) {
+            int showtimeId = static_cast<int>(b.col[FACT_SHOWTIME_ID][i]);
+            auto known = a.showtimes.find(showtimeId);
+            if (known == a.showtimes.end()) {
+                ShowtimeFill fill{ -1, 0 };
+                int sIdx = findShowtimeIndexById(showtimeId);
+                if (sIdx != -1 && site.showtimeCols.startMinute[sIdx] >= 0) {
+                    fill.startMinute = site.showtimeCols.startMinute[sIdx];
+                    fill.capacity = site.showtimeCols.capacity[sIdx];
+                    int movieId = static_cast<int>(b.col[FACT_MOVIE_ID][i]);
+                    fill.curve = &a.curves[{ movieId, timeSlotOfMinute(fill.startMinute) }];
+                    fill.curve->showtimes++;
+                    fill.curve->capacity += fill.capacity;
+                }
+                known = a.showtimes.emplace(showtimeId, fill).first;
+            }
+            ShowtimeFill& fill = known->second;
+
+            if (showtimeId != runShowtimeId) {
+                flushRun();
+                runShowtimeId = showtimeId;
+                int hallId = static_cast<int>(b.col[FACT_HALL_ID][i]);
+                auto h = a.halls.find(hallId);
+                if (h == a.halls.end()) {
+                    int hIdx = findHallIndexById(hallId);
+                    if (hIdx != -1) {
+                        h = a.halls.emplace(hallId, HallHeat()).first;
+                        h->second.rows = site.halls[hIdx].rows;
+                        h->second.cols = site.halls[hIdx].cols;
+                    }
+                }
+                heat = (h != a.halls.end()) ? &h->second : nullptr;
+                size_t words = heat ? (static_cast<size_t>(heat->rows) * heat->cols + 63) / 64 : 0;
+                soldRun.assign(words, 0);
+                refundedRun.assign(words, 0);
+                earlyRun.assign(words, 0);
+            }
+
+            long long quantity = b.col[FACT_QUANTITY][i];
+            if (fill.curve != nullptr) {
+                long long lead = fill.startMinute - (b.col[FACT_SALE_TIME][i] + utcOffset) / 60;
+                int bucket = 0;
+                while (bucket < FILL_LEAD_BUCKETS - 1 && lead < FILL_LEAD_MINUTES[bucket]) ++bucket;
+                fill.curve->tickets[bucket] += quantity;
+            }
+            bool early = quantity > 0 && fill.sold < fill.capacity / 4;
+            fill.sold += static_cast<int>(quantity);
+
+            int row = static_cast<int>(b.col[FACT_SEAT][i] >> 16) - 1;
+            int col = static_cast<int>(b.col[FACT_SEAT][i] & 0xFFFF) - 1;
+            if (heat == nullptr || row < 0 || row >= heat->rows || col < 0 || col >= heat->cols) continue;
+            int seat = row * heat->cols + col;
+            unsigned long long bit = 1ULL << (seat % 64);
+            vector<unsigned long long>& run = (quantity > 0) ? soldRun : refundedRun;
+            if (run[seat / 64] & bit) flushRun(); // Sold, refunded and sold again in one run
+            run[seat / 64] |= bit;
+            if (early) earlyRun[seat / 64] |= bit;
+        }
+        a.rowsConsumed += b.rows;
+    }, a.rowsConsumed);
+    flushRun();
+    return a.rowsConsumed - before;
+}
+
+// Net sales of every seat of a hall, scaled to 0-9, plus per-row totals
+// and the seats most often sold while a showtime was still nearly empty.
+void viewHallHeatMap() {
+    Cinema& site = cinema();
+    cout << "\n--- Seat Heat Map of a Hall ---" << endl;
+    if (site.halls.empty()) {
+        cout << "No halls available." << endl;
+        return;
+    }
+    listAllHalls(false);
+
+    int hallId;
+    cout << "\nEnter hall ID: ";
+    while (!(console >> hallId) || findHallIndexById(hallId) == -1) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid hall ID. Please enter a valid hall ID: ";
+    }
+
+    auto it = site.seatAnalytics.halls.find(hallId);
+    if (it == site.seatAnalytics.halls.end()) {
+        cout << "No ticket sales have been logged for this hall yet." << endl;
+        return;
+    }
+    const HallHeat& heat = it->second;
+    const Hall& h = site.halls[findHallIndexById(hallId)];
+
+    int seatCount = heat.rows * heat.cols;
+    vector<long long> net(static_cast<size_t>(seatCount));
+    vector<long long> early(static_cast<size_t>(seatCount));
+    long long maxNet = 0;
+    for (int i = 0; i < seatCount; ++i) {
+        net[i] = heat.sold.count(i) - heat.refunded.count(i);
+        early[i] = heat.early.count(i);
+        maxNet = max(maxNet, net[i]);
+    }
+
+    cout << "\nHall: " << h.name << " | 0 = never sold ... 9 = most sold (" << maxNet << " sales)" << endl;
+    cout << "      ";
+    for (int c = 1; c <= heat.cols; ++c) cout << (c % 10) << ' ';
+    cout << endl;
+    for (int r = 0; r < heat.rows; ++r) {
+        cout << "Row " << setw(2) << r + 1 << " ";
+        long long rowSales = 0, rowEarly = 0;
+        int rowSeats = 0;
+        for (int c = 0; c < heat.cols; ++c) {
+            int i = r * heat.cols + c;
+            bool hasSeat = r < h.rows && c < h.cols && h.layout->seatType[i] != SEAT_BLOCKED;
+            if (!hasSeat) {
+                cout << "  ";
+                continue;
+            }
+            int level = maxNet ? static_cast<int>((max(net[i], 0LL) * 9 + maxNet / 2) / maxNet) : 0;
+            cout << level << ' ';
+            rowSales += net[i];
+            rowEarly += early[i];
+            ++rowSeats;
+        }
+        cout << "| " << fixed << setprecision(1) << (rowSeats ? static_cast<double>(rowSales) / rowSeats : 0.0)
+             << " sales/seat, " << rowEarly << " early" << endl;
+    }
+
+    vector<int> order;
+    for (int i = 0; i < seatCount; ++i) {
+        if (early[i] > 0) order.push_back(i);
+    }
+    size_t shown = min<size_t>(order.size(), 10);
+    partial_sort(order.begin(), order.begin() + shown, order.end(),
+                 [&](int x, int y) { return early[x] != early[y] ? early[x] > early[y] : x < y; });
+    cout << "\nSeats that sell first (sold while the showtime was under a quarter full):" << endl;
+    for (size_t k = 0; k < shown; ++k) {
+        int i = order[k];
+        cout << "(Row " << i / heat.cols + 1 << ", Col " << i % heat.cols + 1 << "): " << early[i]
+             << " early of " << heat.sold.count(i) << " sales" << endl;
+    }
+}
+
+// For each movie and time slot: average fill of its showtimes, and which
+// share of the tickets had been sold at each lead time before the show.
+void viewFillCurves() {
+    Cinema& site = cinema();
+    cout << "\n--- Fill Curves by Movie and Time Slot ---" << endl;
+    if (site.seatAnalytics.curves.empty()) {
+        cout << "No ticket sales of current showtimes have been logged yet." << endl;
+        return;
+    }
+
+    cout << "Share of tickets sold at least 14d / 7d / 3d / 1d / 6h / 1h before the show" << endl;
+    for (const auto& entry : site.seatAnalytics.curves) {
+        const FillCurve& curve = entry.second;
+        long long total = 0;
+        for (long long t : curve.tickets) total += t;
+        if (total <= 0) continue;
+
+        int mIdx = findMovieIndexById(entry.first.first);
+        string title = (mIdx != -1) ? site.movies[mIdx].title : "(movie ID " + to_string(entry.first.first) + ")";
+        cout << title << " | " << TIME_SLOT_NAMES[entry.first.second]
+             << " | Showtimes: " << curve.showtimes
+             << " | Avg fill: " << fixed << setprecision(1)
+             << (curve.capacity ? 100.0 * total / curve.capacity : 0.0) << "% | Sold by:";
+        long long cumulative = 0;
+        for (int k = 0; k < FILL_LEAD_BUCKETS - 1; ++k) {
+            cumulative += curve.tickets[k];
+            cout << ' ' << setprecision(0) << 100.0 * cumulative / total << '%';
+        }
+        cout << endl;
+    }
+}
+
+void seatAnalyticsMenu() {
+    cout << "\n--- Seat Heat Maps and Fill Curves ---" << endl;
+
+    // Only the refresh is timed; the views below wait for the admin's choice
+    auto start = chrono::steady_clock::now();
+    long long newRows = refreshSeatAnalytics();
+    auto elapsed = chrono::steady_clock::now() - start;
+    recordLatency(OP_REPORT_SEAT_ANALYTICS,
+                  static_cast<unsigned long long>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+    double ms = chrono::duration<double, milli>(elapsed).count();
+    cout << "Read " << newRows << " new ticket log row(s) in " << fixed << setprecision(1) << ms << " ms." << endl;
+
+    cout << "1. Seat heat map of a hall" << endl;
+    cout << "2. Fill curves by movie and time slot" << endl;
+    cout << "Please enter your choice: ";
+    int choice;
+    while (!(console >> choice) || choice < 1 || choice > 2) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid option. Please enter 1 or 2: ";
+    }
+    if (choice == 1) {
+        viewHallHeatMap();
+    } else {
+        viewFillCurves();
+    }
+}
+
+// ===== Metrics implementations =====
+
+// Registry of every thread's metric block. The mutex is only taken when a
+// thread records its first value and when metrics are read.
+mutex metricsRegistryMutex;
+vector<ThreadMetrics*> metricsRegistry;
+
+static ThreadMetrics& threadMetrics() {
+    thread_local ThreadMetrics* local = nullptr;
+    if (local == nullptr) {
+        local = new ThreadMetrics(); // Zero-initialized; kept after thread exit
+        lock_guard<mutex> lock(metricsRegistryMutex);
+        metricsRegistry.push_back(local);
+    }
+    return *local;
+}
+
+static int latencyBucket(unsigned long long ns) {
+    if (ns < HIST_SUB_BUCKETS) return static_cast<int>(ns);
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - 4;
+    int sub = static_cast<int>((ns >> shift) & (HIST_SUB_BUCKETS - 1));
+    return (shift + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+// Highest value (ns) that falls into `bucket`
+static unsigned long long latencyBucketUpper(int bucket) {
+    if (bucket < HIST_SUB_BUCKETS) return static_cast<unsigned long long>(bucket);
+    int shift = bucket / HIST_SUB_BUCKETS - 1;
+    unsigned long long sub = bucket % HIST_SUB_BUCKETS;
+    return ((HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+ScopedLatency::~ScopedLatency() {
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    recordLatency(op, static_cast<unsigned long long>(ns));
+}
+
+// Only the owning thread writes its block, so relaxed atomics suffice;
+// they keep concurrent readers free of torn values.
+void recordLatency(MetricOp op, unsigned long long ns) {
+    ThreadMetrics& m = threadMetrics();
+    m.latency[op][latencyBucket(ns)].fetch_add(1, memory_order_relaxed);
+    m.latencySumNs[op].fetch_add(ns, memory_order_relaxed);
+    if (ns > m.latencyMaxNs[op].load(memory_order_relaxed)) {
+        m.latencyMaxNs[op].store(ns, memory_order_relaxed);
+    }
+}
+
+void countMetric(MetricCounter counter, long long delta) {
+    threadMetrics().counters[counter].fetch_add(delta, memory_order_relaxed);
+}
+
+// Force a written file to stable storage.
+bool syncFileToDisk(const string& path) {
+    bool ok = false;
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h != INVALID_HANDLE_VALUE) {
+        ok = FlushFileBuffers(h) != 0;
+        CloseHandle(h);
+    }
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd >= 0) {
+        ok = fsync(fd) == 0;
+        ::close(fd);
+    }
+#endif
+    countMetric(COUNTER_FSYNCS);
+    return ok;
+}
+
+// Merged view of one operation's histogram
+struct LatencySummary {
+    unsigned long long count = 0;
+    unsigned long long sumNs = 0;
+    unsigned long long maxNs = 0;
+    vector<unsigned long long> buckets = vector<unsigned long long>(HIST_BUCKETS, 0);
+
+    unsigned long long quantileNs(double q) const {
+        unsigned long long rank = static_cast<unsigned long long>(ceil(q * count));
+        if (rank == 0) rank = 1;
+        unsigned long long seen = 0;
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            seen += buckets[b];
+            if (seen >= rank) return min(latencyBucketUpper(b), maxNs);
+        }
+        return maxNs;
+    }
+};
+
+static void mergeMetrics(vector<LatencySummary>& ops, vector<long long>& counters) {
+    ops.assign(OP_COUNT, LatencySummary());
+    counters.assign(COUNTER_COUNT, 0);
+
+    lock_guard<mutex> lock(metricsRegistryMutex);
+    for (const ThreadMetrics* m : metricsRegistry) {
+        for (int op = 0; op < OP_COUNT; ++op) {
+            LatencySummary& sum = ops[op];
+            for (int b = 0; b < HIST_BUCKETS; ++b) {
+                unsigned long long n = m->latency[op][b].load(memory_order_relaxed);
+                sum.buckets[b] += n;
+                sum.count += n;
+            }
+            sum.sumNs += m->latencySumNs[op].load(memory_order_relaxed);
+            sum.maxNs = max(sum.maxNs, m->latencyMaxNs[op].load(memory_order_relaxed));
+        }
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            counters[c] += m->counters[c].load(memory_order_relaxed);
+        }
+    }
+}
+
+static const char* const METRIC_OP_NAMES[OP_COUNT] = {
+    "ticket_purchase", "save_data", "load_data", "report_showtime_status",
+    "report_movie_totals", "report_sales_overview", "report_archived_sales",
+    "report_revenue_analytics", "report_seat_analytics", "replication_lag", "admission_wait"
+};
+
+static const char* const METRIC_COUNTER_NAMES[COUNTER_COUNT] = {
+    "bookings_total", "seats_sold_total", "refunds_total", "save_bytes_total", "fsyncs_total",
+    "seat_map_loads_total", "write_batches_total", "writes_coalesced_total",
+    "waitlist_offers_total", "waitlist_offers_expired_total",
+    "replication_frames_total", "replication_bytes_total", "replication_resyncs_total",
+    "sessions_served_total", "sessions_timed_out_total",
+    "admissions_queued_total", "admission_turns_expired_total"
+};
+
+// Metrics in the Prometheus text exposition format.
+string formatMetricsText() {
+    Cinema& site = cinema();
+    vector<LatencySummary> ops;
+    vector<long long> counters;
+    mergeMetrics(ops, counters);
+
+    ostringstream out;
+    out << "# TYPE mts_op_latency_seconds summary\n";
+    const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (int op = 0; op < OP_COUNT; ++op) {
+        const LatencySummary& sum = ops[op];
+        for (double q : quantiles) {
+            out << "mts_op_latency_seconds{op=\"" << METRIC_OP_NAMES[op] << "\",quantile=\"" << q << "\"} "
+                << (sum.count ? sum.quantileNs(q) / 1e9 : 0.0) << '\n';
+        }
+        out << "mts_op_latency_seconds_sum{op=\"" << METRIC_OP_NAMES[op] << "\"} " << sum.sumNs / 1e9 << '\n';
+        out << "mts_op_latency_seconds_count{op=\"" << METRIC_OP_NAMES[op] << "\"} " << sum.count << '\n';
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        out << "# TYPE mts_" << METRIC_COUNTER_NAMES[c] << " counter\n";
+        out << "mts_" << METRIC_COUNTER_NAMES[c] << ' ' << counters[c] << '\n';
+    }
+
+    pair<const char*, size_t> gauges[] = {
+        { "movies", site.movies.size() },
+        { "halls", site.halls.size() },
+        { "showtimes", site.showtimes.size() },
+        { "orders", site.orders.size() },
+        { "archive_segments", site.archiveSegments.size() },
+        { "replication_frames_behind", static_cast<size_t>(replicationFramesBehind()) },
+        { "sessions_open", static_cast<size_t>(sessionServer.openSessions.load()) }
+    };
+    for (const auto& g : gauges) {
+        out << "# TYPE mts_" << g.first << " gauge\n";
+        out << "mts_" << g.first << ' ' << g.second << '\n';
+    }
+    return out.str();
+}
+
+void viewSystemMetrics() {
+    Cinema& site = cinema();
+    cout << "\n--- System Metrics ---" << endl;
+
+    vector<LatencySummary> ops;
+    vector<long long> counters;
+    mergeMetrics(ops, counters);
+
+    cout << left << setw(26) << "Operation" << right
+         << setw(8) << "Count" << setw(12) << "Mean ms" << setw(12) << "p50 ms"
+         << setw(12) << "p99 ms" << setw(12) << "Max ms" << endl;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        const LatencySummary& sum = ops[op];
+        double mean = sum.count ? sum.sumNs / 1e6 / sum.count : 0.0;
+        cout << left << setw(26) << METRIC_OP_NAMES[op] << right
+             << setw(8) << sum.count << fixed << setprecision(3)
+             << setw(12) << mean
+             << setw(12) << (sum.count ? sum.quantileNs(0.5) / 1e6 : 0.0)
+             << setw(12) << (sum.count ? sum.quantileNs(0.99) / 1e6 : 0.0)
+             << setw(12) << sum.maxNs / 1e6 << endl;
+    }
+
+    cout << endl;
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        cout << left << setw(26) << METRIC_COUNTER_NAMES[c] << right << setw(8) << counters[c] << endl;
+    }
+    cout << left << setw(26) << "movies" << right << setw(8) << site.movies.size() << endl;
+    cout << left << setw(26) << "halls" << right << setw(8) << site.halls.size() << endl;
+    cout << left << setw(26) << "showtimes" << right << setw(8) << site.showtimes.size() << endl;
+    cout << left << setw(26) << "orders" << right << setw(8) << site.orders.size() << endl;
+    if (replication.enabled.load()) {
+        cout << left << setw(26) << "replication_frames_behind" << right << setw(8)
+             << replicationFramesBehind() << endl;
+    }
+    if (sessionServer.enabled.load()) {
+        cout << left << setw(26) << "sessions_open" << right << setw(8) << sessionServer.openSessions.load() << endl;
+    }
+
+    ofstream fout(METRICS_FILE);
+    if (!fout) {
+        cout << "[Error] Failed to open metrics file for writing." << endl;
+        return;
+    }
+    fout << formatMetricsText();
+    cout << "\nMachine-readable metrics written to " << METRICS_FILE << "." << endl;
+}
+
+// ===== Tracing implementations =====
+
+mutex traceRegistryMutex;
+vector<ThreadTrace*> traceRegistry;
+const chrono::steady_clock::time_point traceEpoch = chrono::steady_clock::now();
+
+static long long traceNowNs() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - traceEpoch).count();
+}
+
+static ThreadTrace& threadTrace() {
+    thread_local ThreadTrace* local = nullptr;
+    if (local == nullptr) {
+        local = new ThreadTrace(); // Zero-initialized; kept after thread exit
+        lock_guard<mutex> lock(traceRegistryMutex);
+        local->tid = static_cast<int>(traceRegistry.size()) + 1;
+        traceRegistry.push_back(local);
+    }
+    return *local;
+}
+
+TraceSpan::TraceSpan(const char* spanName) : name(spanName) {
+    if (tracingEnabled.load(memory_order_relaxed)) {
+        startNs = traceNowNs();
+    }
+}
+
+void TraceSpan::end() {
+    if (startNs < 0) return;
+    long long duration = traceNowNs() - startNs;
+
+    // Single writer per ring; `seq` lets the exporter skip slots that are
+    // being overwritten while it reads them.
+    ThreadTrace& t = threadTrace();
+    unsigned long long index = t.written.load(memory_order_relaxed);
+    TraceEvent& e = t.events[index % TRACE_RING_SIZE];
+    e.seq.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e.name.store(name, memory_order_relaxed);
+    e.startNs.store(startNs, memory_order_relaxed);
+    e.durationNs.store(duration, memory_order_relaxed);
+    e.seq.store(index + 1, memory_order_release);
+    t.written.store(index + 1, memory_order_release);
+    startNs = -1;
+}
+
+// Write every buffered span as a Chrome trace-event JSON document.
+bool exportTraceJson(const string& path) {
+    ofstream fout(path);
+    if (!fout) return false;
+
+    fout << "{\"traceEvents\":[\n";
+    bool first = true;
+    lock_guard<mutex> lock(traceRegistryMutex);
+    for (ThreadTrace* t : traceRegistry) {
+        unsigned long long written = t->written.load(memory_order_acquire);
+        unsigned long long begin = (written > TRACE_RING_SIZE) ? written - TRACE_RING_SIZE : 0;
+        for (unsigned long long i = begin; i < written; ++i) {
+            TraceEvent& e = t->events[i % TRACE_RING_SIZE];
+            unsigned long long seq = e.seq.load(memory_order_acquire);
+            const char* name = e.name.load(memory_order_relaxed);
+            long long start = e.startNs.load(memory_order_relaxed);
+            long long duration = e.durationNs.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (seq != i + 1 || e.seq.load(memory_order_relaxed) != seq) continue;
+
+            if (!first) fout << ",\n";
+            first = false;
+            fout << "{\"name\":\"" << name << "\",\"cat\":\"mts\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t->tid
+                 << ",\"ts\":" << fixed << setprecision(3) << start / 1000.0
+                 << ",\"dur\":" << duration / 1000.0 << "}";
+        }
+    }
+    fout << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(fout);
+}
+
+void clearTraceBuffers() {
+    lock_guard<mutex> lock(traceRegistryMutex);
+    for (ThreadTrace* t : traceRegistry) {
+        t->written.store(0, memory_order_release);
+        for (auto& e : t->events) e.seq.store(0, memory_order_relaxed);
+    }
+}
+
+void tracingMenu() {
+    int choice = -1;
+    while (true) {
+        cout << "\n---------- Tracing ----------" << endl;
+        cout << "Tracing is currently " << (tracingEnabled.load() ? "ON" : "OFF") << "." << endl;
+        cout << "1. Turn tracing " << (tracingEnabled.load() ? "off" : "on") << endl;
+        cout << "2. Export trace to " << TRACE_FILE << endl;
+        cout << "3. Clear trace buffers" << endl;
+        cout << "0. Back" << endl;
+        cout << "-----------------------------" << endl;
+        cout << "Please enter your choice: ";
+        console >> choice;
+
+        if (!console) {
+            console.clear();
+            console.ignore(10000, '\n');
+            cout << "Invalid input. Please enter a number option." << endl;
+            continue;
+        }
+
+        if (choice == 0) {
+            cout << "Returning to admin menu..." << endl;
+            break;
+        }
+
+        switch (choice) {
+        case 1:
+            tracingEnabled.store(!tracingEnabled.load());
+            cout << "Tracing turned " << (tracingEnabled.load() ? "on" : "off") << "." << endl;
+            break;
+        case 2:
+            if (exportTraceJson(TRACE_FILE)) {
+                cout << "Trace written to " << TRACE_FILE
+                     << " (open it in chrome://tracing or ui.perfetto.dev)." << endl;
+            } else {
+                cout << "[Error] Failed to write trace file." << endl;
+            }
+            break;
+        case 3:
+            clearTraceBuffers();
+            cout << "Trace buffers cleared." << endl;
+            break;
+        default:
+            cout << "Invalid option. Please try again." << endl;
+        }
+    }
+}
+
+// ===== Command line modes =====
+
+// Non-interactive entry points, e.g. "main.exe --bench-soa 1000000".
+int runCommandLineMode(int argc, char* argv[]) {
+    string mode = argv[1];
+
+    // Replication modes serve the console like a normal start
+    if (mode == "--primary" || mode == "--standby") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " " << mode << " <socket>" << endl;
+            return 1;
+        }
+        if (mode == "--standby") return runStandby(argv[2]);
+        if (!startReplicationPrimary(argv[2])) return 1;
+        openTicketOffice();
+        return runTicketOffice();
+    }
+
+    // Customers buy over a socket while the console serves as usual
+    if (mode == "--serve-sessions") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " " << mode << " <socket>" << endl;
+            return 1;
+        }
+        openTicketOffice();
+        if (!startSessionServer(argv[2], *cinemas.front())) return 1;
+        return runTicketOffice();
+    }
+
+    // Benchmarks run on this thread against a scratch site
+    Cinema scratch;
+    scratch.name = "bench";
+    currentCinema = &scratch;
+
+    if (mode == "--self-test") {
+        return runSelfTests() == 0 ? 0 : 1;
+    }
+    if (mode == "--bench-soa") {
+        int rowCount = (argc > 2) ? atoi(argv[2]) : 1000000;
+        if (rowCount <= 0) {
+            cout << "Row count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkShowtimeScans(rowCount);
+        return 0;
+    }
+    if (mode == "--bench-facts") {
+        long long rowCount = (argc > 2) ? atoll(argv[2]) : 10000000;
+        if (rowCount <= 0) {
+            cout << "Row count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkTicketFacts(rowCount);
+        return 0;
+    }
+
+    if (mode == "--bench-pricing") {
+        int quoteCount = (argc > 2) ? atoi(argv[2]) : 5000000;
+        if (quoteCount <= 0) {
+            cout << "Quote count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkPricing(quoteCount);
+        return 0;
+    }
+
+    if (mode == "--bench-startup") {
+        int showtimeCount = (argc > 2) ? atoi(argv[2]) : 20000;
+        if (showtimeCount <= 0) {
+            cout << "Showtime count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkColdStart(showtimeCount);
+        return 0;
+    }
+
+    if (mode == "--bench-kernels") {
+        int iterations = (argc > 2) ? atoi(argv[2]) : 200000;
+        if (iterations <= 0) {
+            cout << "Iteration count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkSeatKernels(iterations);
+        return 0;
+    }
+
+    if (mode == "--bench-input") {
+        int recordCount = (argc > 2) ? atoi(argv[2]) : 500000;
+        if (recordCount <= 0) {
+            cout << "Record count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkTextInput(recordCount);
+        return 0;
+    }
+
+    if (mode == "--bench-batch") {
+        int groups = (argc > 2) ? atoi(argv[2]) : 200;
+        if (groups <= 0) {
+            cout << "Group count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkBatchBooking(groups);
+        return 0;
+    }
+    if (mode == "--bench-sessions") {
+        int sessionCount = (argc > 2) ? atoi(argv[2]) : 10000;
+        if (sessionCount <= 0) {
+            cout << "Session count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkPurchaseSessions(sessionCount);
+        return 0;
+    }
+    if (mode == "--bench-flash-sale") {
+        int customerCount = (argc > 2) ? atoi(argv[2]) : 3000;
+        if (customerCount <= 0) {
+            cout << "Customer count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkFlashSale(customerCount);
+        return 0;
+    }
+    if (mode == "--bench-schedule") {
+        int hallCount = (argc > 2) ? atoi(argv[2]) : 20;
+        if (hallCount <= 0) {
+            cout << "Hall count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkScheduleOptimizer(hallCount);
+        return 0;
+    }
+    if (mode == "--bench-search") {
+        int titleCount = (argc > 2) ? atoi(argv[2]) : 100000;
+        if (titleCount <= 0) {
+            cout << "Title count must be a positive integer." << endl;
+            return 1;
+        }
+        benchmarkTitleSearch(titleCount);
+        return 0;
+    }
+
+    if (mode == "--generate") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " --generate <dir> [movies] [halls] [weeks] [bookings] [seed]" << endl;
+            return 1;
+        }
+        int movieCount = (argc > 3) ? atoi(argv[3]) : 2000;
+        int hallCount = (argc > 4) ? atoi(argv[4]) : 20;
+        int weeks = (argc > 5) ? atoi(argv[5]) : 4;
+        int traceLength = (argc > 6) ? atoi(argv[6]) : 100000;
+        unsigned long long seed = (argc > 7) ? strtoull(argv[7], nullptr, 10) : 1;
+        if (movieCount <= 0 || hallCount <= 0 || weeks <= 0 || traceLength < 0) {
+            cout << "Counts must be positive integers." << endl;
+            return 1;
+        }
+        return generateSyntheticSite(argv[2], movieCount, hallCount, weeks, traceLength, seed) ? 0 : 1;
+    }
+    if (mode == "--check") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " --check <dir> [--repair]" << endl;
+            return 1;
+        }
+        scratch.name = argv[2];
+        scratch.dataDir = argv[2];
+        bool repair = argc > 3 && string(argv[3]) == "--repair";
+        startBackgroundWriter();
+        if (repair) loadDataFromFiles();
+        bool clean = checkDataFilesMenu(repair) == 0;
+        stopBackgroundWriter();
+        return clean ? 0 : 1;
+    }
+    if (mode == "--replay") {
+        if (argc < 3) {
+            cout << "Usage: " << argv[0] << " --replay <dir> [trace]" << endl;
+            return 1;
+        }
+        string dir = argv[2];
+        string tracePath = (argc > 3) ? argv[3] : dir + "/" + BOOKING_TRACE_FILE;
+        return replayBookingTrace(dir, tracePath) ? 0 : 1;
+    }
+
+    cout << "Unknown option: " << mode << endl;
+    cout << "Usage: " << argv[0] <<  " [--bench-soa [rows] | --bench-facts [rows] | --bench-pricing [quotes]"
+         << " | --bench-search [titles] | --bench-startup [showtimes] | --bench-batch [groups]"
+         << " | --bench-kernels [iterations] | --bench-input [records]"
+         << " | --generate <dir> [movies] [halls] [weeks] [bookings] [seed] | --replay <dir> [trace]"
+         << " | --check <dir> [--repair] | --primary <socket> | --standby <socket>"
+         << " | --serve-sessions <socket> | --bench-sessions [sessions] | --bench-flash-sale [customers]"
+         << " | --bench-schedule [halls] | --self-test]" << endl;
+    return 1;
+}
+
+// Make a new, empty directory for scratch data under the system's temp
+// directory, never one that already exists, so removing it afterwards
+// cannot take anyone's files with it. Empty on failure.
+static string makeScratchDirectory(const string& name) {
+    error_code ec;
+    filesystem::path base = filesystem::temp_directory_path(ec);
+    if (ec) {
+        cout << "[Error] No temporary directory for scratch data: " << ec.message() << endl;
+        return "";
+    }
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        filesystem::path dir = base / ("mts_" + name + "_" + to_string(getpid()) + "_" + to_string(attempt));
+        if (filesystem::create_directory(dir, ec)) return dir.string();
+        if (ec) break;
+    }
+    cout << "[Error] Could not create a scratch directory under " << base.string() << "." << endl;
+    return "";
+}
+
+// Fill the current site with the scratch catalog the benchmarks share:
+// `movieCount` movies, one 20x30 hall and `showtimeCount` showtimes,
+// eight a day from 2099-01-01, taking the movies in turn. With
+// `soldOneIn` > 0 about one seat in that many is sold, the same seats on
+// every run.
+static void fillBenchSite(int movieCount, int showtimeCount, int soldOneIn) {
+    Cinema& site = cinema();
+    for (int i = 1; i <= movieCount; ++i) {
+        site.movies.push_back({ i, movieCount == 1 ? string("Benchmark") : "Benchmark Movie " + to_string(i), "PG", 120 });
+    }
+    Hall h;
+    h.id = 1;
+    h.name = "Bench";
+    h.floor = 1;
+    h.rows = 20;
+    h.cols = 30;
+    h.layout = defaultHallLayout(h.rows, h.cols);
+    site.halls.push_back(h);
+
+    unsigned int seed = 2024;
+    for (int i = 0; i < showtimeCount; ++i) {
+        Showtime s;
+        s.id = i + 1;
+        s.movieId = i % movieCount + 1;
+        s.hallId = 1;
+        s.datetime = formatDayNumber(parseDayNumber("2099-01-01") + i / 8) + " "
+                     + to_string(10 + (i % 8) * 2) + ":00";
+        s.price = 10.0;
+        initShowtimeSeats(s, h.layout);
+        for (int r = 0; soldOneIn > 0 && r < s.rows; ++r) {
+            for (int c = 0; c < s.cols; ++c) {
+                seed = seed * 1103515245u + 12345u;
+                if ((seed >> 16) % soldOneIn == 0) setSeatSold(s, r, c, true);
+            }
+        }
+        site.showtimes.push_back(s);
+    }
+    site.nextShowtimeId = showtimeCount + 1;
+    rebuildMovieTitleIndex();
+    rebuildListingIndexes();
+    rebuildShowtimeColumns();
+}
+
+// Compare a report scan over whole showtime structs against the column
+// scan on a synthetic schedule. Both sides read the same cached totals
+// (sold, revenue, capacity per showtime), so only the layout differs.
+// Uses local data only, the real catalog is untouched.
+void benchmarkShowtimeScans(int rowCount) {
+    const int movieCount = 500;
+    const int rowsPerHall = 4;
+    const int colsPerHall = 5;
+
+    cout << "Building " << rowCount << " synthetic showtimes..." << endl;
+
+    // A showtime with its cached totals stored alongside, as a row store would
+    struct ShowtimeRow {
+        Showtime s;
+        int sold;
+        int capacity;
+        long long revenueCents;
+    };
+    vector<ShowtimeRow> rowsAoS;
+    rowsAoS.reserve(rowCount);
+    ShowtimeColumns cols;
+
+    unsigned int seed = 12345;
+    for (int i = 0; i < rowCount; ++i) {
+        Showtime s;
+        s.id = i + 1;
+        s.movieId = i % movieCount + 1;
+        s.hallId = i % 20 + 1;
+        s.datetime = "2025-01-01 19:30";
+        s.price = 8.0 + (i % 5);
+        initShowtimeSeats(s, defaultHallLayout(rowsPerHall, colsPerHall));
+        for (int r = 0; r < s.rows; ++r) {
+            for (int c = 0; c < s.cols; ++c) {
+                seed = seed * 1103515245u + 12345u;
+                if ((seed >> 16) % 3 == 0) setSeatSold(s, r, c, true);
+            }
+        }
+        appendShowtimeColumns(cols, s);
+        rowsAoS.push_back({ s, cols.sold.back(), cols.capacity.back(), cols.revenueCents.back() });
+    }
+
+    const int repeats = 5;
+    auto timeIt = [&](const char* label, auto&& fn) {
+        auto start = chrono::steady_clock::now();
+        long long check = 0;
+        for (int k = 0; k < repeats; ++k) {
+            check += fn(k);
+        }
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repeats;
+        cout << left << setw(28) << label << fixed << setprecision(3)
+             << ms << " ms/scan (checksum " << check << ")" << endl;
+        return ms;
+    };
+
+    double aosTotal = timeIt("overview, vector<Showtime>", [&](int) {
+        long long sold = 0, revenue = 0, seats = 0;
+        for (const auto& row : rowsAoS) {
+            sold += row.sold;
+            revenue += row.revenueCents;
+            seats += row.capacity;
+        }
+        return sold + revenue / 100 + seats;
+    });
+    double soaTotal = timeIt("overview, columns", [&](int) {
+        SalesTotals t = sumSales(cols);
+        return t.ticketsSold + t.revenueCents / 100 + t.capacity;
+    });
+
+    double aosMovie = timeIt("per movie, vector<Showtime>", [&](int k) {
+        int movieId = k % movieCount + 1;
+        long long sold = 0;
+        for (const auto& row : rowsAoS) {
+            if (row.s.movieId == movieId) sold += row.sold;
+        }
+        return sold;
+    });
+    double soaMovie = timeIt("per movie, columns", [&](int k) {
+        return sumSalesForMovie(cols, k % movieCount + 1).ticketsSold;
+    });
+
+    cout << "Speedup (overview) : " << fixed << setprecision(1) << aosTotal / soaTotal << "x" << endl;
+    cout << "Speedup (per movie): " << fixed << setprecision(1) << aosMovie / soaMovie << "x" << endl;
+}
+
+// Append `rowCount` synthetic ticket facts to a scratch log and time the
+// revenue group-by queries over it.
+void benchmarkTicketFacts(long long rowCount) {
+    string path = (filesystem::temp_directory_path() / "mts_bench_sales.log").string();
+    filesystem::remove(path);
+
+    TicketFactLog log;
+    openTicketFactLog(log, path);
+
+    cout << "Writing " << rowCount << " synthetic ticket facts to " << path << "..." << endl;
+    auto start = chrono::steady_clock::now();
+
+    Showtime s;
+    unsigned int seed = 12345;
+    long long saleTime = 1735689600; // 2025-01-01 00:00 UTC
+    for (long long i = 0; i < rowCount; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        s.id = static_cast<int>(i / 50) + 1;
+        s.movieId = static_cast<int>((seed >> 8) % 200) + 1;
+        s.hallId = s.id % 20 + 1;
+        saleTime += (seed >> 20) % 8;
+        appendTicketFact(log, i / 3 + 1, s, static_cast<int>(i % 15) + 1, static_cast<int>(i % 20) + 1,
+                         800 + (seed >> 24) % 700, 1, saleTime);
+    }
+    flushTicketFacts(log);
+
+    double writeSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long long fileBytes = static_cast<long long>(filesystem::file_size(path));
+    cout << "Write: " << fixed << setprecision(2) << writeSec << " s, "
+         << log.blockCount << " blocks, " << fixed << setprecision(2)
+         << static_cast<double>(fileBytes) / rowCount << " bytes/row on disk" << endl;
+
+    const char* labels[] = { "by movie", "by hall", "by hour", "by day" };
+    for (int g = 0; g < 4; ++g) {
+        start = chrono::steady_clock::now();
+        vector<FactGroupRow> rows = groupTicketRevenue(log, static_cast<FactGroup>(g));
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        long long tickets = 0;
+        for (const auto& r : rows) tickets += r.tickets;
+        cout << "Revenue " << left << setw(9) << labels[g] << fixed << setprecision(3) << sec << " s, "
+             << fixed << setprecision(1) << rowCount / sec / 1e6 << " M rows/s ("
+             << rows.size() << " groups, " << tickets << " tickets)" << endl;
+    }
+
+    filesystem::remove(path);
+}
+
+// Quote 4-seat orders on a 20 x 30 hall, evaluating every rule per seat
+// versus the compiled tier table with cached per-tier prices.
+void benchmarkPricing(int quoteCount) {
+    Cinema& site = cinema();
+    Hall h{ 1, "Bench Hall", 1, 20, 30, defaultHallLayout(20, 30) };
+    site.halls.push_back(h);
+
+    Showtime s;
+    s.id = 1;
+    s.movieId = 1;
+    s.hallId = h.id;
+    s.datetime = "2025-01-01 19:30";
+    s.price = 12.5;
+    initShowtimeSeats(s, h.layout);
+    site.showtimes.push_back(s);
+    rebuildShowtimeColumns();
+    site.showtimeCols.sold[0] = s.rows * s.cols * 3 / 4; // Surge range
+
+    // Every zone, time and occupancy step priced differently
+    PricingRules rules;
+    rules.frontMultiplier = 0.8;
+    rules.premiumMultiplier = 1.2;
+    rules.matineeMultiplier = 0.85;
+    rules.eveningMultiplier = 1.15;
+    rules.surgeMultiplier = 1.1;
+    rules.peakMultiplier = 1.25;
+    site.hallPricingRules[h.id] = rules;
+    long long startMinute = site.showtimeCols.startMinute[0];
+    long long basePrice = site.showtimeCols.priceCents[0];
+
+    vector<vector<pair<int, int>>> requests(1024);
+    unsigned int seed = 12345;
+    for (auto& o : requests) {
+        seed = seed * 1103515245u + 12345u;
+        int row = static_cast<int>((seed >> 8) % s.rows) + 1;
+        int col = static_cast<int>((seed >> 16) % (s.cols - 3)) + 1;
+        for (int k = 0; k < 4; ++k) o.push_back({ row, col + k });
+    }
+
+    auto start = chrono::steady_clock::now();
+    long long naiveSum = 0;
+    for (int i = 0; i < quoteCount; ++i) {
+        for (const auto& seat : requests[i & 1023]) {
+            double occupancy = static_cast<double>(site.showtimeCols.sold[0]) / site.showtimeCols.capacity[0];
+            SeatTier tier = seatTierFromRules(rules, s.rows, s.cols, seat.first - 1, seat.second - 1);
+            naiveSum += llround(basePrice * tierMultiplier(rules, tier)
+                                * (timeOfDayMultiplier(rules, startMinute)
+                                   * occupancyMultiplier(rules, occupancy)));
+        }
+    }
+    double naiveSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    long long tableSum = 0;
+    for (int i = 0; i < quoteCount; ++i) {
+        tableSum += quoteSeats(0, requests[i & 1023], nullptr);
+    }
+    double tableSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Per-seat rule evaluation: " << fixed << setprecision(2) << quoteCount / naiveSec / 1e6
+         << " M quotes/s (checksum " << naiveSum << ")" << endl;
+    cout << "Compiled tier table     : " << fixed << setprecision(2) << quoteCount / tableSec / 1e6
+         << " M quotes/s (checksum " << tableSum << ")" << endl;
+    cout << "Speedup: " << fixed << setprecision(1) << naiveSec / tableSec << "x" << endl;
+}
+
+// Time seat counting and free-run search with the bitmap kernels and
+// seat by seat on the same seat maps (about 40% and 85% sold) of common
+// hall shapes, and check that both give the same answers. Each timing is
+// the best of three rounds.
+void benchmarkSeatKernels(int iterations) {
+    const int mapsPerShape = 64;
+    const int groupSizes[] = { 2, 4, 6 };
+    const pair<int, int> shapes[] = { { 10, 12 }, { 12, 16 }, { 15, 20 }, { 18, 24 }, { 20, 30 } };
+    unsigned int seed = 2024;
+
+    cout << left << setw(8) << "Shape" << right << setw(6) << "Sold"
+         << setw(12) << "count ns" << setw(14) << "seat-by-seat" << setw(9) << "speedup"
+         << setw(12) << "search ns" << setw(14) << "seat-by-seat" << setw(9) << "speedup" << endl;
+    for (const auto& shape : shapes) {
+        shared_ptr<const HallLayout> layout = defaultHallLayout(shape.first, shape.second);
+        for (int density : { 40, 85 }) {
+            vector<Showtime> maps(mapsPerShape);
+            for (Showtime& s : maps) {
+                s.id = 0;
+                initShowtimeSeats(s, layout);
+                for (int r = 0; r < s.rows; ++r) {
+                    for (int c = 0; c < s.cols; ++c) {
+                        seed = seed * 1103515245u + 12345u;
+                        if (static_cast<int>((seed >> 16) % 100) < density) setSeatSold(s, r, c, true);
+                    }
+                }
+            }
+
+            // 0 = bitmap, 1 = seat by seat
+            long long countSum[2] = { 0, 0 }, searchSum[2] = { 0, 0 };
+            double countNs[2] = { 1e18, 1e18 }, searchNs[2] = { 1e18, 1e18 };
+            int searches = max(1, iterations / 10);
+            for (int round = 0; round < 3; ++round) {
+                for (int variant = 0; variant < 2; ++variant) {
+                    long long sum = 0;
+                    auto start = chrono::steady_clock::now();
+                    for (int i = 0; i < iterations; ++i) {
+                        const Showtime& s = maps[i % mapsPerShape];
+                        if (variant == 0) {
+                            sum += countSeatBits(s.soldBits.data(), s.soldBits.size());
+                        } else {
+                            for (int r = 0; r < s.rows; ++r) {
+                                for (int c = 0; c < s.cols; ++c) sum += isSeatSold(s, r, c);
+                            }
+                        }
+                    }
+                    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                    countNs[variant] = min(countNs[variant], ns / iterations);
+                    countSum[variant] = sum;
+
+                    bool (*findRun)(const Showtime&, int, int&, int&) = (variant == 0) ? findSeatRun : findSeatRunScalar;
+                    sum = 0;
+                    start = chrono::steady_clock::now();
+                    for (int i = 0; i < searches; ++i) {
+                        int row, col;
+                        if (findRun(maps[i % mapsPerShape], groupSizes[i % 3], row, col)) {
+                            sum += row * 1000 + col;
+                        }
+                    }
+                    ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                    searchNs[variant] = min(searchNs[variant], ns / searches);
+                    searchSum[variant] = sum;
+                }
+            }
+            bool match = countSum[0] == countSum[1] && searchSum[0] == searchSum[1];
+
+            string name = to_string(shape.first) + "x" + to_string(shape.second);
+            cout << left << setw(8) << name << right << setw(5) << density << '%' << fixed << setprecision(1)
+                 << setw(12) << countNs[0] << setw(14) << countNs[1] << setw(8) << countNs[1] / countNs[0] << 'x'
+                 << setw(12) << searchNs[0] << setw(14) << searchNs[1] << setw(8) << searchNs[1] / searchNs[0] << 'x'
+                 << (match ? "" : "  MISMATCH") << endl;
+        }
+    }
+}
+
+// Read the same file of menu answers and record lines once through an
+// ifstream and once through TextReader, with the same sequence of
+// extractions, and check that both read the same values. Each timing is
+// the best of three rounds.
+template <class Reader>
+static long long readTextInputRecords(Reader& in, int recordCount) {
+    long long sum = 0;
+    string line;
+    for (int i = 0; i < recordCount; ++i) {
+        int choice;
+        double price;
+        long long id;
+        int rows, cols, sold;
+        in >> choice;
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+        in >> price;
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(in, line);
+        in >> id >> rows >> cols >> sold;
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (!in) break;
+        sum += choice + static_cast<long long>(price * 100 + 0.5) + static_cast<long long>(line.size())
+               + id + rows * cols + sold;
+    }
+    return sum;
+}
+
+void benchmarkTextInput(int recordCount) {
+    const string path = "bench_input.txt";
+    {
+        ofstream fout(path, ios::binary);
+        unsigned int seed = 7;
+        for (int i = 0; i < recordCount; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            fout << (seed >> 16) % 10 << '\n'
+                 << (seed >> 8) % 50 + 5 << '.' << setw(2) << setfill('0') << (seed % 100) << setfill(' ') << '\n'
+                 << "2024-06-" << setw(2) << setfill('0') << (i % 28 + 1) << setfill(' ') << ' '
+                 << setw(2) << setfill('0') << (i % 24) << setfill(' ') << ":30\n"
+                 << 100000 + i << ' ' << 10 + i % 11 << ' ' << 12 + i % 19 << ' ' << (seed >> 4) % 100 << '\n';
+        }
+    }
+    error_code ec;
+    double mb = static_cast<double>(filesystem::file_size(path, ec)) / (1024.0 * 1024.0);
+
+    double streamMs = 1e18, readerMs = 1e18;
+    long long streamSum = 0, readerSum = 0;
+    for (int round = 0; round < 3; ++round) {
+        {
+            auto start = chrono::steady_clock::now();
+            ifstream fin(path, ios::binary);
+            streamSum = readTextInputRecords(fin, recordCount);
+            streamMs = min(streamMs, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        {
+            auto start = chrono::steady_clock::now();
+            TextReader fin(path);
+            readerSum = readTextInputRecords(fin, recordCount);
+            readerMs = min(readerMs, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    cout << "Read " << recordCount << " records (" << fixed << setprecision(1) << mb << " MB)" << endl;
+    cout << "ifstream:   " << setprecision(2) << streamMs << " ms (" << setprecision(0)
+         << mb / (streamMs / 1000.0) << " MB/s)" << endl;
+    cout << "TextReader: " << setprecision(2) << readerMs << " ms (" << setprecision(0)
+         << mb / (readerMs / 1000.0) << " MB/s)" << endl;
+    cout << "Speedup: " << setprecision(2) << streamMs / readerMs << "x"
+         << (streamSum == readerSum ? "" : "  MISMATCH") << endl;
+
+    filesystem::remove(path, ec);
+}
+
+// Sell the same group orders (5 showtimes, 30 seats each) once through
+// bookSeats, one order and one save at a time like the purchase dialog,
+// and once through bookBatch with one save per group.
+void benchmarkBatchBooking(int groups) {
+    const string dir = makeScratchDirectory("bench_batch");
+    if (dir.empty()) return;
+    const int itemsPerGroup = 5;
+    const int seatsPerItem = 30;
+    // Enough 20x30 showtimes that every item fits
+    const int showtimeCount = max(itemsPerGroup, (groups * itemsPerGroup * seatsPerItem + 299) / 300);
+    Cinema* previous = currentCinema;
+    error_code ec;
+
+    for (int batched = 0; batched <= 1; ++batched) {
+        filesystem::remove_all(dir, ec);
+        filesystem::create_directories(dir, ec);
+        Cinema site;
+        site.dataDir = dir;
+        currentCinema = &site;
+
+        fillBenchSite(1, showtimeCount, 0);
+        openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+        saveDataToFiles();
+
+        long long seatsSold = 0;
+        auto start = chrono::steady_clock::now();
+        for (int g = 0; g < groups; ++g) {
+            vector<BatchItem> items;
+            for (int k = 0; k < itemsPerGroup; ++k) {
+                items.push_back({ (g * itemsPerGroup + k) % showtimeCount + 1, seatsPerItem, {} });
+            }
+            if (batched) {
+                vector<long long> orderIds;
+                size_t failedItem;
+                if (bookBatch(items, "", orderIds, failedItem) == BOOKING_OK) {
+                    seatsSold += itemsPerGroup * seatsPerItem;
+                }
+            } else {
+                for (const BatchItem& item : items) {
+                    Showtime& s = site.showtimes[findShowtimeIndexById(item.showtimeId)];
+                    vector<pair<int, int>> seats;
+                    long long orderId;
+                    if (findBestSeats(s, item.count, seats)
+                        && bookSeats(item.showtimeId, seats, "", orderId) == BOOKING_OK) {
+                        seatsSold += item.count;
+                    }
+                }
+            }
+        }
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << (batched ? "bookBatch       : " : "Per-order saves : ") << fixed << setprecision(1)
+             << setw(8) << sec * 1000 << " ms for " << groups << " groups, "
+             << setw(8) << setprecision(0) << seatsSold / sec << " seats/s, "
+             << setprecision(2) << sec * 1000 / groups << " ms per group" << endl;
+    }
+    currentCinema = previous;
+    filesystem::remove_all(dir, ec);
+}
+
+// ===== Synthetic workload generator =====
+// Builds a site of any size from a seed, for load and startup tests that
+// need production-like data. The same arguments always produce the same
+// files: movie popularity follows a Zipf law, so a few titles get most
+// showtimes and sell out while the long tail plays to near-empty halls.
+
+const string GENERATOR_START_DATE = "2030-01-07"; // First generated day (a Monday)
+
+// SplitMix64; unlike the <random> distributions its output is the same
+// with every compiler.
+struct SyntheticRng {
+    unsigned long long state;
+
+    explicit SyntheticRng(unsigned long long seed) : state(seed) {}
+
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0); } // [0, 1)
+    int range(int lo, int hi) { return lo + static_cast<int>(next() % static_cast<unsigned long long>(hi - lo + 1)); }
+};
+
+// Draws ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s
+struct ZipfSampler {
+    vector<double> cdf;
+
+    ZipfSampler(int n, double s) : cdf(static_cast<size_t>(n)) {
+        double sum = 0;
+        for (int k = 0; k < n; ++k) {
+            sum += 1.0 / pow(k + 1.0, s);
+            cdf[k] = sum;
+        }
+        for (double& c : cdf) c /= sum;
+    }
+    int sample(SyntheticRng& rng) const {
+        size_t k = upper_bound(cdf.begin(), cdf.end(), rng.uniform()) - cdf.begin();
+        return static_cast<int>(min(k, cdf.size() - 1));
+    }
+};
+
+// Party size of one order: mostly couples, some families
+static int syntheticGroupSize(SyntheticRng& rng) {
+    static const int sizes[] = { 1, 2, 3, 4, 5, 6 };
+    static const double cumulative[] = { 0.20, 0.65, 0.75, 0.93, 0.97, 1.0 };
+    double u = rng.uniform();
+    int k = 0;
+    while (u >= cumulative[k]) ++k;
+    return sizes[k];
+}
+
+static string syntheticTitle(SyntheticRng& rng, set<string>& used) {
+    static const char* const adjectives[] = {
+        "Silent", "Crimson", "Last", "Hidden", "Golden", "Broken", "Midnight", "Frozen",
+        "Lost", "Electric", "Savage", "Distant", "Burning", "Quiet", "Iron", "Paper"
+    };
+    static const char* const nouns[] = {
+        "River", "Empire", "Garden", "Signal", "Horizon", "Harbor", "Echo", "Kingdom",
+        "Machine", "Storm", "Mirror", "Frontier", "Station", "Orchard", "Comet", "Lantern"
+    };
+    string a = adjectives[rng.range(0, 15)];
+    string n = nouns[rng.range(0, 15)];
+    string title;
+    switch (rng.range(0, 2)) {
+    case 0: title = "The " + a + " " + n; break;
+    case 1: title = a + " " + n; break;
+    default: title = n + " of the " + a + " " + nouns[rng.range(0, 15)]; break;
+    }
+    string unique = title;
+    for (int part = 2; used.count(unique); ++part) {
+        unique = title + " " + to_string(part);
+    }
+    used.insert(unique);
+    return unique;
+}
+
+// Write a generated site into `dir`: movies, halls with seat layouts,
+// `weeks` of showtimes, the orders and ticket sales that fill them, and
+// a booking trace of `traceLength` requests for --replay.
+bool generateSyntheticSite(const string& dir, int movieCount, int hallCount, int weeks,
+                           int traceLength, unsigned long long seed) {
+    Cinema& site = cinema();
+    site.dataDir = dir;
+    error_code ec;
+    for (const string& file : { MOVIE_FILE, SHOWTIME_FILE, ORDER_FILE, SALES_LOG_FILE }) {
+        if (filesystem::exists(sitePath(file), ec)) {
+            cout << "[Error] " << dir << " already contains site data; choose an empty directory." << endl;
+            return false;
+        }
+    }
+    filesystem::create_directories(dir, ec);
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    SyntheticRng rng(seed);
+    auto start = chrono::steady_clock::now();
+
+    // ----- Movies -----
+    // Popularity ranks are shuffled over the IDs
+    set<string> titles;
+    vector<int> movieByRank(static_cast<size_t>(movieCount));
+    for (int i = 0; i < movieCount; ++i) {
+        Movie m;
+        m.id = i + 1;
+        m.title = syntheticTitle(rng, titles);
+        double u = rng.uniform();
+        m.rating = (u < 0.08) ? "G" : (u < 0.28) ? "PG" : (u < 0.73) ? "PG-13" : "R";
+        m.duration = 85 + static_cast<int>((rng.uniform() + rng.uniform() + rng.uniform()) * 30);
+        site.movies.push_back(m);
+        movieByRank[i] = m.id;
+    }
+    for (int i = movieCount - 1; i > 0; --i) {
+        swap(movieByRank[i], movieByRank[rng.range(0, i)]);
+    }
+    vector<int> rankOfMovie(static_cast<size_t>(movieCount) + 1);
+    for (int r = 0; r < movieCount; ++r) rankOfMovie[movieByRank[r]] = r;
+
+    // ----- Halls -----
+    // Mostly mid-sized halls, a few large ones with a centre aisle; every
+    // hall has wheelchair spaces at both ends of the back row.
+    static const int hallSizes[][2] = { { 10, 12 }, { 12, 16 }, { 15, 20 }, { 18, 24 }, { 20, 30 } };
+    static const double hallShare[] = { 0.20, 0.45, 0.80, 0.95, 1.0 };
+    for (int i = 0; i < hallCount; ++i) {
+        double u = rng.uniform();
+        int k = 0;
+        while (u >= hallShare[k]) ++k;
+        Hall h;
+        h.id = i + 1;
+        h.name = "Hall " + to_string(i + 1);
+        h.floor = 1 + i / 4;
+        h.rows = hallSizes[k][0];
+        h.cols = hallSizes[k][1];
+        vector<unsigned char> types(static_cast<size_t>(h.rows) * h.cols, SEAT_NORMAL);
+        if (h.cols >= 20) {
+            for (int r = 0; r < h.rows; ++r) types[r * h.cols + h.cols / 2] = SEAT_BLOCKED;
+        }
+        types[(h.rows - 1) * h.cols] = SEAT_ACCESSIBLE;
+        types[(h.rows - 1) * h.cols + h.cols - 1] = SEAT_ACCESSIBLE;
+        h.layout = makeHallLayout(h.rows, h.cols, types);
+        site.halls.push_back(h);
+    }
+
+    // ----- Showtimes -----
+    // Each hall runs back-to-back shows from late morning until midnight
+    // with 20 minutes between them.
+    ZipfSampler moviePick(movieCount, 1.0);
+    long long firstDay = parseDayNumber(GENERATOR_START_DATE);
+    vector<int> showtimeRank; // Popularity rank of each showtime's movie
+    for (int day = 0; day < weeks * 7; ++day) {
+        for (const Hall& h : site.halls) {
+            int minute = 10 * 60 + rng.range(0, 4) * 15;
+            while (true) {
+                int rank = moviePick.sample(rng);
+                const Movie& m = site.movies[movieByRank[rank] - 1];
+                if (minute + m.duration > 24 * 60) break;
+
+                Showtime s;
+                s.id = site.nextShowtimeId++;
+                s.movieId = m.id;
+                s.hallId = h.id;
+                char when[16];
+                snprintf(when, sizeof(when), "%02d:%02d", minute / 60, minute % 60);
+                s.datetime = formatDayNumber(firstDay + day) + " " + when;
+                s.price = (minute < 17 * 60) ? 9.5 : 12.5;
+                initShowtimeSeats(s, h.layout);
+                site.showtimes.push_back(s);
+                showtimeRank.push_back(rank);
+
+                minute += (m.duration + 20 + 4) / 5 * 5;
+            }
+        }
+    }
+    rebuildShowtimeColumns();
+
+    // ----- Advance sales -----
+    // Demand falls off with the movie's rank and peaks on weekend
+    // evenings; orders are placed in the two weeks before the show.
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        Showtime& s = site.showtimes[i];
+        long long startMinute = site.showtimeCols.startMinute[i];
+        long long weekday = (startMinute / 1440 + 4) % 7; // 0 = Sunday
+        bool weekend = (weekday == 0 || weekday == 6);
+        bool evening = (startMinute % 1440) >= 18 * 60;
+        double demand = 0.95 * pow(showtimeRank[i] + 1.0, -0.35) * (evening ? 1.2 : 0.7)
+                        * (weekend ? 1.25 : 1.0) * (0.6 + 0.8 * rng.uniform());
+        int target = static_cast<int>(min(1.0, demand) * s.layout->sellableCount);
+
+        vector<pair<int, int>> seats;
+        while (site.showtimeCols.sold[i] < target) {
+            if (!findBestSeats(s, syntheticGroupSize(rng), seats)) break;
+            long long createdAt = startMinute * 60 - rng.range(600, 14 * 86400);
+            long long orderId;
+            placeOrder(s.id, seats, "", createdAt, orderId);
+        }
+    }
+    saveDataToFiles();
+
+    // ----- Booking trace -----
+    // "B <ms> <showtime ID> <tickets> <key>" books, "R <ms> <key>" refunds
+    // an earlier booking of the trace. Arrivals are Poisson, showtimes are
+    // chosen by movie popularity, and a few requests are client retries.
+    vector<vector<int>> showtimesOfRank(static_cast<size_t>(movieCount));
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        showtimesOfRank[showtimeRank[i]].push_back(site.showtimes[i].id);
+    }
+    ofstream trace(sitePath(BOOKING_TRACE_FILE));
+    trace << "# movies=" << movieCount << " halls=" << hallCount << " weeks=" << weeks
+          << " bookings=" << traceLength << " seed=" << seed << '\n';
+    double ms = 0;
+    vector<string> lastBooking;
+    int bookings = 0;
+    for (int n = 0; n < traceLength; ++n) {
+        ms += -log(1.0 - rng.uniform()) * 50.0; // Mean 50 ms between requests
+        double u = rng.uniform();
+        if (u < 0.03 && bookings > 0) {
+            trace << "R " << static_cast<long long>(ms) << " trace-" << rng.range(1, bookings) << '\n';
+            continue;
+        }
+        if (u < 0.05 && !lastBooking.empty()) {
+            trace << "B " << static_cast<long long>(ms) << ' ' << lastBooking[0] << ' ' << lastBooking[1]
+                  << ' ' << lastBooking[2] << '\n';
+            continue;
+        }
+        int rank = moviePick.sample(rng);
+        while (showtimesOfRank[rank].empty()) rank = moviePick.sample(rng);
+        const vector<int>& choices = showtimesOfRank[rank];
+        int showtimeId = choices[rng.range(0, static_cast<int>(choices.size()) - 1)];
+        lastBooking = { to_string(showtimeId), to_string(syntheticGroupSize(rng)), "trace-" + to_string(++bookings) };
+        trace << "B " << static_cast<long long>(ms) << ' ' << lastBooking[0] << ' ' << lastBooking[1]
+              << ' ' << lastBooking[2] << '\n';
+    }
+    trace.close();
+
+    long long sold = 0, capacity = 0;
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        sold += site.showtimeCols.sold[i];
+        capacity += site.showtimeCols.capacity[i];
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Generated " << dir << " in " << fixed << setprecision(2) << sec << " s (seed " << seed << "):" << endl;
+    cout << "  " << site.movies.size() << " movies, " << site.halls.size() << " halls, "
+         << site.showtimes.size() << " showtimes from " << GENERATOR_START_DATE << endl;
+    cout << "  " << site.orders.size() << " orders, " << sold << " of " << capacity << " seats sold ("
+         << setprecision(1) << (capacity ? 100.0 * sold / capacity : 0.0) << "%)" << endl;
+    cout << "  " << traceLength << " trace requests in " << sitePath(BOOKING_TRACE_FILE) << endl;
+    return static_cast<bool>(trace);
+}
+
+// Load the site in `dir` and run the requests of a booking trace against
+// it as fast as possible, through the same booking and refund paths as
+// the console. The site's files are updated like in a real session.
+bool replayBookingTrace(const string& dir, const string& tracePath) {
+    Cinema& site = cinema();
+    site.dataDir = dir;
+    TextReader fin(tracePath);
+    if (!fin) {
+        cout << "[Error] Cannot open trace " << tracePath << "." << endl;
+        return false;
+    }
+    auto loadStart = chrono::steady_clock::now();
+    loadDataFromFiles();
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - loadStart).count();
+    startBackgroundWriter();
+
+    long long booked = 0, replayed = 0, noSeats = 0, invalid = 0, refunds = 0;
+    vector<double> latencyUs;
+    string line;
+    auto start = chrono::steady_clock::now();
+    while (getline(fin, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        const char* p = line.data() + 1;
+        const char* end = line.data() + line.size();
+        char kind = line[0];
+        long long ms = 0;
+        p = parseNextNumber(p, end, ms);
+        auto opStart = chrono::steady_clock::now();
+        if (kind == 'B') {
+            int showtimeId = 0, tickets = 0;
+            string key;
+            if (p != nullptr) p = parseNextNumber(p, end, showtimeId);
+            if (p != nullptr) p = parseNextNumber(p, end, tickets);
+            if (p != nullptr) parseNextWord(p, end, key);
+            int sIdx = findShowtimeIndexById(showtimeId);
+            vector<pair<int, int>> seats;
+            if (sIdx == -1) {
+                ++invalid;
+                continue;
+            }
+            Showtime& s = site.showtimes[sIdx];
+            ensureSeatMap(s);
+            long long orderId;
+            if (site.orderIdByKey.count(key)) {
+                bookSeats(showtimeId, seats, key, orderId); // Answered from the idempotency index
+                ++replayed;
+            } else if (!findBestSeats(s, tickets, seats)) {
+                ++noSeats;
+            } else if (bookSeats(showtimeId, seats, key, orderId) == BOOKING_OK) {
+                ++booked;
+            }
+        } else if (kind == 'R') {
+            string key;
+            if (p != nullptr) parseNextWord(p, end, key);
+            auto it = site.orderIdByKey.find(key);
+            Order* o = (it != site.orderIdByKey.end()) ? findOrderById(it->second) : nullptr;
+            if (o == nullptr || o->refunded || findShowtimeIndexById(o->showtimeId) == -1) {
+                ++invalid;
+                continue;
+            }
+            if (refundOrder(o->id) == REFUND_OK) ++refunds;
+        }
+        latencyUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - opStart).count());
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    waitForWrites(site, site.lastWriteSeq);
+    double drainSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    stopBackgroundWriter();
+
+    sort(latencyUs.begin(), latencyUs.end());
+    auto pct = [&](double q) {
+        return latencyUs.empty() ? 0.0 : latencyUs[min(latencyUs.size() - 1, static_cast<size_t>(q * latencyUs.size()))];
+    };
+    cout << "Loaded " << site.showtimes.size() << " showtimes in " << fixed << setprecision(1) << loadMs << " ms" << endl;
+    cout << "Replayed " << latencyUs.size() << " requests in " << setprecision(2) << sec << " s ("
+         << setprecision(0) << latencyUs.size() / max(sec, 1e-9) << " req/s), all writes on disk after "
+         << setprecision(2) << drainSec << " s" << endl;
+    cout << "  booked " << booked << ", retries answered " << replayed << ", no seats " << noSeats
+         << ", refunded " << refunds << ", skipped " << invalid << endl;
+    cout << "  latency p50 " << setprecision(1) << pct(0.5) << " us, p99 " << pct(0.99)
+         << " us, max " << (latencyUs.empty() ? 0.0 : latencyUs.back()) << " us" << endl;
+    return true;
+}
+
+// A simulated customer: knows the showtime it wants and answers whatever
+// its session asks, sometimes searching by title or picking seats by hand.
+struct SimulatedCustomer {
+    SyntheticRng rng;
+    int index;
+    int movieId;
+    int showtimeId;
+    bool searched;
+};
+
+static string simulatedCustomerInput(const PurchaseSession& ps, SimulatedCustomer& c) {
+    switch (ps.step) {
+    case STEP_REFERENCE:
+        return (c.index % 2 == 0) ? "bench-" + to_string(c.index) : "";
+    case STEP_MOVIE_PAGE:
+        return (c.rng.uniform() < 0.1) ? "Y" : "N";
+    case STEP_MOVIE:
+        if (!c.searched && c.rng.uniform() < 0.3) {
+            c.searched = true;
+            return "Movie " + to_string(c.movieId);
+        }
+        return to_string(c.movieId);
+    case STEP_SHOWTIME:
+        return to_string(c.showtimeId);
+    case STEP_TICKET_COUNT:
+        return to_string(c.rng.range(1, 4));
+    case STEP_AUTO_SEATS:
+        return (c.rng.uniform() < 0.8) ? "Y" : "N";
+    case STEP_SEAT_ROW:
+        return to_string(c.rng.range(1, 20));
+    case STEP_SEAT_COL:
+        return to_string(c.rng.range(1, 30));
+    case STEP_QUEUED:
+    case STEP_DONE:
+        break;
+    }
+    return "";
+}
+
+// Start `sessionCount` purchase sessions at once and serve them all from
+// this thread, one input per session per round, as the session server
+// does with real customers.
+void benchmarkPurchaseSessions(int sessionCount) {
+    const string dir = makeScratchDirectory("bench_sessions");
+    if (dir.empty()) return;
+    const int movieCount = 50;
+    // About 2.5 tickets per session in 20x30 halls, with room to spare
+    const int showtimeCount = max(movieCount, sessionCount * 4 / 600 + 1);
+    Cinema* previous = currentCinema;
+    error_code ec;
+
+    Cinema site;
+    site.dataDir = dir;
+    currentCinema = &site;
+    fillBenchSite(movieCount, showtimeCount, 0);
+    startBackgroundWriter();
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    saveDataToFiles();
+
+    vector<PurchaseSession> sessions(static_cast<size_t>(sessionCount));
+    vector<SimulatedCustomer> customers;
+    customers.reserve(sessions.size());
+    for (int i = 0; i < sessionCount; ++i) {
+        SimulatedCustomer c = { SyntheticRng(static_cast<unsigned long long>(i) + 1), i, 0, 0, false };
+        c.showtimeId = c.rng.range(1, showtimeCount);
+        c.movieId = (c.showtimeId - 1) % movieCount + 1;
+        customers.push_back(c);
+    }
+
+    ostringstream out;
+    vector<double> stepUs;
+    stepUs.reserve(sessions.size() * 12);
+    long long outputBytes = 0;
+    size_t peakStateBytes = 0;
+    long long outcomes[PURCHASE_CLOSED + 1] = {};
+    auto start = chrono::steady_clock::now();
+    for (auto& ps : sessions) {
+        startPurchaseSession(ps, out);
+    }
+    outputBytes += out.tellp();
+
+    int open = sessionCount;
+    for (int round = 0; open > 0; ++round) {
+        size_t stateBytes = 0;
+        for (int i = 0; i < sessionCount; ++i) {
+            PurchaseSession& ps = sessions[i];
+            if (ps.step == STEP_DONE) continue;
+            string input = simulatedCustomerInput(ps, customers[i]);
+            out.str("");
+            auto t0 = chrono::steady_clock::now();
+            feedPurchaseSession(ps, input, 0, out);
+            stepUs.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count());
+            outputBytes += out.tellp();
+            stateBytes += sizeof(PurchaseSession) + ps.seats.capacity() * sizeof(pair<int, int>)
+                          + ps.requestKey.capacity();
+            if (ps.step == STEP_DONE) {
+                ++outcomes[ps.outcome];
+                --open;
+            }
+        }
+        if (round == 2) peakStateBytes = stateBytes; // Every session is open and has a reference
+    }
+    double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    waitForWrites(site, site.lastWriteSeq);
+    stopBackgroundWriter();
+
+    sort(stepUs.begin(), stepUs.end());
+    auto quantile = [&](double q) { return stepUs[static_cast<size_t>(q * (stepUs.size() - 1))]; };
+    cout << sessionCount << " concurrent sessions on one thread, " << showtimeCount << " showtimes" << endl;
+    cout << "Completed in " << fixed << setprecision(1) << sec * 1000 << " ms: " << setprecision(0)
+         << sessionCount / sec << " sessions/s, " << stepUs.size() / sec << " inputs/s ("
+         << setprecision(1) << static_cast<double>(stepUs.size()) / sessionCount << " per session)" << endl;
+    cout << "Step latency: p50 " << setprecision(1) << quantile(0.5) << " us, p99 " << quantile(0.99)
+         << " us, max " << stepUs.back() << " us" << endl;
+    cout << "Output: " << setprecision(1) << outputBytes / 1024.0 / sessionCount << " KB per session" << endl;
+    cout << "Suspended session state: " << peakStateBytes / sessionCount << " bytes per session" << endl;
+    cout << "Outcomes: booked " << outcomes[PURCHASE_BOOKED] << ", sold out " << outcomes[PURCHASE_SOLD_OUT]
+         << ", seats taken meanwhile " << outcomes[PURCHASE_NOT_BOOKED] << ", other "
+         << outcomes[PURCHASE_REPLAYED] + outcomes[PURCHASE_CLOSED] << endl;
+
+    currentCinema = previous;
+    filesystem::remove_all(dir, ec);
+}
+
+// A flash-sale customer. It wants `tickets` seats at the premiere and
+// picks them by hand among the best seats on the seat map it last saw, as
+// everyone does, so under load its seats are often gone: a seat taken
+// before it is entered is picked again from a fresh look at the map, a
+// booking that fails starts a new purchase.
+struct FlashSaleCustomer {
+    SyntheticRng rng{ 1 };
+    int tickets;
+    long long arrivedMs;
+    long long choosingSinceMs = -1; // Saw the seat map in the current purchase
+    long long choosingMs = 0;       // Time spent choosing seats, over all purchases
+    PurchaseSession session;
+    bool inSession = false;
+    Showtime view;                // The seat map as the customer last saw it
+    vector<pair<int, int>> picks; // Seats it means to enter, 1-based
+    size_t nextPick = 0;
+};
+
+struct FlashSaleResult {
+    vector<double> bookSec;     // Arrival until booked, per booked customer
+    vector<double> soldOutSec;  // Arrival until told it is sold out, per other customer
+    vector<double> choosingSec; // Time spent choosing seats, per customer who saw a seat map
+    double lastBookingSec = 0;
+    long long purchases = 0;    // Sessions started
+    long long inputs = 0;
+    long long seatsTaken = 0;   // Seats entered that someone else had taken
+    long long failedBookings = 0;
+    long long seatsSold = 0;
+    size_t longestQueue = 0;
+    vector<double> stepMicros;  // Worker time per input and per pump of a queued session
+};
+
+// Seats from the customer's view of the seat map: any of the best free
+// seats, as customers want a good seat but do not all want the same one.
+static bool pickFlashSaleSeats(FlashSaleCustomer& c, int count) {
+    const Showtime& v = c.view;
+    double targetRow = (v.rows - 1) * 0.6;
+    double targetCol = (v.cols - 1) / 2.0;
+    vector<pair<double, int>> good;
+    for (int r = 0; r < v.rows; ++r) {
+        for (int col = 0; col < v.cols; ++col) {
+            if (isSeatAvailable(v, r, col)) {
+                good.push_back({ 2.0 * fabs(r - targetRow) + fabs(col - targetCol), r * v.cols + col });
+            }
+        }
+    }
+    c.picks.clear();
+    c.nextPick = 0;
+    if (static_cast<int>(good.size()) < count) return false;
+    size_t keep = min(good.size(), static_cast<size_t>(max(count, 60)));
+    partial_sort(good.begin(), good.begin() + keep, good.end());
+    for (int k = 0; k < count; ++k) {
+        size_t pick = k + static_cast<size_t>(c.rng.range(0, static_cast<int>(keep) - 1 - k));
+        swap(good[k], good[pick]);
+        c.picks.push_back({ good[k].second / v.cols + 1, good[k].second % v.cols + 1 });
+    }
+    return true;
+}
+
+static string flashSaleInput(FlashSaleCustomer& c, int showtimeId) {
+    const PurchaseSession& ps = c.session;
+    switch (ps.step) {
+    case STEP_MOVIE:
+        return "1";
+    case STEP_SHOWTIME:
+        return to_string(showtimeId);
+    case STEP_TICKET_COUNT: {
+        int available = seatsOnOffer(ps, findShowtimeIndexById(showtimeId));
+        return to_string(max(1, min(c.tickets, available))); // Takes what is offered
+    }
+    case STEP_AUTO_SEATS:
+        pickFlashSaleSeats(c, ps.ticketCount);
+        return "N"; // By hand
+    case STEP_SEAT_ROW:
+        return c.nextPick < c.picks.size() ? to_string(c.picks[c.nextPick].first) : "1";
+    case STEP_SEAT_COL:
+        return c.nextPick < c.picks.size() ? to_string(c.picks[c.nextPick].second) : "1";
+    default:
+        break;
+    }
+    return "";
+}
+
+// One flash sale in virtual time: customers arrive within 5 seconds and
+// take 1 to 4 seconds per answer; queued customers are pumped every 250 ms
+// like the session server does. The site lives in `dir`, which is emptied
+// first and removed afterwards.
+static FlashSaleResult runFlashSale(const string& dir, int customerCount, const AdmissionPolicy* policy) {
+    const int showtimeId = 1;
+    Cinema* previous = currentCinema;
+    error_code ec;
+    filesystem::remove_all(dir, ec);
+    filesystem::create_directories(dir, ec);
+
+    Cinema site;
+    site.dataDir = dir;
+    currentCinema = &site;
+    fillBenchSite(1, 1, 0); // The premiere is showtime 1
+    startBackgroundWriter();
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    saveDataToFiles();
+    if (policy != nullptr) setAdmissionGate(showtimeId, *policy);
+
+    vector<FlashSaleCustomer> customers(static_cast<size_t>(customerCount));
+    typedef pair<long long, int> Event; // (virtual ms, customer)
+    priority_queue<Event, vector<Event>, greater<Event>> events;
+    for (int i = 0; i < customerCount; ++i) {
+        FlashSaleCustomer& c = customers[i];
+        c.rng = SyntheticRng(static_cast<unsigned long long>(i) + 1);
+        c.tickets = c.rng.range(1, 4);
+        c.arrivedMs = c.rng.range(0, 5000);
+        events.push({ c.arrivedMs, i });
+    }
+
+    FlashSaleResult result;
+    ostringstream out;
+    vector<int> queued;
+    long long nextPumpMs = 0;
+
+    // After a step: look at a new seat map, finish, or wait for the next answer
+    auto settle = [&](int i, long long now) {
+        FlashSaleCustomer& c = customers[i];
+        PurchaseSession& ps = c.session;
+        if (ps.step == STEP_QUEUED) {
+            queued.push_back(i);
+            return;
+        }
+        if (ps.step == STEP_TICKET_COUNT) {
+            c.view = site.showtimes[findShowtimeIndexById(showtimeId)];
+            c.choosingSinceMs = now;
+        }
+        if (ps.step != STEP_DONE) {
+            events.push({ now + c.rng.range(1000, 4000), i });
+            return;
+        }
+        c.inSession = false;
+        if (c.choosingSinceMs >= 0) {
+            c.choosingMs += now - c.choosingSinceMs;
+            c.choosingSinceMs = -1;
+        }
+        if (ps.outcome == PURCHASE_BOOKED || ps.outcome == PURCHASE_SOLD_OUT) {
+            if (c.choosingMs > 0) result.choosingSec.push_back(c.choosingMs / 1000.0);
+            if (ps.outcome == PURCHASE_BOOKED) {
+                result.bookSec.push_back((now - c.arrivedMs) / 1000.0);
+                result.lastBookingSec = now / 1000.0;
+                result.seatsSold += static_cast<long long>(ps.seats.size());
+            }
+            if (ps.outcome == PURCHASE_SOLD_OUT) result.soldOutSec.push_back((now - c.arrivedMs) / 1000.0);
+            return;
+        }
+        if (ps.outcome == PURCHASE_NOT_BOOKED) ++result.failedBookings;
+        events.push({ now + c.rng.range(2000, 5000), i }); // Tries again
+    };
+
+    while (!events.empty() || !queued.empty()) {
+        long long now = events.empty() ? nextPumpMs : events.top().first;
+        if (!queued.empty() && nextPumpMs <= now) {
+            now = nextPumpMs;
+            nextPumpMs += 250;
+            vector<int> pumped;
+            pumped.swap(queued);
+            for (int i : pumped) {
+                out.str("");
+                auto started = chrono::steady_clock::now();
+                pumpPurchaseSession(customers[i].session, now, out);
+                result.stepMicros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - started).count());
+                settle(i, now);
+            }
+            auto gate = site.admissionGates.find(showtimeId);
+            if (gate != site.admissionGates.end()) {
+                result.longestQueue = max(result.longestQueue, gate->second.waiting.size());
+            }
+            continue;
+        }
+        int i = events.top().second;
+        events.pop();
+        FlashSaleCustomer& c = customers[i];
+        PurchaseSession& ps = c.session;
+        out.str("");
+        if (!c.inSession) {
+            startPurchaseSession(ps, out);
+            c.inSession = true;
+            ++result.purchases;
+            events.push({ now + c.rng.range(1000, 4000), i });
+            continue;
+        }
+
+        PurchaseStep step = ps.step;
+        size_t seatsBefore = ps.seats.size();
+        string input = flashSaleInput(c, showtimeId);
+        if (step == STEP_SEAT_ROW && c.nextPick >= c.picks.size()) {
+            abandonPurchaseSession(ps); // Not enough seats left to pick from
+            settle(i, now);
+            continue;
+        }
+        auto started = chrono::steady_clock::now();
+        feedPurchaseSession(ps, input, now, out);
+        result.stepMicros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - started).count());
+        ++result.inputs;
+        if (step == STEP_SEAT_COL && ps.step != STEP_DONE) {
+            if (ps.seats.size() > seatsBefore) {
+                ++c.nextPick;
+            } else {
+                // Taken meanwhile: look at the seat map again and pick anew
+                ++result.seatsTaken;
+                c.view = site.showtimes[findShowtimeIndexById(showtimeId)];
+                for (const auto& seat : ps.seats) setSeatSold(c.view, seat.first - 1, seat.second - 1, true);
+                if (!pickFlashSaleSeats(c, ps.ticketCount - static_cast<int>(ps.seats.size()))) c.picks.clear();
+            }
+        }
+        nextPumpMs = max(nextPumpMs, now);
+        settle(i, now);
+    }
+
+    waitForWrites(site, site.lastWriteSeq);
+    stopBackgroundWriter();
+    currentCinema = previous;
+    filesystem::remove_all(dir, ec);
+    return result;
+}
+
+static void printFlashSaleResult(const string& title, FlashSaleResult& r) {
+    auto quantile = [](vector<double>& v, double q) {
+        if (v.empty()) return 0.0;
+        sort(v.begin(), v.end());
+        return v[static_cast<size_t>(q * (v.size() - 1))];
+    };
+    cout << "\n" << title << endl;
+    cout << "  booked " << r.bookSec.size() << " customers (" << r.seatsSold << " seats), "
+         << r.soldOutSec.size() << " told it is sold out; last booking at " << fixed << setprecision(1)
+         << r.lastBookingSec << " s" << endl;
+    cout << "  time to book:   p50 " << fixed << setprecision(1) << quantile(r.bookSec, 0.5) << " s, p90 "
+         << quantile(r.bookSec, 0.9) << " s, p99 " << quantile(r.bookSec, 0.99) << " s, max "
+         << quantile(r.bookSec, 1.0) << " s" << endl;
+    cout << "  time spent choosing seats: p50 " << quantile(r.choosingSec, 0.5) << " s, p99 "
+         << quantile(r.choosingSec, 0.99) << " s, max " << quantile(r.choosingSec, 1.0) << " s" << endl;
+    cout << "  time to hear it is sold out: p50 " << quantile(r.soldOutSec, 0.5) << " s, p99 "
+         << quantile(r.soldOutSec, 0.99) << " s, max " << quantile(r.soldOutSec, 1.0) << " s" << endl;
+    vector<double> answered(r.bookSec);
+    answered.insert(answered.end(), r.soldOutSec.begin(), r.soldOutSec.end());
+    cout << "  time to an answer, every customer: p50 " << quantile(answered, 0.5) << " s, p99 "
+         << quantile(answered, 0.99) << " s, max " << quantile(answered, 1.0) << " s" << endl;
+    double workerMicros = 0;
+    for (double t : r.stepMicros) workerMicros += t;
+    cout << "  worker time " << fixed << setprecision(1) << workerMicros / 1000.0 << " ms in total; per step p99 "
+         << quantile(r.stepMicros, 0.99) << " us, max " << quantile(r.stepMicros, 1.0) << " us" << endl;
+    cout << "  seats already taken when entered " << r.seatsTaken << ", failed bookings " << r.failedBookings
+         << ", purchases started " << r.purchases << ", inputs " << r.inputs << endl;
+    if (r.longestQueue > 0) cout << "  longest line " << r.longestQueue << " customers" << endl;
+}
+
+// Sell one 600-seat premiere to `customerCount` customers arriving at
+// once, first with every customer choosing seats at the same time, then
+// through an admission gate. Customers think for seconds per answer, so
+// the gate lets in up to half the seats' worth at once: fewer would keep
+// seats unsold while the line waits.
+void benchmarkFlashSale(int customerCount) {
+    AdmissionPolicy policy;
+    policy.ratePerSecond = 50;
+    policy.burst = 150;
+    policy.maxActive = 300;
+    const string dir = makeScratchDirectory("bench_flash_sale");
+    if (dir.empty()) return;
+    cout << "Flash sale: " << customerCount << " customers, one 600-seat showtime, virtual time" << endl;
+    FlashSaleResult open = runFlashSale(dir, customerCount, nullptr);
+    printFlashSaleResult("Without admission control", open);
+    FlashSaleResult gated = runFlashSale(dir, customerCount, &policy);
+    ostringstream title;
+    title << "With admission control (" << policy.ratePerSecond << "/s, burst " << policy.burst << ", "
+          << policy.maxActive << " choosing at once)";
+    printFlashSaleResult(title.str(), gated);
+}
+
+// ===== Schedule optimizer implementations =====
+
+// Share of a day's customers who want each start-time band, and weight
+// of each weekday (0 = Sunday) in a week's demand
+static const double SCHEDULE_BAND_SHARE[SCHEDULE_BANDS] = { 0.14, 0.18, 0.36, 0.32 };
+static const double SCHEDULE_WEEKDAY_WEIGHT[7] = { 1.2, 0.85, 0.8, 0.85, 0.95, 1.25, 1.45 };
+const int SCHEDULE_DELAY_STEP = 15; // Idle time before a show grows in steps of this many minutes
+const double SCHEDULE_SHOW_PENALTY = 0.01; // Lets the search drop shows that sell nothing
+
+static int scheduleBand(int minuteOfDay) {
+    if (minuteOfDay < 14 * 60) return 0;
+    if (minuteOfDay < 17 * 60) return 1;
+    if (minuteOfDay < 20 * 60) return 2;
+    return 3;
+}
+
+// One day of the problem, copied out of the site so that searches can
+// run on any thread. Groups are indexed movie * SCHEDULE_BANDS + band.
+struct ScheduleDay {
+    vector<int> runMinutes;              // Per movie
+    vector<int> seats;                   // Per hall: sellable seats
+    vector<vector<pair<int, int>>> kept; // Per hall: (start, end) of kept shows, in start order
+    vector<double> demand;               // Per group: tickets wanted
+    vector<double> keptSeats;            // Per group: seats offered by kept shows
+    double price[SCHEDULE_BANDS];
+    int openMinute;
+    int closeMinute;
+    int cleaningMinutes;
+};
+
+struct LaneShow {
+    int movie;
+    int delay; // Idle minutes wanted before the show
+    int start; // Minute of the day, set by packLane
+};
+
+// A schedule for one day: the shows of each hall in start order
+struct DaySchedule {
+    vector<vector<LaneShow>> lanes;
+    vector<double> offered; // Per group: seats offered, kept shows included
+    double revenue = 0;
+    int showCount = 0;
+
+    double score() const { return revenue - SCHEDULE_SHOW_PENALTY * showCount; }
+};
+
+static double groupRevenue(const ScheduleDay& day, size_t g, double offered) {
+    return day.price[g % SCHEDULE_BANDS] * min(day.demand[g], offered);
+}
+
+// Earliest start at or after `earliest` that leaves cleaning time around
+// the hall's kept shows, or -1 if the show would end after closing.
+static int placeShow(const ScheduleDay& day, int hall, int earliest, int run) {
+    auto roundUp = [](int minute) {
+        return (minute + SCHEDULE_SLOT_MINUTES - 1) / SCHEDULE_SLOT_MINUTES * SCHEDULE_SLOT_MINUTES;
+    };
+    int gap = day.cleaningMinutes;
+    int start = roundUp(max(earliest, day.openMinute));
+    for (const auto& k : day.kept[hall]) {
+        if (start < k.second + gap && k.first < start + run + gap) start = roundUp(k.second + gap);
+    }
+    return (start + run <= day.closeMinute) ? start : -1;
+}
+
+// Start every show of a hall as early as the one before it and its delay
+// allow. Shows that no longer fit before closing are dropped.
+static void packLane(const ScheduleDay& day, int hall, vector<LaneShow>& lane) {
+    int cursor = day.openMinute;
+    size_t n = 0;
+    for (size_t i = 0; i < lane.size(); ++i) {
+        int run = day.runMinutes[lane[i].movie];
+        int start = placeShow(day, hall, cursor + lane[i].delay, run);
+        if (start < 0) continue;
+        lane[n] = lane[i];
+        lane[n].start = start;
+        ++n;
+        cursor = start + run + day.cleaningMinutes;
+    }
+    lane.resize(n);
+}
+
+static void addSeatChange(vector<pair<size_t, double>>& change, size_t g, double seats) {
+    for (auto& c : change) {
+        if (c.first == g) {
+            c.second += seats;
+            return;
+        }
+    }
+    change.push_back({ g, seats });
+}
+
+static void laneSeatChange(const ScheduleDay& day, int hall, const vector<LaneShow>& lane, double sign,
+                           vector<pair<size_t, double>>& change) {
+    for (const LaneShow& show : lane) {
+        addSeatChange(change, static_cast<size_t>(show.movie) * SCHEDULE_BANDS + scheduleBand(show.start),
+                      sign * day.seats[hall]);
+    }
+}
+
+static double revenueChange(const ScheduleDay& day, const DaySchedule& s,
+                            const vector<pair<size_t, double>>& change) {
+    double delta = 0;
+    for (const auto& c : change) {
+        delta += groupRevenue(day, c.first, s.offered[c.first] + c.second) - groupRevenue(day, c.first, s.offered[c.first]);
+    }
+    return delta;
+}
+
+static double dayRevenue(const ScheduleDay& day, const vector<double>& offered) {
+    double revenue = 0;
+    for (size_t g = 0; g < offered.size(); ++g) revenue += groupRevenue(day, g, offered[g]);
+    return revenue;
+}
+
+// Fill the halls in time order: the hall that is free first gets the show
+// earning the most per minute of hall time it takes, or waits
+// SCHEDULE_DELAY_STEP minutes if no show would sell another ticket.
+static void greedyDaySchedule(const ScheduleDay& day, DaySchedule& s) {
+    int hallCount = static_cast<int>(day.seats.size());
+    int movieCount = static_cast<int>(day.runMinutes.size());
+    s.lanes.assign(hallCount, {});
+    s.offered = day.keptSeats;
+    s.revenue = dayRevenue(day, s.offered);
+
+    vector<int> cursor(hallCount, day.openMinute), delay(hallCount, 0);
+    vector<bool> full(hallCount, false);
+    while (true) {
+        int h = -1;
+        for (int i = 0; i < hallCount; ++i) {
+            if (!full[i] && (h < 0 || cursor[i] + delay[i] < cursor[h] + delay[h])) h = i;
+        }
+        if (h < 0) break;
+
+        int best = -1, bestStart = 0;
+        double bestRate = 0, bestGain = 0;
+        bool fits = false;
+        for (int m = 0; m < movieCount; ++m) {
+            int run = day.runMinutes[m];
+            int start = placeShow(day, h, cursor[h] + delay[h], run);
+            if (start < 0) continue;
+            fits = true;
+            size_t g = static_cast<size_t>(m) * SCHEDULE_BANDS + scheduleBand(start);
+            double gain = groupRevenue(day, g, s.offered[g] + day.seats[h]) - groupRevenue(day, g, s.offered[g]);
+            double rate = gain / (start + run + day.cleaningMinutes - cursor[h]);
+            if (gain > 0 && rate > bestRate) {
+                best = m;
+                bestStart = start;
+                bestRate = rate;
+                bestGain = gain;
+            }
+        }
+        if (best >= 0) {
+            s.lanes[h].push_back({ best, delay[h], bestStart });
+            s.offered[static_cast<size_t>(best) * SCHEDULE_BANDS + scheduleBand(bestStart)] += day.seats[h];
+            s.revenue += bestGain;
+            ++s.showCount;
+            cursor[h] = bestStart + day.runMinutes[best] + day.cleaningMinutes;
+            delay[h] = 0;
+        } else if (fits) {
+            delay[h] += SCHEDULE_DELAY_STEP;
+        } else {
+            full[h] = true;
+        }
+    }
+}
+
+// Simulated annealing over one day. A move changes, adds, drops, swaps
+// or delays shows of a hall, or trades shows between two halls; the best
+// schedule seen is kept.
+static void searchDaySchedule(const ScheduleDay& day, DaySchedule& s, unsigned long long seed, int iterations) {
+    int hallCount = static_cast<int>(day.seats.size());
+    int movieCount = static_cast<int>(day.runMinutes.size());
+    if (hallCount == 0 || movieCount == 0) return;
+
+    double meanSeats = 0;
+    for (int seats : day.seats) meanSeats += seats;
+    meanSeats /= hallCount;
+    double startTemperature = 0.1 * max(day.price[0], day.price[SCHEDULE_BANDS - 1]) * meanSeats;
+    double endTemperature = startTemperature * 1e-3;
+
+    SyntheticRng rng(seed);
+    DaySchedule best = s;
+    vector<LaneShow> a, b;
+    vector<pair<size_t, double>> change;
+    for (int it = 0; it < iterations; ++it) {
+        double temperature = startTemperature * pow(endTemperature / startTemperature, static_cast<double>(it) / iterations);
+        int h1 = rng.range(0, hallCount - 1), h2 = -1;
+        a = s.lanes[h1];
+        int n = static_cast<int>(a.size());
+        int pos = (n > 0) ? rng.range(0, n - 1) : 0;
+        switch ((n == 0) ? 2 : rng.range(0, 6)) {
+        case 0:
+        case 1:
+            a[pos].movie = rng.range(0, movieCount - 1);
+            break;
+        case 2:
+            a.insert(a.begin() + rng.range(0, n), LaneShow{ rng.range(0, movieCount - 1), 0, 0 });
+            break;
+        case 3:
+            a.erase(a.begin() + pos);
+            break;
+        case 4:
+            swap(a[pos].movie, a[rng.range(0, n - 1)].movie);
+            break;
+        case 5:
+            a[pos].delay = rng.range(0, 8) * SCHEDULE_DELAY_STEP;
+            break;
+        default:
+            h2 = rng.range(0, hallCount - 1);
+            if (h2 == h1 || s.lanes[h2].empty()) {
+                h2 = -1;
+                a[pos].movie = rng.range(0, movieCount - 1);
+                break;
+            }
+            b = s.lanes[h2];
+            swap(a[pos].movie, b[rng.range(0, static_cast<int>(b.size()) - 1)].movie);
+            break;
+        }
+
+        change.clear();
+        packLane(day, h1, a);
+        laneSeatChange(day, h1, s.lanes[h1], -1, change);
+        laneSeatChange(day, h1, a, 1, change);
+        if (h2 >= 0) {
+            packLane(day, h2, b);
+            laneSeatChange(day, h2, s.lanes[h2], -1, change);
+            laneSeatChange(day, h2, b, 1, change);
+        }
+        int showChange = static_cast<int>(a.size()) - static_cast<int>(s.lanes[h1].size());
+        if (h2 >= 0) showChange += static_cast<int>(b.size()) - static_cast<int>(s.lanes[h2].size());
+        double delta = revenueChange(day, s, change);
+        double scoreDelta = delta - SCHEDULE_SHOW_PENALTY * showChange;
+        if (scoreDelta < 0 && rng.uniform() >= exp(scoreDelta / temperature)) continue;
+
+        for (const auto& c : change) s.offered[c.first] += c.second;
+        s.revenue += delta;
+        s.showCount += showChange;
+        s.lanes[h1].swap(a);
+        if (h2 >= 0) s.lanes[h2].swap(b);
+        if (s.score() > best.score() + 1e-6) best = s;
+    }
+    s = move(best);
+    s.revenue = dayRevenue(day, s.offered);
+}
+
+// Read "movie ID  expected tickets for the week" lines; '#' starts a
+// comment line. Lines naming an unknown movie are reported and skipped.
+bool readScheduleDemand(const string& path, vector<ScheduleDemand>& demand) {
+    TextReader fin(path);
+    if (!fin) {
+        cout << "[Error] Cannot open demand file " << path << "." << endl;
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (getline(fin, line)) {
+        ++lineNumber;
+        const char* p = line.data();
+        const char* end = p + line.size();
+        while (p < end && isSpaceChar(*p)) ++p;
+        if (p == end || *p == '#') continue;
+
+        ScheduleDemand d{ 0, 0 };
+        p = parseNextNumber(p, end, d.movieId);
+        if (p != nullptr) p = parseNextNumber(p, end, d.weeklyTickets);
+        if (p == nullptr || !isfinite(d.weeklyTickets) || d.weeklyTickets < 0) {
+            cout << "[Warning] Line " << lineNumber << " of " << path << " is not \"movie ID  tickets\"; skipped." << endl;
+            continue;
+        }
+        if (findMovieIndexById(d.movieId) == -1) {
+            cout << "[Warning] Line " << lineNumber << " of " << path << ": movie ID " << d.movieId
+                 << " not found; skipped." << endl;
+            continue;
+        }
+        demand.push_back(d);
+    }
+    return true;
+}
+
+// Plan the days [firstDay, firstDay + days) for every hall of the site.
+// Each day is searched `restarts` times from its greedy start with
+// different seeds, spread over the threads; the best search of a day
+// wins, so the plan does not depend on the thread count.
+SchedulePlan planSchedule(const vector<ScheduleDemand>& demand, const ScheduleOptions& options) {
+    TraceSpan span("plan_schedule");
+    auto start = chrono::steady_clock::now();
+    Cinema& site = cinema();
+    SchedulePlan plan;
+
+    // Movies with demand; repeated lines add up
+    vector<int> movieIds;
+    vector<double> weekly;
+    unordered_map<int, int> movieSlot;
+    for (const ScheduleDemand& d : demand) {
+        int mIdx = findMovieIndexById(d.movieId);
+        if (mIdx == -1 || d.weeklyTickets <= 0) continue;
+        auto inserted = movieSlot.insert({ d.movieId, static_cast<int>(movieIds.size()) });
+        if (inserted.second) {
+            movieIds.push_back(d.movieId);
+            weekly.push_back(0);
+        }
+        weekly[inserted.first->second] += d.weeklyTickets;
+    }
+    unordered_map<int, int> hallSlot;
+    for (size_t h = 0; h < site.halls.size(); ++h) hallSlot[site.halls[h].id] = static_cast<int>(h);
+
+    double weekdayTotal = 0;
+    for (int d = 0; d < options.days; ++d) weekdayTotal += SCHEDULE_WEEKDAY_WEIGHT[(options.firstDay + d + 4) % 7];
+
+    size_t groupCount = movieIds.size() * SCHEDULE_BANDS;
+    vector<ScheduleDay> days(options.days);
+    for (int d = 0; d < options.days; ++d) {
+        ScheduleDay& day = days[d];
+        for (int id : movieIds) day.runMinutes.push_back(site.movies[findMovieIndexById(id)].duration);
+        for (const Hall& h : site.halls) day.seats.push_back(h.layout->sellableCount);
+        day.kept.assign(site.halls.size(), {});
+        day.demand.assign(groupCount, 0);
+        day.keptSeats.assign(groupCount, 0);
+        double dayShare = SCHEDULE_WEEKDAY_WEIGHT[(options.firstDay + d + 4) % 7] / weekdayTotal;
+        for (size_t m = 0; m < movieIds.size(); ++m) {
+            for (int b = 0; b < SCHEDULE_BANDS; ++b) {
+                day.demand[m * SCHEDULE_BANDS + b] = weekly[m] * dayShare * SCHEDULE_BAND_SHARE[b];
+            }
+        }
+        for (int b = 0; b < SCHEDULE_BANDS; ++b) {
+            day.price[b] = (b < 2) ? options.matineePrice : options.eveningPrice;
+        }
+        day.openMinute = options.openMinute;
+        day.closeMinute = options.closeMinute;
+        day.cleaningMinutes = options.cleaningMinutes;
+    }
+
+    // Showtimes already in the week keep their place. One that runs past
+    // midnight also blocks its hall at the start of the next day, even
+    // when it starts the day before the plan.
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        long long startMinute = site.showtimeCols.startMinute[i];
+        if (startMinute < 0) continue;
+        long long d = startMinute / (24 * 60) - options.firstDay;
+        auto hall = hallSlot.find(site.showtimes[i].hallId);
+        if (d >= options.days || hall == hallSlot.end()) continue;
+        int mIdx = findMovieIndexById(site.showtimes[i].movieId);
+        int minute = static_cast<int>(startMinute % (24 * 60));
+        int run = (mIdx != -1) ? site.movies[mIdx].duration : 0;
+        for (long long k = d; k < options.days; ++k) {
+            long long from = minute - (k - d) * 24 * 60;
+            if (from + run <= 0) break;
+            if (k >= 0) {
+                days[k].kept[hall->second].push_back({ static_cast<int>(max(from, 0LL)), static_cast<int>(from + run) });
+            }
+        }
+        if (d < 0) continue;
+        ScheduleDay& day = days[d];
+        auto slot = movieSlot.find(site.showtimes[i].movieId);
+        if (slot != movieSlot.end()) {
+            day.keptSeats[static_cast<size_t>(slot->second) * SCHEDULE_BANDS + scheduleBand(minute)] +=
+                site.showtimeCols.capacity[i];
+        }
+    }
+    for (ScheduleDay& day : days) {
+        for (auto& kept : day.kept) sort(kept.begin(), kept.end());
+    }
+
+    int threads = (options.threads > 0) ? options.threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+    int restarts = (options.restarts > 0) ? options.restarts : max(1, (threads + options.days - 1) / options.days);
+    int searches = options.days * restarts;
+    threads = min(threads, searches);
+
+    vector<DaySchedule> results(searches);
+    vector<double> greedyRevenue(options.days);
+    atomic<int> nextSearch{ 0 };
+    auto work = [&]() {
+        for (int t; (t = nextSearch++) < searches;) {
+            int d = t / restarts, r = t % restarts;
+            greedyDaySchedule(days[d], results[t]);
+            if (r == 0) greedyRevenue[d] = results[t].revenue;
+            searchDaySchedule(days[d], results[t], 0x5CED0000ULL + static_cast<unsigned long long>(t), options.iterations);
+        }
+    };
+    vector<future<void>> pool;
+    for (int i = 1; i < threads; ++i) pool.push_back(async(launch::async, work));
+    work();
+    for (auto& f : pool) f.get();
+
+    for (int d = 0; d < options.days; ++d) {
+        const DaySchedule* best = &results[d * restarts];
+        for (int r = 1; r < restarts; ++r) {
+            if (results[d * restarts + r].score() > best->score()) best = &results[d * restarts + r];
+        }
+        const ScheduleDay& day = days[d];
+        for (size_t h = 0; h < best->lanes.size(); ++h) {
+            for (const LaneShow& show : best->lanes[h]) {
+                double price = day.price[scheduleBand(show.start)];
+                plan.shows.push_back({ movieIds[show.movie], site.halls[h].id,
+                                       (options.firstDay + d) * 24 * 60 + show.start, price });
+            }
+        }
+        for (size_t g = 0; g < groupCount; ++g) {
+            plan.expectedTickets += min(day.demand[g], best->offered[g]);
+            plan.demandTickets += day.demand[g];
+        }
+        plan.dayRevenue.push_back(best->revenue);
+        plan.expectedRevenue += best->revenue;
+        plan.greedyRevenue += greedyRevenue[d];
+    }
+    sort(plan.shows.begin(), plan.shows.end(), [](const PlannedShow& x, const PlannedShow& y) {
+        return (x.hallId != y.hallId) ? x.hallId < y.hallId : x.startMinute < y.startMinute;
+    });
+    plan.threads = threads;
+    plan.searches = searches;
+    plan.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return plan;
+}
+
+// Add the planned shows as showtimes in one go, with a single save.
+// Returns how many were added; shows whose movie or hall went away are
+// skipped.
+int addPlannedShowtimes(const SchedulePlan& plan) {
+    Cinema& site = cinema();
+    int added = 0;
+    for (const PlannedShow& p : plan.shows) {
+        int hIdx = findHallIndexById(p.hallId);
+        if (hIdx == -1 || findMovieIndexById(p.movieId) == -1) continue;
+
+        Showtime s;
+        s.id = site.nextShowtimeId++;
+        s.movieId = p.movieId;
+        s.hallId = p.hallId;
+        int minute = static_cast<int>(p.startMinute % (24 * 60));
+        char when[16];
+        snprintf(when, sizeof(when), "%02d:%02d", minute / 60, minute % 60);
+        s.datetime = formatDayNumber(p.startMinute / (24 * 60)) + " " + when;
+        s.price = p.price;
+        initShowtimeSeats(s, site.halls[hIdx].layout);
+        site.showtimes.push_back(s);
+        appendShowtimeColumns(site.showtimeCols, s);
+        addToDayPartition(s.id, site.showtimeCols.startMinute.back());
+        ++added;
+    }
+    if (added > 0) {
+        site.dirtyFiles |= DIRTY_SHOWTIMES;
+        saveDataToFiles();
+    }
+    return added;
+}
+
+void planScheduleMenu() {
+    Cinema& site = cinema();
+    cout << "\n--- Plan Week Schedule ---" << endl;
+
+    if (site.movies.empty()) {
+        cout << "No movies available. Please add movies first." << endl;
+        return;
+    }
+    if (site.halls.empty()) {
+        cout << "No halls available. Please add halls first." << endl;
+        return;
+    }
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+
+    ScheduleOptions options;
+    string line;
+    cout << "Enter the first day to plan (e.g. 2025-01-06): ";
+    while (!getline(console, line) || (options.firstDay = parseDayNumber(line)) < 0) {
+        if (!console) return;
+        cout << "Invalid date. Please use the format YYYY-MM-DD: ";
+    }
+    cout << "Demand file lines: movie ID, then expected tickets for the week" << endl;
+    cout << "Enter the demand file (blank = " << sitePath(SCHEDULE_DEMAND_FILE) << "): ";
+    if (!getline(console, line)) return;
+    vector<ScheduleDemand> demand;
+    if (!readScheduleDemand(line.empty() ? sitePath(SCHEDULE_DEMAND_FILE) : line, demand)) return;
+    if (demand.empty()) {
+        cout << "The demand file names no movie of this site." << endl;
+        return;
+    }
+
+    cout << "Enter cleaning time between shows (minutes): ";
+    while (!(console >> options.cleaningMinutes) || options.cleaningMinutes < 0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid time. Please enter a non-negative number: ";
+    }
+    cout << "Enter ticket price for shows before 17:00: ";
+    while (!(console >> options.matineePrice) || options.matineePrice <= 0.0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid price. Please enter a positive number: ";
+    }
+    cout << "Enter ticket price for shows from 17:00: ";
+    while (!(console >> options.eveningPrice) || options.eveningPrice <= 0.0) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid price. Please enter a positive number: ";
+    }
+
+    SchedulePlan plan = planSchedule(demand, options);
+    cout << "Planned " << plan.shows.size() << " showtimes in " << fixed << setprecision(0) << plan.ms
+         << " ms (" << plan.searches << " searches on " << plan.threads << " thread(s))." << endl;
+    for (int d = 0; d < options.days; ++d) {
+        int shows = 0;
+        for (const PlannedShow& p : plan.shows) {
+            if (p.startMinute / (24 * 60) == options.firstDay + d) ++shows;
+        }
+        cout << "Date: " << formatDayNumber(options.firstDay + d) << " | New showtimes: " << shows
+             << " | Expected revenue: " << setprecision(2) << plan.dayRevenue[d] << endl;
+    }
+    cout << "Expected tickets: " << setprecision(0) << plan.expectedTickets << " of " << plan.demandTickets
+         << " wanted | Expected revenue: " << setprecision(2) << plan.expectedRevenue
+         << " (greedy plan: " << plan.greedyRevenue << ")" << endl;
+    if (plan.shows.empty()) {
+        cout << "No new showtime fits or sells a ticket." << endl;
+        return;
+    }
+
+    char ans = 'N';
+    cout << "Add these " << plan.shows.size() << " showtimes? (Y/N): ";
+    console >> ans;
+    if (ans != 'Y' && ans != 'y') {
+        cout << "Plan discarded." << endl;
+        return;
+    }
+    int firstId = site.nextShowtimeId;
+    int added = addPlannedShowtimes(plan);
+    cout << added << " showtimes added";
+    if (added > 0) cout << " [IDs " << firstId << "-" << site.nextShowtimeId - 1 << "]";
+    cout << "." << endl;
+}
+
+// Plan a week for a synthetic multiplex of `hallCount` halls and 60
+// movies, first on one thread and then on every core, and check that no
+// two shows of a hall overlap and none runs past closing.
+void benchmarkScheduleOptimizer(int hallCount) {
+    Cinema& site = cinema();
+    SyntheticRng rng(7);
+    static const int hallSizes[][2] = { { 10, 12 }, { 12, 16 }, { 15, 20 }, { 18, 24 }, { 20, 30 } };
+    double weekSeats = 0;
+    for (int i = 0; i < hallCount; ++i) {
+        Hall h;
+        h.id = i + 1;
+        h.name = "Hall " + to_string(i + 1);
+        h.floor = 1 + i / 4;
+        int k = rng.range(0, 4);
+        h.rows = hallSizes[k][0];
+        h.cols = hallSizes[k][1];
+        h.layout = defaultHallLayout(h.rows, h.cols);
+        weekSeats += h.layout->sellableCount * 6.0 * 7;
+        site.halls.push_back(h);
+    }
+    // Demand for about 70% of a week of six shows a hall, Zipf over the movies
+    const int movieCount = 60;
+    vector<ScheduleDemand> demand;
+    double zipfTotal = 0;
+    for (int i = 0; i < movieCount; ++i) zipfTotal += 1.0 / pow(i + 1.0, 0.9);
+    for (int i = 0; i < movieCount; ++i) {
+        Movie m{ i + 1, "Movie " + to_string(i + 1), "PG-13", 85 + rng.range(0, 18) * 5 };
+        site.movies.push_back(m);
+        demand.push_back({ m.id, 0.7 * weekSeats / pow(i + 1.0, 0.9) / zipfTotal });
+    }
+
+    ScheduleOptions options;
+    options.firstDay = parseDayNumber(GENERATOR_START_DATE);
+    int cores = max(1, static_cast<int>(thread::hardware_concurrency()));
+    options.restarts = max(2, (cores + options.days - 1) / options.days);
+    cout << "Schedule optimizer: " << hallCount << " halls x " << options.days << " days, " << movieCount
+         << " movies, " << options.restarts << " searches per day of " << options.iterations << " moves" << endl;
+
+    double oneThreadMs = 0;
+    for (int threads : { 1, cores }) {
+        options.threads = threads;
+        SchedulePlan plan = planSchedule(demand, options);
+
+        int conflicts = 0;
+        for (size_t i = 0; i < plan.shows.size(); ++i) {
+            const PlannedShow& p = plan.shows[i];
+            long long end = p.startMinute + site.movies[p.movieId - 1].duration;
+            if (p.startMinute % (24 * 60) + site.movies[p.movieId - 1].duration > options.closeMinute) ++conflicts;
+            if (i + 1 < plan.shows.size() && plan.shows[i + 1].hallId == p.hallId
+                && plan.shows[i + 1].startMinute < end + options.cleaningMinutes) {
+                ++conflicts;
+            }
+        }
+        if (threads == 1) oneThreadMs = plan.ms;
+        cout << "  " << plan.threads << " thread(s): " << fixed << setprecision(0) << plan.ms << " ms";
+        if (threads != 1) cout << " (" << setprecision(1) << oneThreadMs / plan.ms << "x)";
+        cout << ", " << plan.shows.size() << " showtimes, " << conflicts << " conflicts" << endl;
+        cout << "    expected revenue " << setprecision(0) << plan.expectedRevenue << " (greedy "
+             << plan.greedyRevenue << ", +" << setprecision(1)
+             << 100.0 * (plan.expectedRevenue - plan.greedyRevenue) / max(1.0, plan.greedyRevenue) << "%), tickets "
+             << setprecision(0) << plan.expectedTickets << " of " << plan.demandTickets << " wanted" << endl;
+        if (cores == 1) break;
+    }
+}
+
+// ===== Persistence implementations =====
+
+// Width of the sold count on a showtime's size line. The count is padded
+// to the widest value it can take, so it can be overwritten in place.
+static int soldFieldWidth(const Showtime& s) {
+    return static_cast<int>(to_string(s.rows * s.cols).size());
+}
+
+static string paddedNumber(long long value, int width) {
+    string text = to_string(value);
+    if (static_cast<int>(text.size()) < width) text.resize(width, ' ');
+    return text;
+}
+
+// Seat grid as "1 0 ... 0\n" per row: two bytes per seat, so a grid
+// always has the same size and can be overwritten in place.
+static void appendSeatGrid(string& out, const Showtime& s) {
+    for (int r = 0; r < s.rows; ++r) {
+        for (int c = 0; c < s.cols; ++c) {
+            out += isSeatSold(s, r, c) ? '1' : '0';
+            out += (c + 1 < s.cols) ? ' ' : '\n';
+        }
+    }
+}
+
+const int ORDER_COUNT_WIDTH = 12; // Padded order count at the start of ORDER_FILE
+
+// Append the record of `o` to `out`, which will start at byte `base` of
+// ORDER_FILE, and remember where its refunded flag lands.
+static void appendOrderRecord(string& out, Order& o, long long base) {
+    out += to_string(o.id) + '\n';
+    out += o.idempotencyKey + '\n';
+    out += to_string(o.showtimeId) + ' ' + to_string(o.totalCents) + ' ' + to_string(o.createdAt) + ' ';
+    o.flagOffset = base + static_cast<long long>(out.size());
+    out += o.refunded ? "1\n" : "0\n";
+    out += to_string(o.seats.size());
+    for (size_t k = 0; k < o.seats.size(); ++k) {
+        out += ' ' + to_string(o.seats[k].first) + ' ' + to_string(o.seats[k].second)
+               + ' ' + to_string(o.seatPriceCents[k]);
+    }
+    out += '\n';
+}
+
+void loadDataFromFiles() {
+    Cinema& site = cinema();
+    ScopedLatency timer(OP_LOAD_DATA);
+    TraceSpan span("load_data");
+    // ----- Load movies -----
+    {
+        TextReader fin(sitePath(MOVIE_FILE));
+        if (!fin) {
+            // No file yet -> start empty
+            // cout << "[Info] No movie file found. Starting with empty movies.\n";
+        } else {
+            int count;
+            if (!(fin >> count)) {
+                // cout << "[Warning] Failed to read movie count.\n";
+            } else {
+                fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip rest of line
+                site.movies.clear();
+                int maxId = 0;
+
+                for (int i = 0; i < count; ++i) {
+                    Movie m;
+                    fin >> m.id;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip end of line
+
+                    getline(fin, m.title);
+                    getline(fin, m.rating);
+                    if (!m.title.empty() && m.title.back() == '\r') m.title.pop_back();
+                    if (!m.rating.empty() && m.rating.back() == '\r') m.rating.pop_back();
+
+                    fin >> m.duration;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip end of line
+
+                    site.movies.push_back(m);
+                    if (m.id > maxId) maxId = m.id;
+                }
+                site.nextMovieId = maxId + 1;
+            }
+        }
+        rebuildMovieTitleIndex();
+    }
+
+    // ----- Load halls -----
+    {
+        TextReader fin(sitePath(HALL_FILE));
+        if (!fin) {
+            // cout << "[Info] No hall file found. Starting with empty halls.\n";
+        } else {
+            int count;
             if (!(fin >> count)) {
                 // cout << "[Warning] Failed to read hall count.\n";
             } else {
-                fin.ignore(numeric_limits<streamsize>::max(), '\n');
-                halls.clear();
-                int maxId = 0;
+                fin.ignore(numeric_limits<streamsize>::max(), '\n');
+                site.halls.clear();
+                int maxId = 0;
+
+                for (int i = 0; i < count; ++i) {
+                    Hall h;
+                    fin >> h.id;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+                    getline(fin, h.name);
+                    if (!h.name.empty() && h.name.back() == '\r') h.name.pop_back();
+
+                    fin >> h.floor;
+                    fin >> h.rows;
+                    fin >> h.cols;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+                    h.layout = defaultHallLayout(h.rows, h.cols);
+                    site.halls.push_back(h);
+                    if (h.id > maxId) maxId = h.id;
+                }
+                site.nextHallId = maxId + 1;
+            }
+        }
+    }
+
+    // Lookups binary search by ID, so keep both lists in ID order
+    sort(site.movies.begin(), site.movies.end(), [](const Movie& a, const Movie& b) { return a.id < b.id; });
+    sort(site.halls.begin(), site.halls.end(), [](const Hall& a, const Hall& b) { return a.id < b.id; });
+    rebuildListingIndexes();
+
+    // ----- Load hall seat layouts -----
+    // Only seats that are not SEAT_NORMAL are stored.
+    {
+        TextReader fin(sitePath(LAYOUT_FILE));
+        int count;
+        int ignored = 0; // Seats outside their hall or of an unknown type
+        if (fin && fin >> count) {
+            for (int i = 0; i < count; ++i) {
+                int hallId, special;
+                if (!(fin >> hallId >> special)) break;
+
+                int hIdx = findHallIndexById(hallId);
+                vector<unsigned char> types;
+                if (hIdx != -1) types.assign(site.halls[hIdx].rows * site.halls[hIdx].cols, SEAT_NORMAL);
+                for (int k = 0; k < special; ++k) {
+                    int r, c, type;
+                    fin >> r >> c >> type;
+                    if (hIdx == -1) continue;
+                    if (r >= 1 && r <= site.halls[hIdx].rows && c >= 1 && c <= site.halls[hIdx].cols
+                        && type >= SEAT_NORMAL && type <= SEAT_ACCESSIBLE) {
+                        types[(r - 1) * site.halls[hIdx].cols + (c - 1)] = static_cast<unsigned char>(type);
+                    } else {
+                        ++ignored;
+                    }
+                }
+                if (hIdx != -1) {
+                    site.halls[hIdx].layout = makeHallLayout(site.halls[hIdx].rows, site.halls[hIdx].cols, types);
+                }
+            }
+        }
+        if (ignored > 0) {
+            cout << "[Warning] " << ignored << " seat(s) in " << LAYOUT_FILE
+                 << " are outside their hall or of an unknown type and were ignored." << endl;
+        }
+    }
+
+    // ----- Load hall pricing rules -----
+    {
+        site.hallPricingRules.clear();
+        site.compiledPricingByHall.clear();
+        site.quoteCache.clear();
+
+        TextReader fin(sitePath(PRICING_FILE));
+        int count;
+        if (fin && fin >> count) {
+            for (int i = 0; i < count; ++i) {
+                int hallId;
+                PricingRules r;
+                fin >> hallId
+                    >> r.frontRows >> r.frontMultiplier >> r.premiumShare >> r.premiumMultiplier
+                    >> r.matineeEndHour >> r.matineeMultiplier >> r.eveningStartHour >> r.eveningMultiplier
+                    >> r.surgeOccupancy >> r.surgeMultiplier >> r.peakOccupancy >> r.peakMultiplier;
+                if (!fin) break;
+                site.hallPricingRules[hallId] = r;
+            }
+        }
+    }
+
+    // ----- Load orders -----
+    {
+        site.orders.clear();
+        site.orderIndexById.clear();
+        site.orderIdByKey.clear();
+
+        // Offsets of the refunded flags are recorded so refunds can be
+        // patched in place when the file has the fixed layout.
+        TextReader fin(sitePath(ORDER_FILE));
+        string countLine;
+        bool patchable = false;
+        if (fin && getline(fin, countLine)) {
+            int count = atoi(countLine.c_str());
+            patchable = countLine.size() == static_cast<size_t>(ORDER_COUNT_WIDTH);
+            string idLine, detailLine, seatLine;
+            for (int i = 0; i < count; ++i) {
+                Order o;
+                int refunded = 0, seatCount = 0;
+                getline(fin, idLine);
+                getline(fin, o.idempotencyKey);
+                if (!o.idempotencyKey.empty() && o.idempotencyKey.back() == '\r') o.idempotencyKey.pop_back();
+                long long detailStart = static_cast<long long>(fin.tellg());
+                getline(fin, detailLine);
+                getline(fin, seatLine);
+                if (!fin) break;
+                o.id = atoll(idLine.c_str());
+
+                const char* p = detailLine.data();
+                const char* end = p + detailLine.size();
+                if (p) p = parseNextNumber(p, end, o.showtimeId);
+                if (p) p = parseNextNumber(p, end, o.totalCents);
+                if (p) p = parseNextNumber(p, end, o.createdAt);
+                if (p) p = parseNextNumber(p, end, refunded);
+                o.refunded = (refunded != 0);
+                if (detailLine.size() >= 2 && detailLine[detailLine.size() - 2] == ' ') {
+                    o.flagOffset = detailStart + static_cast<long long>(detailLine.size()) - 1;
+                } else {
+                    patchable = false; // Trailing '\r' or padding
+                }
+
+                p = seatLine.data();
+                end = p + seatLine.size();
+                p = parseNextNumber(p, end, seatCount);
+                o.seats.resize(max(seatCount, 0));
+                o.seatPriceCents.resize(max(seatCount, 0));
+                bool withPrices = !seatListWithoutPrices(p, end, seatCount);
+                for (int k = 0; k < seatCount && p; ++k) {
+                    p = parseNextNumber(p, end, o.seats[k].first);
+                    if (p) p = parseNextNumber(p, end, o.seats[k].second);
+                    if (p && withPrices) p = parseNextNumber(p, end, o.seatPriceCents[k]);
+                }
+                if (!withPrices) splitOrderTotal(o);
+                addOrder(o);
+            }
+            error_code ec;
+            site.orderFileBytes = static_cast<long long>(filesystem::file_size(sitePath(ORDER_FILE), ec));
+        }
+        site.ordersPatchable = patchable;
+    }
+
+    // ----- Load showtimes -----
+    // Only metadata and sold counts are read; each seat grid is remembered
+    // by its offset and loaded by ensureSeatMap() when first needed.
+    {
+        TextReader fin(sitePath(SHOWTIME_FILE));
+        if (!fin) {
+            // cout << "[Info] No showtime file found. Starting with empty showtimes.\n";
+        } else {
+            int count;
+            if (!(fin >> count)) {
+                // cout << "[Warning] Failed to read showtime count.\n";
+            } else {
+                fin.ignore(numeric_limits<streamsize>::max(), '\n');
+                site.showtimes.clear();
+                unordered_map<int, pair<long long, long long>> grids;
+                bool patchable = true;
+                int maxId = 0;
+
+                for (int i = 0; i < count; ++i) {
+                    Showtime s;
+
+                    fin >> s.id;
+                    fin >> s.movieId;
+                    fin >> s.hallId;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip rest of line
+
+                    getline(fin, s.datetime);
+                    if (!s.datetime.empty() && s.datetime.back() == '\r') s.datetime.pop_back();
+                    fin >> s.price;
+                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+                    // "rows cols sold"; files from older versions lack the sold count
+                    string sizeLine;
+                    getline(fin, sizeLine);
+                    const char* p = sizeLine.data();
+                    const char* end = p + sizeLine.size();
+                    p = parseNextNumber(p, end, s.rows);
+                    if (p) p = parseNextNumber(p, end, s.cols);
+                    bool haveSold = p && parseNextNumber(p, end, s.storedSold);
+
+                    int hIdx = findHallIndexById(s.hallId);
+                    if (hIdx != -1 && site.halls[hIdx].rows == s.rows && site.halls[hIdx].cols == s.cols) {
+                        s.layout = site.halls[hIdx].layout;
+                    } else {
+                        s.layout = defaultHallLayout(s.rows, s.cols);
+                    }
+
+                    long long seatOffset = static_cast<long long>(fin.tellg());
+                    long long seatBytes = 0;
+                    bool fixedRows = haveSold;
+                    if (haveSold) {
+                        // Rows of this version are "v v ... v" with one digit per
+                        // seat, so only their lengths are checked here; the seats
+                        // are parsed when the map is first needed
+                        string row;
+                        for (int r = 0; r < s.rows && fixedRows; ++r) {
+                            fixedRows = static_cast<bool>(getline(fin, row));
+                            if (!row.empty() && row.back() == '\r') row.pop_back();
+                            fixedRows = fixedRows && static_cast<int>(row.size()) == 2 * s.cols - 1;
+                        }
+                        seatBytes = static_cast<long long>(fin.tellg()) - seatOffset;
+                        if (fixedRows) {
+                            // Grids of this version can be patched in place, see saveDataToFiles()
+                            size_t sizeChars = to_string(s.rows).size() + to_string(s.cols).size() + 2
+                                               + static_cast<size_t>(soldFieldWidth(s));
+                            patchable = patchable && sizeLine.size() == sizeChars
+                                        && seatBytes == 2LL * s.rows * s.cols;
+                        } else {
+                            // Hand-edited grid; read it seat by seat like an old file
+                            fin.clear();
+                            fin.seekg(seatOffset);
+                        }
+                    }
+                    if (!fixedRows) {
+                        patchable = false;
+                        s.storedSold = 0;
+                        for (int r = 0; r < s.rows; ++r) {
+                            for (int c = 0; c < s.cols; ++c) {
+                                int v;
+                                fin >> v;
+                                if (v != 0 && isSeatSellable(s, r, c)) ++s.storedSold;
+                            }
+                        }
+                        fin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        seatBytes = static_cast<long long>(fin.tellg()) - seatOffset;
+                    }
+
+                    grids[s.id] = { seatOffset, seatBytes };
+                    site.showtimes.push_back(s);
+                    if (s.id > maxId) maxId = s.id;
+                }
+                site.nextShowtimeId = maxId + 1;
+
+                site.snapshotPatchable = patchable;
+                lock_guard<mutex> lock(site.snapshotMutex);
+                site.seatGridIndex.swap(grids);
+            }
+        }
+    }
+
+    rebuildShowtimeColumns();
+
+    // ----- Open the ticket fact log -----
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    site.nextOrderId = site.ticketLog.maxOrderId + 1;
+    for (const auto& o : site.orders) {
+        if (o.id >= site.nextOrderId) site.nextOrderId = o.id + 1;
+    }
+
+    // Everything on disk matches memory now
+    site.dirtyFiles = 0;
+    site.savedOrderCount = site.orders.size();
+
+    // ----- Roll finished days into the archive -----
+    // Only today's and future partitions stay in memory; the archive
+    // index is small and only needed for ID allocation and reports.
+    loadArchiveIndex();
+    for (const auto& seg : site.archiveSegments) {
+        if (seg.maxShowtimeId >= site.nextShowtimeId) site.nextShowtimeId = seg.maxShowtimeId + 1;
+    }
+    int dropped = dropArchivedShowtimeCopies();
+    if (dropped > 0) {
+        cout << "[Warning] " << dropped << " showtime(s) were both archived and in " << SHOWTIME_FILE
+             << "; the archived copies are kept." << endl;
+    }
+    if (archivePastShowtimes() > 0 || dropped > 0) {
+        saveDataToFiles();
+    }
+}
+
+void saveDataToFiles() {
+    Cinema& site = cinema();
+    ScopedLatency timer(OP_SAVE_DATA);
+    TraceSpan span("save_data");
+    // Only dirty files are serialized here, and the background writer
+    // writes them. Files it failed to update are rewritten in full.
+    site.dirtyFiles |= site.failedWrites.exchange(0);
+    long long seq = ++site.lastWriteSeq;
+    vector<WriteJob*> jobs;
+    auto queueJob = [&](WriteKind kind, const string& fileName, unsigned dirtyOnFailure) -> WriteJob& {
+        WriteJob* job = new WriteJob();
+        job->kind = kind;
+        job->path = sitePath(fileName);
+        job->seq = seq;
+        job->dirtyOnFailure = dirtyOnFailure;
+        jobs.push_back(job);
+        return *job;
+    };
+
+    // ----- Save movies -----
+    if (site.dirtyFiles & DIRTY_MOVIES) {
+        ostringstream fout;
+        fout << site.movies.size() << '\n';
+        for (const auto& m : site.movies) {
+            fout << m.id << '\n';
+            fout << m.title << '\n';
+            fout << m.rating << '\n';
+            fout << m.duration << '\n';
+        }
+        queueJob(WRITE_REPLACE, MOVIE_FILE, DIRTY_MOVIES).data = fout.str();
+    }
+
+    // ----- Save halls -----
+    if (site.dirtyFiles & DIRTY_HALLS) {
+        ostringstream fout;
+        fout << site.halls.size() << '\n';
+        for (const auto& h : site.halls) {
+            fout << h.id << '\n';
+            fout << h.name << '\n';
+            fout << h.floor << ' ' << h.rows << ' ' << h.cols << '\n';
+        }
+        queueJob(WRITE_REPLACE, HALL_FILE, DIRTY_HALLS).data = fout.str();
+    }
+
+    // ----- Save hall seat layouts -----
+    if (site.dirtyFiles & DIRTY_LAYOUTS) {
+        ostringstream fout;
+        vector<const Hall*> custom;
+        for (const auto& h : site.halls) {
+            const auto& types = h.layout->seatType;
+            if (any_of(types.begin(), types.end(), [](unsigned char t) { return t != SEAT_NORMAL; })) {
+                custom.push_back(&h);
+            }
+        }
+        fout << custom.size() << '\n';
+        for (const Hall* hp : custom) {
+            const Hall& h = *hp;
+            vector<int> special;
+            for (int i = 0; i < h.rows * h.cols; ++i) {
+                if (h.layout->seatType[i] != SEAT_NORMAL) special.push_back(i);
+            }
+            fout << h.id << ' ' << special.size() << '\n';
+            for (int i : special) {
+                fout << i / h.cols + 1 << ' ' << i % h.cols + 1 << ' '
+                     << static_cast<int>(h.layout->seatType[i]) << '\n';
+            }
+        }
+        queueJob(WRITE_REPLACE, LAYOUT_FILE, DIRTY_LAYOUTS).data = fout.str();
+    }
+
+    // ----- Save showtimes + seats -----
+    // Dirty seat maps are never evicted, so the LRU list of resident maps
+    // covers all of them.
+    vector<int> dirtySeatMaps; // Showtime indexes
+    for (int id : site.seatMapLru) {
+        int idx = findShowtimeIndexById(id);
+        if (idx != -1 && site.showtimes[idx].seatsDirty) dirtySeatMaps.push_back(idx);
+    }
+    if ((site.dirtyFiles & DIRTY_SHOWTIMES) || (!dirtySeatMaps.empty() && !site.snapshotPatchable)) {
+        // Full snapshot. Seat maps that are not resident are copied byte
+        // for byte from the previous snapshot by the writer, so saving
+        // never loads them.
+        WriteJob& job = queueJob(WRITE_SNAPSHOT, SHOWTIME_FILE, DIRTY_SHOWTIMES);
+        job.data = to_string(site.showtimes.size()) + "\n";
+        job.pieces.reserve(site.showtimes.size());
+
+        for (size_t i = 0; i < site.showtimes.size(); ++i) {
+            Showtime& s = site.showtimes[i];
+            ostringstream fout;
+            fout << s.id << '\n';
+            fout << s.movieId << '\n';
+            fout << s.hallId << '\n';
+            fout << s.datetime << '\n';
+            fout << s.price << '\n';
+            fout << s.rows << ' ' << s.cols << ' '
+                 << paddedNumber(site.showtimeCols.sold[i], soldFieldWidth(s)) << '\n';
+
+            SnapshotPiece piece;
+            piece.showtimeId = s.id;
+            piece.text = fout.str();
+            piece.gridStart = piece.text.size();
+            piece.copyGrid = !s.seatsLoaded;
+            if (s.seatsLoaded) {
+                appendSeatGrid(piece.text, s);
+                s.savedSeq = seq;
+                s.storedSold = site.showtimeCols.sold[i];
+                s.seatsDirty = false;
+            }
+            job.pieces.push_back(move(piece));
+        }
+        site.snapshotPatchable = true;
+    } else {
+        // Only seats changed: overwrite the sold count and grid of each
+        // changed showtime
+        WriteJob* patchJob = nullptr;
+        for (int idx : dirtySeatMaps) {
+            Showtime& s = site.showtimes[idx];
+            int width = soldFieldWidth(s);
+
+            FilePatch patch;
+            patch.showtimeId = s.id;
+            patch.offset = -(width + 1);
+            patch.bytes = paddedNumber(site.showtimeCols.sold[idx], width) + '\n';
+            appendSeatGrid(patch.bytes, s);
+            if (!patchJob) patchJob = &queueJob(WRITE_PATCH, SHOWTIME_FILE, DIRTY_SHOWTIMES);
+            patchJob->patches.push_back(move(patch));
+
+            s.savedSeq = seq;
+            s.storedSold = site.showtimeCols.sold[idx];
+            s.seatsDirty = false;
+        }
+    }
+
+    // ----- Save hall pricing rules -----
+    if (site.dirtyFiles & DIRTY_PRICING) {
+        ostringstream fout;
+        fout << site.hallPricingRules.size() << '\n';
+        for (const auto& entry : site.hallPricingRules) {
+            const PricingRules& r = entry.second;
+            fout << entry.first << '\n';
+            fout << r.frontRows << ' ' << r.frontMultiplier << ' '
+                 << r.premiumShare << ' ' << r.premiumMultiplier << '\n';
+            fout << r.matineeEndHour << ' ' << r.matineeMultiplier << ' '
+                 << r.eveningStartHour << ' ' << r.eveningMultiplier << '\n';
+            fout << r.surgeOccupancy << ' ' << r.surgeMultiplier << ' '
+                 << r.peakOccupancy << ' ' << r.peakMultiplier << '\n';
+        }
+        queueJob(WRITE_REPLACE, PRICING_FILE, DIRTY_PRICING).data = fout.str();
+    }
+
+    // ----- Save orders -----
+    bool ordersChanged = site.savedOrderCount < site.orders.size() || !site.refundedOrders.empty();
+    if ((site.dirtyFiles & DIRTY_ORDERS) || (ordersChanged && !site.ordersPatchable)) {
+        string out = paddedNumber(static_cast<long long>(site.orders.size()), ORDER_COUNT_WIDTH) + '\n';
+        for (auto& o : site.orders) {
+            appendOrderRecord(out, o, 0);
+        }
+        site.orderFileBytes = static_cast<long long>(out.size());
+        queueJob(WRITE_REPLACE, ORDER_FILE, DIRTY_ORDERS).data = move(out);
+        site.ordersPatchable = true;
+    } else if (ordersChanged) {
+        // Orders are only ever added or refunded: flip the refunded flags
+        // in place, update the count and append the new records.
+        vector<FilePatch> patches;
+        for (size_t idx : site.refundedOrders) {
+            if (idx >= site.savedOrderCount) continue; // Written below with its flag
+            const Order& o = site.orders[idx];
+            patches.push_back({ -1, o.flagOffset, o.refunded ? "1" : "0" });
+        }
+        if (site.savedOrderCount < site.orders.size()) {
+            patches.push_back({ -1, 0, paddedNumber(static_cast<long long>(site.orders.size()),
+                                                    ORDER_COUNT_WIDTH) });
+        }
+        if (!patches.empty()) {
+            queueJob(WRITE_PATCH, ORDER_FILE, DIRTY_ORDERS).patches = move(patches);
+        }
+        if (site.savedOrderCount < site.orders.size()) {
+            string out;
+            for (size_t i = site.savedOrderCount; i < site.orders.size(); ++i) {
+                appendOrderRecord(out, site.orders[i], site.orderFileBytes + static_cast<long long>(out.size()));
+            }
+            site.orderFileBytes += static_cast<long long>(out.size());
+            queueJob(WRITE_APPEND, ORDER_FILE, DIRTY_ORDERS).data = move(out);
+        }
+    }
+    site.savedOrderCount = site.orders.size();
+    site.refundedOrders.clear();
+    site.dirtyFiles = 0;
+
+    if (jobs.empty()) {
+        --site.lastWriteSeq; // Nothing changed; no write to wait for
+    } else {
+        submitWrites(jobs);
+    }
+
+    // ----- Append logged ticket sales -----
+    flushTicketFacts(site.ticketLog);
+
+    if (durabilityMode.load() == DURABILITY_FSYNC && !waitForWrites(site, site.lastWriteSeq, seq - 1)) {
+        printWriterErrors();
+        cout << "[Error] Not all data reached the disk; it is written again on the next save." << endl;
+    }
+    evictSeatMaps(); // Maps kept only because they were unsaved may go now
+}
+
+// ===== Consistency checker implementations =====
+
+// Next line of [p, end) as [first, last), without its line break.
+static bool nextLine(const char*& p, const char* end, const char*& first, const char*& last) {
+    if (p >= end) return false;
+    first = p;
+    const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    last = newline ? newline : end;
+    p = newline ? newline + 1 : end;
+    if (last > first && last[-1] == '\r') --last;
+    return true;
+}
+
+static bool parseFields(const char*&, const char*) {
+    return true;
+}
+
+template <class T, class... Rest>
+static bool parseFields(const char*& p, const char* end, T& value, Rest&... rest) {
+    p = parseNextNumber(p, end, value);
+    return p != nullptr && parseFields(p, end, rest...);
+}
+
+// True if the line [first, last) holds exactly the given numbers.
+template <class... T>
+static bool parseLine(const char* first, const char* last, T&... values) {
+    const char* p = first;
+    if (!parseFields(p, last, values...)) return false;
+    while (p < last && isSpaceChar(*p)) ++p;
+    return p == last;
+}
+
+// Opens `path` and reads its count line. False if the file is absent
+// (nothing to check) or the count is unreadable (reported).
+static bool openCheckedFile(FileCheck& check, MappedFile& file, const string& path,
+                            const char*& p, const char*& end, int& count) {
+    if (!file.open(path)) return false;
+    check.bytes = static_cast<long long>(file.size);
+    p = reinterpret_cast<const char*>(file.data);
+    end = p + file.size;
+    const char *first, *last;
+    if (!nextLine(p, end, first, last) || !parseLine(first, last, count) || count < 0) {
+        check.problem("The record count on the first line is missing or invalid.");
+        return false;
+    }
+    return true;
+}
+
+static FileCheck checkMovieFile(const string& path, unordered_set<int>& movieIds) {
+    FileCheck check;
+    check.fileName = MOVIE_FILE;
+    MappedFile file;
+    const char *p, *end, *first, *last;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    for (int i = 0; i < count; ++i) {
+        const char *idFirst, *idLast, *titleFirst, *titleLast, *ratingFirst, *ratingLast;
+        if (!nextLine(p, end, idFirst, idLast) || !nextLine(p, end, titleFirst, titleLast)
+            || !nextLine(p, end, ratingFirst, ratingLast) || !nextLine(p, end, first, last)) {
+            check.problem("The file ends after " + to_string(i) + " of " + to_string(count) + " movies.");
+            break;
+        }
+        ++check.records;
+        int id, duration;
+        if (!parseLine(idFirst, idLast, id)) {
+            check.problem("Movie #" + to_string(i + 1) + " has an invalid ID.");
+            continue;
+        }
+        if (!movieIds.insert(id).second) check.problem("Movie ID " + to_string(id) + " is used more than once.");
+        if (titleFirst == titleLast) check.problem("Movie " + to_string(id) + " has no title.");
+        if (!parseLine(first, last, duration) || duration <= 0) {
+            check.problem("Movie " + to_string(id) + " has an invalid duration.");
+        }
+    }
+    return check;
+}
+
+static FileCheck checkHallFile(const string& path, unordered_map<int, pair<int, int>>& hallShapes) {
+    FileCheck check;
+    check.fileName = HALL_FILE;
+    MappedFile file;
+    const char *p, *end, *first, *last;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    for (int i = 0; i < count; ++i) {
+        const char *idFirst, *idLast, *nameFirst, *nameLast;
+        if (!nextLine(p, end, idFirst, idLast) || !nextLine(p, end, nameFirst, nameLast)
+            || !nextLine(p, end, first, last)) {
+            check.problem("The file ends after " + to_string(i) + " of " + to_string(count) + " halls.");
+            break;
+        }
+        ++check.records;
+        int id, floor, rows, cols;
+        if (!parseLine(idFirst, idLast, id)) {
+            check.problem("Hall #" + to_string(i + 1) + " has an invalid ID.");
+            continue;
+        }
+        if (!parseLine(first, last, floor, rows, cols) || rows <= 0 || cols <= 0) {
+            check.problem("Hall " + to_string(id) + " has an invalid floor or size.");
+            continue;
+        }
+        if (!hallShapes.emplace(id, make_pair(rows, cols)).second) {
+            check.problem("Hall ID " + to_string(id) + " is used more than once.");
+        }
+    }
+    return check;
+}
+
+static FileCheck checkLayoutFile(const string& path, const unordered_map<int, pair<int, int>>& hallShapes) {
+    FileCheck check;
+    check.fileName = LAYOUT_FILE;
+    MappedFile file;
+    const char *p, *end, *first, *last;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    unordered_set<int> seen;
+    for (int i = 0; i < count; ++i) {
+        int hallId, special;
+        if (!nextLine(p, end, first, last) || !parseLine(first, last, hallId, special) || special < 0) {
+            check.problem("Layout #" + to_string(i + 1) + " has an invalid header; the rest of the file is skipped.");
+            break;
+        }
+        ++check.records;
+        auto hall = hallShapes.find(hallId);
+        string name = "Layout of hall " + to_string(hallId);
+        if (hall == hallShapes.end()) check.problem(name + ": the hall does not exist.");
+        if (!seen.insert(hallId).second) check.problem(name + " appears more than once.");
+        for (int k = 0; k < special; ++k) {
+            int r, c, type;
+            if (!nextLine(p, end, first, last) || !parseLine(first, last, r, c, type)) {
+                check.problem(name + ": seat #" + to_string(k + 1) + " is unreadable.");
+                continue;
+            }
+            string seat = " (" + to_string(r) + ", " + to_string(c) + ")";
+            if (hall != hallShapes.end()
+                && (r < 1 || r > hall->second.first || c < 1 || c > hall->second.second)) {
+                check.problem(name + ": seat" + seat + " is outside the hall.");
+            }
+            if (type < SEAT_NORMAL || type > SEAT_ACCESSIBLE) {
+                check.problem(name + ": seat" + seat + " has unknown type " + to_string(type) + ".");
+            }
+        }
+    }
+    return check;
+}
+
+static FileCheck checkPricingFile(const string& path, const unordered_map<int, pair<int, int>>& hallShapes) {
+    FileCheck check;
+    check.fileName = PRICING_FILE;
+    MappedFile file;
+    const char *p, *end, *first, *last;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    for (int i = 0; i < count; ++i) {
+        int hallId;
+        PricingRules r;
+        const char *f1, *l1, *f2, *l2, *f3, *l3;
+        if (!nextLine(p, end, first, last) || !nextLine(p, end, f1, l1) || !nextLine(p, end, f2, l2)
+            || !nextLine(p, end, f3, l3)) {
+            check.problem("The file ends after " + to_string(i) + " of " + to_string(count) + " hall rules.");
+            break;
+        }
+        ++check.records;
+        if (!parseLine(first, last, hallId)
+            || !parseLine(f1, l1, r.frontRows, r.frontMultiplier, r.premiumShare, r.premiumMultiplier)
+            || !parseLine(f2, l2, r.matineeEndHour, r.matineeMultiplier, r.eveningStartHour, r.eveningMultiplier)
+            || !parseLine(f3, l3, r.surgeOccupancy, r.surgeMultiplier, r.peakOccupancy, r.peakMultiplier)) {
+            check.problem("Pricing rules #" + to_string(i + 1) + " are unreadable.");
+            continue;
+        }
+        if (!hallShapes.count(hallId)) {
+            check.problem("Pricing rules for hall " + to_string(hallId) + ", which does not exist.");
+        }
+        if (r.surgeMultiplier > r.peakMultiplier || r.surgeOccupancy > r.peakOccupancy) {
+            check.problem("Pricing rules for hall " + to_string(hallId) + " have a surge step above the peak step.");
+        }
+    }
+    return check;
+}
+
+// Checks references, sizes and seat grids. Grids of the current format
+// are validated byte by byte; others are read as numbers like the loader does.
+static FileCheck checkShowtimeFile(const string& path, const unordered_set<int>& movieIds,
+                                   const unordered_map<int, pair<int, int>>& hallShapes,
+                                   unordered_map<int, pair<int, int>>& showtimeShapes, vector<int>& regrid) {
+    FileCheck check;
+    check.fileName = SHOWTIME_FILE;
+    MappedFile file;
+    const char *p, *end;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    for (int i = 0; i < count; ++i) {
+        const char *lines[6][2];
+        bool complete = true;
+        for (auto& line : lines) complete = complete && nextLine(p, end, line[0], line[1]);
+        int id, movieId, hallId, rows, cols, storedSold = 0;
+        double price;
+        if (!complete) {
+            check.problem("The file ends after " + to_string(i) + " of " + to_string(count) + " showtimes.");
+            break;
+        }
+        bool haveSold = parseLine(lines[5][0], lines[5][1], rows, cols, storedSold);
+        if (!parseLine(lines[0][0], lines[0][1], id) || !parseLine(lines[1][0], lines[1][1], movieId)
+            || !parseLine(lines[2][0], lines[2][1], hallId)
+            || (!haveSold && !parseLine(lines[5][0], lines[5][1], rows, cols)) || rows <= 0 || cols <= 0) {
+            check.problem("Showtime #" + to_string(i + 1) + " has an unreadable header; the rest of the file is skipped.");
+            break;
+        }
+        ++check.records;
+
+        string name = "Showtime " + to_string(id);
+        if (!showtimeShapes.emplace(id, make_pair(rows, cols)).second) {
+            check.problem("Showtime ID " + to_string(id) + " is used more than once.");
+        }
+        if (!movieIds.count(movieId)) {
+            check.problem(name + " refers to movie " + to_string(movieId) + ", which does not exist.");
+        }
+        auto hall = hallShapes.find(hallId);
+        if (hall == hallShapes.end()) {
+            check.problem(name + " refers to hall " + to_string(hallId) + ", which does not exist.");
+        } else if (hall->second.first != rows || hall->second.second != cols) {
+            check.problem(name + " has a " + to_string(rows) + " x " + to_string(cols) + " seat grid, but hall "
+                          + to_string(hallId) + " is " + to_string(hall->second.first) + " x "
+                          + to_string(hall->second.second) + ".");
+        }
+        string datetime(lines[3][0], lines[3][1]);
+        if (parseDatetimeMinutes(datetime) < 0) {
+            check.problem(name + " has an unreadable date and time \"" + datetime + "\".");
+        }
+        if (!parseLine(lines[4][0], lines[4][1], price) || price < 0) {
+            check.problem(name + " has an invalid price.");
+        }
+
+        // Grid: any nonzero value counts as sold, as in ensureSeatMap()
+        const char* grid = p;
+        long long seats = static_cast<long long>(rows) * cols;
+        long long sold = 0, strange = 0;
+        bool fixedLayout = haveSold && end - grid >= 2 * seats;
+        for (const char* row = grid; fixedLayout && row < grid + 2 * seats; row += 2 * cols) {
+            int badBytes = 0;
+            for (int c = 0; c < cols; ++c) {
+                unsigned char digit = static_cast<unsigned char>(row[2 * c] - '0');
+                badBytes += (digit > 9) + (row[2 * c + 1] != (c + 1 < cols ? ' ' : '\n'));
+                sold += digit != 0;
+                strange += digit > 1;
+            }
+            fixedLayout = badBytes == 0;
+        }
+        if (fixedLayout) {
+            p = grid + 2 * seats;
+        } else {
+            sold = strange = 0;
+            p = grid;
+            for (long long k = 0; k < seats && p; ++k) {
+                long long value;
+                p = parseNextNumber(p, end, value);
+                sold += p && value != 0;
+                strange += p && value != 0 && value != 1;
+            }
+            if (!p) {
+                check.problem(name + ": the seat grid is incomplete; the rest of the file is skipped.");
+                regrid.push_back(id);
+                break;
+            }
+            const char* newline = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+            p = newline ? newline + 1 : end;
+            if (haveSold) {
+                check.problem(name + ": the seat grid does not have the fixed two-bytes-per-seat layout.");
+                regrid.push_back(id);
+            }
+        }
+        if (strange > 0) {
+            check.problem(name + ": the seat grid has " + to_string(strange) + " value(s) other than 0 and 1.");
+            if (fixedLayout || !haveSold) regrid.push_back(id);
+        }
+        if (haveSold && sold != storedSold) {
+            check.problem(name + " records " + to_string(storedSold) + " sold seat(s), but its grid has "
+                          + to_string(sold) + ".");
+            if (fixedLayout && strange == 0) regrid.push_back(id);
+        }
+    }
+    return check;
+}
+
+struct OrderRef {
+    long long id;
+    int showtimeId;
+    int maxRow; // Largest seat row and column of the order, 1-based
+    int maxCol;
+};
+
+static FileCheck checkOrderFile(const string& path, vector<OrderRef>& refs) {
+    FileCheck check;
+    check.fileName = ORDER_FILE;
+    MappedFile file;
+    const char *p, *end;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    unordered_set<long long> ids;
+    unordered_set<string_view> keys; // Views into the mapped file
+    ids.reserve(static_cast<size_t>(count));
+    keys.reserve(static_cast<size_t>(count));
+    refs.reserve(static_cast<size_t>(count));
+    for (int i = 0; i < count; ++i) {
+        const char *lines[4][2];
+        bool complete = true;
+        for (auto& line : lines) complete = complete && nextLine(p, end, line[0], line[1]);
+        if (!complete) {
+            check.problem("The file ends after " + to_string(i) + " of " + to_string(count) + " orders.");
+            break;
+        }
+        ++check.records;
+        OrderRef ref = { 0, 0, 0, 0 };
+        long long totalCents, createdAt;
+        int refunded;
+        if (!parseLine(lines[0][0], lines[0][1], ref.id)) {
+            check.problem("Order #" + to_string(i + 1) + " has an invalid ID.");
+            continue;
+        }
+        auto name = [&] { return "Order " + to_string(ref.id); };
+        if (!ids.insert(ref.id).second) check.problem("Order ID " + to_string(ref.id) + " is used more than once.");
+        string_view key(lines[1][0], static_cast<size_t>(lines[1][1] - lines[1][0]));
+        if (!key.empty() && !keys.insert(key).second) {
+            check.problem("Purchase reference \"" + string(key) + "\" is used by more than one order.");
+        }
+        if (!parseLine(lines[2][0], lines[2][1], ref.showtimeId, totalCents, createdAt, refunded)
+            || (refunded != 0 && refunded != 1)) {
+            check.problem(name() + " has unreadable details.");
+            continue;
+        }
+
+        const char* s = lines[3][0];
+        const char* seatEnd = lines[3][1];
+        int seatCount = 0;
+        long long priceSum = 0;
+        bool seatsOk = (s = parseNextNumber(s, seatEnd, seatCount)) != nullptr && seatCount >= 0;
+        bool withPrices = !seatsOk || !seatListWithoutPrices(s, seatEnd, seatCount);
+        if (!withPrices) priceSum = totalCents; // Older files have no per-seat prices
+        for (int k = 0; seatsOk && k < seatCount; ++k) {
+            int r, c;
+            long long cents = 0;
+            seatsOk = (withPrices ? parseFields(s, seatEnd, r, c, cents) : parseFields(s, seatEnd, r, c))
+                      && r >= 1 && c >= 1;
+            ref.maxRow = max(ref.maxRow, r);
+            ref.maxCol = max(ref.maxCol, c);
+            priceSum += cents;
+        }
+        while (seatsOk && s < seatEnd && isSpaceChar(*s)) ++s;
+        if (!seatsOk || s != seatEnd) {
+            check.problem(name() + " has an unreadable seat list.");
+            continue;
+        }
+        if (priceSum != totalCents) {
+            check.problem(name() + " totals " + to_string(totalCents) + " cents, but its seats add up to "
+                          + to_string(priceSum) + ".");
+        }
+        refs.push_back(ref);
+    }
+    return check;
+}
+
+static FileCheck checkArchiveIndexFile(const string& path, const string& archiveDir, int& maxArchivedShowtimeId) {
+    FileCheck check;
+    check.fileName = ARCHIVE_INDEX_FILE;
+    MappedFile file;
+    const char *p, *end, *first, *last;
+    int count;
+    if (!openCheckedFile(check, file, path, p, end, count)) return check;
+
+    for (int i = 0; i < count; ++i) {
+        string date, fileName;
+        int showtimeCount, maxId;
+        long long sold, revenueCents;
+        const char* q = nullptr;
+        if (nextLine(p, end, first, last)) q = parseNextWord(first, last, date);
+        if (q) q = parseNextWord(q, last, fileName);
+        if (!q || !parseLine(q, last, showtimeCount, sold, revenueCents, maxId)) {
+            check.problem("Archive segment #" + to_string(i + 1) + " is unreadable.");
+            continue;
+        }
+        ++check.records;
+        maxArchivedShowtimeId = max(maxArchivedShowtimeId, maxId);
+        if (parseDayNumber(date) < 0) check.problem("Archive segment " + fileName + " has an invalid date.");
+        error_code ec;
+        if (!filesystem::exists(archiveDir + "/" + fileName, ec)) {
+            check.problem("Archive segment " + fileName + " is missing.");
+        }
+    }
+    return check;
+}
+
+// Runs one file checker and records how long it took.
+template <class Check>
+static FileCheck timedCheck(Check check) {
+    auto start = chrono::steady_clock::now();
+    FileCheck result = check();
+    result.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Check the current site's data files as they are on disk. Movies and
+// halls are read first, since the other files refer to them; the rest
+// are checked in parallel, one thread per file.
+ConsistencyReport checkDataFiles() {
+    TraceSpan span("check_data_files");
+    auto start = chrono::steady_clock::now();
+    ConsistencyReport report;
+
+    string moviePath = sitePath(MOVIE_FILE), hallPath = sitePath(HALL_FILE);
+    string layoutPath = sitePath(LAYOUT_FILE), pricingPath = sitePath(PRICING_FILE);
+    string showtimePath = sitePath(SHOWTIME_FILE), orderPath = sitePath(ORDER_FILE);
+    string archiveIndexPath = sitePath(ARCHIVE_INDEX_FILE), archiveDir = sitePath(ARCHIVE_DIR);
+
+    unordered_set<int> movieIds;
+    unordered_map<int, pair<int, int>> hallShapes;
+    future<FileCheck> movies = async(launch::async, [&] {
+        return timedCheck([&] { return checkMovieFile(moviePath, movieIds); });
+    });
+    FileCheck halls = timedCheck([&] { return checkHallFile(hallPath, hallShapes); });
+    FileCheck movieCheck = movies.get();
+
+    unordered_map<int, pair<int, int>> showtimeShapes;
+    vector<OrderRef> orderRefs;
+    int maxArchivedShowtimeId = 0;
+    future<FileCheck> layouts = async(launch::async, [&] {
+        return timedCheck([&] { return checkLayoutFile(layoutPath, hallShapes); });
+    });
+    future<FileCheck> pricing = async(launch::async, [&] {
+        return timedCheck([&] { return checkPricingFile(pricingPath, hallShapes); });
+    });
+    future<FileCheck> orders = async(launch::async, [&] {
+        return timedCheck([&] { return checkOrderFile(orderPath, orderRefs); });
+    });
+    future<FileCheck> archive = async(launch::async, [&] {
+        return timedCheck([&] { return checkArchiveIndexFile(archiveIndexPath, archiveDir, maxArchivedShowtimeId); });
+    });
+    FileCheck showtimes = timedCheck([&] {
+        return checkShowtimeFile(showtimePath, movieIds, hallShapes, showtimeShapes, report.regridShowtimeIds);
+    });
+    FileCheck orderCheck = orders.get();
+    FileCheck archiveCheck = archive.get();
+
+    // Orders may outlive a deleted showtime, but not refer to one that
+    // never existed or to seats outside its grid.
+    int maxShowtimeId = maxArchivedShowtimeId;
+    for (const auto& entry : showtimeShapes) maxShowtimeId = max(maxShowtimeId, entry.first);
+    for (const OrderRef& ref : orderRefs) {
+        auto shape = showtimeShapes.find(ref.showtimeId);
+        auto name = [&] { return "Order " + to_string(ref.id); };
+        if (shape != showtimeShapes.end()) {
+            if (ref.maxRow > shape->second.first || ref.maxCol > shape->second.second) {
+                orderCheck.problem(name() + " has seats outside the grid of showtime " + to_string(ref.showtimeId) + ".");
+            }
+        } else if (ref.showtimeId > maxShowtimeId || ref.showtimeId <= 0) {
+            orderCheck.problem(name() + " refers to showtime " + to_string(ref.showtimeId) + ", which never existed.");
+        }
+    }
+
+    report.files = { movieCheck, halls, layouts.get(), pricing.get(), showtimes, orderCheck, archiveCheck };
+    sort(report.regridShowtimeIds.begin(), report.regridShowtimeIds.end());
+    report.regridShowtimeIds.erase(unique(report.regridShowtimeIds.begin(), report.regridShowtimeIds.end()),
+                                   report.regridShowtimeIds.end());
+    report.ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+void printConsistencyReport(const ConsistencyReport& report) {
+    cout << left << setw(20) << "File" << right << setw(10) << "Records" << setw(10) << "MB"
+         << setw(10) << "ms" << setw(10) << "Problems" << endl;
+    for (const FileCheck& f : report.files) {
+        cout << left << setw(20) << f.fileName << right << setw(10) << f.records << fixed << setprecision(1)
+             << setw(10) << f.bytes / (1024.0 * 1024.0) << setw(10) << f.ms << setw(10) << f.problemCount << endl;
+    }
+    for (const FileCheck& f : report.files) {
+        if (f.problemCount == 0) continue;
+        cout << f.fileName << ":" << endl;
+        for (const string& problem : f.problems) cout << "  - " << problem << endl;
+        if (f.problemCount > static_cast<long long>(f.problems.size())) {
+            cout << "  ... and " << f.problemCount - static_cast<long long>(f.problems.size()) << " more" << endl;
+        }
+    }
+    cout << "Checked in " << fixed << setprecision(1) << report.ms << " ms: ";
+    if (report.problemCount() == 0) {
+        cout << "no problems found." << endl;
+    } else {
+        cout << report.problemCount() << " problem(s)." << endl;
+    }
+}
+
+// Load the seat grid of a showtime the checker flagged, counting seats
+// the way the checker does: any nonzero number is sold, while unreadable
+// values and seats missing at the end of the file are free.
+// ensureSeatMap() would stop at the first unreadable value instead.
+static void loadFlaggedSeatMap(Showtime& s) {
+    Cinema& site = cinema();
+    if (s.seatsLoaded) return; // Resident maps are newer than the file
+    s.soldBits.assign(s.layout->sellable.size(), 0);
+    s.heldBits.assign(s.layout->sellable.size(), 0);
+    s.seatsLoaded = true;
+    lock_guard<mutex> lock(site.snapshotMutex);
+    auto grid = site.seatGridIndex.find(s.id);
+    MappedFile file;
+    if (grid == site.seatGridIndex.end() || !file.open(sitePath(SHOWTIME_FILE))) return;
+    long long first = min<long long>(grid->second.first, static_cast<long long>(file.size));
+    long long last = (grid->second.second < 0) ? static_cast<long long>(file.size)
+                                               : min<long long>(first + grid->second.second, file.size);
+    const char* p = reinterpret_cast<const char*>(file.data) + first;
+    const char* end = reinterpret_cast<const char*>(file.data) + last;
+    string word;
+    for (int k = 0; k < s.rows * s.cols && (p = parseNextWord(p, end, word)) != nullptr; ++k) {
+        long long value;
+        const char* wordEnd = word.data() + word.size();
+        int r = k / s.cols, c = k % s.cols;
+        if (parseNextNumber(word.data(), wordEnd, value) == wordEnd && value != 0 && isSeatSellable(s, r, c)) {
+            setSeatSold(s, r, c, true);
+        }
+    }
+}
+
+// Fix what can be fixed on the loaded site and save every file in full.
+// Duplicates keep their first record; showtimes whose movie or hall is
+// gone are removed; seat grids are rebuilt from what the loader reads,
+// on the hall's grid if it differs. Orders are never changed. Returns the
+// number of fixes.
+int repairSiteData(const ConsistencyReport& report) {
+    Cinema& site = cinema();
+    int fixes = 0;
+
+    size_t before = site.movies.size();
+    unordered_set<int> movieIds, hallIds;
+    site.movies.erase(remove_if(site.movies.begin(), site.movies.end(),
+                                [&](const Movie& m) { return !movieIds.insert(m.id).second; }), site.movies.end());
+    if (site.movies.size() != before) {
+        cout << "Removed " << before - site.movies.size() << " duplicate movie(s)." << endl;
+        fixes += static_cast<int>(before - site.movies.size());
+    }
+    before = site.halls.size();
+    site.halls.erase(remove_if(site.halls.begin(), site.halls.end(),
+                               [&](const Hall& h) { return !hallIds.insert(h.id).second; }), site.halls.end());
+    if (site.halls.size() != before) {
+        cout << "Removed " << before - site.halls.size() << " duplicate hall(s)." << endl;
+        fixes += static_cast<int>(before - site.halls.size());
+    }
+    rebuildMovieTitleIndex();
+    rebuildListingIndexes();
+
+    // Unknown seat types become normal seats
+    unordered_set<int> relaidHalls;
+    for (Hall& h : site.halls) {
+        vector<unsigned char> types = h.layout->seatType;
+        bool changed = false;
+        for (unsigned char& t : types) {
+            if (t > SEAT_ACCESSIBLE) {
+                t = SEAT_NORMAL;
+                changed = true;
+            }
+        }
+        if (changed) {
+            h.layout = makeHallLayout(h.rows, h.cols, types);
+            relaidHalls.insert(h.id);
+            cout << "Reset unknown seat types in the layout of hall " << h.id << "." << endl;
+            ++fixes;
+        }
+    }
+
+    for (auto it = site.hallPricingRules.begin(); it != site.hallPricingRules.end();) {
+        if (findHallIndexById(it->first) == -1) {
+            cout << "Removed pricing rules of hall " << it->first << ", which does not exist." << endl;
+            it = site.hallPricingRules.erase(it);
+            ++fixes;
+        } else {
+            ++it;
+        }
+    }
+
+    // Showtimes: drop duplicates and those without a movie or hall
+    unordered_set<int> seen;
+    vector<Showtime> kept;
+    kept.reserve(site.showtimes.size());
+    for (size_t i = 0; i < site.showtimes.size(); ++i) {
+        Showtime& s = site.showtimes[i];
+        bool duplicate = !seen.insert(s.id).second;
+        if (duplicate || findMovieIndexById(s.movieId) == -1 || findHallIndexById(s.hallId) == -1) {
+            cout << "Removed " << (duplicate ? "duplicate showtime " : "showtime ") << s.id
+                 << (duplicate ? "" : ", whose movie or hall does not exist") << " ("
+                 << site.showtimeCols.sold[i] << " sold seat(s))." << endl;
+            if (!duplicate) {
+                forgetSeatMap(s.id);
+                dropWaitlist(s.id);
+            }
+            ++fixes;
+            continue;
+        }
+        kept.push_back(move(s));
+    }
+    site.showtimes.swap(kept);
+    rebuildShowtimeColumns();
+
+    // Seat grids: rebuild the reported ones and move grids that differ
+    // from their hall onto the hall's grid
+    unordered_set<int> regrid(report.regridShowtimeIds.begin(), report.regridShowtimeIds.end());
+    for (Showtime& s : site.showtimes) {
+        const Hall& h = site.halls[findHallIndexById(s.hallId)];
+        bool reshape = s.rows != h.rows || s.cols != h.cols;
+        if (!reshape && relaidHalls.count(h.id)) s.layout = h.layout;
+        if (!reshape && !regrid.count(s.id)) continue;
+
+        if (regrid.count(s.id)) loadFlaggedSeatMap(s);
+        ensureSeatMap(s);
+        s.seatsDirty = true; // Keeps the map resident until it is saved
+        if (reshape) {
+            Showtime old = s;
+            dropWaitlist(s.id); // Held seats refer to the old grid
+            initShowtimeSeats(s, h.layout);
+            int lost = 0;
+            for (int r = 0; r < old.rows; ++r) {
+                for (int c = 0; c < old.cols; ++c) {
+                    if (!isSeatSold(old, r, c)) continue;
+                    if (r < s.rows && c < s.cols && isSeatSellable(s, r, c)) {
+                        setSeatSold(s, r, c, true);
+                    } else {
+                        ++lost;
+                    }
+                }
+            }
+            cout << "Moved showtime " << s.id << " onto the " << h.rows << " x " << h.cols << " grid of hall "
+                 << h.id << " (" << lost << " sold seat(s) did not fit)." << endl;
+        } else {
+            cout << "Rebuilt the seat grid of showtime " << s.id << "." << endl;
+        }
+        ++fixes;
+    }
+    rebuildShowtimeColumns();
+    site.compiledPricingByHall.clear();
+    site.quoteCache.clear();
+
+    // Saving also drops what the loader skipped, e.g. layout seats outside the hall
+    site.dirtyFiles = DIRTY_ALL;
+    saveDataToFiles();
+    waitForWrites(site, site.lastWriteSeq);
+    return fixes;
+}
+
+// The site's consistency report, scanned again only if the site has
+// written something since the last scan.
+static const ConsistencyReport& currentDataReport() {
+    Cinema& site = cinema();
+    if (site.dataReportSeq != site.lastWriteSeq) {
+        waitForWrites(site, site.lastWriteSeq); // Check what this site has saved so far
+        site.dataReport = checkDataFiles();
+        site.dataReportSeq = site.lastWriteSeq;
+    }
+    return site.dataReport;
+}
+
+// Check the files of the current site, and optionally repair them.
+// Returns the number of problems left.
+int checkDataFilesMenu(bool repair) {
+    cout << "\n--- " << (repair ? "Check and Repair" : "Check") << " Data Files ---" << endl;
+    const ConsistencyReport& report = currentDataReport();
+    printConsistencyReport(report);
+    if (!repair || report.problemCount() == 0) return static_cast<int>(report.problemCount());
+
+    int fixes = repairSiteData(report);
+    const ConsistencyReport& after = currentDataReport();
+    cout << "Data files rewritten with " << fixes << " fix(es). " << after.problemCount()
+         << " problem(s) remain that need manual attention." << endl;
+    if (after.problemCount() > 0) printConsistencyReport(after);
+    return static_cast<int>(after.problemCount());
+}
+
+// Startup check: only speaks up when something is wrong. The report is
+// kept for the check menu.
+void warnAboutDataProblems() {
+    const ConsistencyReport& report = currentDataReport();
+    if (report.problemCount() == 0) return;
+    cout << "[Warning] Site \"" << cinema().name << "\": " << report.problemCount()
+         << " problem(s) in the data files. Use Persistence Settings > Check Data Files for details." << endl;
+}
+
+// ===== Background writer implementations =====
+
+atomic<WriteJob*> writeQueueHead{ nullptr }; // Lock-free stack, newest first
+atomic<bool> writerSleeping{ false };
+atomic<bool> writerStopping{ false };
+mutex writerMutex;                 // Only for sleeping and waking, never held while writing
+condition_variable writerWake;     // Jobs arrived or stop requested
+condition_variable writesFinished; // Some site's writesDone advanced
+thread writerThread;
+mutex writerErrorMutex;
+vector<string> writerErrors; // Printed by the console between menus, see printWriterErrors()
+
+// Remember that `job` failed, so its files are rewritten on the next save
+// and waiters learn about it.
+static void noteWriteFailure(const WriteJob& job) {
+    Cinema& site = *job.site;
+    site.failedWrites.fetch_or(job.dirtyOnFailure);
+    // Only the thread doing the writes stores here
+    if (site.failedWriteSeq.load() < job.seq) site.failedWriteSeq.store(job.seq);
+}
+
+// Print `message` now, or queue it when the writer thread reports it
+// while the console may be showing a prompt.
+static void writerMessage(const string& message) {
+    if (this_thread::get_id() != writerThread.get_id()) {
+        cout << message << endl;
+        return;
+    }
+    lock_guard<mutex> lock(writerErrorMutex);
+    writerErrors.push_back(message);
+}
+
+// Write `data` to a temporary file next to `path`, sync it and rename it
+// over `path`, so a crash leaves either the old or the new file.
+static bool replaceFileDurably(const string& path, const string& data, long long& bytesWritten) {
+    string tmpPath = path + ".tmp";
+    {
+        ofstream fout(tmpPath, ios::binary | ios::trunc);
+        fout.write(data.data(), static_cast<streamsize>(data.size()));
+        if (!fout) return false;
+    }
+    bytesWritten += static_cast<long long>(data.size());
+    syncFileToDisk(tmpPath);
+    error_code ec;
+    filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+// Write the showtime snapshot of `job`, copying non-resident grids from
+// the current snapshot, then swap it in together with its grid index.
+static bool writeShowtimeSnapshot(const WriteJob& job, long long& bytesWritten) {
+    Cinema& site = *job.site;
+    string tmpPath = job.path + ".tmp";
+    unordered_map<int, pair<long long, long long>> grids;
+    {
+        ifstream previous(job.path, ios::binary);
+        ofstream fout(tmpPath, ios::binary | ios::trunc);
+        if (!fout) return false;
+
+        // Copy the index; the loader and ensureSeatMap() use it under the lock
+        unordered_map<int, pair<long long, long long>> oldGrids;
+        {
+            lock_guard<mutex> lock(site.snapshotMutex);
+            oldGrids = site.seatGridIndex;
+        }
+        string grid;
+        long long offset = static_cast<long long>(job.data.size());
+        fout.write(job.data.data(), static_cast<streamsize>(job.data.size()));
+        for (const SnapshotPiece& piece : job.pieces) {
+            fout.write(piece.text.data(), static_cast<streamsize>(piece.text.size()));
+            long long gridOffset = offset + static_cast<long long>(piece.gridStart);
+            offset += static_cast<long long>(piece.text.size());
+            if (piece.copyGrid) {
+                auto old = oldGrids.find(piece.showtimeId);
+                if (old == oldGrids.end()) return false;
+                grid.resize(static_cast<size_t>(old->second.second));
+                previous.seekg(old->second.first);
+                previous.read(&grid[0], old->second.second);
+                if (!previous) return false;
+                fout.write(grid.data(), old->second.second);
+                offset += old->second.second;
+            }
+            grids[piece.showtimeId] = { gridOffset, offset - gridOffset };
+        }
+        fout.flush();
+        if (!fout) return false;
+        bytesWritten += offset;
+    }
+    syncFileToDisk(tmpPath);
+
+    lock_guard<mutex> lock(site.snapshotMutex);
+    error_code ec;
+    filesystem::rename(tmpPath, job.path, ec);
+    if (ec) return false;
+    site.seatGridIndex.swap(grids);
+    site.committedSnapshotSeq.store(job.seq, memory_order_release);
+    return true;
+}
+
+// Apply the appends and patches of `jobs` to the existing file `path`
+// and sync it once. On failure appends are cut off again; patches cannot
+// be undone, so the caller has the file rewritten in full.
+static bool updateFileInPlace(const string& path, const vector<WriteJob*>& jobs, long long& bytesWritten) {
+    Cinema& site = *jobs.front()->site;
+    // Seat maps are read from the showtime snapshot under this lock
+    lock_guard<mutex> lock(site.snapshotMutex);
+    fstream f(path, ios::in | ios::out | ios::binary);
+    if (!f) {
+        ofstream(path, ios::binary).close(); // First append creates the file
+        f.open(path, ios::in | ios::out | ios::binary);
+    }
+    f.seekp(0, ios::end);
+    long long originalSize = static_cast<long long>(f.tellp());
+
+    bool ok = static_cast<bool>(f);
+    vector<pair<long long, const string*>> writes; // (offset, bytes) for the standby
+    long long fileEnd = originalSize;
+    for (const WriteJob* job : jobs) {
+        if (!ok) break;
+        if (job->kind == WRITE_APPEND) {
+            f.seekp(0, ios::end);
+            writes.push_back({ fileEnd, &job->data });
+            fileEnd += static_cast<long long>(job->data.size());
+            f.write(job->data.data(), static_cast<streamsize>(job->data.size()));
+            bytesWritten += static_cast<long long>(job->data.size());
+            continue;
+        }
+        for (const FilePatch& patch : job->patches) {
+            long long offset = patch.offset;
+            if (patch.showtimeId >= 0) {
+                auto grid = site.seatGridIndex.find(patch.showtimeId);
+                if (grid == site.seatGridIndex.end()) {
+                    ok = false;
+                    break;
+                }
+                offset += grid->second.first;
+            }
+            f.seekp(offset);
+            writes.push_back({ offset, &patch.bytes });
+            fileEnd = max(fileEnd, offset + static_cast<long long>(patch.bytes.size()));
+            f.write(patch.bytes.data(), static_cast<streamsize>(patch.bytes.size()));
+            bytesWritten += static_cast<long long>(patch.bytes.size());
+        }
+    }
+    f.flush();
+    ok = ok && static_cast<bool>(f);
+    f.close();
+    if (!ok) {
+        error_code ec;
+        filesystem::resize_file(path, static_cast<uintmax_t>(originalSize), ec);
+        return false;
+    }
+    syncFileToDisk(path);
+    shipFileWrites(path, writes);
+    return true;
+}
+
+// Perform one batch of jobs in queue order. A full replacement of a file
+// supersedes every earlier job on it, and the appends and patches after
+// it are applied with one sync. Every job in the batch counts as
+// finished afterwards.
+static void performWrites(const vector<WriteJob*>& batch) {
+    TraceSpan span("write_batch");
+    // Files whose last in-place update failed. Appends and patches to them
+    // are dropped until a full rewrite or a repairing append arrives. Only
+    // the writer thread (or the command line thread without one) gets here.
+    static set<string> brokenPaths;
+    long long bytesWritten = 0;
+
+    map<string, vector<WriteJob*>> byPath;
+    vector<string> order; // Paths in first-seen order
+    for (WriteJob* job : batch) {
+        auto& jobs = byPath[job->path];
+        if (jobs.empty()) order.push_back(job->path);
+        if (job->kind == WRITE_REPLACE || job->kind == WRITE_SNAPSHOT) {
+            countMetric(COUNTER_WRITES_COALESCED, static_cast<long long>(jobs.size()));
+            jobs.clear();
+        }
+        jobs.push_back(job);
+    }
+
+    for (const string& path : order) {
+        vector<WriteJob*>& jobs = byPath[path];
+        Cinema& site = *jobs.front()->site;
+        size_t next = 0;
+
+        if (jobs[0]->kind == WRITE_REPLACE || jobs[0]->kind == WRITE_SNAPSHOT) {
+            const WriteJob& job = *jobs[0];
+            bool ok = (job.kind == WRITE_SNAPSHOT) ? writeShowtimeSnapshot(job, bytesWritten)
+                                                   : replaceFileDurably(job.path, job.data, bytesWritten);
+            if (ok) {
+                brokenPaths.erase(path);
+                if (job.kind == WRITE_SNAPSHOT) {
+                    shipFileFromDisk(job.path); // Grids were copied from the old file
+                } else {
+                    shipFileReplacement(job.path, job.data);
+                }
+            } else {
+                error_code ec;
+                filesystem::remove(job.path + ".tmp", ec);
+                writerMessage("[Error] Failed to write " + job.path + "; keeping the previous file.");
+                noteWriteFailure(job);
+                brokenPaths.insert(path);
+            }
+            next = 1;
+        }
+
+        vector<WriteJob*> updates;
+        for (size_t i = next; i < jobs.size(); ++i) {
+            if (jobs[i]->repair) brokenPaths.erase(path);
+            if (!brokenPaths.count(path)) updates.push_back(jobs[i]);
+        }
+        if (updates.empty()) continue;
+        countMetric(COUNTER_WRITES_COALESCED, static_cast<long long>(updates.size()) - 1);
+
+        if (updateFileInPlace(path, updates, bytesWritten)) {
+            for (const WriteJob* job : updates) {
+                if (job->log) job->log->durableRows.store(job->endRow, memory_order_release);
+                if (job->kind == WRITE_PATCH && !job->patches.empty() && job->patches[0].showtimeId >= 0) {
+                    site.committedSnapshotSeq.store(job->seq, memory_order_release);
+                }
+            }
+        } else {
+            writerMessage("[Error] Failed to update " + path + ".");
+            brokenPaths.insert(path);
+            if (updates.front()->log) {
+                updates.front()->log->writeFailed.store(true);
+            }
+            for (const WriteJob* job : updates) noteWriteFailure(*job);
+        }
+    }
+    countMetric(COUNTER_SAVE_BYTES, bytesWritten);
+    countMetric(COUNTER_WRITE_BATCHES);
+
+    {
+        lock_guard<mutex> lock(writerMutex);
+        for (WriteJob* job : batch) {
+            if (job->site->writesDone.load(memory_order_relaxed) < job->seq) {
+                job->site->writesDone.store(job->seq, memory_order_release);
+            }
+        }
+    }
+    writesFinished.notify_all();
+}
+
+static void writerLoop() {
+    while (true) {
+        // Between batches the files are complete, so a base copy is consistent
+        if (replication.resyncRequested.exchange(false)) {
+            sendReplicaBaseCopy();
+        }
+        WriteJob* head = writeQueueHead.exchange(nullptr, memory_order_acquire);
+        if (!head) {
+            if (writerStopping.load()) break;
+            writerSleeping.store(true);
+            {
+                unique_lock<mutex> lock(writerMutex);
+                writerWake.wait(lock, [] {
+                    return writeQueueHead.load() != nullptr || writerStopping.load()
+                           || replication.resyncRequested.load();
+                });
+            }
+            writerSleeping.store(false);
+            continue;
+        }
+
+        vector<WriteJob*> batch;
+        for (WriteJob* job = head; job; job = job->next) batch.push_back(job);
+        reverse(batch.begin(), batch.end()); // Stack order -> queue order
+        performWrites(batch);
+        for (WriteJob* job : batch) delete job;
+    }
+}
+
+void startBackgroundWriter() {
+    writerStopping.store(false);
+    writerThread = thread(writerLoop);
+}
+
+// Finish every queued write, then stop the writer thread.
+void stopBackgroundWriter() {
+    if (!writerThread.joinable()) return;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        writerStopping.store(true);
+    }
+    writerWake.notify_one();
+    writerThread.join();
+}
+
+// Hand jobs to the writer, which takes ownership. Without a writer thread
+// (command line modes) they are written before this returns.
+void submitWrites(vector<WriteJob*>& jobs) {
+    Cinema& site = cinema();
+    for (WriteJob* job : jobs) {
+        job->site = &site;
+        if (job->seq == 0) job->seq = ++site.lastWriteSeq;
+    }
+    if (!writerThread.joinable()) {
+        performWrites(jobs);
+        for (WriteJob* job : jobs) delete job;
+        jobs.clear();
+        return;
+    }
+
+    for (WriteJob* job : jobs) {
+        job->next = writeQueueHead.load(memory_order_relaxed);
+        while (!writeQueueHead.compare_exchange_weak(job->next, job, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+        }
+    }
+    jobs.clear();
+    if (writerSleeping.load()) {
+        lock_guard<mutex> lock(writerMutex);
+        writerWake.notify_one();
+    }
+}
+
+// Block until the writer has finished `site`'s writes up to `seq`.
+// Returns false if one of the writes after `afterSeq` failed.
+bool waitForWrites(Cinema& site, long long seq, long long afterSeq) {
+    unique_lock<mutex> lock(writerMutex);
+    writesFinished.wait(lock, [&] { return site.writesDone.load(memory_order_acquire) >= seq; });
+    return site.failedWriteSeq.load() <= afterSeq;
+}
+
+// Wait for every write queued so far, by any site. Returns false if some
+// site still has data the writer could not put on disk.
+bool flushPendingWrites() {
+    bool ok = true;
+    for (auto& site : cinemas) {
+        waitForWrites(*site, site->lastWriteSeq);
+        if (site->failedWrites.load() != 0 || site->ticketLog.writeFailed.load()) ok = false;
+    }
+    return ok;
+}
+
+// Print the errors the writer thread queued since the last call.
+void printWriterErrors() {
+    vector<string> messages;
+    {
+        lock_guard<mutex> lock(writerErrorMutex);
+        messages.swap(writerErrors);
+    }
+    for (const string& message : messages) cout << message << endl;
+}
+
+void persistenceMenu() {
+    Cinema& site = cinema();
+    int choice = -1;
+    while (true) {
+        bool fsyncMode = durabilityMode.load() == DURABILITY_FSYNC;
+        printWriterErrors();
+        cout << "\n---------- Persistence Settings ----------" << endl;
+        cout << "Durability: " << (fsyncMode ? "acknowledge after fsync"
+                                             : "acknowledge after enqueue (written in background)") << endl;
+        cout << "Writes queued by this site: " << site.lastWriteSeq
+             << ", pending: " << site.lastWriteSeq - site.writesDone.load() << endl;
+        printReplicationStatus();
+        cout << "1. Switch to acknowledge after " << (fsyncMode ? "enqueue" : "fsync") << endl;
+        cout << "2. Flush pending writes now" << endl;
+        cout << "3. Check data files" << endl;
+        cout << "4. Check and repair data files" << endl;
+        cout << "0. Back" << endl;
+        cout << "------------------------------------------" << endl;
+        cout << "Please enter your choice: ";
+        console >> choice;
+
+        if (!console) {
+            console.clear();
+            console.ignore(10000, '\n');
+            cout << "Invalid input. Please enter a number option." << endl;
+            continue;
+        }
+
+        if (choice == 0) {
+            cout << "Returning to admin menu..." << endl;
+            break;
+        }
+
+        switch (choice) {
+        case 1:
+            durabilityMode.store(fsyncMode ? DURABILITY_ENQUEUE : DURABILITY_FSYNC);
+            cout << "Saves now return after their data is "
+                 << (fsyncMode ? "queued for writing." : "on stable storage.") << endl;
+            break;
+        case 2:
+            waitForWrites(site, site.lastWriteSeq);
+            printWriterErrors();
+            if (site.failedWrites.load() != 0 || site.ticketLog.writeFailed.load()) {
+                cout << "[Error] Some writes of this site failed; they are retried on the next save." << endl;
+            } else {
+                cout << "All writes of this site are on disk." << endl;
+            }
+            break;
+        case 3:
+            checkDataFilesMenu(false);
+            break;
+        case 4:
+            checkDataFilesMenu(true);
+            break;
+        default:
+            cout << "Invalid option. Please try again." << endl;
+        }
+    }
+}
+
+// ===== Replication implementations =====
+
+static void putFixed(string& out, unsigned long long v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+static unsigned long long getFixed(const char* p, int bytes) {
+    unsigned long long v = 0;
+    for (int i = 0; i < bytes; ++i) {
+        v |= static_cast<unsigned long long>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+static void wakeReplicationSender() {
+#ifndef _WIN32
+    char byte = 1;
+    if (::write(replication.wakePipe[1], &byte, 1) < 0) {
+        // The pipe is full, so the sender is awake anyway
+    }
+#endif
+}
+
+static string encodeReplicaFrame(ReplicaFrameKind kind, long long seq, const string& path, long long offset,
+                                 const char* data, size_t size) {
+    string bytes;
+    bytes.reserve(REPLICA_FRAME_HEADER + path.size() + size);
+    bytes.push_back(static_cast<char>(kind));
+    putFixed(bytes, static_cast<unsigned long long>(seq), 8);
+    putFixed(bytes, static_cast<unsigned long long>(offset), 8);
+    putFixed(bytes, path.size(), 4);
+    putFixed(bytes, size, 8);
+    bytes += path;
+    bytes.append(data, size);
+    return bytes;
+}
+
+// Queue one frame for the standby. Frames are only queued while the
+// standby is streaming; a backlog it cannot drain gets it dropped, and
+// it resynchronizes from a new base copy when it reconnects.
+static void queueReplicaFrame(ReplicaFrameKind kind, const string& path, long long offset,
+                              const char* data, size_t size, bool live = true) {
+    if (!replication.streaming.load()) return;
+    {
+        lock_guard<mutex> lock(replication.outboxMutex);
+        if (!replication.streaming.load()) return;
+        if (replication.outboxBytes + size > MAX_REPLICA_BACKLOG_BYTES) {
+            replication.streaming.store(false);
+            replication.outbox.clear();
+            replication.outboxBytes = 0;
+            replication.dropRequested.store(true);
+        } else {
+            ReplicaFrame frame;
+            frame.seq = ++replication.lastSeq;
+            frame.queuedAt = live ? chrono::steady_clock::now() : chrono::steady_clock::time_point();
+            frame.bytes = encodeReplicaFrame(kind, frame.seq, path, offset, data, size);
+            replication.outboxBytes += frame.bytes.size();
+            replication.outbox.push_back(move(frame));
+        }
+    }
+    wakeReplicationSender();
+}
+
+void shipFileReplacement(const string& path, const string& data) {
+    queueReplicaFrame(REPLICA_REPLACE, path, 0, data.data(), data.size());
+}
+
+static void shipFileFromDisk(const string& path, bool live) {
+    if (!replication.streaming.load()) return;
+    // Read and queue as one step, so the base copy and a site thread
+    // shipping the same file queue their copies in the order they read them
+    static mutex shipMutex;
+    lock_guard<mutex> lock(shipMutex);
+    ifstream fin(path, ios::binary);
+    if (!fin) {
+        queueReplicaFrame(REPLICA_REMOVE, path, 0, nullptr, 0, live);
+        return;
+    }
+    string data((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    queueReplicaFrame(REPLICA_REPLACE, path, 0, data.data(), data.size(), live);
+}
+
+// Ship the current contents of a file, or its removal if it is gone.
+void shipFileFromDisk(const string& path) {
+    shipFileFromDisk(path, true);
+}
+
+// Ship in-place writes, as (offset, bytes), that were just applied to `path`.
+void shipFileWrites(const string& path, const vector<pair<long long, const string*>>& writes) {
+    for (const auto& w : writes) {
+        queueReplicaFrame(REPLICA_WRITE, path, w.first, w.second->data(), w.second->size());
+    }
+}
+
+// Data directories of the sites listed in SITES_FILE. The site objects
+// belong to the console thread, so replication reads the list on disk.
+static vector<string> siteDataDirsOnDisk() {
+    vector<string> dirs;
+    TextReader fin(SITES_FILE);
+    int count;
+    if (fin && fin >> count) {
+        fin.ignore(numeric_limits<streamsize>::max(), '\n');
+        for (int i = 0; i < count; ++i) {
+            string name, dataDir;
+            getline(fin, name);
+            getline(fin, dataDir);
+            if (!fin) break;
+            if (!dataDir.empty() && dataDir.back() == '\r') dataDir.pop_back();
+            dirs.push_back(dataDir.empty() ? "." : dataDir);
+        }
+    }
+    if (dirs.empty()) dirs.push_back(".");
+    return dirs;
+}
+
+// Ship every data file of every site, then mark the copy complete. Runs
+// on the writer thread between batches, so no file is half written.
+void sendReplicaBaseCopy() {
+    if (!replication.connected.load()) return;
+    TraceSpan span("replica_base_copy");
+    replication.streaming.store(true);
+    countMetric(COUNTER_REPLICATION_RESYNCS);
+
+    vector<string> dirs = siteDataDirsOnDisk();
+    shipFileFromDisk(SITES_FILE, false);
+
+    const string* dataFiles[] = { &MOVIE_FILE, &HALL_FILE, &LAYOUT_FILE, &PRICING_FILE, &SHOWTIME_FILE,
+                                  &ORDER_FILE, &SALES_LOG_FILE, &ARCHIVE_INDEX_FILE };
+    for (const string& dir : dirs) {
+        string prefix = (dir == ".") ? "" : dir + "/";
+        for (const string* file : dataFiles) {
+            shipFileFromDisk(prefix + *file, false);
+        }
+        error_code ec;
+        for (filesystem::directory_iterator it(prefix + ARCHIVE_DIR, ec), end; !ec && it != end; it.increment(ec)) {
+            string fileName = it->path().filename().string();
+            if (it->is_regular_file() && fileName.size() > 4 && fileName.compare(fileName.size() - 4, 4, ".seg") == 0) {
+                shipFileFromDisk(prefix + ARCHIVE_DIR + "/" + fileName, false);
+            }
+        }
+    }
+    queueReplicaFrame(REPLICA_SYNCED, "", 0, nullptr, 0, false);
+}
+
+// Frames queued or sent but not yet applied by the standby.
+long long replicationFramesBehind() {
+    if (!replication.connected.load()) return 0;
+    lock_guard<mutex> lock(replication.outboxMutex);
+    return replication.lastSeq - replication.ackedSeq.load();
+}
+
+void printReplicationStatus() {
+    if (!replication.enabled.load()) return;
+    cout << "Standby at " << replication.socketPath << ": ";
+    if (!replication.connected.load()) {
+        cout << "not connected (retrying every second)";
+    } else if (!replication.streaming.load()) {
+        cout << "connected, base copy pending";
+    } else {
+        cout << "streaming, " << replicationFramesBehind() << " change(s) not yet applied";
+    }
+    cout << endl;
+}
+
+#ifndef _WIN32
+
+static bool sendAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t sent = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += sent;
+        n -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static bool makeSocketAddress(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        cout << "[Error] Socket path must have 1 to " << sizeof(addr.sun_path) - 1 << " characters." << endl;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static void drainWakePipe(int fd) {
+    char buf[256];
+    while (::read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+// Connect to the standby, send it every queued frame and collect its
+// acknowledgements, which give the replication lag of each change.
+static void replicationSenderLoop() {
+    sockaddr_un addr;
+    makeSocketAddress(replication.socketPath, addr);
+    int fd = -1;
+    deque<pair<long long, chrono::steady_clock::time_point>> inFlight; // Sent, not yet acknowledged
+    string acks;
+
+    while (true) {
+        bool stopping = replication.stopping.load();
+        if (fd < 0) {
+            if (stopping) break;
+            fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+                ::close(fd);
+                fd = -1;
+            }
+            if (fd < 0) {
+                pollfd wake = { replication.wakePipe[0], POLLIN, 0 };
+                ::poll(&wake, 1, 1000);
+                drainWakePipe(replication.wakePipe[0]);
+                continue;
+            }
+            {
+                lock_guard<mutex> lock(replication.outboxMutex);
+                replication.outbox.clear();
+                replication.outboxBytes = 0;
+                replication.ackedSeq.store(replication.lastSeq);
+                replication.streaming.store(false);
+            }
+            inFlight.clear();
+            acks.clear();
+            replication.dropRequested.store(false);
+            replication.connected.store(true);
+            {
+                lock_guard<mutex> lock(writerMutex);
+                replication.resyncRequested.store(true);
+            }
+            writerWake.notify_one();
+            continue;
+        }
+
+        deque<ReplicaFrame> frames;
+        {
+            lock_guard<mutex> lock(replication.outboxMutex);
+            frames.swap(replication.outbox);
+            replication.outboxBytes = 0;
+        }
+        bool ok = !replication.dropRequested.exchange(false);
+        for (const ReplicaFrame& frame : frames) {
+            if (!ok) break;
+            ok = sendAll(fd, frame.bytes.data(), frame.bytes.size());
+            countMetric(COUNTER_REPLICATION_FRAMES);
+            countMetric(COUNTER_REPLICATION_BYTES, static_cast<long long>(frame.bytes.size()));
+            inFlight.push_back({ frame.seq, frame.queuedAt });
+        }
+
+        if (ok && stopping) {
+            // Say goodbye and wait (briefly) until the standby has applied everything
+            string bye = encodeReplicaFrame(REPLICA_BYE, 0, "", 0, nullptr, 0);
+            if (sendAll(fd, bye.data(), bye.size())) {
+                ::shutdown(fd, SHUT_WR);
+                char buf[256];
+                pollfd done = { fd, POLLIN, 0 };
+                while (::poll(&done, 1, 2000) > 0 && ::recv(fd, buf, sizeof(buf), 0) > 0) {
+                }
+            }
+            ::close(fd);
+            fd = -1;
+            break;
+        }
+
+        if (ok) {
+            pollfd fds[2] = { { fd, POLLIN, 0 }, { replication.wakePipe[0], POLLIN, 0 } };
+            if (::poll(fds, 2, -1) < 0 && errno != EINTR) ok = false;
+            if (fds[1].revents) drainWakePipe(replication.wakePipe[0]);
+            if (ok && fds[0].revents) {
+                char buf[4096];
+                ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    ok = false;
+                } else {
+                    acks.append(buf, static_cast<size_t>(n));
+                    size_t used = 0;
+                    auto now = chrono::steady_clock::now();
+                    for (; acks.size() - used >= 8; used += 8) {
+                        long long seq = static_cast<long long>(getFixed(acks.data() + used, 8));
+                        replication.ackedSeq.store(seq);
+                        while (!inFlight.empty() && inFlight.front().first <= seq) {
+                            // Base copy frames carry no time; only changes count as lag
+                            if (inFlight.front().second != chrono::steady_clock::time_point()) {
+                                recordLatency(OP_REPLICATION_LAG, static_cast<unsigned long long>(
+                                    chrono::duration_cast<chrono::nanoseconds>(now - inFlight.front().second).count()));
+                            }
+                            inFlight.pop_front();
+                        }
+                    }
+                    acks.erase(0, used);
+                }
+            }
+        }
+        if (!ok) {
+            ::close(fd);
+            fd = -1;
+            replication.streaming.store(false);
+            replication.connected.store(false);
+        }
+    }
+    replication.connected.store(false);
+    replication.streaming.store(false);
+}
+
+// Paths come from the primary and are resolved against the standby's
+// working directory; they may not leave it.
+static bool isSafeReplicaPath(const string& path) {
+    if (path.empty() || path[0] == '/') return false;
+    for (const auto& part : filesystem::path(path)) {
+        if (part == "..") return false;
+    }
+    return true;
+}
+
+// Start shipping changes to the standby listening on `socketPath`. The
+// sender keeps retrying until a standby is there.
+bool startReplicationPrimary(const string& socketPath) {
+    sockaddr_un addr;
+    if (!makeSocketAddress(socketPath, addr)) return false;
+    for (const string& dir : siteDataDirsOnDisk()) {
+        if (dir != "." && !isSafeReplicaPath(dir)) {
+            cout << "[Warning] " << dir << " is outside the working directory. The standby rejects"
+                 << " files there, so the site keeping its data in it is not replicated." << endl;
+        }
+    }
+    if (::pipe(replication.wakePipe) != 0) {
+        cout << "[Error] Failed to set up replication: " << strerror(errno) << endl;
+        return false;
+    }
+    for (int end : replication.wakePipe) {
+        ::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
+    }
+    replication.socketPath = socketPath;
+    replication.stopping.store(false);
+    replication.enabled.store(true);
+    replication.sender = thread(replicationSenderLoop);
+    cout << "Replicating to the standby at " << socketPath << "." << endl;
+    return true;
+}
+
+// Send what is queued, tell the standby the primary is shutting down and
+// stop the sender. Call after the writer has stopped.
+void stopReplication() {
+    if (!replication.enabled.load()) return;
+    replication.stopping.store(true);
+    wakeReplicationSender();
+    replication.sender.join();
+    ::close(replication.wakePipe[0]);
+    ::close(replication.wakePipe[1]);
+    replication.wakePipe[0] = replication.wakePipe[1] = -1;
+    replication.enabled.store(false);
+}
+
+static bool applyReplicaFrame(ReplicaFrameKind kind, const string& path, long long offset,
+                              const char* data, size_t size) {
+    error_code ec;
+    filesystem::path parent = filesystem::path(path).parent_path();
+    if (kind != REPLICA_REMOVE && !parent.empty()) filesystem::create_directories(parent, ec);
+
+    if (kind == REPLICA_REPLACE) {
+        string tmpPath = path + ".tmp";
+        {
+            ofstream fout(tmpPath, ios::binary | ios::trunc);
+            fout.write(data, static_cast<streamsize>(size));
+            if (!fout) return false;
+        }
+        if (!syncFileToDisk(tmpPath)) return false;
+        filesystem::rename(tmpPath, path, ec);
+        return !ec;
+    }
+    if (kind == REPLICA_WRITE) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) return false;
+        bool ok = true;
+        while (ok && size > 0) {
+            ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) {
+                data += n;
+                size -= static_cast<size_t>(n);
+                offset += n;
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+    filesystem::remove(path, ec);
+    return !ec;
+}
+
+struct StandbyProgress {
+    long long appliedSeq = 0;
+    bool synced = false;       // The last base copy is complete
+    bool bye = false;          // The primary shut down cleanly
+    long long baseFrames = 0;  // Of the base copy being received
+    long long baseBytes = 0;
+    chrono::steady_clock::time_point connectedAt;
+    set<string> rejectedPaths;
+    set<string> unsyncedPaths; // Written in place since the last acknowledgement
+};
 
-                for (int i = 0; i < count; ++i) {
-                    Hall h;
-                    fin >> h.id;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+// Apply the complete frames at the start of `data`; return the bytes used.
+static size_t applyReplicaFrames(const string& data, StandbyProgress& progress) {
+    size_t used = 0;
+    while (data.size() - used >= REPLICA_FRAME_HEADER) {
+        const char* p = data.data() + used;
+        ReplicaFrameKind kind = static_cast<ReplicaFrameKind>(static_cast<unsigned char>(p[0]));
+        long long seq = static_cast<long long>(getFixed(p + 1, 8));
+        long long offset = static_cast<long long>(getFixed(p + 9, 8));
+        size_t pathBytes = static_cast<size_t>(getFixed(p + 17, 4));
+        size_t payloadBytes = static_cast<size_t>(getFixed(p + 21, 8));
+        size_t frameBytes = REPLICA_FRAME_HEADER + pathBytes + payloadBytes;
+        if (data.size() - used < frameBytes) break;
+
+        string path(p + REPLICA_FRAME_HEADER, pathBytes);
+        const char* payload = p + REPLICA_FRAME_HEADER + pathBytes;
+        used += frameBytes;
+        countMetric(COUNTER_REPLICATION_FRAMES);
+        countMetric(COUNTER_REPLICATION_BYTES, static_cast<long long>(frameBytes));
+
+        if (kind == REPLICA_BYE) {
+            progress.bye = true;
+            continue;
+        }
+        progress.appliedSeq = seq;
+        if (kind == REPLICA_SYNCED) {
+            progress.synced = true;
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - progress.connectedAt).count();
+            cout << "Base copy received: " << progress.baseFrames << " files, " << fixed << setprecision(1)
+                 << progress.baseBytes / (1024.0 * 1024.0) << " MB in " << ms << " ms. Following changes." << endl;
+            continue;
+        }
+        if (!progress.synced) {
+            ++progress.baseFrames;
+            progress.baseBytes += static_cast<long long>(payloadBytes);
+        }
+        if (!isSafeReplicaPath(path)) {
+            if (progress.rejectedPaths.insert(path).second) {
+                cout << "[Error] Ignoring changes to " << path << ", which is outside this directory." << endl;
+            }
+            continue;
+        }
+        if (!applyReplicaFrame(kind, path, offset, payload, payloadBytes)) {
+            cout << "[Error] Failed to apply a change to " << path << "." << endl;
+        } else if (kind == REPLICA_WRITE) {
+            progress.unsyncedPaths.insert(path);
+        }
+    }
+    return used;
+}
 
-                    getline(fin, h.name);
+// Wait for a primary, keep a copy of its files up to date and take over
+// the console when the primary is lost or the operator asks for it.
+int runStandby(const string& socketPath) {
+    sockaddr_un addr;
+    if (!makeSocketAddress(socketPath, addr)) return 1;
+    int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(socketPath.c_str()); // Left behind by an earlier standby
+    if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(listenFd, 1) != 0) {
+        cout << "[Error] Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+        if (listenFd >= 0) ::close(listenFd);
+        return 1;
+    }
+    cout << "Standby listening on " << socketPath << "." << endl;
+    cout << "Enter PROMOTE to take over. The standby also takes over when it loses the primary." << endl;
+
+    int connFd = -1;
+    bool stdinOpen = true;
+    bool promote = false;
+    StandbyProgress progress;
+    string pending; // Received bytes not yet applied
+    vector<char> buf(1 << 16);
+    while (!promote) {
+        // Lines the console has buffered already do not wake poll()
+        bool consoleReady = stdinOpen && console.pos < console.end;
+        pollfd fds[2] = { { connFd >= 0 ? connFd : listenFd, POLLIN, 0 }, { 0, POLLIN, 0 } };
+        if (!consoleReady && ::poll(fds, stdinOpen ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            cout << "[Error] Standby stopped waiting: " << strerror(errno) << endl;
+            break;
+        }
 
-                    fin >> h.floor;
-                    fin >> h.rows;
-                    fin >> h.cols;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (consoleReady || (stdinOpen && fds[1].revents)) {
+            string line;
+            if (!getline(console, line)) {
+                stdinOpen = false;
+            } else {
+                for (char& ch : line) ch = static_cast<char>(toupper(static_cast<unsigned char>(ch)));
+                if (line.find("PROMOTE") != string::npos) {
+                    promote = true;
+                } else {
+                    cout << "Standby is following the primary. Enter PROMOTE to take over." << endl;
+                }
+            }
+            continue;
+        }
+        if (!fds[0].revents) continue;
+
+        if (connFd < 0) {
+            connFd = ::accept(listenFd, nullptr, nullptr);
+            if (connFd < 0) continue;
+            progress.synced = false;
+            progress.bye = false;
+            progress.baseFrames = progress.baseBytes = 0;
+            progress.connectedAt = chrono::steady_clock::now();
+            pending.clear();
+            cout << "Primary connected; receiving base copy..." << endl;
+            continue;
+        }
 
-                    halls.push_back(h);
-                    if (h.id > maxId) maxId = h.id;
+        ssize_t n = ::recv(connFd, buf.data(), buf.size(), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) {
+            pending.append(buf.data(), static_cast<size_t>(n));
+            long long before = progress.appliedSeq;
+            size_t used = applyReplicaFrames(pending, progress);
+            pending.erase(0, used);
+            if (progress.appliedSeq != before) {
+                // Acknowledge only what is on stable storage here
+                for (const string& path : progress.unsyncedPaths) {
+                    if (!syncFileToDisk(path)) cout << "[Error] Failed to sync " << path << "." << endl;
                 }
-                nextHallId = maxId + 1;
+                progress.unsyncedPaths.clear();
+                string ack;
+                putFixed(ack, static_cast<unsigned long long>(progress.appliedSeq), 8);
+                sendAll(connFd, ack.data(), ack.size());
             }
+            continue;
         }
-    }
 
-    // ----- Load showtimes + seats -----
-    {
-        ifstream fin(SHOWTIME_FILE);
-        if (!fin) {
-            // cout << "[Info] No showtime file found. Starting with empty showtimes.\n";
+        ::close(connFd);
+        connFd = -1;
+        if (progress.bye) {
+            cout << "Primary shut down; waiting for it to come back." << endl;
+        } else if (progress.synced) {
+            cout << "Lost the primary; taking over." << endl;
+            promote = true;
         } else {
-            int count;
-            if (!(fin >> count)) {
-                // cout << "[Warning] Failed to read showtime count.\n";
-            } else {
-                fin.ignore(numeric_limits<streamsize>::max(), '\n');
-                showtimes.clear();
-                int maxId = 0;
+            cout << "[Error] Lost the primary before the base copy was complete. Waiting;"
+                 << " enter PROMOTE to take over with the files as they are." << endl;
+        }
+    }
+    if (connFd >= 0) ::close(connFd);
+    ::close(listenFd);
+    ::unlink(socketPath.c_str());
+    if (!promote) return 1;
+
+    auto start = chrono::steady_clock::now();
+    openTicketOffice();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "Promoted to primary in " << fixed << setprecision(1) << ms << " ms." << endl;
+    return runTicketOffice();
+}
 
-                for (int i = 0; i < count; ++i) {
-                    Showtime s;
+#else
 
-                    fin >> s.id;
-                    fin >> s.movieId;
-                    fin >> s.hallId;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n'); // Skip rest of line
+bool startReplicationPrimary(const string& socketPath) {
+    (void)socketPath;
+    cout << "[Error] Replication needs Unix domain sockets, which this build does not have." << endl;
+    return false;
+}
 
-                    getline(fin, s.datetime);
-                    fin >> s.price;
-                    fin >> s.rows >> s.cols;
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+void stopReplication() {
+}
 
-                    s.seats.assign(s.rows, vector<int>(s.cols, 0));
-                    for (int r = 0; r < s.rows; ++r) {
-                        for (int c = 0; c < s.cols; ++c) {
-                            fin >> s.seats[r][c];
-                        }
-                    }
-                    fin.ignore(numeric_limits<streamsize>::max(), '\n');
+int runStandby(const string& socketPath) {
+    return startReplicationPrimary(socketPath) ? 0 : 1;
+}
 
-                    showtimes.push_back(s);
-                    if (s.id > maxId) maxId = s.id;
+#endif
+
+// ===== Session server implementations =====
+
+#ifndef _WIN32
+
+struct SessionConnection {
+    int fd;
+    string in;  // Received input not yet fed to the session
+    string out; // Output not yet sent
+    PurchaseSession session;
+    bool started = false;
+    bool inputClosed = false; // The customer sent everything
+    bool closing = false;     // Close once `out` is sent
+    bool broken = false;      // Close now
+    bool busy = false;        // In a task on the site's worker; the poll thread keeps off
+    chrono::steady_clock::time_point lastInput;
+};
+
+// Start the session if it is new, move it on if it waits for admission
+// and feed it every complete input line. Runs on the site's worker.
+static void runSessionInputs(SessionConnection& conn, chrono::steady_clock::time_point now,
+                             ostringstream& scratch) {
+    long long nowMs = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count();
+    scratch.str("");
+    if (!conn.started) {
+        startPurchaseSession(conn.session, scratch);
+        conn.started = true;
+    }
+    bool queued = conn.session.step == STEP_QUEUED;
+    pumpPurchaseSession(conn.session, nowMs, scratch);
+    if (queued && conn.session.step != STEP_QUEUED) conn.lastInput = now; // The turn starts now
+    size_t used = 0;
+    while (conn.session.step != STEP_DONE) {
+        size_t newline = conn.in.find('\n', used);
+        if (newline == string::npos) break;
+        size_t first = used;
+        size_t last = newline;
+        used = newline + 1;
+        if (last > first && conn.in[last - 1] == '\r') --last;
+        if (!purchaseStepTakesLine(conn.session)) {
+            while (first < last && isspace(static_cast<unsigned char>(conn.in[first]))) ++first;
+            while (last > first && isspace(static_cast<unsigned char>(conn.in[last - 1]))) --last;
+        }
+        feedPurchaseSession(conn.session, conn.in.substr(first, last - first), nowMs, scratch);
+    }
+    conn.in.erase(0, used);
+    conn.out += scratch.str();
+}
+
+// Read what the customer sent; false once the connection is unusable.
+static bool receiveSessionInput(SessionConnection& conn, vector<char>& buf) {
+    while (true) {
+        ssize_t n = ::recv(conn.fd, buf.data(), buf.size(), 0);
+        if (n > 0) {
+            conn.in.append(buf.data(), static_cast<size_t>(n));
+            if (conn.in.size() > MAX_SESSION_LINE_BYTES && conn.in.find('\n') == string::npos) return false;
+            continue;
+        }
+        if (n == 0) {
+            conn.inputClosed = true;
+            return true;
+        }
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+}
+
+static bool sendSessionOutput(SessionConnection& conn) {
+    while (!conn.out.empty()) {
+        ssize_t sent = ::send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.out.erase(0, static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+// One thread serves every customer connection. Each round collects the
+// input of all connections and runs it in a single task on the site's
+// worker, so the worker is asked once however many customers typed. While
+// customers wait for admission to a flash sale, rounds come at least
+// five times a second so they are let in promptly. The poll thread does
+// not wait for the task: while the console has the worker (e.g. in the
+// admin menu), it keeps accepting customers and timing out idle ones, and
+// the connections in the task wait for it.
+static void sessionServerLoop() {
+    Cinema& site = *sessionServer.site;
+    vector<unique_ptr<SessionConnection>> conns;
+    vector<SessionConnection*> ready;
+    vector<SessionConnection*> leaving;
+    vector<pollfd> fds;
+    vector<char> buf(1 << 16);
+    ostringstream scratch; // Only used by the task of the current round
+    future<void> round;    // Task of the current round, if one was posted
+    bool acceptPaused = false; // Out of file descriptors until a customer leaves
+
+    while (!sessionServer.stopping.load()) {
+        if (round.valid() && round.wait_for(chrono::seconds(0)) == future_status::ready) {
+            round.get();
+            for (auto& conn : conns) conn->busy = false;
+        }
+
+        fds.clear();
+        fds.push_back({ sessionServer.listenFd, static_cast<short>(acceptPaused ? 0 : POLLIN), 0 });
+        fds.push_back({ sessionServer.wakePipe[0], POLLIN, 0 });
+        for (const auto& conn : conns) {
+            short events = (conn->inputClosed ? 0 : POLLIN) | (conn->out.empty() ? 0 : POLLOUT);
+            fds.push_back({ conn->busy ? -1 : conn->fd, events, 0 }); // poll() skips negative fds
+        }
+        bool waiting = any_of(conns.begin(), conns.end(), [](const unique_ptr<SessionConnection>& conn) {
+            return !conn->busy && purchaseSessionWaiting(conn->session);
+        });
+        if (::poll(fds.data(), fds.size(), waiting ? 200 : 1000) < 0 && errno != EINTR) {
+            cout << "[Error] Session server stopped: " << strerror(errno) << endl;
+            break;
+        }
+        if (fds[1].revents) drainWakePipe(sessionServer.wakePipe[0]);
+
+        size_t polled = conns.size();
+        if (fds[0].revents & POLLIN) {
+            int fd;
+            while ((fd = ::accept(sessionServer.listenFd, nullptr, nullptr)) >= 0) {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                unique_ptr<SessionConnection> conn(new SessionConnection());
+                conn->fd = fd;
+                conn->lastInput = chrono::steady_clock::now();
+                conns.push_back(move(conn));
+                sessionServer.openSessions.fetch_add(1);
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                if (!acceptPaused) {
+                    cout << "[Warning] Out of file descriptors at " << conns.size()
+                         << " customer connections; new customers wait until one leaves." << endl;
+                }
+                acceptPaused = true;
+            }
+        }
+
+        auto now = chrono::steady_clock::now();
+        ready.clear();
+        for (size_t i = 0; i < conns.size(); ++i) {
+            SessionConnection& conn = *conns[i];
+            if (conn.busy) continue;
+            if (i < polled && (fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) && !conn.inputClosed) {
+                conn.broken = !receiveSessionInput(conn, buf);
+                conn.lastInput = now;
+            }
+            if (conn.broken || conn.closing) continue;
+            if (!conn.started || conn.in.find('\n') != string::npos || purchaseSessionWaiting(conn.session)) {
+                ready.push_back(&conn);
+            }
+        }
+
+        for (auto& conn : conns) {
+            if (conn->busy) continue;
+            if (!conn->closing && !conn->broken) {
+                if (conn->session.step == STEP_DONE) {
+                    conn->closing = true;
+                    countMetric(COUNTER_SESSIONS_SERVED);
+                } else if (conn->inputClosed) {
+                    conn->closing = true; // The customer left mid-purchase
+                } else if (conn->session.step != STEP_QUEUED
+                           && now - conn->lastInput > chrono::seconds(SESSION_IDLE_TIMEOUT_SECONDS)) {
+                    conn->out += "\nSession timed out. Goodbye.\n";
+                    conn->closing = true;
+                    countMetric(COUNTER_SESSIONS_TIMED_OUT);
                 }
-                nextShowtimeId = maxId + 1;
             }
+            if (!conn->broken) conn->broken = !sendSessionOutput(*conn);
+        }
+
+        // Customers leaving mid-purchase give up their place in line or
+        // turn; they are closed once the worker has done that
+        leaving.clear();
+        for (auto& conn : conns) {
+            bool gone = conn->broken || (conn->closing && conn->out.empty());
+            if (!conn->busy && gone && purchaseSessionWaiting(conn->session)) leaving.push_back(conn.get());
         }
+        ready.erase(remove_if(ready.begin(), ready.end(),
+                              [](const SessionConnection* conn) { return conn->broken || conn->closing; }),
+                    ready.end());
+        if (!round.valid() && (!ready.empty() || !leaving.empty())) {
+            for (SessionConnection* conn : ready) conn->busy = true;
+            for (SessionConnection* conn : leaving) conn->busy = true;
+            round = postToCinema(site, [&scratch, now, ready, leaving] {
+                for (SessionConnection* conn : ready) runSessionInputs(*conn, now, scratch);
+                for (SessionConnection* conn : leaving) abandonPurchaseSession(conn->session);
+                char byte = 1;
+                if (::write(sessionServer.wakePipe[1], &byte, 1) < 0) {
+                    // The pipe is full, so the server is awake anyway
+                }
+            });
+        }
+
+        auto done = remove_if(conns.begin(), conns.end(), [](const unique_ptr<SessionConnection>& conn) {
+            if (conn->busy || purchaseSessionWaiting(conn->session)) return false;
+            if (!conn->broken && !(conn->closing && conn->out.empty())) return false;
+            ::close(conn->fd);
+            sessionServer.openSessions.fetch_sub(1);
+            return true;
+        });
+        if (done != conns.end()) acceptPaused = false;
+        conns.erase(done, conns.end());
+    }
+
+    if (round.valid()) round.get();
+    runOnCinema(site, [&] {
+        for (auto& conn : conns) abandonPurchaseSession(conn->session);
+    });
+    for (auto& conn : conns) ::close(conn->fd);
+    sessionServer.openSessions.store(0);
+}
+
+// Serve purchase sessions for `site` to customers connecting to `socketPath`.
+bool startSessionServer(const string& socketPath, Cinema& site) {
+    sockaddr_un addr;
+    if (!makeSocketAddress(socketPath, addr)) return false;
+    int listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(socketPath.c_str()); // Left behind by an earlier server
+    if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(listenFd, SOMAXCONN) != 0 || ::pipe(sessionServer.wakePipe) != 0) {
+        cout << "[Error] Cannot listen on " << socketPath << ": " << strerror(errno) << endl;
+        if (listenFd >= 0) ::close(listenFd);
+        return false;
+    }
+    ::fcntl(listenFd, F_SETFL, ::fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    for (int end : sessionServer.wakePipe) {
+        ::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
     }
+    sessionServer.socketPath = socketPath;
+    sessionServer.site = &site;
+    sessionServer.listenFd = listenFd;
+    sessionServer.stopping.store(false);
+    sessionServer.enabled.store(true);
+    sessionServer.loop = thread(sessionServerLoop);
+    cout << "Serving purchase sessions for site \"" << site.name << "\" on " << socketPath << "." << endl;
+    return true;
 }
 
-void saveDataToFiles() {
-    // ----- Save movies -----
-    {
-        ofstream fout(MOVIE_FILE);
-        if (!fout) {
-            cout << "[Error] Failed to open movie file for writing." << endl;
-        } else {
-            fout << movies.size() << '\n';
-            for (const auto& m : movies) {
-                fout << m.id << '\n';
-                fout << m.title << '\n';
-                fout << m.rating << '\n';
-                fout << m.duration << '\n';
+// Close every customer connection and stop the server. Call before the
+// site workers stop.
+void stopSessionServer() {
+    if (!sessionServer.enabled.load()) return;
+    sessionServer.stopping.store(true);
+    char byte = 1;
+    if (::write(sessionServer.wakePipe[1], &byte, 1) < 0) {
+        // The pipe is full, so the server is awake anyway
+    }
+    sessionServer.loop.join();
+    ::close(sessionServer.listenFd);
+    ::close(sessionServer.wakePipe[0]);
+    ::close(sessionServer.wakePipe[1]);
+    ::unlink(sessionServer.socketPath.c_str());
+    sessionServer.listenFd = sessionServer.wakePipe[0] = sessionServer.wakePipe[1] = -1;
+    sessionServer.enabled.store(false);
+}
+
+#else
+
+bool startSessionServer(const string& socketPath, Cinema& site) {
+    (void)socketPath;
+    (void)site;
+    cout << "[Error] The session server needs Unix domain sockets, which this build does not have." << endl;
+    return false;
+}
+
+void stopSessionServer() {
+}
+
+#endif
+
+// ===== Cinema site implementations =====
+
+Cinema& cinema() {
+    if (currentCinema == nullptr) {
+        // Site code ran on a thread that no site owns; there is no sane fallback
+        cout << "[Error] No cinema site is selected on this thread." << endl;
+        abort();
+    }
+    return *currentCinema;
+}
+
+// Path of a data file inside the current site's directory.
+string sitePath(const string& fileName) {
+    const string& dir = cinema().dataDir;
+    return (dir == ".") ? fileName : dir + "/" + fileName;
+}
+
+// Create a site and start its worker thread. The site's data is not
+// loaded here; run loadDataFromFiles on it.
+Cinema& addCinema(const string& name, const string& dataDir) {
+    unique_ptr<Cinema> site(new Cinema());
+    site->id = static_cast<int>(cinemas.size()) + 1;
+    site->name = name;
+    site->dataDir = dataDir.empty() ? "." : dataDir;
+
+    error_code ec;
+    filesystem::create_directories(site->dataDir, ec);
+    if (ec) {
+        cout << "[Error] Failed to create directory " << site->dataDir << ": " << ec.message() << endl;
+    }
+
+    Cinema* raw = site.get();
+    raw->worker = thread([raw]() {
+        currentCinema = raw;
+        while (true) {
+            packaged_task<void()> task;
+            {
+                // An idle worker wakes up when the next waitlist offer expires
+                long long expiry = nextWaitlistExpiry(*raw);
+                unique_lock<mutex> lock(raw->taskMutex);
+                auto ready = [raw]() { return raw->stopping || !raw->tasks.empty(); };
+                if (expiry < 0) {
+                    raw->taskReady.wait(lock, ready);
+                } else if (!raw->taskReady.wait_until(lock, chrono::system_clock::from_time_t(expiry), ready)) {
+                    lock.unlock();
+                    expireWaitlistOffers();
+                    continue;
+                }
+                if (raw->tasks.empty()) return; // Stopping and drained
+                task = move(raw->tasks.front());
+                raw->tasks.pop_front();
             }
+            task();
+        }
+    });
+    pinWorkerThread(raw->worker, raw->id);
+    cinemas.push_back(move(site));
+    return *raw;
+}
+
+// Pin a site worker to one CPU so sites spread over the cores instead of
+// migrating between them. Sites beyond the core count share cores round robin.
+void pinWorkerThread(thread& worker, int siteId) {
+    unsigned int cores = thread::hardware_concurrency();
+    if (cores == 0) return;
+    unsigned int core = static_cast<unsigned int>(siteId - 1) % cores;
+#if defined(_WIN32)
+    if (SetThreadAffinityMask(worker.native_handle(), DWORD_PTR(1) << core) == 0) {
+        cout << "[Warning] Could not pin the site " << siteId << " worker to CPU " << core << "." << endl;
+    }
+#elif defined(__linux__)
+    // Pick among the CPUs this process may use, which a container may limit
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) return;
+    core = static_cast<unsigned int>(siteId - 1) % static_cast<unsigned int>(CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (core-- > 0) continue;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(worker.native_handle(), sizeof(cpus), &cpus) != 0) {
+            cout << "[Warning] Could not pin the site " << siteId << " worker to CPU " << cpu << "." << endl;
         }
+        break;
     }
+#else
+    (void)worker; // No affinity API; the scheduler places the worker
+#endif
+}
 
-    // ----- Save halls -----
+// Queue a task on the site's worker thread.
+future<void> postToCinema(Cinema& site, function<void()> task) {
+    packaged_task<void()> job(move(task));
+    future<void> done = job.get_future();
     {
-        ofstream fout(HALL_FILE);
-        if (!fout) {
-            cout << "[Error] Failed to open hall file for writing." << endl;
-        } else {
-            fout << halls.size() << '\n';
-            for (const auto& h : halls) {
-                fout << h.id << '\n';
-                fout << h.name << '\n';
-                fout << h.floor << ' ' << h.rows << ' ' << h.cols << '\n';
-            }
+        lock_guard<mutex> lock(site.taskMutex);
+        site.tasks.push_back(move(job));
+    }
+    site.taskReady.notify_one();
+    return done;
+}
+
+// Run a task on the site's worker thread and wait for it.
+void runOnCinema(Cinema& site, function<void()> task) {
+    postToCinema(site, move(task)).get();
+}
+
+// A console menu runs on the console thread, one step at a time: the code
+// between two console reads is posted to the site's worker as a task that
+// holds the worker until the step ends. Reading input ends the step, so
+// customers and expiring offers are served while the clerk types.
+struct ConsoleStep {
+    Cinema* site = nullptr;       // Site of the running menu, null outside menus
+    bool running = false;         // A step holds the site's worker
+    promise<void> release;        // Lets the worker go at the end of the step
+    future<void> done;            // The step's task has returned
+};
+
+ConsoleStep consoleStep; // Only the console thread touches this
+
+// Run a console menu on the console thread, its steps on the site's worker.
+void runConsoleMenu(Cinema& site, void (*menu)()) {
+    Cinema* previous = currentCinema;
+    currentCinema = &site;
+    consoleStep.site = &site;
+    resumeConsoleStep();
+    menu();
+    pauseConsoleStep();
+    consoleStep.site = nullptr;
+    currentCinema = previous;
+}
+
+// Start a console step: wait until the site's worker has picked up the
+// step's task, which holds the worker until pauseConsoleStep.
+void resumeConsoleStep() {
+    if (consoleStep.site == nullptr || consoleStep.running) return;
+    auto started = make_shared<promise<void>>();
+    future<void> holding = started->get_future();
+    consoleStep.release = promise<void>();
+    shared_future<void> released = consoleStep.release.get_future().share();
+    consoleStep.done = postToCinema(*consoleStep.site, [started, released] {
+        started->set_value();
+        released.wait();
+    });
+    holding.wait();
+    consoleStep.running = true;
+}
+
+// End the running console step and wait until the worker is free again.
+void pauseConsoleStep() {
+    if (!consoleStep.running) return;
+    consoleStep.release.set_value();
+    consoleStep.done.get();
+    consoleStep.running = false;
+}
+
+// Let every worker finish its queued tasks, then join it.
+void stopCinemaWorkers() {
+    for (auto& site : cinemas) {
+        {
+            lock_guard<mutex> lock(site->taskMutex);
+            site->stopping = true;
         }
+        site->taskReady.notify_one();
+    }
+    for (auto& site : cinemas) {
+        if (site->worker.joinable()) site->worker.join();
     }
+}
 
-    // ----- Save showtimes + seats -----
-    {
-        ofstream fout(SHOWTIME_FILE);
-        if (!fout) {
-            cout << "[Error] Failed to open showtime file for writing." << endl;
-        } else {
-            fout << showtimes.size() << '\n';
-            for (const auto& s : showtimes) {
-                fout << s.id << '\n';
-                fout << s.movieId << '\n';
-                fout << s.hallId << '\n';
-                fout << s.datetime << '\n';
-                fout << s.price << '\n';
-                fout << s.rows << ' ' << s.cols << '\n';
+// Read the site list and load every site in parallel. Without a site list
+// the process serves one site from the working directory.
+void loadCinemaSites() {
+    TextReader fin(SITES_FILE);
+    int count;
+    if (fin && fin >> count) {
+        fin.ignore(numeric_limits<streamsize>::max(), '\n');
+        for (int i = 0; i < count; ++i) {
+            string name, dataDir;
+            getline(fin, name);
+            getline(fin, dataDir);
+            if (!fin) break;
+            if (!name.empty() && name.back() == '\r') name.pop_back();
+            if (!dataDir.empty() && dataDir.back() == '\r') dataDir.pop_back();
+            addCinema(name, dataDir);
+        }
+    }
+    if (cinemas.empty()) {
+        addCinema("Main", ".");
+    }
 
-                for (int r = 0; r < s.rows; ++r) {
-                    for (int c = 0; c < s.cols; ++c) {
-                        fout << s.seats[r][c];
-                        if (c + 1 < s.cols) fout << ' ';
-                    }
-                    fout << '\n';
-                }
-            }
+    vector<future<void>> loads;
+    for (auto& site : cinemas) {
+        loads.push_back(postToCinema(*site, [] {
+            warnAboutDataProblems();
+            loadDataFromFiles();
+        }));
+    }
+    for (auto& done : loads) {
+        done.get();
+    }
+}
+
+void saveCinemaSites() {
+    ofstream fout(SITES_FILE + ".tmp"); // Renamed into place, see writeArchiveSegment()
+    if (!fout) {
+        cout << "[Error] Failed to open site file for writing." << endl;
+        return;
+    }
+    fout << cinemas.size() << '\n';
+    for (const auto& site : cinemas) {
+        fout << site->name << '\n';
+        fout << site->dataDir << '\n';
+    }
+    fout.close();
+    error_code ec;
+    if (fout) filesystem::rename(SITES_FILE + ".tmp", SITES_FILE, ec);
+    if (!fout || ec) {
+        cout << "[Error] Failed to write the site file." << endl;
+        return;
+    }
+    shipFileFromDisk(SITES_FILE);
+}
+
+// List the sites and switch to one, or add a new one.
+// Return the site the console should serve next.
+Cinema* selectCinemaMenu(Cinema* selected) {
+    cout << "\n--- Cinema Sites ---" << endl;
+    for (const auto& site : cinemas) {
+        cout << "ID: " << site->id
+             << " | Name: " << site->name
+             << " | Data directory: " << site->dataDir
+             << (site.get() == selected ? " (current)" : "") << endl;
+    }
+
+    int id;
+    cout << "Enter site ID to switch to (0 to add a new site): ";
+    while (!(console >> id) || id < 0 || id > static_cast<int>(cinemas.size())) {
+        console.clear();
+        console.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "Invalid site ID. Please enter a valid site ID: ";
+    }
+    if (id > 0) {
+        selected = cinemas[id - 1].get();
+        cout << "Now serving site \"" << selected->name << "\"." << endl;
+        return selected;
+    }
+
+    console.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear leftover '\n' from cin >>
+    string name, dataDir;
+    cout << "Enter site name: ";
+    getline(console, name);
+    cout << "Enter data directory for this site: ";
+    getline(console, dataDir);
+    if (name.empty() || dataDir.empty()) {
+        cout << "[Error] Site name and data directory must not be empty." << endl;
+        return selected;
+    }
+
+    // Two sites writing the same files would overwrite each other
+    filesystem::path newDir = filesystem::absolute(dataDir).lexically_normal();
+    for (const auto& site : cinemas) {
+        if (filesystem::absolute(site->dataDir).lexically_normal() == newDir) {
+            cout << "[Error] Site \"" << site->name << "\" already uses this directory." << endl;
+            return selected;
         }
     }
+
+    Cinema& site = addCinema(name, dataDir);
+    runOnCinema(site, loadDataFromFiles); // Picks up data already in the directory
+    saveCinemaSites();
+    cout << "Site added successfully! [ID = " << site.id << "]" << endl;
+    cout << "Now serving site \"" << site.name << "\"." << endl;
+    return &site;
 }
 
 // Helper
 bool hasShowtimeForMovie(int movieId) {
-    for (const auto& s : showtimes) {
+    for (const auto& s : cinema().showtimes) {
         if (s.movieId == movieId) return true;
     }
     return false;
 }
 
 bool hasShowtimeForHall(int hallId) {
-    for (const auto& s : showtimes) {
+    for (const auto& s : cinema().showtimes) {
         if (s.hallId == hallId) return true;
     }
     return false;
-}
\ No newline at end of file
+}
+
+// Index `titleCount` synthetic titles and time prefix, exact-word and
+// misspelled queries against them.
+void benchmarkTitleSearch(int titleCount) {
+    Cinema& site = cinema();
+    const char* words[] = {
+        "the", "dark", "knight", "star", "wars", "lord", "rings", "return", "king", "night",
+        "city", "love", "story", "last", "man", "war", "dream", "ocean", "fire", "ice",
+        "shadow", "river", "empire", "secret", "journey", "lost", "planet", "ghost", "storm", "golden",
+        "silent", "wild", "broken", "hidden", "eternal", "iron", "crystal", "winter", "summer", "legend"
+    };
+    const int wordCount = sizeof(words) / sizeof(words[0]);
+
+    unsigned int seed = 12345;
+    site.movies.clear();
+    for (int i = 0; i < titleCount; ++i) {
+        Movie m;
+        m.id = i + 1;
+        int n = 2 + static_cast<int>(i % 3);
+        for (int k = 0; k < n; ++k) {
+            seed = seed * 1103515245u + 12345u;
+            if (k > 0) m.title += ' ';
+            m.title += words[(seed >> 16) % wordCount];
+        }
+        m.title += " " + to_string(i % 97);
+        m.rating = "PG";
+        m.duration = 120;
+        site.movies.push_back(m);
+    }
+    site.movies.push_back({ titleCount + 1, "Interstellar", "PG-13", 169 });
+
+    auto start = chrono::steady_clock::now();
+    rebuildMovieTitleIndex();
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "Indexed " << site.movies.size() << " titles in " << fixed << setprecision(1) << buildMs << " ms" << endl;
+
+    const char* queries[] = { "Intersteller", "interst", "golden storm", "shadw empire", "the lost", "crystl" };
+    const int repeats = 200;
+    for (const char* q : queries) {
+        vector<TitleMatch> matches;
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            matches = searchMovieTitles(q, 10);
+        }
+        double us = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / repeats;
+        cout << left << setw(16) << q << fixed << setprecision(1) << setw(10) << us << " us/query  top: "
+             << (matches.empty() ? string("(none)") : site.movies[findMovieIndexById(matches[0].movieId)].title) << endl;
+    }
+}
+
+// Write a site with `showtimeCount` 20x30 showtimes, then time a cold
+// start with lazy seat maps against one that loads every seat map.
+void benchmarkColdStart(int showtimeCount) {
+    const string dir = makeScratchDirectory("bench_startup");
+    if (dir.empty()) return;
+    Cinema& writer = cinema();
+    writer.dataDir = dir;
+    error_code ec;
+
+    fillBenchSite(1, showtimeCount, 3);
+    saveDataToFiles();
+    cout << "Wrote " << showtimeCount << " showtimes ("
+         << filesystem::file_size(dir + "/" + SHOWTIME_FILE, ec) / (1024 * 1024) << " MB)" << endl;
+
+    for (int eager = 0; eager <= 1; ++eager) {
+        Cinema site;
+        site.dataDir = dir;
+        if (eager) site.maxResidentSeatMaps = numeric_limits<size_t>::max();
+        currentCinema = &site;
+
+        auto start = chrono::steady_clock::now();
+        loadDataFromFiles();
+        if (eager) {
+            for (auto& s : site.showtimes) ensureSeatMap(s);
+        }
+        double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        // First touch of 1000 seat maps spread over the schedule
+        start = chrono::steady_clock::now();
+        int touches = min(1000, showtimeCount);
+        for (int k = 0; k < touches; ++k) {
+            ensureSeatMap(site.showtimes[static_cast<size_t>(k) * site.showtimes.size() / touches]);
+        }
+        double touchUs = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / touches;
+
+        cout << (eager ? "Eager seat maps : " : "Lazy seat maps  : ")
+             << fixed << setprecision(1) << setw(8) << loadMs << " ms startup, "
+             << setw(6) << touchUs << " us per seat map access, "
+             << site.seatMapLru.size() << " resident" << endl;
+        currentCinema = &writer;
+    }
+    filesystem::remove_all(dir, ec);
+}
+
+// ===== Self tests =====
+// "--self-test" runs the paths a change can break without any menu
+// showing it. Each test builds its own scratch site; a failed check
+// prints an error and the run exits nonzero.
+
+string selfTestDir; // Scratch directory of this run
+int selfTestFailures = 0;
+
+static void selfCheck(bool ok, const string& what) {
+    if (ok) return;
+    cout << "[Error] " << what << endl;
+    ++selfTestFailures;
+}
+
+static void resetSelfTestDir() {
+    error_code ec;
+    filesystem::remove_all(selfTestDir, ec);
+    filesystem::create_directories(selfTestDir, ec);
+}
+
+// Rewrite line `lineNo` (0-based) of a site file the way a person editing
+// it by hand would.
+static void editSelfTestLine(const string& fileName, size_t lineNo, const string& text) {
+    string path = selfTestDir + "/" + fileName;
+    vector<string> lines;
+    {
+        ifstream fin(path);
+        string line;
+        while (getline(fin, line)) lines.push_back(line);
+    }
+    if (lineNo >= lines.size()) {
+        selfCheck(false, fileName + " has no line " + to_string(lineNo + 1));
+        return;
+    }
+    lines[lineNo] = text;
+    ofstream fout(path, ios::trunc);
+    for (const string& line : lines) fout << line << '\n';
+}
+
+// Line of SHOWTIME_FILE holding row `row` (0-based) of the grid of the
+// showtime at `idx`, for files written from fillBenchSite()
+static size_t benchGridLine(int idx, int row) {
+    const int rows = 20;
+    return 1 + static_cast<size_t>(idx) * (6 + rows) + 6 + static_cast<size_t>(row);
+}
+
+// Load the scratch site into a fresh site and compare every seat map with
+// `soldBits` and the sold counts with `sold`.
+static void expectSavedSeats(const vector<vector<unsigned long long>>& soldBits, const vector<int>& sold,
+                             const string& when) {
+    Cinema* previous = currentCinema;
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    loadDataFromFiles();
+    selfCheck(site.showtimes.size() == soldBits.size(), when + ": wrong number of showtimes loaded");
+    for (size_t i = 0; i < site.showtimes.size() && i < soldBits.size(); ++i) {
+        Showtime& s = site.showtimes[i];
+        selfCheck(site.showtimeCols.sold[i] == sold[i],
+                  when + ": showtime " + to_string(s.id) + " has " + to_string(site.showtimeCols.sold[i])
+                  + " seats sold instead of " + to_string(sold[i]));
+        ensureSeatMap(s);
+        selfCheck(s.soldBits == soldBits[i], when + ": seat map of showtime " + to_string(s.id) + " differs");
+    }
+    currentCinema = previous;
+}
+
+// Grids are read later from the offsets the loader noted, so a grid of
+// the wrong length must not shift the grids after it, and a grid patched
+// in place must land where it was read from.
+static void selfTestSeatGrids() {
+    Cinema* previous = currentCinema;
+    resetSelfTestDir();
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    fillBenchSite(1, 3, 3);
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    saveDataToFiles();
+
+    vector<vector<unsigned long long>> soldBits;
+    for (Showtime& s : site.showtimes) soldBits.push_back(s.soldBits);
+    expectSavedSeats(soldBits, site.showtimeCols.sold, "Saved grids");
+
+    // Sell a seat of the middle showtime, saved as a patch of its grid
+    Showtime& middle = site.showtimes[1];
+    pair<int, int> seat(0, 0);
+    for (int r = 0; r < middle.rows && seat.first == 0; ++r) {
+        for (int c = 0; c < middle.cols; ++c) {
+            if (isSeatAvailable(middle, r, c)) {
+                seat = { r + 1, c + 1 };
+                break;
+            }
+        }
+    }
+    long long orderId;
+    selfCheck(bookSeats(middle.id, { seat }, "", orderId) == BOOKING_OK, "Booking a free seat failed");
+    soldBits[1] = middle.soldBits;
+    expectSavedSeats(soldBits, site.showtimeCols.sold, "Patched grid");
+
+    // Widen the first row of the first grid by hand
+    string row = "0";
+    for (int c = 1; c < site.showtimes[0].cols; ++c) row += isSeatSold(site.showtimes[0], 0, c) ? "  1" : "  0";
+    if (isSeatSold(site.showtimes[0], 0, 0)) row[0] = '1';
+    editSelfTestLine(SHOWTIME_FILE, benchGridLine(0, 0), row);
+    expectSavedSeats(soldBits, site.showtimeCols.sold, "Hand-edited grid");
+
+    currentCinema = previous;
+}
+
+// A write the writer could not do is reported to whoever waits for it,
+// kept for the next save, and cleared by a save that succeeds.
+static void selfTestWriterFailure() {
+    Cinema* previous = currentCinema;
+    resetSelfTestDir();
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    fillBenchSite(1, 1, 0);
+    startBackgroundWriter();
+    saveDataToFiles();
+    selfCheck(waitForWrites(site, site.lastWriteSeq), "The first save failed");
+
+    // A directory where the temporary file goes makes the write fail
+    error_code ec;
+    string blocker = sitePath(MOVIE_FILE) + ".tmp";
+    filesystem::create_directories(blocker, ec);
+    long long savedSeq = site.lastWriteSeq;
+    site.movies[0].title = "Benchmark Renamed";
+    site.dirtyFiles |= DIRTY_MOVIES;
+    saveDataToFiles();
+    selfCheck(!waitForWrites(site, site.lastWriteSeq, savedSeq), "A failed write was reported as done");
+    selfCheck((site.failedWrites.load() & DIRTY_MOVIES) != 0, "A failed write was not kept for the next save");
+    vector<string> messages;
+    {
+        lock_guard<mutex> lock(writerErrorMutex);
+        messages.swap(writerErrors);
+    }
+    selfCheck(!messages.empty(), "A failed write queued no error for the console");
+
+    filesystem::remove_all(blocker, ec);
+    long long failedSeq = site.lastWriteSeq;
+    saveDataToFiles();
+    selfCheck(waitForWrites(site, site.lastWriteSeq, failedSeq), "The retried write failed");
+    selfCheck(site.failedWrites.load() == 0, "A retried write is still marked as failed");
+    stopBackgroundWriter();
+
+    Cinema loaded;
+    loaded.dataDir = selfTestDir;
+    currentCinema = &loaded;
+    loadDataFromFiles();
+    selfCheck(!loaded.movies.empty() && loaded.movies[0].title == "Benchmark Renamed",
+              "The retried write did not reach the movie file");
+    currentCinema = previous;
+}
+
+// A batch that cannot place every item places none, holds nothing after
+// it returns, and a repeated key returns the orders of the first call.
+static void selfTestBatchBooking() {
+    Cinema* previous = currentCinema;
+    resetSelfTestDir();
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    fillBenchSite(1, 2, 0);
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    saveDataToFiles();
+
+    long long orderId;
+    bookSeats(2, { { 1, 1 } }, "", orderId);
+    size_t ordersBefore = site.orders.size();
+    auto soldOf = [&](int showtimeId) { return site.showtimeCols.sold[findShowtimeIndexById(showtimeId)]; };
+    auto heldOf = [&](int showtimeId) { return countHeldSeats(site.showtimes[findShowtimeIndexById(showtimeId)]); };
+
+    vector<long long> orderIds;
+    size_t failedItem;
+    vector<BatchItem> items = { { 1, 4, {} }, { 2, 0, { { 1, 2 }, { 1, 1 } } } };
+    BookingStatus status = bookBatch(items, "group", orderIds, failedItem);
+    selfCheck(status == BOOKING_SEAT_TAKEN && failedItem == 1, "A batch with a sold seat was not refused at that item");
+    selfCheck(site.orders.size() == ordersBefore && soldOf(1) == 0 && soldOf(2) == 1,
+              "A refused batch sold seats");
+    selfCheck(heldOf(1) == 0 && heldOf(2) == 0, "A refused batch left seats held");
+    selfCheck(orderIds == vector<long long>(2, -1), "A refused batch returned order IDs");
+
+    items = { { 1, 0, { { 2, 2 }, { 2, 2 } } } };
+    status = bookBatch(items, "", orderIds, failedItem);
+    selfCheck(status == BOOKING_SEAT_TAKEN && soldOf(1) == 0 && heldOf(1) == 0,
+              "A seat listed twice in one item was booked");
+
+    items = { { 1, 4, {} }, { 2, 2, {} } };
+    status = bookBatch(items, "group", orderIds, failedItem);
+    selfCheck(status == BOOKING_OK && site.orders.size() == ordersBefore + 2 && soldOf(1) == 4 && soldOf(2) == 3,
+              "A batch that fits was not booked in full");
+    vector<long long> firstIds = orderIds;
+    status = bookBatch(items, "group", orderIds, failedItem);
+    selfCheck(status == BOOKING_REPLAYED && orderIds == firstIds && soldOf(1) == 4 && soldOf(2) == 3,
+              "A repeated batch key booked again");
+
+    // A purchase reference cannot name an item of someone else's batch
+    PurchaseSession ps;
+    ostringstream out;
+    startPurchaseSession(ps, out);
+    feedPurchaseSession(ps, "group/0", 0, out);
+    selfCheck(ps.outcome == PURCHASE_OPEN && ps.step != STEP_REFERENCE, "A reference replayed a batch item");
+    ps = PurchaseSession();
+    feedPurchaseSession(ps, "group" + string(1, '\x1f') + "0", 0, out);
+    selfCheck(ps.outcome == PURCHASE_OPEN && ps.step == STEP_REFERENCE, "A reference with a control character was taken");
+
+    // The rollback of a batch that fails while placing its orders
+    selfCheck(placeOrder(1, { { 5, 5 } }, "undo", 0, orderId) == BOOKING_OK, "Placing an order failed");
+    unplaceLastOrder();
+    selfCheck(site.orders.size() == ordersBefore + 2 && soldOf(1) == 4 && isSeatAvailable(site.showtimes[0], 4, 4)
+              && site.orderIdByKey.count("undo") == 0 && findOrderById(orderId) == nullptr,
+              "An order taken back left a trace");
+    currentCinema = previous;
+}
+
+// A grid with a value that is not a number is reported and rebuilt with
+// the seats after that value, and the other grids keep their seats.
+static void selfTestRepair() {
+    Cinema* previous = currentCinema;
+    resetSelfTestDir();
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    fillBenchSite(1, 3, 3);
+    saveDataToFiles();
+
+    string row = "x";
+    for (int c = 1; c < site.showtimes[1].cols; ++c) row += isSeatSold(site.showtimes[1], 0, c) ? " 1" : " 0";
+    editSelfTestLine(SHOWTIME_FILE, benchGridLine(1, 0), row);
+
+    Cinema damaged;
+    damaged.dataDir = selfTestDir;
+    currentCinema = &damaged;
+    loadDataFromFiles();
+    ConsistencyReport report = checkDataFiles();
+    selfCheck(report.problemCount() > 0, "A seat value of x was not reported");
+    selfCheck(find(report.regridShowtimeIds.begin(), report.regridShowtimeIds.end(), 2)
+              != report.regridShowtimeIds.end(), "The damaged grid was not marked for rebuilding");
+    selfCheck(repairSiteData(report) > 0, "Repair fixed nothing");
+    selfCheck(checkDataFiles().problemCount() == 0, "The site still has problems after repair");
+    setSeatSold(site.showtimes[1], 0, 0, false); // The unreadable seat comes back free
+    for (int i = 0; i < 3; ++i) {
+        Showtime& s = damaged.showtimes[i];
+        ensureSeatMap(s);
+        selfCheck(s.soldBits == site.showtimes[i].soldBits,
+                  "Repair lost seats of showtime " + to_string(s.id));
+    }
+    currentCinema = previous;
+}
+
+// Walk customers through the gate of a one-at-a-time flash sale.
+static void selfTestAdmission() {
+    Cinema* previous = currentCinema;
+    resetSelfTestDir();
+    Cinema site;
+    site.dataDir = selfTestDir;
+    currentCinema = &site;
+    fillBenchSite(1, 1, 0);
+    openTicketFactLog(site.ticketLog, sitePath(SALES_LOG_FILE));
+    saveDataToFiles();
+    AdmissionPolicy policy;
+    policy.ratePerSecond = 1;
+    policy.burst = 1;
+    policy.maxActive = 1;
+    policy.turnMinutes = 5;
+    setAdmissionGate(1, policy);
+    AdmissionGate& g = site.admissionGates[1];
+    const int capacity = site.showtimeCols.capacity[0];
+
+    ostringstream out;
+    auto feed = [&](PurchaseSession& ps, const string& input, long long nowMs) {
+        out.str("");
+        feedPurchaseSession(ps, input, nowMs, out);
+    };
+    auto reachShowtime = [&](PurchaseSession& ps, long long nowMs) {
+        out.str("");
+        startPurchaseSession(ps, out);
+        feed(ps, "", nowMs);
+        feed(ps, "1", nowMs);
+        feed(ps, "1", nowMs);
+    };
+
+    PurchaseSession first, second, third, fourth;
+    reachShowtime(first, 0);
+    selfCheck(first.admitted && first.step == STEP_TICKET_COUNT, "The first customer was not let in");
+    reachShowtime(second, 0);
+    selfCheck(second.step == STEP_QUEUED && g.waiting.size() == 1, "The second customer was not queued");
+
+    feed(first, "2", 100);
+    selfCheck(g.deciding == 0 && g.promised == 2, "A ticket count did not become a promise");
+    feed(first, "N", 100);
+    feed(first, "1", 100);
+    feed(first, "1", 100);
+    selfCheck(g.promised == 1 && isSeatHeld(site.showtimes[0], 0, 0), "A picked seat was not held");
+    feed(first, "1", 100);
+    feed(first, "1", 100);
+    selfCheck(out.str().find("already selected") != string::npos && first.seats.size() == 1,
+              "A seat picked twice was not refused");
+    feed(first, "1", 100);
+    feed(first, "2", 100);
+    selfCheck(first.outcome == PURCHASE_BOOKED && site.showtimeCols.sold[0] == 2 && countHeldSeats(site.showtimes[0]) == 0,
+              "The first customer's seats were not booked");
+    selfCheck(g.active == 0 && g.promised == 0, "A booked customer still counts at the gate");
+
+    out.str("");
+    pumpPurchaseSession(second, 2000, out);
+    selfCheck(second.admitted && second.step == STEP_TICKET_COUNT, "The queued customer was not let in");
+    feed(second, to_string(capacity - 1), 2000);
+    selfCheck(second.step == STEP_TICKET_COUNT, "More tickets than free seats were accepted");
+    feed(second, to_string(capacity - 2), 2000);
+    selfCheck(g.promised == capacity - 2, "The last seats were not promised");
+
+    reachShowtime(third, 3000);
+    selfCheck(third.outcome == PURCHASE_SOLD_OUT, "A showtime with every free seat promised was not sold out");
+    abandonPurchaseSession(second);
+    selfCheck(g.active == 0 && g.deciding == 0 && g.promised == 0, "An abandoned turn still counts at the gate");
+
+    reachShowtime(fourth, 10000);
+    selfCheck(fourth.admitted, "A customer was not let in after an abandoned turn");
+    out.str("");
+    pumpPurchaseSession(fourth, 10000 + policy.turnMinutes * 60000LL + 1, out);
+    selfCheck(fourth.outcome == PURCHASE_CLOSED && g.turnsExpired == 1 && g.active == 0 && g.deciding == 0,
+              "A turn that ran out was not ended");
+    currentCinema = previous;
+}
+
+int runSelfTests() {
+    struct SelfTest {
+        const char* name;
+        void (*run)();
+    };
+    const SelfTest tests[] = {
+        { "Seat grid offsets", selfTestSeatGrids },
+        { "Writer failures  ", selfTestWriterFailure },
+        { "Batch booking    ", selfTestBatchBooking },
+        { "Repair           ", selfTestRepair },
+        { "Admission gate   ", selfTestAdmission },
+    };
+    selfTestDir = makeScratchDirectory("self_test");
+    if (selfTestDir.empty()) return 1;
+    int failedTests = 0;
+    for (const SelfTest& test : tests) {
+        int before = selfTestFailures;
+        test.run();
+        bool ok = selfTestFailures == before;
+        if (!ok) ++failedTests;
+        cout << test.name << " : " << (ok ? "ok" : "FAILED") << endl;
+    }
+    error_code ec;
+    filesystem::remove_all(selfTestDir, ec);
+    cout << (failedTests == 0 ? "All self tests passed." : to_string(failedTests) + " self test(s) failed.") << endl;
+    return failedTests;
+}